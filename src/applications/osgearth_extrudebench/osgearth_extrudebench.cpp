@@ -0,0 +1,245 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless build-time and memory benchmark for ExtrudeGeometryFilter.
+ *
+ * Extrudes a grid of synthetic building footprints (4 to 12 sided, so some
+ * corners crease and some don't) with and without geometry merging, and
+ * reports the time to build, the peak heap while building, and the heap
+ * the resulting graph holds on to. Merging appends every part straight into
+ * arrays sized by a counting pass, so its peak should stay close to what
+ * it keeps.
+ *
+ * Exits non-zero if merging changes the number of triangles.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/TriangleFunctor>
+#include <osgEarthFeatures/ExtrudeGeometryFilter>
+#include <osgEarthFeatures/FilterContext>
+#include <osgEarthSymbology/Style>
+#include <osgEarthSymbology/ExtrusionSymbol>
+#include <osgEarthSymbology/PolygonSymbol>
+#include <osgEarthSymbology/LineSymbol>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cmath>
+#include <new>
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+// Counts live and peak heap bytes. This tool is single-threaded.
+namespace
+{
+    size_t s_liveBytes = 0;
+    size_t s_peakBytes = 0;
+    const size_t HEADER = 16;
+}
+
+void* operator new( size_t n )
+{
+    size_t* p = (size_t*)::malloc( n + HEADER );
+    if ( !p )
+        throw std::bad_alloc();
+    p[0] = n;
+    s_liveBytes += n;
+    if ( s_liveBytes > s_peakBytes )
+        s_peakBytes = s_liveBytes;
+    return (char*)p + HEADER;
+}
+
+void operator delete( void* ptr ) throw()
+{
+    if ( ptr )
+    {
+        size_t* p = (size_t*)((char*)ptr - HEADER);
+        s_liveBytes -= p[0];
+        ::free( p );
+    }
+}
+
+namespace
+{
+    struct Result
+    {
+        Result() : _ms(0.0), _peakBytes(0), _keptBytes(0), _drawables(0), _verts(0), _triangles(0) { }
+        double   _ms;
+        size_t   _peakBytes;
+        size_t   _keptBytes;
+        unsigned _drawables;
+        unsigned _verts;
+        unsigned _triangles;
+    };
+
+    // a footprint of 4 to 12 sides, about 20m across, on a 40m grid.
+    Feature* makeFootprint( unsigned i, unsigned cols )
+    {
+        unsigned sides = 4 + (i * 7) % 9;
+        double   cx    = 40.0 * (double)(i % cols);
+        double   cy    = 40.0 * (double)(i / cols);
+        double   r     = 8.0 + (double)(i % 5);
+
+        Polygon* poly = new Polygon( sides );
+        for( unsigned s = 0; s < sides; ++s )
+        {
+            double a = 2.0 * osg::PI * (double)s / (double)sides;
+            poly->push_back( osg::Vec3d(cx + r*cos(a), cy + r*sin(a), 0.0) );
+        }
+        return new Feature( poly, 0L );
+    }
+
+    void makeFeatures( unsigned count, FeatureList& out )
+    {
+        unsigned cols = (unsigned)sqrt( (double)count ) + 1;
+        for( unsigned i = 0; i < count; ++i )
+            out.push_back( makeFootprint(i, cols) );
+    }
+
+    struct TriangleCounter
+    {
+        TriangleCounter() : _count(0) { }
+        void operator()( const osg::Vec3&, const osg::Vec3&, const osg::Vec3&, bool ) { ++_count; }
+        unsigned _count;
+    };
+
+    void countGeometry( osg::Node* node, Result& r )
+    {
+        osg::Group* group = node->asGroup();
+        if ( group )
+        {
+            for( unsigned i = 0; i < group->getNumChildren(); ++i )
+                countGeometry( group->getChild(i), r );
+        }
+
+        osg::Geode* geode = node->asGeode();
+        if ( geode )
+        {
+            for( unsigned i = 0; i < geode->getNumDrawables(); ++i )
+            {
+                osg::Geometry* geom = geode->getDrawable(i)->asGeometry();
+                if ( !geom )
+                    continue;
+
+                osg::TriangleFunctor<TriangleCounter> tris;
+                geom->accept( tris );
+                r._triangles += tris._count;
+                r._verts     += geom->getVertexArray() ? geom->getVertexArray()->getNumElements() : 0;
+                r._drawables++;
+            }
+        }
+    }
+
+    Result run( unsigned count, bool merge, bool outlines )
+    {
+        Style style;
+        style.getOrCreate<ExtrusionSymbol>()->height() = 20.0f;
+        style.getOrCreate<PolygonSymbol>()->fill()->color() = Color::White;
+        if ( outlines )
+            style.getOrCreate<LineSymbol>()->stroke()->color() = Color::Black;
+
+        FeatureList features;
+        makeFeatures( count, features );
+
+        ExtrudeGeometryFilter filter;
+        filter.setStyle( style );
+        if ( !merge )
+            filter.setFeatureNameExpr( StringExpression("building") );
+
+        FilterContext context;
+
+        Result r;
+        size_t before = s_liveBytes;
+        s_peakBytes = s_liveBytes;
+
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        osg::ref_ptr<osg::Node> node = filter.push( features, context );
+        r._ms = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+        r._peakBytes = s_peakBytes - before;
+        r._keptBytes = s_liveBytes - before;
+
+        countGeometry( node.get(), r );
+        return r;
+    }
+
+    void report( const char* name, const Result& r, unsigned count )
+    {
+        std::cout
+            << "    " << name << ": " << std::setw(8) << r._ms << " ms, "
+            << std::setw(6) << r._peakBytes/count << " peak bytes/feature, "
+            << std::setw(6) << r._keptBytes/count << " kept bytes/feature, "
+            << r._drawables << " drawables, " << r._verts << " verts, " << r._triangles << " triangles\n";
+    }
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--features n] [--outlines]\n"
+            << "    --features n : number of footprints (default 20000)\n"
+            << "    --outlines   : add a line symbol, so outlines are extruded too\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned count = 20000;
+    arguments.read( "--features", count );
+    count = osg::maximum( count, 1u );
+    bool outlines = arguments.read( "--outlines" );
+
+    std::cout << std::setprecision(4) << count << " footprints" << (outlines ? " with outlines" : "") << "\n";
+
+    // warm up both modes on a small batch, so one-time setup (registry,
+    // shader and tessellator state) doesn't land on either measurement.
+    run( osg::minimum(count, 100u), true,  outlines );
+    run( osg::minimum(count, 100u), false, outlines );
+
+    Result separate = run( count, false, outlines );
+    Result merged   = run( count, true,  outlines );
+
+    report( "separate", separate, count );
+    report( "merged  ", merged,   count );
+
+    bool ok = true;
+    ok = check( merged._triangles == separate._triangles, "merging changed the triangle count" ) && ok;
+    ok = check( merged._triangles > 0, "nothing was extruded" ) && ok;
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
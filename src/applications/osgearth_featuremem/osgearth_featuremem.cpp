@@ -0,0 +1,263 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless memory comparison and check for feature attribute storage.
+ *
+ * Measures the heap used by the attributes of a feature set stored as a
+ * std::map per feature (the old AttributeTable), as tables with a layout of
+ * their own, with one layout per cursor-sized batch, and with the one layout
+ * from the FeatureProfile. Times CompiledNumericExpression::evalAll over the
+ * batched and profile-shared sets, and checks the copy-on-write rules of
+ * shared layouts.
+ *
+ * Exits non-zero if a check fails.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osgEarthFeatures/Feature>
+#include <osgEarthFeatures/CompiledExpression>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <sstream>
+#include <new>
+#include <map>
+#include <vector>
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+
+// Counts live heap bytes. This tool is single-threaded.
+namespace
+{
+    size_t s_liveBytes = 0;
+    const size_t HEADER = 16;
+}
+
+void* operator new( size_t n )
+{
+    size_t* p = (size_t*)::malloc( n + HEADER );
+    if ( !p )
+        throw std::bad_alloc();
+    p[0] = n;
+    s_liveBytes += n;
+    return (char*)p + HEADER;
+}
+
+void operator delete( void* ptr ) throw()
+{
+    if ( ptr )
+    {
+        size_t* p = (size_t*)((char*)ptr - HEADER);
+        s_liveBytes -= p[0];
+        ::free( p );
+    }
+}
+
+namespace
+{
+    const char* s_names[] = {
+        "osm_id", "name", "highway", "building", "height", "levels",
+        "roof_shape", "addr_street", "addr_housenumber", "landuse", "source", "ele"
+    };
+    const unsigned s_numNames = sizeof(s_names)/sizeof(s_names[0]);
+
+    std::string nameValue( unsigned f ) { std::ostringstream buf; buf << "Feature " << f; return buf.str(); }
+
+    // the same values go into every storage scheme.
+    template<typename SETTER>
+    void fill( unsigned f, SETTER& set )
+    {
+        for( unsigned a = 0; a < s_numNames; ++a )
+        {
+            if ( a % 3 == 0 )      set( s_names[a], (double)(f + a) * 0.5 );
+            else if ( a % 3 == 1 ) set( s_names[a], (int)(f * 7 + a) );
+            else                   set( s_names[a], nameValue(f) );
+        }
+    }
+
+    struct MapSetter
+    {
+        std::map<std::string, AttributeValue>* _map;
+        void operator()( const char* name, double v )             { AttributeValue& a = (*_map)[name]; a.first = ATTRTYPE_DOUBLE; a.second.doubleValue = v; a.second.set = true; }
+        void operator()( const char* name, int v )                { AttributeValue& a = (*_map)[name]; a.first = ATTRTYPE_INT;    a.second.intValue = v;    a.second.set = true; }
+        void operator()( const char* name, const std::string& v ) { AttributeValue& a = (*_map)[name]; a.first = ATTRTYPE_STRING; a.second.stringValue = v; a.second.set = true; }
+    };
+
+    struct FeatureSetter
+    {
+        Feature* _feature;
+        void operator()( const char* name, double v )             { _feature->set( name, v ); }
+        void operator()( const char* name, int v )                { _feature->set( name, v ); }
+        void operator()( const char* name, const std::string& v ) { _feature->set( name, v ); }
+    };
+
+    AttributeLayout* makeLayout()
+    {
+        AttributeLayout* layout = new AttributeLayout();
+        for( unsigned a = 0; a < s_numNames; ++a )
+            layout->add( s_names[a] );
+        return layout;
+    }
+
+    // batchSize 0: each feature builds its own layout; otherwise features
+    // share a layout per batch (a batch as large as the set = the profile's).
+    size_t buildFeatures( unsigned count, unsigned batchSize, AttributeLayout* profileLayout, FeatureList& out )
+    {
+        size_t before = s_liveBytes;
+        osg::ref_ptr<AttributeLayout> layout = profileLayout;
+        for( unsigned f = 0; f < count; ++f )
+        {
+            if ( !profileLayout && batchSize > 0 && f % batchSize == 0 )
+                layout = makeLayout();
+
+            Feature* feature = new Feature( 0L, 0L );
+            if ( layout.valid() )
+                feature->setAttributeLayout( layout.get() );
+            FeatureSetter set = { feature };
+            fill( f, set );
+            out.push_back( feature );
+        }
+        return s_liveBytes - before;
+    }
+
+    double timeEval( const FeatureList& features, unsigned passes, double& checksum )
+    {
+        CompiledNumericExpression expr( NumericExpression("[height] * 2 + [levels] - [ele]") );
+        std::vector<double> results;
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        for( unsigned p = 0; p < passes; ++p )
+            expr.evalAll( features, results );
+        double ms = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+        checksum = 0.0;
+        for( unsigned i = 0; i < results.size(); ++i )
+            checksum += results[i];
+        return ms;
+    }
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+
+    bool checkCopyOnWrite()
+    {
+        bool ok = true;
+        osg::ref_ptr<AttributeLayout> shared = makeLayout();
+
+        osg::ref_ptr<Feature> a = new Feature( 0L, 0L );
+        a->setAttributeLayout( shared.get() );
+        a->set( "height", 10.0 );
+        ok = check( a->getAttrs().getLayout() == shared.get(), "a known name cloned the shared layout" ) && ok;
+
+        a->set( "extra", 1 );
+        ok = check( a->getAttrs().getLayout() != shared.get(), "a new name changed the shared layout" ) && ok;
+        ok = check( shared->size() == s_numNames, "the shared layout grew" ) && ok;
+        ok = check( a->getDouble("height") == 10.0 && a->getInt("extra") == 1, "values lost in the clone" ) && ok;
+
+        // a copy shares the (now private) layout; both must clone before adding.
+        osg::ref_ptr<Feature> b = new Feature( *a.get() );
+        const AttributeLayout* aLayout = a->getAttrs().getLayout();
+        b->set( "only_b", 2 );
+        a->set( "only_a", 3 );
+        ok = check( !a->hasAttr("only_b") && !b->hasAttr("only_a"), "a copied table shares new names with its original" ) && ok;
+        ok = check( aLayout->indexOf("only_a") < 0 && aLayout->indexOf("only_b") < 0, "a layout shared by a copy was changed" ) && ok;
+
+        return ok;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--features n] [--batch n]\n"
+            << "    --features n : number of features (default 100000)\n"
+            << "    --batch n    : features per cursor-sized batch (default 500)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned count = 100000, batch = 500;
+    arguments.read( "--features", count );
+    arguments.read( "--batch",    batch );
+    batch = osg::maximum( batch, 1u );
+
+    std::cout << std::setprecision(4) << count << " features, " << s_numNames << " attributes each\n";
+
+    bool ok = checkCopyOnWrite();
+
+    // attribute storage alone, old and new:
+    {
+        size_t before = s_liveBytes;
+        std::vector< std::map<std::string, AttributeValue> > maps( count );
+        for( unsigned f = 0; f < count; ++f )
+        {
+            MapSetter set = { &maps[f] };
+            fill( f, set );
+        }
+        size_t bytes = s_liveBytes - before;
+        std::cout << "    std::map per feature:       " << std::setw(8) << bytes/count << " bytes/feature\n";
+    }
+
+    size_t baseBytes;
+    {
+        // a feature with no attributes, to subtract from the rest.
+        size_t before = s_liveBytes;
+        FeatureList bare;
+        for( unsigned f = 0; f < count; ++f )
+            bare.push_back( new Feature(0L, 0L) );
+        baseBytes = s_liveBytes - before;
+    }
+
+    FeatureList own, batched, shared;
+    osg::ref_ptr<AttributeLayout> profileLayout = makeLayout();
+
+    size_t ownBytes     = buildFeatures( count, 0,     0L,                  own );
+    size_t batchedBytes = buildFeatures( count, batch, 0L,                  batched );
+    size_t sharedBytes  = buildFeatures( count, count, profileLayout.get(), shared );
+
+    std::cout
+        << "    layout per feature:         " << std::setw(8) << (ownBytes-baseBytes)/count     << " bytes/feature\n"
+        << "    layout per " << std::setw(5) << batch << " features:  " << std::setw(8) << (batchedBytes-baseBytes)/count << " bytes/feature\n"
+        << "    layout per profile:         " << std::setw(8) << (sharedBytes-baseBytes)/count  << " bytes/feature\n";
+
+    ok = check( sharedBytes <= batchedBytes && batchedBytes <= ownBytes, "sharing a layout used more memory" ) && ok;
+
+    double sumBatched, sumShared;
+    double batchedMs = timeEval( batched, 10, sumBatched );
+    double sharedMs  = timeEval( shared,  10, sumShared );
+    std::cout
+        << "    evalAll, layout per batch:   " << std::setw(8) << batchedMs << " ms\n"
+        << "    evalAll, layout per profile: " << std::setw(8) << sharedMs  << " ms\n";
+
+    ok = check( sumBatched == sumShared, "evalAll results depend on the layout" ) && ok;
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
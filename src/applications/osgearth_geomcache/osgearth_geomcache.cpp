@@ -0,0 +1,216 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless check and benchmark for the engine_mp compiled geometry cache.
+ *
+ * Builds an MP terrain over synthetic elevation with geometry caching on,
+ * first with a cold cache and then again with the records the first build
+ * wrote, and reads the engine's "mp.geometry*" totals after each. Reports
+ * the time to build the root tiles and the per-tile compile and load times.
+ *
+ * Then builds the terrain twice more over the same records: with a
+ * different map elevation tile size, and with the elevation layer capped
+ * below the root LOD so every tile gets fallback elevation. Neither may
+ * load anything from the cache.
+ *
+ * Each run uses a new elevation layer cache ID, so records from earlier
+ * runs in the same cache folder are never read.
+ *
+ * Exits non-zero if a check fails.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/ValueObject>
+#include <osgEarth/Map>
+#include <osgEarth/MapNode>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/TileSource>
+#include <osgEarth/Registry>
+#include <osgEarthDrivers/engine_mp/MPTerrainEngineOptions>
+#include <osgEarthDrivers/cache_filesystem/FileSystemCache>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+
+namespace
+{
+    // rolling hills.
+    class HillsTileSource : public TileSource
+    {
+    public:
+        HillsTileSource() : TileSource() { }
+
+        Status initialize( const osgDB::Options* dbOptions )
+        {
+            setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+            return STATUS_OK;
+        }
+
+        osg::Image* createImage( const TileKey& key, ProgressCallback* progress )
+        {
+            return 0L;
+        }
+
+        osg::HeightField* createHeightField( const TileKey& key, ProgressCallback* progress )
+        {
+            const unsigned size = 65;
+            const GeoExtent& ex = key.getExtent();
+
+            osg::HeightField* hf = new osg::HeightField();
+            hf->allocate( size, size );
+            for( unsigned c = 0; c < size; ++c )
+            {
+                double lon = ex.xMin() + ex.width() * (double)c / (double)(size-1);
+                for( unsigned r = 0; r < size; ++r )
+                {
+                    double lat = ex.yMin() + ex.height() * (double)r / (double)(size-1);
+                    hf->setHeight( c, r, (float)(1000.0 * sin(osg::DegreesToRadians(lon*4.0)) * cos(osg::DegreesToRadians(lat*4.0))) );
+                }
+            }
+            return hf;
+        }
+    };
+
+    struct Run
+    {
+        Run() : _valid(false), _buildMs(0.0), _compiled(0), _loaded(0), _compileMs(0.0), _loadMs(0.0) { }
+        bool     _valid;
+        double   _buildMs;
+        unsigned _compiled, _loaded;
+        double   _compileMs, _loadMs;
+    };
+
+    // builds a terrain and returns the engine's geometry cache totals.
+    Run build( const std::string& cachePath, const std::string& cacheId, unsigned lod, unsigned tileSize, bool capped )
+    {
+        Run r;
+
+        MapOptions mapOptions;
+        FileSystemCacheOptions cacheOptions;
+        cacheOptions.rootPath() = cachePath;
+        mapOptions.cache() = cacheOptions;
+        mapOptions.elevationTileSize() = tileSize;
+
+        osg::ref_ptr<Map> map = new Map( mapOptions );
+
+        ElevationLayerOptions layerOptions( "hills", TileSourceOptions() );
+        layerOptions.cacheId()     = cacheId;
+        layerOptions.cachePolicy() = CachePolicy::NO_CACHE;
+        if ( capped )
+            layerOptions.maxLevel() = lod > 0 ? lod-1 : 0;
+        map->addElevationLayer( new ElevationLayer(layerOptions, new HillsTileSource()) );
+
+        MPTerrainEngineOptions engineOptions;
+        engineOptions.firstLOD()        = lod;
+        engineOptions.geometryCaching() = true;
+
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        osg::ref_ptr<MapNode> mapNode = new MapNode( map.get(), MapNodeOptions(engineOptions) );
+        r._buildMs = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+        const osg::Node* engine = mapNode->getTerrainEngine();
+        r._valid =
+            engine &&
+            engine->getUserValue( "mp.geometryCompiled",  r._compiled ) &&
+            engine->getUserValue( "mp.geometryLoaded",    r._loaded ) &&
+            engine->getUserValue( "mp.geometryCompileMs", r._compileMs ) &&
+            engine->getUserValue( "mp.geometryLoadMs",    r._loadMs );
+        return r;
+    }
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--cache path] [--lod n] [--size n]\n"
+            << "    --cache path : cache folder (default osgearth_geomcache_bench)\n"
+            << "    --lod n      : LOD of the root tiles (default 3)\n"
+            << "    --size n     : map elevation tile size (default 17)\n"
+            << std::endl;
+        return 0;
+    }
+
+    std::string cachePath = "osgearth_geomcache_bench";
+    unsigned    lod = 3, size = 17;
+    arguments.read( "--cache", cachePath );
+    arguments.read( "--lod",   lod );
+    arguments.read( "--size",  size );
+    size = osg::maximum( size, 2u );
+
+    std::ostringstream cacheId;
+    cacheId << "geomcache_" << osg::Timer::instance()->tick();
+
+    std::cout << std::setprecision(4) << "root tiles at LOD " << lod << ", elevation tiles " << size << "x" << size << "\n";
+
+    Run cold = build( cachePath, cacheId.str(), lod, size, false );
+    if ( !cold._valid )
+    {
+        std::cout << "FAILED: no geometry cache totals (is the mp engine plugin on the path, and the cache writable?)" << std::endl;
+        return 1;
+    }
+
+    Run warm   = build( cachePath, cacheId.str(), lod, size,     false );
+    Run resize = build( cachePath, cacheId.str(), lod, size*2-1, false );
+    Run capped = build( cachePath, cacheId.str(), lod, size,     true );
+
+    bool ok = true;
+    ok = check( warm._valid && resize._valid && capped._valid, "a terrain published no geometry cache totals" ) && ok;
+    ok = check( cold._compiled > 0 && cold._loaded == 0, "the cold build did not compile every tile" ) && ok;
+
+    if ( ok )
+    {
+        double compileMs = cold._compileMs / cold._compiled;
+        double loadMs    = warm._loaded > 0 ? warm._loadMs / warm._loaded : 0.0;
+
+        std::cout
+            << "    cold cache: build " << std::setw(8) << cold._buildMs << " ms, "
+            << cold._compiled << " tiles compiled, " << compileMs << " ms/tile\n"
+            << "    warm cache: build " << std::setw(8) << warm._buildMs << " ms, "
+            << warm._loaded << " tiles loaded, " << loadMs << " ms/tile";
+        if ( loadMs > 0.0 )
+            std::cout << " (" << compileMs/loadMs << "x faster)";
+        std::cout << "\n";
+    }
+
+    ok = check( warm._loaded == cold._compiled && warm._compiled == 0, "the warm build did not load every tile from the cache" ) && ok;
+    ok = check( resize._loaded == 0, "a build with another elevation tile size loaded cached geometry" ) && ok;
+    ok = check( capped._loaded == 0 && capped._compiled == cold._compiled, "tiles with fallback elevation loaded cached geometry" ) && ok;
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
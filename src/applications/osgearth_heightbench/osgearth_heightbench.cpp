@@ -0,0 +1,307 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless check and benchmark for TerrainHeightIndex. Publishes a pyramid
+ * of synthetic tiles (every LOD down to the finest, over a region) and
+ * measures getHeight queries/sec from one and from several threads, next to
+ * a vertical-segment intersection against a scene graph of the finest tiles,
+ * which is how Terrain::getHeight answered before the index.
+ *
+ * Each LOD's heights are a plane plus a per-LOD offset, so bilinear samples
+ * are exact and a query shows which LOD answered it. Exits non-zero if a
+ * query misses, comes from anything but the finest tile, or is off by more
+ * than the tolerance.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Shape>
+#include <osgUtil/LineSegmentIntersector>
+#include <osgUtil/IntersectionVisitor>
+#include <osgEarth/TerrainHeightIndex>
+#include <osgEarth/Registry>
+#include <osgEarth/Profile>
+#include <osgEarth/TileKey>
+#include <OpenThreads/Thread>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    const double LOD_OFFSET = 1000.0;
+
+    // the synthetic terrain at one LOD, in meters (x, y in degrees).
+    inline double planeHeight( unsigned lod, double x, double y )
+    {
+        return 100.0 + 20.0*x - 15.0*y + LOD_OFFSET*(double)lod;
+    }
+
+    osg::HeightField* makeHeightField( const TileKey& key, unsigned size )
+    {
+        const GeoExtent& ex = key.getExtent();
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate( size, size );
+        hf->setOrigin( osg::Vec3(ex.xMin(), ex.yMin(), 0.0) );
+        hf->setXInterval( ex.width() / (double)(size-1) );
+        hf->setYInterval( ex.height() / (double)(size-1) );
+        for( unsigned r = 0; r < size; ++r )
+        {
+            double y = ex.yMin() + ex.height() * (double)r / (double)(size-1);
+            for( unsigned c = 0; c < size; ++c )
+            {
+                double x = ex.xMin() + ex.width() * (double)c / (double)(size-1);
+                hf->setHeight( c, r, (float)planeHeight(key.getLOD(), x, y) );
+            }
+        }
+        return hf;
+    }
+
+    // a triangulated mesh of a heightfield, in the profile's coordinates.
+    osg::Geode* makeMesh( const osg::HeightField* hf )
+    {
+        unsigned cols = hf->getNumColumns(), rows = hf->getNumRows();
+
+        osg::Vec3Array* verts = new osg::Vec3Array();
+        verts->reserve( cols*rows );
+        for( unsigned r = 0; r < rows; ++r )
+            for( unsigned c = 0; c < cols; ++c )
+                verts->push_back( hf->getVertex(c, r) );
+
+        osg::DrawElementsUInt* tris = new osg::DrawElementsUInt( GL_TRIANGLES );
+        tris->reserve( (cols-1)*(rows-1)*6 );
+        for( unsigned r = 0; r+1 < rows; ++r )
+        {
+            for( unsigned c = 0; c+1 < cols; ++c )
+            {
+                unsigned i = r*cols + c;
+                tris->push_back( i ); tris->push_back( i+1 ); tris->push_back( i+cols );
+                tris->push_back( i+1 ); tris->push_back( i+cols+1 ); tris->push_back( i+cols );
+            }
+        }
+
+        osg::Geometry* geom = new osg::Geometry();
+        geom->setVertexArray( verts );
+        geom->addPrimitiveSet( tris );
+
+        osg::Geode* geode = new osg::Geode();
+        geode->addDrawable( geom );
+        return geode;
+    }
+
+    // the tiles at one LOD that cover the region (tile rows run north to south).
+    void getKeys( const Profile* profile, const GeoExtent& region, unsigned lod, std::vector<TileKey>& out )
+    {
+        const double eps = 1e-9;
+        TileKey nw = profile->createTileKey( region.xMin() + eps, region.yMax() - eps, lod );
+        TileKey se = profile->createTileKey( region.xMax() - eps, region.yMin() + eps, lod );
+        for( unsigned y = nw.getTileY(); y <= se.getTileY(); ++y )
+            for( unsigned x = nw.getTileX(); x <= se.getTileX(); ++x )
+                out.push_back( TileKey(lod, x, y, profile) );
+    }
+
+    // query points inside the region, the same for every run.
+    void makeQueries( const GeoExtent& region, unsigned count, std::vector<osg::Vec2d>& out )
+    {
+        out.resize( count );
+        unsigned seed = 12345u;
+        for( unsigned i = 0; i < count; ++i )
+        {
+            seed = seed * 1664525u + 1013904223u;
+            double u = (double)(seed >> 8) / (double)(1u << 24);
+            seed = seed * 1664525u + 1013904223u;
+            double v = (double)(seed >> 8) / (double)(1u << 24);
+            out[i].set( region.xMin() + u*region.width(), region.yMin() + v*region.height() );
+        }
+    }
+
+    struct QueryThread : public OpenThreads::Thread
+    {
+        QueryThread( const TerrainHeightIndex* index, const std::vector<osg::Vec2d>& queries, unsigned passes )
+            : _index(index), _queries(queries), _passes(passes), _sum(0.0) { }
+
+        void run()
+        {
+            double h;
+            for( unsigned p = 0; p < _passes; ++p )
+                for( unsigned i = 0; i < _queries.size(); ++i )
+                    if ( _index->getHeight(_queries[i].x(), _queries[i].y(), h) )
+                        _sum += h;
+        }
+
+        const TerrainHeightIndex*       _index;
+        const std::vector<osg::Vec2d>&  _queries;
+        unsigned                        _passes;
+        double                          _sum;
+    };
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--lod n] [--size n] [--queries n] [--threads n]\n"
+            << "    --lod n     : finest LOD (default 10)\n"
+            << "    --size n    : heightfield samples per side (default 17)\n"
+            << "    --queries n : queries per run (default 200000)\n"
+            << "    --threads n : threads for the parallel run (default 4)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned maxLOD = 10, size = 17, numQueries = 200000, numThreads = 4;
+    arguments.read( "--lod",     maxLOD );
+    arguments.read( "--size",    size );
+    arguments.read( "--queries", numQueries );
+    arguments.read( "--threads", numThreads );
+    size       = osg::maximum( size, 2u );
+    numQueries = osg::maximum( numQueries, 1u );
+    numThreads = osg::maximum( numThreads, 1u );
+
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+    GeoExtent region( profile->getSRS(), -5.0, 40.0, 5.0, 50.0 );
+
+    // publish every LOD over the region; the graph gets the finest only.
+    osg::ref_ptr<TerrainHeightIndex> index = new TerrainHeightIndex( profile );
+    osg::ref_ptr<osg::Group>         graph = new osg::Group();
+    unsigned                         finestTiles = 0;
+
+    for( unsigned lod = 0; lod <= maxLOD; ++lod )
+    {
+        std::vector<TileKey> keys;
+        getKeys( profile, region, lod, keys );
+        for( unsigned k = 0; k < keys.size(); ++k )
+        {
+            osg::ref_ptr<osg::HeightField> hf = makeHeightField( keys[k], size );
+            index->add( keys[k], hf.get() );
+            if ( lod == maxLOD )
+            {
+                graph->addChild( makeMesh(hf.get()) );
+                ++finestTiles;
+            }
+        }
+    }
+
+    std::cout << std::setprecision(4)
+        << index->size() << " tiles indexed over LOD 0-" << maxLOD << ", "
+        << finestTiles << " at the finest, " << size << "x" << size << " samples\n";
+
+    std::vector<osg::Vec2d> queries;
+    makeQueries( region, numQueries, queries );
+
+    bool ok = true;
+
+    // accuracy: every query must come back from the finest LOD.
+    {
+        double   maxError = 0.0;
+        unsigned misses   = 0;
+        for( unsigned i = 0; i < queries.size(); ++i )
+        {
+            double h;
+            if ( !index->getHeight(queries[i].x(), queries[i].y(), h) )
+                ++misses;
+            else
+                maxError = osg::maximum( maxError, fabs(h - planeHeight(maxLOD, queries[i].x(), queries[i].y())) );
+        }
+        std::cout << "    index max error " << maxError << " m\n";
+        ok = check( misses == 0, "queries missed the index" ) && ok;
+        ok = check( maxError < 0.05, "queries answered from a coarser LOD or sampled wrong" ) && ok;
+    }
+
+    // one thread:
+    double indexMs;
+    {
+        QueryThread q( index.get(), queries, 1 );
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        q.run();
+        indexMs = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+    }
+
+    // several threads at once, each running the full query set:
+    double parallelMs;
+    {
+        std::vector<QueryThread*> threads;
+        for( unsigned i = 0; i < numThreads; ++i )
+            threads.push_back( new QueryThread(index.get(), queries, 1) );
+
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        for( unsigned i = 0; i < threads.size(); ++i )
+            threads[i]->start();
+        for( unsigned i = 0; i < threads.size(); ++i )
+            threads[i]->join();
+        parallelMs = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+        for( unsigned i = 0; i < threads.size(); ++i )
+            delete threads[i];
+    }
+
+    // the scene graph intersection, on a slice of the queries (it is much slower):
+    unsigned numIsect = osg::minimum( numQueries, 20000u );
+    double   isectMs, isectMaxError = 0.0;
+    unsigned isectMisses = 0;
+    {
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        for( unsigned i = 0; i < numIsect; ++i )
+        {
+            const osg::Vec2d& q = queries[i];
+            osg::ref_ptr<osgUtil::LineSegmentIntersector> lsi = new osgUtil::LineSegmentIntersector(
+                osg::Vec3d(q.x(), q.y(), 1e5), osg::Vec3d(q.x(), q.y(), -1e5) );
+            osgUtil::IntersectionVisitor iv( lsi.get() );
+            graph->accept( iv );
+
+            if ( lsi->containsIntersections() )
+            {
+                double h = lsi->getFirstIntersection().getWorldIntersectPoint().z();
+                isectMaxError = osg::maximum( isectMaxError, fabs(h - planeHeight(maxLOD, q.x(), q.y())) );
+            }
+            else
+            {
+                ++isectMisses;
+            }
+        }
+        isectMs = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+    }
+
+    std::cout
+        << "    index, 1 thread:      " << std::setw(10) << 1000.0*numQueries/indexMs << " queries/sec\n"
+        << "    index, " << numThreads << " threads:     " << std::setw(10) << 1000.0*numQueries*numThreads/parallelMs << " queries/sec\n"
+        << "    graph intersection:   " << std::setw(10) << 1000.0*numIsect/isectMs << " queries/sec"
+        << " (max error " << isectMaxError << " m, " << isectMisses << " misses)\n";
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,349 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless check and benchmark for ImageUtils::resizeImage.
+ *
+ * Resizes synthetic RGBA8, RGB8, L8 and float images (down, up, and to odd
+ * sizes) and compares the results with:
+ *  - the per-pixel PixelReader/PixelWriter nearest-neighbor loop that
+ *    resizeImage used before it had row kernels (copied below);
+ *  - the source pixels that loop picks, copied byte for byte;
+ *  - bilinear and box filters evaluated per pixel in double precision.
+ * Then times the old loop against the nearest, bilinear and box kernels.
+ *
+ * Exits non-zero if nearest-neighbor picks different pixels than the old
+ * loop, if any result is off by more than one 8-bit step (box: by anything)
+ * or, for float images, by more than the float tolerance.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/Image>
+#include <osgEarth/ImageUtils>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    struct Format
+    {
+        const char* _name;
+        GLenum      _pixelFormat;
+        GLenum      _dataType;
+    };
+
+    const Format s_formats[] = {
+        { "RGBA8", GL_RGBA,      GL_UNSIGNED_BYTE },
+        { "RGB8 ", GL_RGB,       GL_UNSIGNED_BYTE },
+        { "L8   ", GL_LUMINANCE, GL_UNSIGNED_BYTE },
+        { "L32F ", GL_LUMINANCE, GL_FLOAT }
+    };
+    const unsigned s_numFormats = sizeof(s_formats)/sizeof(s_formats[0]);
+
+    // float test images hold heights in this range.
+    const double FLOAT_RANGE = 5000.0;
+
+    unsigned nextRandom( unsigned& seed )
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    }
+
+    // a smooth gradient with noise on top, so every filter has edges to blend.
+    osg::Image* makeImage( const Format& f, unsigned s, unsigned t, unsigned seed )
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage( s, t, 1, f._pixelFormat, f._dataType );
+
+        unsigned n = osg::Image::computeNumComponents( f._pixelFormat );
+        for( unsigned row = 0; row < t; ++row )
+        {
+            for( unsigned col = 0; col < s; ++col )
+            {
+                for( unsigned c = 0; c < n; ++c )
+                {
+                    double g = (double)(col*(c+1) + row*(n-c)) / (double)(s + t) / (double)(n+1);
+                    double v = osg::clampBetween( 0.8*g + 0.2*(double)(nextRandom(seed) & 0xffff)/65535.0, 0.0, 1.0 );
+                    if ( f._dataType == GL_FLOAT )
+                        ((float*)image->data(col, row))[c] = (float)(v * FLOAT_RANGE);
+                    else
+                        image->data(col, row)[c] = (unsigned char)(v * 255.0 + 0.5);
+                }
+            }
+        }
+        return image;
+    }
+
+    double getValue( const osg::Image* image, unsigned s, unsigned t, unsigned c )
+    {
+        if ( image->getDataType() == GL_FLOAT )
+            return ((const float*)image->data(s, t))[c];
+        else
+            return image->data(s, t)[c];
+    }
+
+    // resizeImage's nearest-neighbor path before the row kernels, as it was.
+    void legacyResize( const osg::Image* input, unsigned out_s, unsigned out_t, osg::ref_ptr<osg::Image>& output )
+    {
+        unsigned in_s = input->s();
+        unsigned in_t = input->t();
+
+        output = new osg::Image();
+        output->allocateImage( out_s, out_t, 1, input->getPixelFormat(), input->getDataType(), input->getPacking() );
+        output->setInternalTextureFormat( input->getInternalTextureFormat() );
+
+        ImageUtils::PixelReader read( input );
+        ImageUtils::PixelWriter write( output.get() );
+
+        for( unsigned int output_row=0; output_row < out_t; output_row++ )
+        {
+            float output_row_ratio = (float)output_row/(float)out_t;
+            int input_row = (unsigned int)( output_row_ratio * (float)in_t );
+            if ( input_row >= input->t() ) input_row = in_t-1;
+            else if ( input_row < 0 ) input_row = 0;
+
+            for( unsigned int output_col = 0; output_col < out_s; output_col++ )
+            {
+                float output_col_ratio = (float)output_col/(float)out_s;
+                int input_col = (unsigned int)( output_col_ratio * (float)in_s );
+                if ( input_col >= (int)in_s ) input_col = in_s-1;
+
+                osg::Vec4 color = read( input_col, input_row );
+                write( color, output_col, output_row, 0, 0 );
+            }
+        }
+    }
+
+    // the source pixel the old loop picks for an output index.
+    unsigned legacyPick( unsigned i, unsigned in, unsigned out )
+    {
+        unsigned j = (unsigned)( ((float)i/(float)out) * (float)in );
+        return j >= in ? in-1 : j;
+    }
+
+    double refNearest( const osg::Image* in, unsigned s, unsigned t, unsigned c, unsigned out_s, unsigned out_t )
+    {
+        return getValue( in, legacyPick(s, in->s(), out_s), legacyPick(t, in->t(), out_t), c );
+    }
+
+    // bilinear between the source pixels that straddle the output pixel's center.
+    double refBilinear( const osg::Image* in, unsigned s, unsigned t, unsigned c, unsigned out_s, unsigned out_t )
+    {
+        double x = osg::clampBetween( ((double)s + 0.5) * (double)in->s() / (double)out_s - 0.5, 0.0, (double)(in->s()-1) );
+        double y = osg::clampBetween( ((double)t + 0.5) * (double)in->t() / (double)out_t - 0.5, 0.0, (double)(in->t()-1) );
+        unsigned x0 = (unsigned)x, y0 = (unsigned)y;
+        unsigned x1 = osg::minimum( x0+1, (unsigned)in->s()-1 ), y1 = osg::minimum( y0+1, (unsigned)in->t()-1 );
+        double wx = x - (double)x0, wy = y - (double)y0;
+
+        double top    = getValue(in, x0, y0, c)*(1.0-wx) + getValue(in, x1, y0, c)*wx;
+        double bottom = getValue(in, x0, y1, c)*(1.0-wx) + getValue(in, x1, y1, c)*wx;
+        return top*(1.0-wy) + bottom*wy;
+    }
+
+    // the mean of every source pixel the output pixel touches.
+    double refBox( const osg::Image* in, unsigned s, unsigned t, unsigned c, unsigned out_s, unsigned out_t )
+    {
+        unsigned x0 = (unsigned)( (double)s     * in->s() / out_s );
+        unsigned x1 = (unsigned)ceil( (double)(s+1) * in->s() / out_s );
+        unsigned y0 = (unsigned)( (double)t     * in->t() / out_t );
+        unsigned y1 = (unsigned)ceil( (double)(t+1) * in->t() / out_t );
+        x1 = osg::clampBetween( x1, x0+1, (unsigned)in->s() );
+        y1 = osg::clampBetween( y1, y0+1, (unsigned)in->t() );
+
+        double sum = 0.0;
+        for( unsigned y = y0; y < y1; ++y )
+            for( unsigned x = x0; x < x1; ++x )
+                sum += getValue( in, x, y, c );
+        return sum / (double)((x1-x0)*(y1-y0));
+    }
+
+    typedef double (*RefFunc)( const osg::Image*, unsigned, unsigned, unsigned, unsigned, unsigned );
+
+    // largest difference between an output image and the reference, in the
+    // output's units; 8-bit references are rounded to the nearest step first.
+    double maxDifference( const osg::Image* in, const osg::Image* out, RefFunc ref )
+    {
+        unsigned n       = osg::Image::computeNumComponents( in->getPixelFormat() );
+        bool     isFloat = in->getDataType() == GL_FLOAT;
+        double   maxDiff = 0.0;
+
+        for( unsigned t = 0; t < (unsigned)out->t(); ++t )
+        {
+            for( unsigned s = 0; s < (unsigned)out->s(); ++s )
+            {
+                for( unsigned c = 0; c < n; ++c )
+                {
+                    double expected = ref( in, s, t, c, out->s(), out->t() );
+                    if ( !isFloat )
+                        expected = floor( expected + 0.5 );
+                    maxDiff = osg::maximum( maxDiff, fabs(getValue(out, s, t, c) - expected) );
+                }
+            }
+        }
+        return maxDiff;
+    }
+
+    // largest difference between two images of the same size and format.
+    double maxDifference( const osg::Image* a, const osg::Image* b )
+    {
+        unsigned n       = osg::Image::computeNumComponents( a->getPixelFormat() );
+        double   maxDiff = 0.0;
+        for( unsigned t = 0; t < (unsigned)a->t(); ++t )
+            for( unsigned s = 0; s < (unsigned)a->s(); ++s )
+                for( unsigned c = 0; c < n; ++c )
+                    maxDiff = osg::maximum( maxDiff, fabs(getValue(a, s, t, c) - getValue(b, s, t, c)) );
+        return maxDiff;
+    }
+
+    osg::Image* resize( const osg::Image* in, unsigned s, unsigned t, ImageUtils::ResizeFilter filter )
+    {
+        osg::ref_ptr<osg::Image> out;
+        ImageUtils::resizeImage( in, s, t, out, 0, filter );
+        return out.release();
+    }
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+
+    // output pixels per second of a resize, over a number of passes.
+    double timeResize( const osg::Image* in, unsigned s, unsigned t, int filter, unsigned passes )
+    {
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for( unsigned p = 0; p < passes; ++p )
+        {
+            osg::ref_ptr<osg::Image> out;
+            if ( filter < 0 )
+                legacyResize( in, s, t, out );
+            else
+                ImageUtils::resizeImage( in, s, t, out, 0, (ImageUtils::ResizeFilter)filter );
+        }
+        double sec = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+        return sec > 0.0 ? (double)s*(double)t*(double)passes / sec : 0.0;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--size n] [--passes n]\n"
+            << "    --size n   : source size of the timed resizes (default 1024)\n"
+            << "    --passes n : resizes per timing (default 20)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned size = 1024, passes = 20;
+    arguments.read( "--size",   size );
+    arguments.read( "--passes", passes );
+    size   = osg::maximum( size, 2u );
+    passes = osg::maximum( passes, 1u );
+
+    bool ok = true;
+    std::cout << std::setprecision(4);
+
+    // accuracy, over reductions, enlargements and sizes that don't divide evenly:
+    const unsigned sizes[][4] = {
+        { 256, 256, 128, 128 },
+        { 256, 256,  97, 173 },
+        { 100,  60, 256, 256 },
+        { 257, 129, 256, 128 }
+    };
+
+    for( unsigned f = 0; f < s_numFormats; ++f )
+    {
+        const Format& format  = s_formats[f];
+        bool          isFloat = format._dataType == GL_FLOAT;
+
+        // float results are compared relative to the data range.
+        double tolerance = isFloat ? 1e-5 * FLOAT_RANGE : 1.0;
+
+        double nearestPicks = 0.0, nearestLegacy = 0.0, bilinear = 0.0, box = 0.0;
+        for( unsigned i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i )
+        {
+            osg::ref_ptr<osg::Image> in = makeImage( format, sizes[i][0], sizes[i][1], 1234u + i );
+            unsigned s = sizes[i][2], t = sizes[i][3];
+
+            osg::ref_ptr<osg::Image> nearest = resize( in.get(), s, t, ImageUtils::RESIZE_NEAREST );
+            osg::ref_ptr<osg::Image> legacy;
+            legacyResize( in.get(), s, t, legacy );
+
+            nearestPicks  = osg::maximum( nearestPicks,  maxDifference(in.get(), nearest.get(), refNearest) );
+            nearestLegacy = osg::maximum( nearestLegacy, maxDifference(nearest.get(), legacy.get()) );
+
+            osg::ref_ptr<osg::Image> bl = resize( in.get(), s, t, ImageUtils::RESIZE_BILINEAR );
+            bilinear = osg::maximum( bilinear, maxDifference(in.get(), bl.get(), refBilinear) );
+
+            osg::ref_ptr<osg::Image> bx = resize( in.get(), s, t, ImageUtils::RESIZE_BOX );
+            box = osg::maximum( box, maxDifference(in.get(), bx.get(), refBox) );
+        }
+
+        std::cout << "    " << format._name
+            << ": max difference, nearest vs source pixels " << nearestPicks
+            << ", vs old loop " << nearestLegacy
+            << "; bilinear " << bilinear
+            << "; box " << box << "\n";
+
+        std::string name = std::string(format._name);
+        ok = check( nearestPicks == 0.0, name + " nearest picks different pixels than the old loop" ) && ok;
+        ok = check( nearestLegacy <= (isFloat ? 0.0 : 1.0), name + " nearest differs from the old loop by more than its rounding" ) && ok;
+        ok = check( bilinear <= tolerance, name + " bilinear is off" ) && ok;
+        ok = check( box <= (isFloat ? tolerance : 0.0), name + " box is off" ) && ok;
+    }
+
+    // throughput, in output megapixels per second:
+    for( unsigned f = 0; f < s_numFormats; ++f )
+    {
+        const Format& format = s_formats[f];
+        osg::ref_ptr<osg::Image> in = makeImage( format, size, size, 99u );
+
+        for( unsigned div = 2; div <= 4; div *= 2 )
+        {
+            unsigned s = osg::maximum( size/div, 1u );
+            double old      = timeResize( in.get(), s, s, -1,                           passes );
+            double nearest  = timeResize( in.get(), s, s, ImageUtils::RESIZE_NEAREST,  passes );
+            double bilinear = timeResize( in.get(), s, s, ImageUtils::RESIZE_BILINEAR, passes );
+            double box      = timeResize( in.get(), s, s, ImageUtils::RESIZE_BOX,      passes );
+
+            std::cout << "    " << format._name << " " << size << " -> " << s << ": "
+                << "old loop " << std::setw(8) << old*1e-6 << ", "
+                << "nearest " << std::setw(8) << nearest*1e-6
+                << " (" << (old > 0.0 ? nearest/old : 0.0) << "x), "
+                << "bilinear " << std::setw(8) << bilinear*1e-6 << ", "
+                << "box " << std::setw(8) << box*1e-6 << " Mpix/s\n";
+        }
+    }
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
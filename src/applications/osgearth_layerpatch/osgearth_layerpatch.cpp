@@ -0,0 +1,255 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless check for patching image layer changes into live engine_mp tiles.
+ *
+ * Builds an MP terrain with synthetic imagery, then adds and removes image
+ * layers while running UPDATE traversals until the engine reports the change
+ * done, and reads its "mp.liveTiles", "mp.tilesPatched" and "mp.tilesRebuilt"
+ * counters. Reports how long each change takes to reach every live tile,
+ * including the updater's quiet period.
+ *
+ * Exits non-zero if a layer change rebuilds the terrain or any tile, or if
+ * an addition patches a number of tiles other than the live count.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/FrameStamp>
+#include <osg/ValueObject>
+#include <osgUtil/UpdateVisitor>
+#include <osgEarth/Map>
+#include <osgEarth/MapNode>
+#include <osgEarth/ImageLayer>
+#include <osgEarth/TileSource>
+#include <osgEarth/Registry>
+#include <osgEarthDrivers/engine_mp/MPTerrainEngineOptions>
+#include <OpenThreads/Thread>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+
+namespace
+{
+    // imagery of a single color.
+    class SolidTileSource : public TileSource
+    {
+    public:
+        SolidTileSource( const osg::Vec4ub& color ) : TileSource(), _color(color) { }
+
+        Status initialize( const osgDB::Options* dbOptions )
+        {
+            setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+            return STATUS_OK;
+        }
+
+        osg::Image* createImage( const TileKey& key, ProgressCallback* progress )
+        {
+            const unsigned size = 256;
+            osg::Image* image = new osg::Image();
+            image->allocateImage( size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+            unsigned char* p = image->data();
+            for( unsigned i = 0; i < size*size; ++i, p += 4 )
+            {
+                p[0] = _color.r(); p[1] = _color.g(); p[2] = _color.b(); p[3] = _color.a();
+            }
+            return image;
+        }
+
+    private:
+        osg::Vec4ub _color;
+    };
+
+    ImageLayer* makeLayer( unsigned i )
+    {
+        std::ostringstream name;
+        name << "layer " << i;
+        ImageLayerOptions options( name.str() );
+        options.cachePolicy() = CachePolicy::NO_CACHE;
+        return new ImageLayer( options, new SolidTileSource(osg::Vec4ub(40*i, 255-40*i, 128, 255)) );
+    }
+
+    struct Counters
+    {
+        Counters() : _live(0), _patched(0), _rebuilt(0) { }
+        unsigned _live, _patched, _rebuilt;
+    };
+
+    Counters getCounters( const osg::Node* engine )
+    {
+        Counters c;
+        engine->getUserValue( "mp.liveTiles",    c._live );
+        engine->getUserValue( "mp.tilesPatched", c._patched );
+        engine->getUserValue( "mp.tilesRebuilt", c._rebuilt );
+        return c;
+    }
+
+    // runs one UPDATE traversal.
+    void update( osg::Node* root, osg::FrameStamp* fs )
+    {
+        fs->setFrameNumber( fs->getFrameNumber() + 1 );
+        fs->setReferenceTime( osg::Timer::instance()->time_s() );
+        fs->setSimulationTime( fs->getReferenceTime() );
+
+        osgUtil::UpdateVisitor uv;
+        uv.setFrameStamp( fs );
+        uv.setTraversalNumber( fs->getFrameNumber() );
+        root->accept( uv );
+    }
+
+    // runs UPDATE traversals until the engine stops asking for them.
+    bool updateUntilIdle( osg::Node* root, osg::Node* engine, osg::FrameStamp* fs, double timeout_s )
+    {
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        do
+        {
+            update( root, fs );
+            unsigned pending = 1;
+            if ( engine->getUserValue("mp.layerUpdatePending", pending) && pending == 0 )
+                return true;
+            OpenThreads::Thread::microSleep( 5000 );
+        }
+        while( osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) < timeout_s );
+        return false;
+    }
+
+    void getChildren( osg::Group* group, std::vector<osg::Node*>& out )
+    {
+        out.clear();
+        for( unsigned i = 0; i < group->getNumChildren(); ++i )
+            out.push_back( group->getChild(i) );
+    }
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--lod n] [--layers n] [--timeout s]\n"
+            << "    --lod n     : LOD of the root tiles (default 3)\n"
+            << "    --layers n  : layers to add and then remove (default 3)\n"
+            << "    --timeout s : seconds to wait for each change (default 60)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned lod = 3, numLayers = 3;
+    double   timeout = 60.0;
+    arguments.read( "--lod",     lod );
+    arguments.read( "--layers",  numLayers );
+    arguments.read( "--timeout", timeout );
+    numLayers = osg::clampBetween( numLayers, 1u, 6u );
+
+    osg::ref_ptr<Map> map = new Map();
+    map->addImageLayer( makeLayer(0) );
+
+    MPTerrainEngineOptions engineOptions;
+    engineOptions.firstLOD() = lod;
+
+    osg::ref_ptr<MapNode> mapNode = new MapNode( map.get(), MapNodeOptions(engineOptions) );
+    osg::Group* engine = mapNode->getTerrainEngine();
+    if ( !engine )
+    {
+        std::cout << "FAILED: no terrain engine (is the mp engine plugin on the path?)" << std::endl;
+        return 1;
+    }
+
+    osg::ref_ptr<osg::FrameStamp> fs = new osg::FrameStamp();
+    update( mapNode.get(), fs.get() );
+
+    // the terrain node is replaced when the engine rebuilds the terrain.
+    std::vector<osg::Node*> children, current;
+    getChildren( engine, children );
+
+    bool ok = true;
+    Counters last = getCounters( engine );
+
+    std::cout << std::setprecision(4) << "root tiles at LOD " << lod << "\n";
+
+    std::vector< osg::ref_ptr<ImageLayer> > layers;
+    for( unsigned i = 1; i <= numLayers; ++i )
+    {
+        layers.push_back( makeLayer(i) );
+
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        map->addImageLayer( layers.back().get() );
+        bool idle = updateUntilIdle( mapNode.get(), engine, fs.get(), timeout );
+        double ms = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+        Counters now = getCounters( engine );
+        unsigned patched = now._patched - last._patched;
+        unsigned rebuilt = now._rebuilt - last._rebuilt;
+        last = now;
+
+        std::cout
+            << "    add " << layers.back()->getName() << ": " << std::setw(8) << ms << " ms, "
+            << now._live << " live tiles, " << patched << " patched, " << rebuilt << " rebuilt\n";
+
+        std::ostringstream what;
+        what << "adding " << layers.back()->getName();
+        ok = check( idle, what.str() + " did not finish" ) && ok;
+        ok = check( now._live > 0 && patched == now._live, what.str() + " patched a different number of tiles than are live" ) && ok;
+        ok = check( rebuilt == 0, what.str() + " rebuilt tiles" ) && ok;
+
+        getChildren( engine, current );
+        ok = check( current == children, what.str() + " rebuilt the terrain" ) && ok;
+    }
+
+    for( unsigned i = 0; i < layers.size(); ++i )
+    {
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        map->removeImageLayer( layers[i].get() );
+        bool idle = updateUntilIdle( mapNode.get(), engine, fs.get(), timeout );
+        double ms = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+        Counters now = getCounters( engine );
+        unsigned rebuilt = now._rebuilt - last._rebuilt;
+        last = now;
+
+        std::cout << "    remove " << layers[i]->getName() << ": " << std::setw(8) << ms << " ms, " << rebuilt << " rebuilt\n";
+
+        std::ostringstream what;
+        what << "removing " << layers[i]->getName();
+        ok = check( idle, what.str() + " did not finish" ) && ok;
+        ok = check( rebuilt == 0, what.str() + " rebuilt tiles" ) && ok;
+
+        getChildren( engine, current );
+        ok = check( current == children, what.str() + " rebuilt the terrain" ) && ok;
+    }
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,357 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless multithreaded stress check for Map snapshots and MapFrame.
+ *
+ * Several threads each keep a MapFrame of an MP terrain's map and, over and
+ * over, sync it, build tile images and a heightfield for a random key from
+ * the frame's layer lists, and have the engine create a tile, the way pager
+ * threads do. Meanwhile the main thread adds and removes image and elevation
+ * layers, recording the layer lists it published at each revision. Reports
+ * syncs/sec and tiles/sec across the threads.
+ *
+ * Exits non-zero if a frame's revision goes backwards, if a frame's layer
+ * lists differ from what the map published at that revision, if a heightfield
+ * doesn't come from the top elevation layer, or if a tile can't be built.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osgEarth/Map>
+#include <osgEarth/MapFrame>
+#include <osgEarth/MapNode>
+#include <osgEarth/ImageLayer>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/TerrainEngineNode>
+#include <osgEarth/TileSource>
+#include <osgEarth/Registry>
+#include <osgEarthDrivers/engine_mp/MPTerrainEngineOptions>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+#include <map>
+#include <vector>
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+
+namespace
+{
+    // imagery of a single color, and elevation of a single height.
+    class FlatTileSource : public TileSource
+    {
+    public:
+        FlatTileSource( unsigned id ) : TileSource(), _id(id) { }
+
+        Status initialize( const osgDB::Options* dbOptions )
+        {
+            setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+            return STATUS_OK;
+        }
+
+        osg::Image* createImage( const TileKey& key, ProgressCallback* progress )
+        {
+            const unsigned size = 64;
+            osg::Image* image = new osg::Image();
+            image->allocateImage( size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+            unsigned char* p = image->data();
+            for( unsigned i = 0; i < size*size; ++i, p += 4 )
+            {
+                p[0] = (unsigned char)_id; p[1] = 128; p[2] = 128; p[3] = 255;
+            }
+            return image;
+        }
+
+        osg::HeightField* createHeightField( const TileKey& key, ProgressCallback* progress )
+        {
+            const unsigned size = 17;
+            osg::HeightField* hf = new osg::HeightField();
+            hf->allocate( size, size );
+            for( unsigned c = 0; c < size; ++c )
+                for( unsigned r = 0; r < size; ++r )
+                    hf->setHeight( c, r, getHeight() );
+            return hf;
+        }
+
+        float getHeight() const { return 10.0f * (float)_id; }
+
+    private:
+        unsigned _id;
+    };
+
+    ImageLayer* makeImageLayer( unsigned id )
+    {
+        std::ostringstream name;
+        name << "image " << id;
+        ImageLayerOptions options( name.str() );
+        options.cachePolicy() = CachePolicy::NO_CACHE;
+        return new ImageLayer( options, new FlatTileSource(id) );
+    }
+
+    ElevationLayer* makeElevationLayer( unsigned id )
+    {
+        std::ostringstream name;
+        name << "elevation " << id;
+        ElevationLayerOptions options( name.str(), TileSourceOptions() );
+        options.cachePolicy() = CachePolicy::NO_CACHE;
+        return new ElevationLayer( options, new FlatTileSource(id) );
+    }
+
+    // the layer UIDs in a frame or map at one revision.
+    struct Layers
+    {
+        std::vector<UID> _image, _elevation;
+        bool operator == ( const Layers& rhs ) const { return _image == rhs._image && _elevation == rhs._elevation; }
+        bool operator != ( const Layers& rhs ) const { return !(*this == rhs); }
+    };
+    typedef std::map<int, Layers> LayersByRevision;
+
+    Layers getLayers( const MapFrame& frame )
+    {
+        Layers layers;
+        for( ImageLayerVector::const_iterator i = frame.imageLayers().begin(); i != frame.imageLayers().end(); ++i )
+            layers._image.push_back( i->get()->getUID() );
+        for( ElevationLayerVector::const_iterator i = frame.elevationLayers().begin(); i != frame.elevationLayers().end(); ++i )
+            layers._elevation.push_back( i->get()->getUID() );
+        return layers;
+    }
+
+    struct WorkThread : public OpenThreads::Thread
+    {
+        WorkThread( const Map* map, TerrainEngineNode* engine, unsigned lod, unsigned seed, OpenThreads::Atomic& stop )
+            : _map(map), _engine(engine), _lod(lod), _seed(seed), _stop(stop),
+              _syncs(0), _tiles(0), _regressions(0), _imageFailures(0), _heightFailures(0), _tileFailures(0) { }
+
+        void run()
+        {
+            MapFrame frame( _map, Map::TERRAIN_LAYERS, "mapsnapshot" );
+            const Profile* profile = frame.getProfile();
+            unsigned tilesWide, tilesHigh;
+            profile->getNumTiles( _lod, tilesWide, tilesHigh );
+
+            unsigned seed = _seed;
+            int last = -1;
+
+            while( (unsigned)_stop == 0 )
+            {
+                if ( frame.sync() )
+                    ++_syncs;
+
+                int revision = frame.getRevision();
+                if ( revision < last )
+                    ++_regressions;
+                last = revision;
+
+                if ( _seen.find(revision) == _seen.end() )
+                    _seen[revision] = getLayers( frame );
+
+                seed = seed * 1664525u + 1013904223u;
+                unsigned x = (seed >> 8) % tilesWide;
+                seed = seed * 1664525u + 1013904223u;
+                unsigned y = (seed >> 8) % tilesHigh;
+                TileKey key( _lod, x, y, profile );
+
+                // the layer lists are used in place, as they are valid until the next sync.
+                const ImageLayerVector& imageLayers = frame.imageLayers();
+                for( ImageLayerVector::const_iterator i = imageLayers.begin(); i != imageLayers.end(); ++i )
+                {
+                    GeoImage image = i->get()->createImage( key );
+                    if ( !image.valid() )
+                        ++_imageFailures;
+                }
+
+                const ElevationLayerVector& elevationLayers = frame.elevationLayers();
+                osg::ref_ptr<osg::HeightField> hf;
+                if ( !frame.getHeightField(key, true, hf) || !hf.valid() )
+                {
+                    ++_heightFailures;
+                }
+                else if ( !elevationLayers.empty() )
+                {
+                    const FlatTileSource* top = static_cast<const FlatTileSource*>( elevationLayers.back()->getTileSource() );
+                    float h = hf->getHeight( hf->getNumColumns()/2, hf->getNumRows()/2 );
+                    if ( !top || !(fabs(h - top->getHeight()) < 0.01f) )
+                        ++_heightFailures;
+                }
+
+                osg::ref_ptr<osg::Node> tile = _engine->createTile( key );
+                if ( tile.valid() )
+                    ++_tiles;
+                else
+                    ++_tileFailures;
+            }
+        }
+
+        const Map*           _map;
+        TerrainEngineNode*   _engine;
+        unsigned             _lod;
+        unsigned             _seed;
+        OpenThreads::Atomic& _stop;
+        LayersByRevision     _seen;
+        unsigned             _syncs, _tiles;
+        unsigned             _regressions, _imageFailures, _heightFailures, _tileFailures;
+    };
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--threads n] [--changes n] [--layers n] [--lod n]\n"
+            << "    --threads n : threads building tiles (default 8)\n"
+            << "    --changes n : layers of each kind to add, and remove (default 200)\n"
+            << "    --layers n  : layers of each kind to keep in the map (default 3)\n"
+            << "    --lod n     : LOD of the tiles built (default 3)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned numThreads = 8, changes = 200, numLayers = 3, lod = 3;
+    arguments.read( "--threads", numThreads );
+    arguments.read( "--changes", changes );
+    arguments.read( "--layers",  numLayers );
+    arguments.read( "--lod",     lod );
+    numThreads = osg::maximum( numThreads, 1u );
+    changes    = osg::maximum( changes, 1u );
+    numLayers  = osg::maximum( numLayers, 1u );
+
+    osg::ref_ptr<Map> map = new Map();
+    std::vector< osg::ref_ptr<ImageLayer> >     imageLayers;
+    std::vector< osg::ref_ptr<ElevationLayer> > elevationLayers;
+    imageLayers.push_back( makeImageLayer(0) );
+    elevationLayers.push_back( makeElevationLayer(0) );
+    map->addImageLayer( imageLayers.back().get() );
+    map->addElevationLayer( elevationLayers.back().get() );
+
+    MPTerrainEngineOptions engineOptions;
+    engineOptions.firstLOD() = 1;
+
+    osg::ref_ptr<MapNode> mapNode = new MapNode( map.get(), MapNodeOptions(engineOptions) );
+    TerrainEngineNode* engine = mapNode->getTerrainEngine();
+    if ( !engine )
+    {
+        std::cout << "FAILED: no terrain engine (is the mp engine plugin on the path?)" << std::endl;
+        return 1;
+    }
+
+    // what the map published at each revision, read back from a frame synced on this thread.
+    LayersByRevision published;
+    MapFrame mainFrame( map.get(), Map::TERRAIN_LAYERS, "mapsnapshot-main" );
+    published[mainFrame.getRevision()] = getLayers( mainFrame );
+
+    OpenThreads::Atomic stop;
+    std::vector<WorkThread*> threads;
+    for( unsigned i = 0; i < numThreads; ++i )
+        threads.push_back( new WorkThread(map.get(), engine, lod, 1000u + i, stop) );
+
+    osg::Timer_t t = osg::Timer::instance()->tick();
+    for( unsigned i = 0; i < threads.size(); ++i )
+        threads[i]->start();
+
+    bool ok = true;
+    for( unsigned n = 1; n <= changes; ++n )
+    {
+        imageLayers.push_back( makeImageLayer(n) );
+        map->addImageLayer( imageLayers.back().get() );
+        mainFrame.sync();
+        published[mainFrame.getRevision()] = getLayers( mainFrame );
+
+        elevationLayers.push_back( makeElevationLayer(n) );
+        map->addElevationLayer( elevationLayers.back().get() );
+        mainFrame.sync();
+        published[mainFrame.getRevision()] = getLayers( mainFrame );
+
+        if ( imageLayers.size() > numLayers )
+        {
+            map->removeImageLayer( imageLayers.front().get() );
+            imageLayers.erase( imageLayers.begin() );
+            mainFrame.sync();
+            published[mainFrame.getRevision()] = getLayers( mainFrame );
+
+            map->removeElevationLayer( elevationLayers.front().get() );
+            elevationLayers.erase( elevationLayers.begin() );
+            mainFrame.sync();
+            published[mainFrame.getRevision()] = getLayers( mainFrame );
+        }
+
+        OpenThreads::Thread::microSleep( 2000 );
+    }
+
+    ++stop;
+    for( unsigned i = 0; i < threads.size(); ++i )
+        threads[i]->join();
+    double ms = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+    unsigned syncs = 0, tiles = 0, regressions = 0, imageFailures = 0, heightFailures = 0, tileFailures = 0;
+    unsigned revisionsSeen = 0, unknown = 0, mismatches = 0;
+    for( unsigned i = 0; i < threads.size(); ++i )
+    {
+        WorkThread* w = threads[i];
+        syncs          += w->_syncs;
+        tiles          += w->_tiles;
+        regressions    += w->_regressions;
+        imageFailures  += w->_imageFailures;
+        heightFailures += w->_heightFailures;
+        tileFailures   += w->_tileFailures;
+
+        for( LayersByRevision::const_iterator s = w->_seen.begin(); s != w->_seen.end(); ++s )
+        {
+            ++revisionsSeen;
+            LayersByRevision::const_iterator p = published.find( s->first );
+            if ( p == published.end() )
+                ++unknown;
+            else if ( p->second != s->second )
+                ++mismatches;
+        }
+        delete w;
+    }
+
+    std::cout << std::setprecision(4)
+        << numThreads << " threads, " << published.size() << " revisions published in " << ms << " ms\n"
+        << "    " << std::setw(10) << 1000.0*syncs/ms << " syncs/sec (" << syncs << ", "
+        << revisionsSeen << " revisions seen across threads)\n"
+        << "    " << std::setw(10) << 1000.0*tiles/ms << " tiles/sec (" << tiles << ")\n";
+
+    ok = check( regressions == 0,    "a frame synced to an older revision" ) && ok;
+    ok = check( unknown == 0,        "a frame synced to a revision the map never published" ) && ok;
+    ok = check( mismatches == 0,     "a frame's layer lists differ from what the map published at its revision" ) && ok;
+    ok = check( imageFailures == 0,  "an image layer in a frame could not create an image" ) && ok;
+    ok = check( heightFailures == 0, "a heightfield did not come from the frame's top elevation layer" ) && ok;
+    ok = check( tileFailures == 0,   "the engine could not create a tile" ) && ok;
+    ok = check( syncs > 0,           "no frame ever synced to a new revision" ) && ok;
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless check and benchmark for the noise driver's batched Perlin
+ * evaluator. For several option sets it samples rows of ECEF positions (the
+ * way the driver samples a tile) with both PerlinBatch and libnoise's
+ * module::Perlin, which is what the driver called per sample before, and
+ * reports the largest difference and samples/ms for each.
+ *
+ * Exits non-zero if any sample differs by more than the tolerance.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/Math>
+#include <osgEarthDrivers/noise/PerlinBatch>
+#include <noise/noise.h>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <vector>
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+
+namespace
+{
+    struct Result
+    {
+        Result() : _maxError(0.0), _moduleMs(0.0), _batchMs(0.0), _samples(0) { }
+        double   _maxError;
+        double   _moduleMs;
+        double   _batchMs;
+        unsigned _samples;
+    };
+
+    // one row of positions on a sphere of the earth's radius, like a tile row.
+    void makeRow( unsigned row, unsigned numRows, unsigned cols, double span,
+                  std::vector<double>& x, std::vector<double>& y, std::vector<double>& z )
+    {
+        const double R   = 6378137.0;
+        double       lat = osg::DegreesToRadians( -80.0 + 160.0 * (double)row / (double)numRows );
+        double       lon0 = osg::DegreesToRadians( -180.0 + 7.0 * (double)row );
+        for( unsigned c = 0; c < cols; ++c )
+        {
+            double lon = lon0 + osg::DegreesToRadians( span * (double)c / (double)(cols-1) );
+            x[c] = R * cos(lat) * cos(lon);
+            y[c] = R * cos(lat) * sin(lon);
+            z[c] = R * sin(lat);
+        }
+    }
+
+    Result run( const NoiseOptions& options, unsigned numRows, unsigned cols, double span )
+    {
+        noise::module::Perlin perlin;
+        perlin.SetFrequency  ( options.frequency().get() );
+        perlin.SetLacunarity ( options.lacunarity().get() );
+        perlin.SetPersistence( options.persistence().get() );
+        perlin.SetOctaveCount( options.octaves().get() );
+        if ( options.seed().isSet() )
+            perlin.SetSeed( options.seed().get() );
+
+        PerlinBatch batch( options );
+
+        std::vector<double> x(cols), y(cols), z(cols), bx(cols), by(cols), bz(cols);
+        std::vector<double> expected(cols), actual(cols);
+
+        Result r;
+        osg::Timer_t t;
+
+        for( unsigned row = 0; row < numRows; ++row )
+        {
+            makeRow( row, numRows, cols, span, x, y, z );
+
+            t = osg::Timer::instance()->tick();
+            for( unsigned c = 0; c < cols; ++c )
+                expected[c] = perlin.GetValue( x[c], y[c], z[c] );
+            r._moduleMs += osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+            bx = x; by = y; bz = z;
+            t = osg::Timer::instance()->tick();
+            batch.getValues( &bx[0], &by[0], &bz[0], &actual[0], cols );
+            r._batchMs += osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+            for( unsigned c = 0; c < cols; ++c )
+                r._maxError = osg::maximum( r._maxError, fabs(expected[c] - actual[c]) );
+
+            r._samples += cols;
+        }
+
+        return r;
+    }
+
+    bool check( const std::string& name, const NoiseOptions& options, unsigned numRows, unsigned cols, double span, double tolerance )
+    {
+        Result r = run( options, numRows, cols, span );
+
+        std::cout
+            << name << ": " << r._samples << " samples, " << options.octaves().get() << " octaves\n"
+            << "    module::Perlin: " << std::setw(10) << r._moduleMs << " ms, "
+            << (r._moduleMs > 0.0 ? r._samples/r._moduleMs : 0.0) << " samples/ms\n"
+            << "    PerlinBatch:    " << std::setw(10) << r._batchMs << " ms, "
+            << (r._batchMs > 0.0 ? r._samples/r._batchMs : 0.0) << " samples/ms"
+            << " (" << (r._batchMs > 0.0 ? r._moduleMs/r._batchMs : 0.0) << "x)\n"
+            << "    max difference " << r._maxError
+            << std::endl;
+
+        if ( r._maxError > tolerance )
+        {
+            std::cout << "FAILED: " << name << " differs from module::Perlin" << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--rows n] [--cols n]\n"
+            << "    --rows n : sample rows per option set (default 2048)\n"
+            << "    --cols n : samples per row (default 257)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned rows = 2048, cols = 257;
+    arguments.read( "--rows", rows );
+    arguments.read( "--cols", cols );
+    cols = osg::maximum( cols, 2u );
+
+    std::cout << std::setprecision(4);
+
+    // the batch folds libnoise's gradient scale into its table, so allow
+    // a few ulps of the [-1..1] output per octave.
+    const double tolerance = 1e-12;
+
+    bool ok = true;
+
+    NoiseOptions defaults;
+    ok = check( "defaults", defaults, rows, cols, 1.0, tolerance ) && ok;
+
+    // resolution in meters, as in the earth files:
+    NoiseOptions fine;
+    fine.frequency() = 1.0 / 5000.0;
+    fine.octaves()   = 8;
+    ok = check( "1/5000 m, 8 octaves", fine, rows, cols, 0.05, tolerance ) && ok;
+
+    NoiseOptions seeded;
+    seeded.frequency()   = 1.0 / 250000.0;
+    seeded.octaves()     = 12;
+    seeded.persistence() = 0.6;
+    seeded.lacunarity()  = 2.2;
+    seeded.seed()        = 1234;
+    ok = check( "seeded, 12 octaves", seeded, rows, cols, 5.0, tolerance ) && ok;
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
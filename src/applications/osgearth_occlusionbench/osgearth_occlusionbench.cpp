@@ -0,0 +1,387 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless check and benchmark for the OcclusionCullingService.
+ *
+ * Publishes a terrain with a north-south ridge to a TerrainHeightIndex and
+ * puts the eye 200m above the flat ground west of it. Half of the
+ * annotations sit on the ground beyond the ridge and half in the open to the
+ * west. For sets of 10k, 50k and 100k annotations, times a cull of one
+ * camera, which submits every annotation, and the wait from the end of that
+ * cull until the batch has been tested, and reports annotations/ms for each.
+ * Culls are run with no viewer, calling the camera's cull callback the way
+ * osgUtil::SceneView does.
+ *
+ * Exits non-zero if the batch is not tested until a later frame starts, if
+ * an annotation in the open is hidden or one beyond the ridge is not, or if
+ * the service keeps the state of a deleted camera once a new one culls.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/Camera>
+#include <osg/FrameStamp>
+#include <osg/View>
+#include <osgGA/GUIActionAdapter>
+#include <osgUtil/CullVisitor>
+#include <osgUtil/RenderStage>
+#include <osgUtil/StateGraph>
+#include <osgEarth/OcclusionCullingService>
+#include <osgEarth/TerrainHeightIndex>
+#include <osgEarth/Registry>
+#include <osgEarth/Profile>
+#include <osgEarth/GeoData>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Thread>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    const double   VIEW_LON = -0.05, VIEW_LAT = 45.5, VIEW_ALT = 200.0;
+    const double   RIDGE_WEST = 0.03, RIDGE_EAST = 0.07;
+    const float    RIDGE_HEIGHT = 1500.0f;
+    const unsigned TILE_LOD = 6, TILE_SIZE = 257;
+    const double   MAX_ALTITUDE = 1.0e7;
+
+    // a pseudo-random number in [0,1).
+    inline double random( unsigned& seed )
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return (double)(seed >> 8) / (double)(1u << 24);
+    }
+
+    osg::HeightField* makeHeightField( const GeoExtent& ex )
+    {
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate( TILE_SIZE, TILE_SIZE );
+        hf->setOrigin( osg::Vec3(ex.xMin(), ex.yMin(), 0.0f) );
+        hf->setXInterval( ex.width()  / (double)(TILE_SIZE-1) );
+        hf->setYInterval( ex.height() / (double)(TILE_SIZE-1) );
+        for( unsigned c = 0; c < TILE_SIZE; ++c )
+        {
+            double lon = ex.xMin() + ex.width() * (double)c / (double)(TILE_SIZE-1);
+            float  h   = lon >= RIDGE_WEST && lon <= RIDGE_EAST ? RIDGE_HEIGHT : 0.0f;
+            for( unsigned r = 0; r < TILE_SIZE; ++r )
+                hf->setHeight( c, r, h );
+        }
+        return hf;
+    }
+
+    // the tiles around the eye, with the ridge running through them.
+    TerrainHeightIndex* makeIndex( const Profile* profile )
+    {
+        TerrainHeightIndex* index = new TerrainHeightIndex( profile );
+        const double lons[] = { VIEW_LON - 1.0, VIEW_LON + 1.0 };
+        const double lats[] = { VIEW_LAT - 1.0, VIEW_LAT + 1.0 };
+        for( unsigned i = 0; i < 2; ++i )
+        {
+            for( unsigned j = 0; j < 2; ++j )
+            {
+                TileKey key = profile->createTileKey( lons[i], lats[j], TILE_LOD );
+                index->add( key, makeHeightField(key.getExtent()) );
+            }
+        }
+        return index;
+    }
+
+    // a view that counts the redraws the service asks for.
+    struct RedrawView : public osg::View, public osgGA::GUIActionAdapter
+    {
+        void requestRedraw() { ++_redraws; }
+        void requestContinuousUpdate( bool ) { }
+        void requestWarpPointer( float, float ) { }
+
+        unsigned redraws() const { return (unsigned)_redraws; }
+
+        bool waitForRedraw( unsigned before, double timeout_s ) const
+        {
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            while( (unsigned)_redraws == before )
+            {
+                if ( osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) > timeout_s )
+                    return false;
+                OpenThreads::Thread::microSleep( 100 );
+            }
+            return true;
+        }
+
+        OpenThreads::Atomic _redraws;
+    };
+
+    // submits every annotation to the service when culled, and tallies the answers.
+    struct Annotations : public osg::NodeCallback
+    {
+        Annotations( OcclusionCullingService* service, const SpatialReference* srs, unsigned count )
+            : _service( service ), _limit( count )
+        {
+            unsigned seed = 12345u;
+            for( unsigned i = 0; i < count; ++i )
+            {
+                bool   beyond = (i % 2) == 1;
+                double lon    = beyond ? 0.1 + 0.4*random(seed) : VIEW_LON - 0.5 + 0.4*random(seed);
+                double lat    = VIEW_LAT - 0.1 + 0.2*random(seed);
+
+                osg::Vec3d world;
+                GeoPoint( srs, lon, lat, 10.0, ALTMODE_ABSOLUTE ).toWorld( world );
+
+                _ids.push_back( service->allocateID() );
+                _world.push_back( world );
+                _beyond.push_back( beyond );
+            }
+            reset();
+        }
+
+        void reset() { _visible = 0; _openHidden = 0; _beyondVisible = 0; }
+
+        void operator()( osg::Node* node, osg::NodeVisitor* nv )
+        {
+            osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>( nv );
+            if ( !cv )
+                return;
+
+            unsigned count = osg::minimum( _limit, (unsigned)_ids.size() );
+            for( unsigned i = 0; i < count; ++i )
+            {
+                bool visible = _service->isVisible( cv, _ids[i], _world[i], MAX_ALTITUDE );
+                if ( visible )
+                    ++_visible;
+                if ( visible && _beyond[i] )
+                    ++_beyondVisible;
+                else if ( !visible && !_beyond[i] )
+                    ++_openHidden;
+            }
+        }
+
+        osg::ref_ptr<OcclusionCullingService> _service;
+        std::vector<unsigned>                 _ids;
+        std::vector<osg::Vec3d>               _world;
+        std::vector<bool>                     _beyond;
+        unsigned                              _limit;   // annotations submitted per cull
+        unsigned                              _visible, _openHidden, _beyondVisible;
+    };
+
+    // a headless cull of one camera.
+    struct Culler
+    {
+        Culler( const SpatialReference* srs, osg::Node* scene, RedrawView* view )
+        {
+            _camera = new osg::Camera();
+            _camera->setViewport( 0, 0, 1920, 1080 );
+            _camera->setProjectionMatrixAsPerspective( 30.0, 1920.0/1080.0, 1.0, 1.0e7 );
+
+            osg::Vec3d eye, center;
+            GeoPoint( srs, VIEW_LON, VIEW_LAT, VIEW_ALT, ALTMODE_ABSOLUTE ).toWorld( eye );
+            GeoPoint( srs, VIEW_LON + 0.1, VIEW_LAT, 0.0, ALTMODE_ABSOLUTE ).toWorld( center );
+            osg::Vec3d up = eye;
+            up.normalize();
+            _camera->setViewMatrixAsLookAt( eye, center, up );
+            _camera->addChild( scene );
+            if ( view )
+                view->setCamera( _camera.get() );
+
+            _frameStamp  = new osg::FrameStamp();
+            _stateGraph  = new osgUtil::StateGraph();
+            _renderStage = new osgUtil::RenderStage();
+            _renderStage->setCamera( _camera.get() );
+            _renderStage->setViewport( _camera->getViewport() );
+
+            _cv = new osgUtil::CullVisitor();
+            _cv->setFrameStamp( _frameStamp.get() );
+            _cv->setStateGraph( _stateGraph.get() );
+            _cv->setRenderStage( _renderStage.get() );
+        }
+
+        // culls the next frame, running the camera's cull callback as SceneView does.
+        void cull()
+        {
+            _frameStamp->setFrameNumber( _frameStamp->getFrameNumber() + 1 );
+
+            _cv->reset();
+            _stateGraph->clean();
+            _renderStage->reset();
+
+            _cv->pushViewport( _camera->getViewport() );
+            _cv->pushProjectionMatrix( new osg::RefMatrix(_camera->getProjectionMatrix()) );
+            _cv->pushModelViewMatrix( new osg::RefMatrix(_camera->getViewMatrix()), osg::Transform::ABSOLUTE_RF );
+
+            osg::NodeCallback* callback = _camera->getCullCallback();
+            if ( callback )
+                (*callback)( _camera.get(), _cv.get() );
+            else
+                _cv->traverse( *_camera.get() );
+
+            _cv->popModelViewMatrix();
+            _cv->popProjectionMatrix();
+            _cv->popViewport();
+        }
+
+        osg::ref_ptr<osg::Camera>           _camera;
+        osg::ref_ptr<osg::FrameStamp>       _frameStamp;
+        osg::ref_ptr<osgUtil::StateGraph>   _stateGraph;
+        osg::ref_ptr<osgUtil::RenderStage>  _renderStage;
+        osg::ref_ptr<osgUtil::CullVisitor>  _cv;
+    };
+
+    osg::Group* makeScene( Annotations* annotations )
+    {
+        osg::Group* scene = new osg::Group();
+        scene->setCullingActive( false );
+        scene->setCullCallback( annotations );
+        return scene;
+    }
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+
+    bool checkViews( TerrainHeightIndex* index, const SpatialReference* srs )
+    {
+        osg::ref_ptr<OcclusionCullingService> service = new OcclusionCullingService( index, srs, true );
+        osg::ref_ptr<osg::Group> scene = makeScene( new Annotations(service.get(), srs, 100) );
+
+        bool ok = true;
+
+        Culler a( srs, scene.get(), 0L );
+        a.cull();
+        ok = check( service->getNumViews() == 1, "the first camera was not tracked" ) && ok;
+        ok = check( a._camera->getCullCallback() != 0L, "the first camera got no cull callback" ) && ok;
+        {
+            Culler b( srs, scene.get(), 0L );
+            b.cull();
+            ok = check( service->getNumViews() == 2, "the second camera was not tracked" ) && ok;
+        }
+
+        Culler c( srs, scene.get(), 0L );
+        c.cull();
+        ok = check( service->getNumViews() == 2, "the state of a deleted camera was kept" ) && ok;
+        return ok;
+    }
+
+    bool bench( TerrainHeightIndex* index, const SpatialReference* srs, unsigned count, unsigned passes, double timeout )
+    {
+        bool ok = true;
+        double cullMs = 0.0, testMs = 0.0;
+        unsigned done = 0;
+
+        for( unsigned p = 0; p < passes; ++p )
+        {
+            // a new service each pass, so the first answers always ask for a redraw.
+            osg::ref_ptr<OcclusionCullingService> service = new OcclusionCullingService( index, srs, true );
+            osg::ref_ptr<Annotations> annotations = new Annotations( service.get(), srs, count );
+            osg::ref_ptr<osg::Group>  scene = makeScene( annotations.get() );
+            osg::ref_ptr<RedrawView>  view  = new RedrawView();
+            Culler culler( srs, scene.get(), view.get() );
+
+            // the cull that installs the flush callback does not run it, so
+            // its point is shipped by the next cull, which submits nothing.
+            annotations->_limit = 1;
+            culler.cull();
+            annotations->_limit = 0;
+            unsigned redraws = view->redraws();
+            culler.cull();
+            bool tested = view->waitForRedraw( redraws, timeout );
+            ok = check( tested, "the batch was not tested after the cull ended" ) && ok;
+            if ( !tested )
+                break;
+
+            annotations->_limit = count;
+            annotations->reset();
+            redraws = view->redraws();
+            osg::Timer_t t = osg::Timer::instance()->tick();
+            culler.cull();
+            osg::Timer_t culled = osg::Timer::instance()->tick();
+            cullMs += osg::Timer::instance()->delta_m( t, culled );
+
+            ok = check( annotations->_visible == count, "annotations with no answers yet were hidden" ) && ok;
+
+            // again no later frame: the batch must go out when the cull ends.
+            tested = view->waitForRedraw( redraws, timeout );
+            testMs += osg::Timer::instance()->delta_m( culled, osg::Timer::instance()->tick() );
+            ok = check( tested, "the batch was not tested after the cull ended" ) && ok;
+            if ( !tested )
+                break;
+
+            annotations->reset();
+            culler.cull();
+
+            std::ostringstream what;
+            what << annotations->_openHidden << " annotations in the open were hidden and "
+                 << annotations->_beyondVisible << " beyond the ridge were not";
+            ok = check( annotations->_openHidden == 0 && annotations->_beyondVisible == 0, what.str() ) && ok;
+            ++done;
+        }
+
+        if ( done == 0 )
+            return ok;
+
+        std::cout
+            << "    " << std::setw(6) << count << " annotations: "
+            << "cull " << std::setw(8) << cullMs/done << " ms (" << std::setw(8) << count*done/cullMs << " annotations/ms), "
+            << "test " << std::setw(8) << testMs/done << " ms (" << std::setw(8) << count*done/testMs << " annotations/ms)\n";
+
+        return ok;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--passes n] [--timeout s]\n"
+            << "    --passes n  : batches timed per set of annotations (default 5)\n"
+            << "    --timeout s : seconds to wait for a batch to be tested (default 30)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned passes  = 5;
+    double   timeout = 30.0;
+    arguments.read( "--passes",  passes );
+    arguments.read( "--timeout", timeout );
+    passes = osg::maximum( passes, 1u );
+
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+    const SpatialReference* srs = profile->getSRS();
+    osg::ref_ptr<TerrainHeightIndex> index = makeIndex( profile );
+
+    std::cout << std::setprecision(4);
+
+    bool ok = checkViews( index.get(), srs );
+
+    const unsigned counts[] = { 10000, 50000, 100000 };
+    for( unsigned i = 0; i < sizeof(counts)/sizeof(counts[0]); ++i )
+        ok = bench( index.get(), srs, counts[i], passes, timeout ) && ok;
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -30,6 +30,7 @@
 #include <osgEarth/HTTPClient>
 #include <osgEarthUtil/TMSPackager>
 #include <osgEarthDrivers/tms/TMSOptions>
+#include <osgEarthDrivers/mbtiles/MBTilesOptions>
 
 #include <iostream>
 #include <sstream>
@@ -63,8 +64,11 @@ usage( const std::string& msg = "" )
         << "            [--out-earth <earthfile>]       : export an earth file referencing the new repo\n"
         << "            [--ext <extension>]             : overrides the image file extension (e.g. jpg)\n"
         << "            [--overwrite]                   : overwrite existing tiles\n"
+        << "            [--mbtiles]                     : write each layer to an MBTiles database instead of a TMS folder\n"
         << "            [--keep-empties]                : writes out fully transparent image tiles (normally discarded)\n"
         << "            [--continue-single-color]       : continues to subdivide single color tiles, subdivision typicall stops on single color images\n"
+        << "            [--fetch-threads <num>]         : number of threads fetching tiles (default=2 x cores)\n"
+        << "            [--encode-threads <num>]        : number of threads encoding tiles (default=cores)\n"
         << "            [--db-options]                : db options string to pass to the image writer in quotes (e.g., \"JPEG_QUALITY 60\")\n"
         << std::endl
         << "         [--quiet]               : suppress progress output" << std::endl;
@@ -99,6 +103,27 @@ findArgumentWithExtension( osg::ArgumentParser& args, const std::string& ext )
 }
 
 
+/** Driver options for reading back a packaged layer in the output earth file. */
+TileSourceOptions
+makeDriverOptions( const std::string& layerFolder, const std::string& outEarthFile, bool mbtiles )
+{
+    if ( mbtiles )
+    {
+        MBTilesOptions mbt;
+        mbt.filename() = URI( layerFolder, outEarthFile );
+        return mbt;
+    }
+    else
+    {
+        TMSOptions tms;
+        tms.url() = URI(
+            osgDB::concatPaths(layerFolder, "tms.xml"),
+            outEarthFile );
+        return tms;
+    }
+}
+
+
 /** Packages an image layer as a TMS folder. */
 int
 makeTMS( osg::ArgumentParser& args )
@@ -154,11 +179,19 @@ makeTMS( osg::ArgumentParser& args )
     unsigned maxLevel = ~0;
     args.read( "--max-level", maxLevel );
 
+    // whether to write MBTiles databases instead of TMS folders
+    bool mbtiles = args.read("--mbtiles");
+
     // whether to keep 'empty' tiles
     bool keepEmpties = args.read("--keep-empties");    
 
     bool continueSingleColor = args.read("--continue-single-color");
 
+    // pipeline thread counts
+    unsigned fetchThreads = 0, encodeThreads = 0;
+    args.read( "--fetch-threads", fetchThreads );
+    args.read( "--encode-threads", encodeThreads );
+
     // load up the map
     osg::ref_ptr<MapNode> mapNode = MapNode::load( args );
     if ( !mapNode.valid() )
@@ -179,6 +212,11 @@ makeTMS( osg::ArgumentParser& args )
     packager.setKeepEmptyImageTiles( keepEmpties );
     packager.setSubdivideSingleColorImageTiles( continueSingleColor );
 
+    if ( fetchThreads > 0 )
+        packager.setNumFetchThreads( fetchThreads );
+    if ( encodeThreads > 0 )
+        packager.setNumEncodeThreads( encodeThreads );
+
     if ( maxLevel != ~0 )
         packager.setMaxLevel( maxLevel );
 
@@ -224,6 +262,9 @@ makeTMS( osg::ArgumentParser& args )
                 OE_NOTICE << LC << "Packaging image layer \"" << layerFolder << "\"" << std::endl;
             }
 
+            if ( mbtiles )
+                layerFolder += ".mbtiles";
+
             std::string layerRoot = osgDB::concatPaths( rootFolder, layerFolder );
             TMSPackager::Result r = packager.package( layer, layerRoot, 0L, extension );
             if ( r.ok )
@@ -231,13 +272,7 @@ makeTMS( osg::ArgumentParser& args )
                 // save to the output map if requested:
                 if ( outMap.valid() )
                 {
-                    // new TMS driver info:
-                    TMSOptions tms;
-                    tms.url() = URI(
-                        osgDB::concatPaths(layerFolder, "tms.xml"),
-                        outEarthFile );
-
-                    ImageLayerOptions layerOptions( layer->getName(), tms );
+                    ImageLayerOptions layerOptions( layer->getName(), makeDriverOptions(layerFolder, outEarthFile, mbtiles) );
                     layerOptions.mergeConfig( layer->getInitialOptions().getConfig(true) );
                     layerOptions.cachePolicy() = CachePolicy::NO_CACHE;
 
@@ -274,6 +309,9 @@ makeTMS( osg::ArgumentParser& args )
                 OE_NOTICE << LC << "Packaging elevation layer \"" << layerFolder << "\"" << std::endl;
             }
 
+            if ( mbtiles )
+                layerFolder += ".mbtiles";
+
             std::string layerRoot = osgDB::concatPaths( rootFolder, layerFolder );
             TMSPackager::Result r = packager.package( layer, layerRoot );
 
@@ -282,13 +320,7 @@ makeTMS( osg::ArgumentParser& args )
                 // save to the output map if requested:
                 if ( outMap.valid() )
                 {
-                    // new TMS driver info:
-                    TMSOptions tms;
-                    tms.url() = URI(
-                        osgDB::concatPaths(layerFolder, "tms.xml"),
-                        outEarthFile );
-
-                    ElevationLayerOptions layerOptions( layer->getName(), tms );
+                    ElevationLayerOptions layerOptions( layer->getName(), makeDriverOptions(layerFolder, outEarthFile, mbtiles) );
                     layerOptions.mergeConfig( layer->getInitialOptions().getConfig(true) );
                     layerOptions.cachePolicy() = CachePolicy::NO_CACHE;
 
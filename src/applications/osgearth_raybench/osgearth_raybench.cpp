@@ -0,0 +1,210 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless check and benchmark for TriangleBVH. For synthetic terrain tiles
+ * of several sizes it runs the same rays through DPLineSegmentIntersector
+ * twice: against a tile with a BVH installed, and against a copy without one
+ * (every triangle tested). Reports rays/sec for each and the cost of the
+ * lazy build, which happens on the first ray.
+ *
+ * Exits non-zero if the two disagree on whether a ray hits, or on where.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osgUtil/IntersectionVisitor>
+#include <osgEarth/DPLineSegmentIntersector>
+#include <osgEarth/TriangleBVH>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    // a tile-sized grid of rolling terrain, in meters.
+    osg::Geometry* makeTile( unsigned posts )
+    {
+        const double size = 10000.0;
+
+        osg::Vec3Array* verts = new osg::Vec3Array();
+        verts->reserve( posts*posts );
+        for( unsigned r = 0; r < posts; ++r )
+        {
+            for( unsigned c = 0; c < posts; ++c )
+            {
+                double x = size * (double)c / (double)(posts-1);
+                double y = size * (double)r / (double)(posts-1);
+                double z = 800.0 * sin(x/1300.0) * cos(y/1700.0) + 150.0 * sin((x+y)/400.0);
+                verts->push_back( osg::Vec3(x, y, z) );
+            }
+        }
+
+        osg::DrawElementsUInt* tris = new osg::DrawElementsUInt( GL_TRIANGLES );
+        tris->reserve( (posts-1)*(posts-1)*6 );
+        for( unsigned r = 0; r+1 < posts; ++r )
+        {
+            for( unsigned c = 0; c+1 < posts; ++c )
+            {
+                unsigned i = r*posts + c;
+                tris->push_back( i ); tris->push_back( i+1 ); tris->push_back( i+posts );
+                tris->push_back( i+1 ); tris->push_back( i+posts+1 ); tris->push_back( i+posts );
+            }
+        }
+
+        osg::Geometry* geom = new osg::Geometry();
+        geom->setVertexArray( verts );
+        geom->addPrimitiveSet( tris );
+        return geom;
+    }
+
+    // rays from above the tile down through it at varying slants (picks,
+    // height queries and line-of-sight spokes), some of which leave the tile.
+    void makeRays( unsigned count, std::vector<osg::Vec3d>& starts, std::vector<osg::Vec3d>& ends )
+    {
+        starts.resize( count );
+        ends.resize( count );
+        unsigned seed = 4242u;
+        for( unsigned i = 0; i < count; ++i )
+        {
+            double u[5];
+            for( unsigned k = 0; k < 5; ++k )
+            {
+                seed = seed * 1664525u + 1013904223u;
+                u[k] = (double)(seed >> 8) / (double)(1u << 24);
+            }
+            starts[i].set( 10000.0*u[0], 10000.0*u[1], 3000.0 );
+            ends[i].set( starts[i].x() + 6000.0*(u[2]-0.5)*u[4], starts[i].y() + 6000.0*(u[3]-0.5)*u[4], -2000.0 );
+        }
+    }
+
+    struct Result
+    {
+        Result() : _ms(0.0), _hits(0) { }
+        double              _ms;
+        unsigned            _hits;
+        std::vector<double> _ratios; // nearest hit per ray, or -1
+    };
+
+    void run( osg::Node* node, const std::vector<osg::Vec3d>& starts, const std::vector<osg::Vec3d>& ends, Result& r )
+    {
+        r._ratios.assign( starts.size(), -1.0 );
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        for( unsigned i = 0; i < starts.size(); ++i )
+        {
+            osg::ref_ptr<DPLineSegmentIntersector> lsi = new DPLineSegmentIntersector( starts[i], ends[i] );
+            lsi->setIntersectionLimit( osgUtil::Intersector::LIMIT_NEAREST );
+            osgUtil::IntersectionVisitor iv( lsi.get() );
+            node->accept( iv );
+            if ( lsi->containsIntersections() )
+            {
+                r._ratios[i] = lsi->getFirstIntersection().ratio;
+                ++r._hits;
+            }
+        }
+        r._ms = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+    }
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--rays n]\n"
+            << "    --rays n : rays per tile size (default 20000)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned numRays = 20000;
+    arguments.read( "--rays", numRays );
+    numRays = osg::maximum( numRays, 1u );
+
+    std::cout << std::setprecision(4);
+
+    std::vector<osg::Vec3d> starts, ends;
+    makeRays( numRays, starts, ends );
+
+    bool ok = true;
+
+    unsigned sizes[] = { 17, 33, 65, 129 };
+    for( unsigned s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s )
+    {
+        unsigned posts = sizes[s];
+
+        osg::ref_ptr<osg::Geode> plain = new osg::Geode();
+        plain->addDrawable( makeTile(posts) );
+
+        osg::Geometry* accelerated = makeTile( posts );
+        TriangleBVH::install( accelerated );
+        osg::ref_ptr<osg::Geode> withBVH = new osg::Geode();
+        withBVH->addDrawable( accelerated );
+
+        // the first ray builds the BVH:
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        const TriangleBVH* bvh = TriangleBVH::get( accelerated );
+        double buildMs = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+        ok = check( bvh != 0L && bvh->getNumTriangles() == 2*(posts-1)*(posts-1), "BVH missing triangles" ) && ok;
+
+        Result brute, fast;
+        run( plain.get(),   starts, ends, brute );
+        run( withBVH.get(), starts, ends, fast );
+
+        unsigned mismatches = 0;
+        double   maxError   = 0.0;
+        for( unsigned i = 0; i < numRays; ++i )
+        {
+            if ( (brute._ratios[i] < 0.0) != (fast._ratios[i] < 0.0) )
+                ++mismatches;
+            else if ( brute._ratios[i] >= 0.0 )
+                maxError = osg::maximum( maxError, fabs(brute._ratios[i] - fast._ratios[i]) * (ends[i]-starts[i]).length() );
+        }
+
+        std::cout
+            << posts << "x" << posts << " posts, " << 2*(posts-1)*(posts-1) << " triangles, "
+            << fast._hits << "/" << numRays << " rays hit\n"
+            << "    all triangles: " << std::setw(10) << 1000.0*numRays/brute._ms << " rays/sec\n"
+            << "    BVH:           " << std::setw(10) << 1000.0*numRays/fast._ms  << " rays/sec"
+            << " (" << brute._ms/fast._ms << "x), built in " << buildMs << " ms\n"
+            << "    max difference " << maxError << " m\n";
+
+        ok = check( mismatches == 0, "BVH and brute force disagree on hits" ) && ok;
+        ok = check( maxError < 1e-6, "BVH and brute force disagree on hit positions" ) && ok;
+    }
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
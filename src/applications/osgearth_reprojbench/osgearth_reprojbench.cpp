@@ -0,0 +1,215 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless accuracy check and benchmark for
+ * SpatialReference::transformExtentPointsOnGrid, the interpolated transform
+ * that GeoImage reprojection uses for its source sample locations.
+ *
+ * For geodetic tiles sampled from a mercator source and mercator tiles
+ * sampled from a geodetic source, at several LODs and latitudes, transforms
+ * the pixel centers of a tile both exactly (transformExtentPoints) and on
+ * the grid, and reports points/sec for each and the largest difference in
+ * source pixels. The source pixel is the tile's bounding box in the source
+ * SRS divided by the tile size, and the tolerance is an eighth of one, as
+ * in reprojection.
+ *
+ * Exits non-zero if a grid point is off by more than the tolerance.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osgEarth/SpatialReference>
+#include <osgEarth/Registry>
+#include <osgEarth/Profile>
+#include <osgEarth/TileKey>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    const double   MAX_ERROR = 0.125;   // in source pixels
+    const unsigned SPACING   = 16;
+
+    struct Result
+    {
+        Result() : _valid(false), _exactMs(0.0), _gridMs(0.0), _maxError(0.0) { }
+        bool   _valid;
+        double _exactMs;
+        double _gridMs;
+        double _maxError;
+    };
+
+    // the tile of "profile" at "lod" containing a lon/lat.
+    TileKey getKey( const Profile* profile, double lon, double lat, unsigned lod )
+    {
+        const SpatialReference* geoSRS = profile->getSRS()->getGeographicSRS();
+        double x, y;
+        if ( !geoSRS->transform2D(lon, lat, profile->getSRS(), x, y) )
+            return TileKey::INVALID;
+        return profile->createTileKey( x, y, lod );
+    }
+
+    Result run( const TileKey& key, const SpatialReference* srcSRS, unsigned size, unsigned passes )
+    {
+        Result r;
+
+        const GeoExtent&        ex      = key.getExtent();
+        const SpatialReference* destSRS = ex.getSRS();
+        const double dx = ex.width()  / (double)size;
+        const double dy = ex.height() / (double)size;
+        const double xmin = ex.xMin() + .5*dx, xmax = ex.xMax() - .5*dx;
+        const double ymin = ex.yMin() + .5*dy, ymax = ex.yMax() - .5*dy;
+
+        unsigned numPoints = size*size;
+        std::vector<double> exact( numPoints*2 ), grid( numPoints*2 );
+        double* ex_x = &exact[0];
+        double* ex_y = ex_x + numPoints;
+        double* gr_x = &grid[0];
+        double* gr_y = gr_x + numPoints;
+
+        if ( !destSRS->transformExtentPoints(srcSRS, xmin, ymin, xmax, ymax, ex_x, ex_y, size, size) )
+            return r;
+
+        // one source pixel, from the bounding box of the exact points.
+        double sxmin = ex_x[0], sxmax = ex_x[0], symin = ex_y[0], symax = ex_y[0];
+        for( unsigned i = 1; i < numPoints; ++i )
+        {
+            sxmin = osg::minimum( sxmin, ex_x[i] );  sxmax = osg::maximum( sxmax, ex_x[i] );
+            symin = osg::minimum( symin, ex_y[i] );  symax = osg::maximum( symax, ex_y[i] );
+        }
+        double pixelX = (sxmax - sxmin) / (double)size;
+        double pixelY = (symax - symin) / (double)size;
+
+        if ( !destSRS->transformExtentPointsOnGrid(srcSRS, xmin, ymin, xmax, ymax, gr_x, gr_y, size, size,
+                                                   MAX_ERROR*pixelX, MAX_ERROR*pixelY, SPACING) )
+            return r;
+
+        for( unsigned i = 0; i < numPoints; ++i )
+        {
+            double e = osg::maximum( fabs(gr_x[i] - ex_x[i]) / pixelX, fabs(gr_y[i] - ex_y[i]) / pixelY );
+            // (negated so that NaNs count as failures)
+            if ( !(e <= r._maxError) )
+                r._maxError = e;
+        }
+
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        for( unsigned p = 0; p < passes; ++p )
+            destSRS->transformExtentPoints( srcSRS, xmin, ymin, xmax, ymax, ex_x, ex_y, size, size );
+        r._exactMs = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+        t = osg::Timer::instance()->tick();
+        for( unsigned p = 0; p < passes; ++p )
+            destSRS->transformExtentPointsOnGrid( srcSRS, xmin, ymin, xmax, ymax, gr_x, gr_y, size, size,
+                                                  MAX_ERROR*pixelX, MAX_ERROR*pixelY, SPACING );
+        r._gridMs = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+        r._valid = true;
+        return r;
+    }
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--size n] [--passes n]\n"
+            << "    --size n   : tile size in pixels (default 256)\n"
+            << "    --passes n : transforms timed per case (default 20)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned size = 256, passes = 20;
+    arguments.read( "--size",   size );
+    arguments.read( "--passes", passes );
+    size   = osg::maximum( size, 2u );
+    passes = osg::maximum( passes, 1u );
+
+    const Profile* geodetic = Registry::instance()->getGlobalGeodeticProfile();
+    const Profile* mercator = Registry::instance()->getSphericalMercatorProfile();
+
+    const unsigned lods[] = { 3, 6, 10, 14 };
+    const double   lats[] = { 0.5, 45.5, 70.5, 80.5, 84.5 };
+    const unsigned numLods = sizeof(lods)/sizeof(lods[0]);
+    const unsigned numLats = sizeof(lats)/sizeof(lats[0]);
+
+    std::cout << std::setprecision(4) << size << "x" << size << " points per tile, grid every "
+        << SPACING << ", tolerance " << MAX_ERROR << " source pixels\n";
+
+    bool ok = true;
+
+    for( unsigned d = 0; d < 2; ++d )
+    {
+        const Profile* dest = d == 0 ? geodetic : mercator;
+        const Profile* src  = d == 0 ? mercator : geodetic;
+
+        std::cout << (d == 0 ? "geodetic tiles from a mercator source:\n" : "mercator tiles from a geodetic source:\n");
+
+        for( unsigned l = 0; l < numLods; ++l )
+        {
+            for( unsigned a = 0; a < numLats; ++a )
+            {
+                TileKey key = getKey( dest, 10.5, lats[a], lods[l] );
+                if ( !key.valid() )
+                    continue;
+
+                Result r = run( key, src->getSRS(), size, passes );
+                if ( !r._valid )
+                {
+                    std::cout << "    LOD " << std::setw(2) << lods[l] << " lat " << std::setw(4) << lats[a]
+                        << ": no exact transform, skipped\n";
+                    continue;
+                }
+
+                double points = (double)size*size*passes;
+                std::cout
+                    << "    LOD " << std::setw(2) << lods[l] << " lat " << std::setw(4) << lats[a] << ": "
+                    << "exact " << std::setw(8) << points/(1000.0*r._exactMs) << " Mpoints/s, "
+                    << "grid "  << std::setw(8) << points/(1000.0*r._gridMs)  << " Mpoints/s, "
+                    << "speedup " << std::setw(6) << r._exactMs/r._gridMs << ", "
+                    << "max error " << r._maxError << " px\n";
+
+                std::ostringstream what;
+                what << "grid off by " << r._maxError << " source pixels at LOD " << lods[l] << " lat " << lats[a];
+                ok = check( r._maxError <= MAX_ERROR, what.str() ) && ok;
+            }
+        }
+    }
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
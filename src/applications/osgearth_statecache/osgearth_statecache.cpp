@@ -0,0 +1,205 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless multithreaded stress check and benchmark for StateSetCache.
+ *
+ * Several threads at once share freshly built statesets drawn from a fixed
+ * set of distinct contents, the way pager threads share the state of new
+ * tiles, while the cache prunes itself as it goes. Reports shares/sec from
+ * one thread and from all of them. Then drops every outside reference and
+ * prunes with a zero maximum age.
+ *
+ * Exits non-zero if two equivalent statesets come back as different cached
+ * objects, if the hit and miss counts don't add up to the shares made, or
+ * if the final prune leaves anything behind or doesn't count it.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/StateSet>
+#include <osg/Material>
+#include <osg/PolygonMode>
+#include <osgEarth/StateSetCache>
+#include <OpenThreads/Thread>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    // a new stateset with the i'th of the distinct contents.
+    osg::StateSet* makeStateSet( unsigned i )
+    {
+        osg::StateSet* ss = new osg::StateSet();
+
+        osg::Material* m = new osg::Material();
+        m->setDiffuse( osg::Material::FRONT_AND_BACK, osg::Vec4((float)(i % 97)/97.0f, (float)(i / 97)/97.0f, 0.5f, 1.0f) );
+        ss->setAttributeAndModes( m, osg::StateAttribute::ON );
+
+        if ( i % 2 )
+            ss->setAttributeAndModes( new osg::PolygonMode(osg::PolygonMode::FRONT_AND_BACK, osg::PolygonMode::LINE) );
+
+        ss->setMode( GL_LIGHTING, (i % 3) ? osg::StateAttribute::ON : osg::StateAttribute::OFF );
+        return ss;
+    }
+
+    struct ShareThread : public OpenThreads::Thread
+    {
+        ShareThread( StateSetCache* cache, const std::vector< osg::ref_ptr<osg::StateSet> >& canonical, unsigned shares, unsigned seed )
+            : _cache(cache), _canonical(canonical), _shares(shares), _seed(seed), _mismatches(0) { }
+
+        void run()
+        {
+            unsigned seed = _seed;
+            for( unsigned n = 0; n < _shares; ++n )
+            {
+                seed = seed * 1664525u + 1013904223u;
+                unsigned i = (seed >> 8) % _canonical.size();
+
+                osg::ref_ptr<osg::StateSet> input = makeStateSet( i ), output;
+                _cache->share( input, output );
+                if ( output.get() != _canonical[i].get() )
+                    ++_mismatches;
+            }
+        }
+
+        StateSetCache*                                    _cache;
+        const std::vector< osg::ref_ptr<osg::StateSet> >& _canonical;
+        unsigned                                          _shares;
+        unsigned                                          _seed;
+        unsigned                                          _mismatches;
+    };
+
+    // runs "numThreads" threads of "shares" shares each; returns the ms taken.
+    double run( StateSetCache* cache, const std::vector< osg::ref_ptr<osg::StateSet> >& canonical,
+                unsigned numThreads, unsigned shares, unsigned& mismatches )
+    {
+        std::vector<ShareThread*> threads;
+        for( unsigned i = 0; i < numThreads; ++i )
+            threads.push_back( new ShareThread(cache, canonical, shares, 1000u + i) );
+
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        if ( numThreads == 1 )
+        {
+            threads[0]->run();
+        }
+        else
+        {
+            for( unsigned i = 0; i < threads.size(); ++i )
+                threads[i]->start();
+            for( unsigned i = 0; i < threads.size(); ++i )
+                threads[i]->join();
+        }
+        double ms = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+        for( unsigned i = 0; i < threads.size(); ++i )
+        {
+            mismatches += threads[i]->_mismatches;
+            delete threads[i];
+        }
+        return ms;
+    }
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--distinct n] [--shares n] [--threads n]\n"
+            << "    --distinct n : distinct stateset contents (default 2000)\n"
+            << "    --shares n   : shares per thread (default 200000)\n"
+            << "    --threads n  : threads for the parallel run (default 8)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned distinct = 2000, shares = 200000, numThreads = 8;
+    arguments.read( "--distinct", distinct );
+    arguments.read( "--shares",   shares );
+    arguments.read( "--threads",  numThreads );
+    distinct   = osg::clampBetween( distinct, 1u, 97u*97u );
+    shares     = osg::maximum( shares, 1u );
+    numThreads = osg::maximum( numThreads, 1u );
+
+    osg::ref_ptr<StateSetCache> cache = new StateSetCache();
+
+    // the first of each content goes in; the rest must come back as it.
+    std::vector< osg::ref_ptr<osg::StateSet> > canonical( distinct );
+    unsigned firstMisses = 0;
+    for( unsigned i = 0; i < distinct; ++i )
+    {
+        osg::ref_ptr<osg::StateSet> input = makeStateSet( i );
+        if ( !cache->share(input, canonical[i]) )
+            ++firstMisses;
+    }
+
+    bool ok = true;
+    ok = check( firstMisses == distinct, "distinct statesets were shared with each other" ) && ok;
+
+    std::cout << std::setprecision(4) << distinct << " distinct statesets\n";
+
+    unsigned mismatches = 0;
+    double oneMs  = run( cache.get(), canonical, 1,          shares, mismatches );
+    double manyMs = run( cache.get(), canonical, numThreads, shares, mismatches );
+
+    std::cout
+        << "    1 thread:   " << std::setw(10) << 1000.0*shares/oneMs << " shares/sec\n"
+        << "    " << std::setw(2) << numThreads << " threads: " << std::setw(10) << 1000.0*shares*numThreads/manyMs << " shares/sec\n";
+
+    ok = check( mismatches == 0, "equivalent statesets came back as different objects" ) && ok;
+
+    StateSetCache::Stats stats;
+    cache->getStats( stats );
+    unsigned total = distinct + shares*(1 + numThreads);
+    std::cout
+        << "    stateset hits " << stats._stateSetHits << ", misses " << stats._stateSetMisses
+        << ", attribute hits " << stats._attributeHits << ", misses " << stats._attributeMisses
+        << ", evictions " << stats._evictions << "\n";
+    ok = check( stats._stateSetHits + stats._stateSetMisses == total, "hits and misses don't add up to the shares" ) && ok;
+    ok = check( stats._stateSetMisses == distinct, "a held stateset was evicted or added twice" ) && ok;
+    ok = check( cache->size() == distinct, "the cache holds a different number of statesets than are distinct" ) && ok;
+
+    // nothing outside the cache refers to its entries any more:
+    canonical.clear();
+    unsigned before = stats._evictions;
+    cache->setMaxAge( 0.0 );
+    cache->prune();
+    cache->getStats( stats );
+
+    ok = check( cache->size() == 0, "prune left unused statesets behind" ) && ok;
+    ok = check( stats._evictions - before >= distinct, "prune did not count its evictions" ) && ok;
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -53,6 +53,8 @@ usage( const std::string& msg )
         << "    --crop             ; Crops features instead of doing a centroid check.  Features can be added to multiple tiles when cropping is enabled" << std::endl
         << "    --dest-srs         ; The destination SRS string in any format osgEarth can understand (wkt, proj4, epsg).  If none is specified the source data SRS will be used" << std::endl
         << "    --bounds minx miny maxx maxy ; The bounding box to use as Level 0.  Feature extent will be used by default" << std::endl
+        << "    --threads          ; The number of threads writing tiles.  Defaults to the number of processors" << std::endl
+        << "    --max-in-memory    ; The maximum number of feature records kept in memory before spilling to temporary files" << std::endl
         << std::endl;
 
     return -1;
@@ -107,6 +109,12 @@ int main(int argc, char** argv)
     std::string destSRS;
     while(arguments.read("--dest-srs", destSRS));
 
+    unsigned int numThreads = 0;
+    while (arguments.read("--threads", numThreads));
+
+    unsigned int maxInMemory = 0;
+    while (arguments.read("--max-in-memory", maxInMemory));
+
     // Custom bounding box
     Bounds bounds;
     double xmin=DBL_MAX, ymin=DBL_MAX, xmax=DBL_MIN, ymax=DBL_MIN;
@@ -190,6 +198,10 @@ int main(int argc, char** argv)
     packager.setQuery( query );
     packager.setMethod( cropMethod );    
     packager.setDestSRS( destSRS );
+    if (numThreads > 0)
+        packager.setNumThreads( numThreads );
+    if (maxInMemory > 0)
+        packager.setMaxRecordsInMemory( maxInMemory );
     if (bounds.isValid())
     {
         packager.setLod0Extent(GeoExtent(osgEarth::SpatialReference::create( destSRS ), bounds));
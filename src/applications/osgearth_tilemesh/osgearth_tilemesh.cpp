@@ -0,0 +1,241 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless check and benchmark for the engine_mp tile grid transform. For a
+ * run of tiles with synthetic heights it compares the separable per-row/column
+ * path against the locator's own unitToModel (position and up vector) and
+ * times both, and checks that locators doing their own projection, like the
+ * cube face locator, stay on the exact path.
+ *
+ * Exits non-zero if any vertex is off by more than the tolerance.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osgEarth/Map>
+#include <osgEarth/MapInfo>
+#include <osgEarth/Locators>
+#include <osgEarth/TileKey>
+#include <osgEarth/Cube>
+#include <osgEarthDrivers/engine_mp/GridTransform>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <vector>
+
+using namespace osgEarth;
+using namespace osgEarth_engine_mp;
+
+namespace
+{
+    // rolling synthetic terrain, in meters.
+    inline double syntheticHeight( unsigned tile, unsigned i, unsigned j )
+    {
+        return 1500.0 * sin(0.37*i + 0.11*tile) * cos(0.29*j - 0.07*tile) + 200.0;
+    }
+
+    struct Result
+    {
+        Result() : _maxPosError(0.0), _maxUpError(0.0), _exactMs(0.0), _gridMs(0.0), _verts(0), _fastTiles(0) { }
+        double   _maxPosError;   // meters
+        double   _maxUpError;    // 1 - cos(angle)
+        double   _exactMs;
+        double   _gridMs;
+        unsigned _verts;
+        unsigned _fastTiles;
+    };
+
+    void exactVertex( const GeoLocator* locator, const osg::Vec3d& ndc, osg::Vec3d& model, osg::Vec3d& up )
+    {
+        locator->unitToModel( ndc, model );
+        locator->unitToModel( osg::Vec3d(ndc.x(), ndc.y(), ndc.z()+1.0), up );
+        up = up - model;
+        up.normalize();
+    }
+
+    void run( const std::vector< osg::ref_ptr<GeoLocator> >& locators, unsigned size, Result& r )
+    {
+        const unsigned count = size*size;
+        std::vector<osg::Vec3d> exactPos( count ), exactUp( count ), gridPos( count ), gridUp( count );
+        osg::Timer_t t;
+
+        for( unsigned k = 0; k < locators.size(); ++k )
+        {
+            const GeoLocator* locator = locators[k].get();
+
+            t = osg::Timer::instance()->tick();
+            for( unsigned j = 0; j < size; ++j )
+            {
+                for( unsigned i = 0; i < size; ++i )
+                {
+                    osg::Vec3d ndc( (double)i/(double)(size-1), (double)j/(double)(size-1), syntheticHeight(k, i, j) );
+                    exactVertex( locator, ndc, exactPos[j*size+i], exactUp[j*size+i] );
+                }
+            }
+            r._exactMs += osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+            t = osg::Timer::instance()->tick();
+            GridTransform grid;
+            grid.init( locator, size, size );
+            for( unsigned j = 0; j < size; ++j )
+            {
+                for( unsigned i = 0; i < size; ++i )
+                {
+                    osg::Vec3d ndc( (double)i/(double)(size-1), (double)j/(double)(size-1), syntheticHeight(k, i, j) );
+                    grid.toModel( i, j, ndc, gridPos[j*size+i], gridUp[j*size+i] );
+                }
+            }
+            r._gridMs += osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+            if ( grid._separable )
+                ++r._fastTiles;
+
+            for( unsigned v = 0; v < count; ++v )
+            {
+                r._maxPosError = osg::maximum( r._maxPosError, (exactPos[v] - gridPos[v]).length() );
+                r._maxUpError  = osg::maximum( r._maxUpError,  1.0 - exactUp[v]*gridUp[v] );
+            }
+            r._verts += count;
+        }
+    }
+
+    void report( const std::string& name, const Result& r, unsigned numTiles )
+    {
+        std::cout
+            << name << ": " << numTiles << " tiles (" << r._fastTiles << " separable), " << r._verts << " verts\n"
+            << "    unitToModel: " << std::setw(10) << r._exactMs << " ms, "
+            << (r._exactMs > 0.0 ? r._verts/r._exactMs : 0.0) << " verts/ms\n"
+            << "    grid:        " << std::setw(10) << r._gridMs << " ms, "
+            << (r._gridMs > 0.0 ? r._verts/r._gridMs : 0.0) << " verts/ms"
+            << " (" << (r._gridMs > 0.0 ? r._exactMs/r._gridMs : 0.0) << "x)\n"
+            << "    max position error " << r._maxPosError << " m, max up error (1-cos) " << r._maxUpError
+            << std::endl;
+    }
+
+    bool checkMap( MapOptions::CoordinateSystemType cstype, const std::string& profile,
+                   const std::string& name, unsigned lod, unsigned numTiles, unsigned size,
+                   double posTolerance, double upTolerance )
+    {
+        MapOptions options;
+        options.coordSysType() = cstype;
+        if ( !profile.empty() )
+            options.profile() = ProfileOptions( profile );
+
+        osg::ref_ptr<Map> map = new Map( options );
+        MapInfo info( map.get() );
+
+        unsigned tx, ty;
+        map->getProfile()->getNumTiles( lod, tx, ty );
+
+        std::vector< osg::ref_ptr<GeoLocator> > locators;
+        for( unsigned n = 0; n < numTiles; ++n )
+        {
+            // spread the tiles over the whole profile, poles included.
+            unsigned x = (n * 7919u) % tx;
+            unsigned y = (n * 104729u) % ty;
+            locators.push_back( GeoLocator::createForKey(TileKey(lod, x, y, map->getProfile()), info) );
+        }
+
+        Result r;
+        run( locators, size, r );
+        report( name, r, numTiles );
+
+        return r._fastTiles == numTiles && r._maxPosError <= posTolerance && r._maxUpError <= upTolerance;
+    }
+
+    // the cube face locator reports linear but projects in unitToModel; the
+    // grid must not take the separable path for it.
+    bool checkCubeFace( unsigned size )
+    {
+        bool ok = true;
+        std::vector< osg::ref_ptr<GeoLocator> > locators;
+        for( unsigned face = 0; face < 6; ++face )
+        {
+            CubeFaceLocator* locator = new CubeFaceLocator( face );
+            locator->setTransform( osg::Matrixd::scale(0.5, 0.5, 1.0) * osg::Matrixd::translate(0.25, 0.25, 0.0) );
+            locator->setCoordinateSystemType( osgTerrain::Locator::GEOCENTRIC );
+            locator->setEllipsoidModel( new osg::EllipsoidModel() );
+            locators.push_back( locator );
+        }
+
+        Result r;
+        run( locators, size, r );
+        report( "cube faces", r, locators.size() );
+
+        if ( r._fastTiles != 0 )
+        {
+            std::cout << "FAILED: a cube face locator took the separable path" << std::endl;
+            ok = false;
+        }
+        if ( r._maxPosError != 0.0 )
+        {
+            std::cout << "FAILED: cube face vertices differ from unitToModel" << std::endl;
+            ok = false;
+        }
+        return ok;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--tiles n] [--size n] [--lod n]\n"
+            << "    --tiles n : number of tiles per map type (default 4096)\n"
+            << "    --size n  : tile grid size (default 17)\n"
+            << "    --lod n   : level of detail of the tiles (default 8)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned numTiles = 4096, size = 17, lod = 8;
+    arguments.read( "--tiles", numTiles );
+    arguments.read( "--size",  size );
+    arguments.read( "--lod",   lod );
+    size = osg::maximum( size, 2u );
+
+    std::cout << std::setprecision(4);
+
+    bool ok = true;
+
+    // geocentric positions are ~6.4e6 m; allow a few ulps of that.
+    if ( !checkMap(MapOptions::CSTYPE_GEOCENTRIC, "", "geocentric", lod, numTiles, size, 1e-6, 1e-12) )
+    {
+        std::cout << "FAILED: geocentric grid differs from unitToModel" << std::endl;
+        ok = false;
+    }
+
+    if ( !checkMap(MapOptions::CSTYPE_PROJECTED, "spherical-mercator", "projected", lod, numTiles, size, 1e-6, 1e-12) )
+    {
+        std::cout << "FAILED: projected grid differs from unitToModel" << std::endl;
+        ok = false;
+    }
+
+    if ( !checkCubeFace(size) )
+        ok = false;
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless check and benchmark for TrackLayerNode.
+ *
+ * For layers of 10k, 50k and 100k tracks scattered over a region partly in
+ * view, times a setPositions() call that moves every track and a cull
+ * traversal by a CullVisitor with no viewer, and reports the icons the cull
+ * emits.
+ *
+ * Checks the padded frustum test with a 32x32 icon: a track whose anchor
+ * is 8 pixels outside the left edge of the view must be drawn (its icon
+ * reaches into the view), and one 40 pixels outside must not.
+ *
+ * Exits non-zero if a check fails.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/Camera>
+#include <osg/Geometry>
+#include <osgUtil/CullVisitor>
+#include <osgUtil/RenderStage>
+#include <osgUtil/StateGraph>
+#include <osgEarth/Map>
+#include <osgEarth/MapNode>
+#include <osgEarthAnnotation/TrackLayerNode>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstring>
+#include <vector>
+
+using namespace osgEarth;
+using namespace osgEarth::Annotation;
+
+namespace
+{
+    const double VIEW_LON = 0.0, VIEW_LAT = 45.0, VIEW_ALT = 2.0e6;
+
+    // a pseudo-random number in [0,1).
+    inline double random( unsigned& seed )
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return (double)(seed >> 8) / (double)(1u << 24);
+    }
+
+    osg::Image* makeIcon( unsigned size )
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage( size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+        memset( image->data(), 255, image->getTotalSizeInBytes() );
+        return image;
+    }
+
+    // a headless cull of one camera.
+    struct Culler
+    {
+        Culler( MapNode* mapNode, unsigned width, unsigned height )
+        {
+            _camera = new osg::Camera();
+            _camera->setViewport( 0, 0, width, height );
+            _camera->setProjectionMatrixAsPerspective( 30.0, (double)width/(double)height, 1000.0, 1.0e8 );
+
+            const SpatialReference* geoSRS = mapNode->getMapSRS()->getGeographicSRS();
+            osg::Vec3d eye, center;
+            GeoPoint( geoSRS, VIEW_LON, VIEW_LAT, VIEW_ALT, ALTMODE_ABSOLUTE ).toWorld( eye );
+            GeoPoint( geoSRS, VIEW_LON, VIEW_LAT, 0.0,      ALTMODE_ABSOLUTE ).toWorld( center );
+            _camera->setViewMatrixAsLookAt( eye, center, osg::Vec3d(0,0,1) );
+
+            _stateGraph  = new osgUtil::StateGraph();
+            _renderStage = new osgUtil::RenderStage();
+            _renderStage->setCamera( _camera.get() );
+            _renderStage->setViewport( _camera->getViewport() );
+
+            _cv = new osgUtil::CullVisitor();
+            _cv->setStateGraph( _stateGraph.get() );
+            _cv->setRenderStage( _renderStage.get() );
+        }
+
+        // culls the node and returns the number of icons emitted.
+        unsigned cull( osg::Node* node )
+        {
+            _cv->reset();
+            _stateGraph->clean();
+            _renderStage->reset();
+
+            _cv->pushViewport( _camera->getViewport() );
+            _cv->pushProjectionMatrix( new osg::RefMatrix(_camera->getProjectionMatrix()) );
+            _cv->pushModelViewMatrix( new osg::RefMatrix(_camera->getViewMatrix()), osg::Transform::ABSOLUTE_RF );
+            node->accept( *_cv );
+            _cv->popModelViewMatrix();
+            _cv->popProjectionMatrix();
+            _cv->popViewport();
+
+            return countIcons( _renderStage.get() );
+        }
+
+        unsigned countIcons( osgUtil::RenderBin* bin )
+        {
+            unsigned count = 0;
+            osgUtil::RenderBin::StateGraphList& graphs = bin->getStateGraphList();
+            for( osgUtil::RenderBin::StateGraphList::iterator g = graphs.begin(); g != graphs.end(); ++g )
+            {
+                for( osgUtil::StateGraph::LeafList::iterator l = (*g)->_leaves.begin(); l != (*g)->_leaves.end(); ++l )
+                {
+                    const osg::Geometry* geom = dynamic_cast<const osg::Geometry*>( (*l)->_drawable );
+                    if ( geom && geom->getNumPrimitiveSets() > 0 && geom->getPrimitiveSet(0)->getMode() == GL_QUADS )
+                        count += geom->getPrimitiveSet(0)->getNumIndices() / 4;
+                }
+            }
+            osgUtil::RenderBin::RenderBinList& bins = bin->getRenderBinList();
+            for( osgUtil::RenderBin::RenderBinList::iterator b = bins.begin(); b != bins.end(); ++b )
+                count += countIcons( b->second.get() );
+            return count;
+        }
+
+        // the point at "distance" from the eye under a window location.
+        osg::Vec3d unproject( double x, double y, double distance ) const
+        {
+            osg::Matrixd inv;
+            inv.invert( _camera->getViewMatrix() * _camera->getProjectionMatrix() * _camera->getViewport()->computeWindowMatrix() );
+            osg::Vec3d nearPoint = osg::Vec3d(x, y, 0.0) * inv;
+            osg::Vec3d farPoint  = osg::Vec3d(x, y, 1.0) * inv;
+
+            osg::Vec3d eye, center, up;
+            _camera->getViewMatrixAsLookAt( eye, center, up );
+            osg::Vec3d dir = farPoint - nearPoint;
+            dir.normalize();
+            return eye + dir * distance;
+        }
+
+        osg::ref_ptr<osg::Camera>           _camera;
+        osg::ref_ptr<osgUtil::StateGraph>   _stateGraph;
+        osg::ref_ptr<osgUtil::RenderStage>  _renderStage;
+        osg::ref_ptr<osgUtil::CullVisitor>  _cv;
+    };
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+
+    bool checkEdges( MapNode* mapNode, Culler& culler )
+    {
+        osg::ref_ptr<TrackLayerNode> layer = new TrackLayerNode( mapNode );
+        unsigned icon = layer->addIcon( makeIcon(32) );
+
+        const osg::Viewport* vp = culler._camera->getViewport();
+        const double distance = 0.5 * VIEW_ALT;
+        const double offsets[] = { -8.0, -40.0 };
+        const bool   drawn[]   = { true,  false };
+
+        bool ok = true;
+        for( unsigned i = 0; i < 2; ++i )
+        {
+            layer->clear();
+
+            GeoPoint p;
+            p.fromWorld( mapNode->getMapSRS(), culler.unproject(vp->x() + offsets[i], vp->y() + 0.5*vp->height(), distance) );
+            ok = check( layer->addTrack(p, icon) >= 0, "could not add an edge track" ) && ok;
+
+            unsigned icons = culler.cull( layer.get() );
+            std::ostringstream what;
+            what << "a 32-pixel icon anchored " << -offsets[i] << " pixels outside the view was " << (drawn[i] ? "culled" : "drawn");
+            ok = check( (icons == 1) == drawn[i], what.str() ) && ok;
+        }
+        return ok;
+    }
+
+    void bench( MapNode* mapNode, Culler& culler, unsigned count, unsigned passes )
+    {
+        osg::ref_ptr<TrackLayerNode> layer = new TrackLayerNode( mapNode );
+        unsigned icon = layer->addIcon( makeIcon(32) );
+
+        const SpatialReference* srs = mapNode->getMapSRS();
+        std::vector<TrackLayerNode::TrackUpdate> updates( count );
+        unsigned seed = 12345u;
+        for( unsigned i = 0; i < count; ++i )
+        {
+            double lon = VIEW_LON - 30.0 + 60.0*random(seed);
+            double lat = VIEW_LAT - 25.0 + 50.0*random(seed);
+            updates[i]._id = layer->addTrack( GeoPoint(srs, lon, lat, 1000.0, ALTMODE_ABSOLUTE), icon );
+            updates[i]._position.set( lon, lat, 1000.0 );
+        }
+
+        double updateMs = 0.0, cullMs = 0.0;
+        unsigned icons = 0;
+        for( unsigned p = 0; p < passes; ++p )
+        {
+            for( unsigned i = 0; i < count; ++i )
+            {
+                updates[i]._position.x() += 0.001;
+                updates[i]._heading = 360.0*random(seed);
+            }
+
+            osg::Timer_t t = osg::Timer::instance()->tick();
+            layer->setPositions( updates );
+            updateMs += osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+            t = osg::Timer::instance()->tick();
+            icons = culler.cull( layer.get() );
+            cullMs += osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+        }
+
+        std::cout
+            << "    " << std::setw(6) << count << " tracks: "
+            << "update " << std::setw(8) << updateMs/passes << " ms ("
+            << std::setw(8) << count*passes/(1000.0*updateMs) << " M tracks/s), "
+            << "cull " << std::setw(8) << cullMs/passes << " ms, "
+            << icons << " icons drawn\n";
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--passes n]\n"
+            << "    --passes n : updates and culls timed per layer (default 20)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned passes = 20;
+    arguments.read( "--passes", passes );
+    passes = osg::maximum( passes, 1u );
+
+    osg::ref_ptr<MapNode> mapNode = new MapNode( new Map() );
+    Culler culler( mapNode.get(), 1920, 1080 );
+
+    std::cout << std::setprecision(4);
+
+    bool ok = checkEdges( mapNode.get(), culler );
+
+    const unsigned counts[] = { 10000, 50000, 100000 };
+    for( unsigned i = 0; i < sizeof(counts)/sizeof(counts[0]); ++i )
+        bench( mapNode.get(), culler, counts[i], passes );
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
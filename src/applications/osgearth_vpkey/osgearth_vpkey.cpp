@@ -0,0 +1,267 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/**
+ * Headless check and benchmark for the VirtualProgram program keys.
+ *
+ * Checks that VirtualProgram::getProgramKeySeed and extendProgramKey compute
+ * 64-bit FNV-1a over the stamp bytes, that keys depend on stamp order, that
+ * no two stamp stacks in a large sample share a key, and that a VP gets a
+ * new data stamp whenever its contents change.
+ *
+ * Then times a program lookup by stamp key (building the key and finding it
+ * in a std::map) against a lookup in a program cache keyed by the vector of
+ * accumulated shaders, for stacks of several depths. The latter leaves out
+ * the shader accumulation that has to come before it, so it understates
+ * what a lookup cost before the stamp keys.
+ *
+ * Exits non-zero if a check fails.
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/Shader>
+#include <osgEarth/VirtualProgram>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    typedef VirtualProgram::ProgramKey ProgramKey;
+
+    // keeps the timed lookups from being optimized away.
+    volatile unsigned s_sink = 0;
+
+    // FNV-1a, written out independently of VirtualProgram.
+    ProgramKey referenceKey( const std::vector<unsigned>& stamps )
+    {
+        ProgramKey key = 14695981039346656037ULL;
+        for( unsigned i = 0; i < stamps.size(); ++i )
+        {
+            unsigned char bytes[4] = {
+                (unsigned char)(stamps[i]),       (unsigned char)(stamps[i] >> 8),
+                (unsigned char)(stamps[i] >> 16), (unsigned char)(stamps[i] >> 24) };
+            for( unsigned b = 0; b < 4; ++b )
+            {
+                key ^= bytes[b];
+                key *= 1099511628211ULL;
+            }
+        }
+        return key;
+    }
+
+    ProgramKey makeKey( const std::vector<unsigned>& stamps )
+    {
+        ProgramKey key = VirtualProgram::getProgramKeySeed();
+        for( unsigned i = 0; i < stamps.size(); ++i )
+            key = VirtualProgram::extendProgramKey( key, stamps[i] );
+        return key;
+    }
+
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+            std::cout << "FAILED: " << what << std::endl;
+        return ok;
+    }
+
+    bool checkKeys( unsigned sample )
+    {
+        bool ok = true;
+
+        ok = check( VirtualProgram::getProgramKeySeed() == referenceKey(std::vector<unsigned>()), "the seed is not the FNV-1a offset basis" ) && ok;
+
+        // against the reference, over stamps with every byte in play:
+        std::vector<unsigned> stamps;
+        unsigned seed = 12345u, mismatches = 0;
+        for( unsigned i = 0; i < sample; ++i )
+        {
+            seed = seed * 1664525u + 1013904223u;
+            stamps.push_back( seed );
+            if ( stamps.size() > 8 )
+                stamps.erase( stamps.begin() );
+            if ( makeKey(stamps) != referenceKey(stamps) )
+                ++mismatches;
+        }
+        ok = check( mismatches == 0, "extendProgramKey does not match FNV-1a" ) && ok;
+
+        // order matters:
+        {
+            std::vector<unsigned> ab, ba;
+            ab.push_back( 7 ); ab.push_back( 11 );
+            ba.push_back( 11 ); ba.push_back( 7 );
+            ok = check( makeKey(ab) != makeKey(ba), "keys ignore stamp order" ) && ok;
+        }
+
+        // no collisions among stacks of 1-3 small stamps, the common case:
+        {
+            std::set<ProgramKey> keys;
+            unsigned count = 0, range = 1;
+            while( range*range*range < sample ) ++range;
+
+            std::vector<unsigned> s(1);
+            for( unsigned a = 1; a <= range*range; ++a, ++count )
+            {
+                s[0] = a;
+                keys.insert( makeKey(s) );
+            }
+            s.resize(2);
+            for( unsigned a = 1; a <= range*4; ++a )
+                for( unsigned b = 1; b <= range*4; ++b, ++count )
+                {
+                    s[0] = a; s[1] = b;
+                    keys.insert( makeKey(s) );
+                }
+            s.resize(3);
+            for( unsigned a = 1; a <= range; ++a )
+                for( unsigned b = 1; b <= range; ++b )
+                    for( unsigned c = 1; c <= range; ++c, ++count )
+                    {
+                        s[0] = a; s[1] = b; s[2] = c;
+                        keys.insert( makeKey(s) );
+                    }
+
+            std::cout << "    " << count << " stamp stacks, " << count - keys.size() << " key collisions\n";
+            ok = check( keys.size() == count, "stamp stacks share a key" ) && ok;
+        }
+
+        return ok;
+    }
+
+    bool checkStamps()
+    {
+        bool ok = true;
+        osg::ref_ptr<VirtualProgram> a = new VirtualProgram();
+        osg::ref_ptr<VirtualProgram> b = new VirtualProgram();
+        ok = check( a->getDataStamp() != b->getDataStamp(), "two VPs share a data stamp" ) && ok;
+
+        unsigned stamp = a->getDataStamp();
+        a->setFunction( "f", "void f(inout vec4 c) { }", ShaderComp::LOCATION_FRAGMENT_COLORING );
+        ok = check( a->getDataStamp() != stamp, "setFunction kept the data stamp" ) && ok;
+
+        stamp = a->getDataStamp();
+        a->setInheritShaders( false );
+        ok = check( a->getDataStamp() != stamp, "setInheritShaders kept the data stamp" ) && ok;
+
+        stamp = a->getDataStamp();
+        a->addBindAttribLocation( "attr", 6 );
+        ok = check( a->getDataStamp() != stamp, "addBindAttribLocation kept the data stamp" ) && ok;
+
+        stamp = a->getDataStamp();
+        osg::ref_ptr<VirtualProgram> c = new VirtualProgram( *a.get() );
+        ok = check( c->getDataStamp() != stamp && a->getDataStamp() == stamp, "a copied VP shares its original's data stamp" ) && ok;
+
+        return ok;
+    }
+
+    // times "lookups" lookups of each of "programs" programs, for stacks of "depth" VPs.
+    void bench( unsigned depth, unsigned programs, unsigned lookups )
+    {
+        // stamp-keyed lookup, as in VirtualProgram::apply:
+        std::vector< std::vector<unsigned> > stacks( programs );
+        std::map<ProgramKey, unsigned>       byKey;
+        for( unsigned p = 0; p < programs; ++p )
+        {
+            for( unsigned d = 0; d < depth; ++d )
+                stacks[p].push_back( 1000u + p*depth + d );
+            byKey[ makeKey(stacks[p]) ] = p;
+        }
+
+        // shader-keyed lookup, as in the program cache (two shaders per VP):
+        typedef std::vector< osg::ref_ptr<osg::Shader> > ShaderVector;
+        std::vector<ShaderVector>        shaders( programs );
+        std::map<ShaderVector, unsigned> byShaders;
+        for( unsigned p = 0; p < programs; ++p )
+        {
+            for( unsigned d = 0; d < 2*depth; ++d )
+                shaders[p].push_back( new osg::Shader(d % 2 ? osg::Shader::FRAGMENT : osg::Shader::VERTEX) );
+            byShaders[ shaders[p] ] = p;
+        }
+
+        unsigned sum = 0;
+        osg::Timer_t t = osg::Timer::instance()->tick();
+        for( unsigned i = 0; i < lookups; ++i )
+        {
+            const std::vector<unsigned>& s = stacks[i % programs];
+            ProgramKey key = VirtualProgram::getProgramKeySeed();
+            for( unsigned d = 0; d < s.size(); ++d )
+                key = VirtualProgram::extendProgramKey( key, s[d] );
+            sum += byKey.find( key )->second;
+        }
+        double keyMs = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+        t = osg::Timer::instance()->tick();
+        for( unsigned i = 0; i < lookups; ++i )
+        {
+            sum += byShaders.find( shaders[i % programs] )->second;
+        }
+        double shaderMs = osg::Timer::instance()->delta_m( t, osg::Timer::instance()->tick() );
+
+        std::cout
+            << "    depth " << std::setw(2) << depth << ": "
+            << "stamp key " << std::setw(8) << lookups/(1000.0*keyMs)    << " M lookups/s, "
+            << "shader vector " << std::setw(8) << lookups/(1000.0*shaderMs) << " M lookups/s\n";
+
+        s_sink = sum;
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    if ( arguments.read("-h") || arguments.read("--help") )
+    {
+        std::cout
+            << arguments.getApplicationName() << " [--sample n] [--programs n] [--lookups n]\n"
+            << "    --sample n   : stamp stacks to check (default 200000)\n"
+            << "    --programs n : programs in each lookup table (default 32)\n"
+            << "    --lookups n  : lookups timed per stack depth (default 2000000)\n"
+            << std::endl;
+        return 0;
+    }
+
+    unsigned sample = 200000, programs = 32, lookups = 2000000;
+    arguments.read( "--sample",   sample );
+    arguments.read( "--programs", programs );
+    arguments.read( "--lookups",  lookups );
+    sample   = osg::maximum( sample,   8u );
+    programs = osg::maximum( programs, 1u );
+    lookups  = osg::maximum( lookups,  1u );
+
+    std::cout << std::setprecision(4);
+
+    bool ok = true;
+    ok = checkKeys( sample ) && ok;
+    ok = checkStamps() && ok;
+
+    const unsigned depths[] = { 1, 2, 4, 8 };
+    for( unsigned i = 0; i < sizeof(depths)/sizeof(depths[0]); ++i )
+        bench( depths[i], programs, lookups );
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -21,6 +21,9 @@
 #include <osgEarth/VirtualProgram>
 #include <osgEarth/DPLineSegmentIntersector>
 #include <osgEarth/GeoData>
+#include <osgEarth/OcclusionCullingService>
+#include <osgEarth/TerrainEngineNode>
+#include <osgEarth/ThreadingUtils>
 #include <osg/ClusterCullingCallback>
 #include <osg/PrimitiveSet>
 #include <osg/Geode>
@@ -34,6 +37,9 @@ using namespace osgEarth;
 
 namespace
 {
+    // guards the frame budget of the fallback OcclusionCullingCallback path
+    Threading::Mutex budgetMutex;
+
     struct ComputeMaxNormalLength
     {
         void set( const osg::Vec3& normalECEF, const osg::Matrixd& local2world, float* maxNormalLen )
@@ -609,9 +615,22 @@ _srs        ( srs ),
 _world      ( world ),
 _node       ( node ),
 _visible    ( true ),
-_maxAltitude( 200000 )
+_maxAltitude( 200000 ),
+_serviceID  ( 0 )
 {
-    //nop
+    // a terrain engine can test us in a batch with everyone else:
+    TerrainEngineNode* engine = dynamic_cast<TerrainEngineNode*>( node );
+    if ( engine && engine->getTerrain() )
+    {
+        _service   = engine->getTerrain()->getOcclusionCullingService();
+        _serviceID = _service->allocateID();
+    }
+}
+
+OcclusionCullingCallback::~OcclusionCullingCallback()
+{
+    if ( _service.valid() )
+        _service->releaseID( _serviceID );
 }
 
 double OcclusionCullingCallback::getMaxFrameTime()
@@ -650,28 +669,44 @@ void OcclusionCullingCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
     {        
         osgUtil::CullVisitor* cv = Culling::asCullVisitor(nv);
 
+        if ( _service.valid() )
+        {
+            if ( _service->isVisible(cv, _serviceID, _world, _maxAltitude) )
+            {
+                traverse( node, nv );
+            }
+            return;
+        }
+
+        // fallback: intersect the scene graph directly, within a time budget
+        // shared by all callbacks (and cameras) in a frame.
         static int frameNumber = -1;
         static double remainingTime = OcclusionCullingCallback::_maxFrameTime;
         static int numCompleted = 0;
         static int numSkipped = 0;
 
-        if (nv->getFrameStamp()->getFrameNumber() != frameNumber)
+        bool withinBudget;
         {
-            if (numCompleted > 0 || numSkipped > 0)
+            Threading::ScopedMutexLock lock( budgetMutex );
+            if (nv->getFrameStamp()->getFrameNumber() != frameNumber)
             {
-                OE_DEBUG << "OcclusionCullingCallback frame=" << frameNumber << " completed=" << numCompleted << " skipped=" << numSkipped << std::endl;
+                if (numCompleted > 0 || numSkipped > 0)
+                {
+                    OE_DEBUG << "OcclusionCullingCallback frame=" << frameNumber << " completed=" << numCompleted << " skipped=" << numSkipped << std::endl;
+                }
+                frameNumber = nv->getFrameStamp()->getFrameNumber();
+                numCompleted = 0;
+                numSkipped = 0;
+                remainingTime = OcclusionCullingCallback::_maxFrameTime;
             }
-            frameNumber = nv->getFrameStamp()->getFrameNumber();
-            numCompleted = 0;
-            numSkipped = 0;
-            remainingTime = OcclusionCullingCallback::_maxFrameTime;
+            withinBudget = remainingTime > 0.0;
         }
 
         osg::Vec3d eye = cv->getViewPoint();
 
         if (_prevEye != eye || _prevWorld != _world)
         {
-            if (remainingTime > 0.0)
+            if (withinBudget)
             {
                 double alt = 0.0;
 
@@ -703,6 +738,7 @@ void OcclusionCullingCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
                     _visible = results.empty();
                     osg::Timer_t endTick = osg::Timer::instance()->tick();
                     double elapsed = osg::Timer::instance()->delta_m( startTick, endTick );
+                    Threading::ScopedMutexLock lock( budgetMutex );
                     remainingTime -= elapsed;
                 }
                 else
@@ -710,14 +746,20 @@ void OcclusionCullingCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
                     _visible = true;
                 }
 
-                numCompleted++;
+                {
+                    Threading::ScopedMutexLock lock( budgetMutex );
+                    numCompleted++;
+                }
 
                 _prevEye = eye;
                 _prevWorld = _world;
             }
             else
             {
-                numSkipped++;
+                {
+                    Threading::ScopedMutexLock lock( budgetMutex );
+                    numSkipped++;
+                }
                 // if we skipped some we need to request a redraw so the remianing ones get processed on the next frame.
                 if ( cv->getCurrentCamera() && cv->getCurrentCamera()->getView() )
                 {
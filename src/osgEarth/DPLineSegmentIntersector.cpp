@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarth/DPLineSegmentIntersector>
+#include <osgEarth/TriangleBVH>
 #include <osg/KdTree>
 #include <osg/TriangleFunctor>
 
@@ -264,6 +265,54 @@ DPLineSegmentIntersector::intersect(osgUtil::IntersectionVisitor& iv, osg::Drawa
     if (iv.getDoDummyTraversal()) return;
 
     osg::KdTree* kdTree = iv.getUseKdTreeWhenAvailable() ? dynamic_cast<osg::KdTree*>(drawable->getShape()) : 0;
+
+    // otherwise use the drawable's triangle hierarchy if it has one (e.g. a
+    // terrain tile). This is the call that builds it, so skip it when a
+    // KdTree will answer anyway.
+    const TriangleBVH* bvh = kdTree ? 0L : TriangleBVH::get(drawable);
+    if (bvh)
+    {
+        TriangleBVH::HitList hits;
+        bool nearestOnly = (_intersectionLimit != NO_LIMIT);
+        if (bvh->intersect(s, e, hits, nearestOnly))
+        {
+            for(TriangleBVH::HitList::const_iterator h = hits.begin(); h != hits.end(); ++h)
+            {
+                // remap ratio into _start, _end range
+                double remap_ratio = ((s-_start).length() + h->_ratio * (e-s).length() )/(_end-_start).length();
+
+                if ( _intersectionLimit == LIMIT_NEAREST && !getIntersections().empty() )
+                {
+                    if (remap_ratio >= getIntersections().begin()->ratio )
+                        break;
+                    else
+                        getIntersections().clear();
+                }
+
+                Intersection hit;
+                hit.ratio = remap_ratio;
+                hit.matrix = iv.getModelMatrix();
+                hit.nodePath = iv.getNodePath();
+                hit.drawable = drawable;
+                hit.primitiveIndex = h->_primitiveIndex;
+
+                hit.localIntersectionPoint = _start*(1.0-remap_ratio) + _end*remap_ratio;
+                hit.localIntersectionNormal = h->_normal;
+
+                hit.indexList.reserve(3);
+                hit.ratioList.reserve(3);
+                for(unsigned k=0; k<3; ++k)
+                {
+                    hit.indexList.push_back(h->_index[k]);
+                    hit.ratioList.push_back(h->_weight[k]);
+                }
+
+                insertIntersection(hit);
+            }
+        }
+        return;
+    }
+
     if (kdTree)
     {
         osg::KdTree::LineSegmentIntersections intersections;
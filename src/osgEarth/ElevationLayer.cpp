@@ -299,7 +299,7 @@ ElevationLayer::assembleHeightFieldFromTileSource(const TileKey&    key,
                 else
                 { 
                     // We couldn't get a heightfield at the given key so fall back on parent tiles
-                    TileKey parentKey = layerKey.createParentKey();
+                    TileKey parentKey = getBestAvailableTileKey( layerKey.createParentKey() );
                     while (!hf && parentKey.valid())
                     {
                         // Make sure we haven't already added this heightfield to the list.
@@ -315,7 +315,9 @@ ElevationLayer::assembleHeightFieldFromTileSource(const TileKey&    key,
                                 existingTiles.insert(parentKey.getTileId());
                                 break;
                             }                        
-                            parentKey = parentKey.createParentKey();
+                            if ( !progress || !progress->isCanceled() )
+                                recordMiss( parentKey );
+                            parentKey = getBestAvailableTileKey( parentKey.createParentKey() );
                         }                        
                         else
                         {                            
@@ -460,6 +462,12 @@ ElevationLayer::createHeightField(const TileKey&    key,
             OE_WARN << LC << "Driver " << getTileSource()->getName() << " returned an illegal heightfield" << std::endl;
             result = 0L;
         }
+
+        // remember the miss so fallback searches can skip this key.
+        if ( !result.valid() && (!progress || !progress->isCanceled()) )
+        {
+            recordMiss( key );
+        }
     }
 
     // cache if necessary
@@ -577,7 +585,12 @@ ElevationLayerVector::createHeightField(const TileKey&                  key,
         if ( layer->getEnabled() && layer->getVisible() )
         {
             GeoHeightField geoHF;
-            if ( layer->isKeyValid(keyToUse) )
+
+            // find the best key that might actually have data, so we don't
+            // waste requests on LODs or areas the layer doesn't cover.
+            TileKey bestKey = layer->getBestAvailableTileKey( keyToUse );
+
+            if ( bestKey == keyToUse && layer->isKeyValid(keyToUse) )
             {
                 geoHF = layer->createHeightField( keyToUse, progress );
             }
@@ -585,13 +598,15 @@ ElevationLayerVector::createHeightField(const TileKey&                  key,
             // if "fallback" is set, try to fall back on lower LODs.
             if ( !geoHF.valid() && fallback )
             {
-                TileKey hf_key = keyToUse.createParentKey();
+                TileKey hf_key = 
+                    bestKey.valid() && bestKey != keyToUse ? bestKey :
+                    layer->getBestAvailableTileKey( keyToUse.createParentKey() );
 
                 while ( hf_key.valid() && !geoHF.valid() )
                 {
                     geoHF = layer->createHeightField( hf_key, progress );
                     if ( !geoHF.valid() )
-                        hf_key = hf_key.createParentKey();
+                        hf_key = layer->getBestAvailableTileKey( hf_key.createParentKey() );
                 }
 
                 if ( geoHF.valid() )
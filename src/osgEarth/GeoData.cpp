@@ -25,6 +25,8 @@
 #include <osgEarth/Cube>
 #include <osgEarth/VerticalDatum>
 #include <osgEarth/Terrain>
+#include <osgEarth/TaskService>
+#include <OpenThreads/Thread>
 
 #include <osg/Notify>
 #include <osg/Timer>
@@ -1508,91 +1510,66 @@ namespace
     }    
 
 
-    osg::Image*
-    manualReproject(
-        const osg::Image* image, 
-        const GeoExtent&  src_extent, 
-        const GeoExtent&  dest_extent,
-        unsigned int      width = 0, 
-        unsigned int      height = 0)
-    {
-        //TODO:  Compute the optimal destination size
-        if (width == 0 || height == 0)
-        {
-            //If no width and height are specified, just use the minimum dimension for the image
-            width = osg::minimum(image->s(), image->t());
-            height = osg::minimum(image->s(), image->t());
-        }
+    // Spacing (in destination pixels) of the grid of exactly transformed
+    // points that manualReproject interpolates between.
+    const unsigned REPROJECT_GRID_SPACING = 16;
 
-        // need to know this in order to choose the right interpolation algorithm
-        const bool isSrcContiguous = src_extent.getSRS()->isContiguous();
+    // Largest interpolation error (in source pixels) accepted in a grid cell;
+    // cells that exceed it are transformed pixel by pixel.
+    const double REPROJECT_MAX_ERROR = 0.125;
 
-        osg::Image *result = new osg::Image();
-        //result->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
-        result->allocateImage(width, height, 1, image->getPixelFormat(), GL_UNSIGNED_BYTE);
-
-        //Initialize the image to be completely transparent/black
-        memset(result->data(), 0, result->getImageSizeInBytes());
+    // Smaller images are sampled entirely on the calling thread.
+    const unsigned REPROJECT_MIN_PARALLEL_PIXELS = 65536;
 
-        //ImageUtils::PixelReader ra(result);
-        ImageUtils::PixelWriter writer(result);
-        const double dx = dest_extent.width() / (double)width;
-        const double dy = dest_extent.height() / (double)height;
-
-        // offset the sample points by 1/2 a pixel so we are sampling "pixel center".
-        // (This is especially useful in the UnifiedCubeProfile since it nullifes the chances for
-        // edge ambiguity.)
+    /**
+     * Samples the source image for a band of destination rows [_rowStart, _rowEnd)
+     * for manualReproject. Bands write to disjoint rows of the result, so they
+     * can run concurrently.
+     */
+    struct ReprojectRows
+    {
+        const osg::Image* _image;
+        osg::Image*       _result;
+        const GeoExtent*  _src_extent;
+        const double*     _srcPointsX;
+        const double*     _srcPointsY;
+        unsigned          _width, _height;
+        unsigned          _rowStart, _rowEnd;
 
-        unsigned int numPixels = width * height;
+        void execute()
+        {
+            const osg::Image* image      = _image;
+            const GeoExtent&  src_extent = *_src_extent;
 
-        // Start by creating a sample grid over the destination
-        // extent. These will be the source coordinates. Then, reproject
-        // the sample grid into the source coordinate system.
-        double *srcPointsX = new double[numPixels * 2];
-        double *srcPointsY = srcPointsX + numPixels;
-        dest_extent.getSRS()->transformExtentPoints(
-            src_extent.getSRS(),
-            dest_extent.xMin() + .5 * dx, dest_extent.yMin() + .5 * dy,
-            dest_extent.xMax() - .5 * dx, dest_extent.yMax() - .5 * dy,
-            srcPointsX, srcPointsY, width, height);
+            ImageUtils::PixelReader ia(image);
+            ImageUtils::PixelWriter writer(_result);
 
-        // Next, go through the source-SRS sample grid, read the color at each point from the source image,
-        // and write it to the corresponding pixel in the destination image.
-        int pixel = 0;
-        ImageUtils::PixelReader ia(image);
-        double xfac = (image->s() - 1) / src_extent.width();
-        double yfac = (image->t() - 1) / src_extent.height();
-        for (unsigned int c = 0; c < width; ++c)
-        {
-            for (unsigned int r = 0; r < height; ++r)
-            {   
-                double src_x = srcPointsX[pixel];
-                double src_y = srcPointsY[pixel];
+            double xfac = (image->s() - 1) / src_extent.width();
+            double yfac = (image->t() - 1) / src_extent.height();
 
-                if ( src_x < src_extent.xMin() || src_x > src_extent.xMax() || src_y < src_extent.yMin() || src_y > src_extent.yMax() )
+            for (unsigned int c = 0; c < _width; ++c)
+            {
+                for (unsigned int r = _rowStart; r < _rowEnd; ++r)
                 {
-                    //If the sample point is outside of the bound of the source extent, increment the pixel and keep looping through.
-                    //OE_WARN << LC << "ERROR: sample point out of bounds: " << src_x << ", " << src_y << std::endl;
-                    pixel++;
-                    continue;
-                }
+                    unsigned int pixel = c * _height + r;
+                    double src_x = _srcPointsX[pixel];
+                    double src_y = _srcPointsY[pixel];
 
-                float px = (src_x - src_extent.xMin()) * xfac;
-                float py = (src_y - src_extent.yMin()) * yfac;
+                    if ( src_x < src_extent.xMin() || src_x > src_extent.xMax() || src_y < src_extent.yMin() || src_y > src_extent.yMax() )
+                    {
+                        //If the sample point is outside of the bound of the source extent, leave the pixel transparent.
+                        continue;
+                    }
 
-                int px_i = osg::clampBetween( (int)osg::round(px), 0, image->s()-1 );
-                int py_i = osg::clampBetween( (int)osg::round(py), 0, image->t()-1 );
+                    float px = (src_x - src_extent.xMin()) * xfac;
+                    float py = (src_y - src_extent.yMin()) * yfac;
 
-                osg::Vec4 color(0,0,0,0);
+                    int px_i = osg::clampBetween( (int)osg::round(px), 0, image->s()-1 );
+                    int py_i = osg::clampBetween( (int)osg::round(py), 0, image->t()-1 );
 
-                // TODO: consider this again later. Causes blockiness.
-                if ( false ) //! isSrcContiguous ) // non-contiguous space- use nearest neighbot
-                {
-                    color = ia(px_i, py_i);
-                }
+                    osg::Vec4 color(0,0,0,0);
 
-                else // contiguous space - use bilinear sampling
-                {
+                    // bilinear sampling
                     int rowMin = osg::maximum((int)floor(py), 0);
                     int rowMax = osg::maximum(osg::minimum((int)ceil(py), (int)(image->t()-1)), 0);
                     int colMin = osg::maximum((int)floor(px), 0);
@@ -1606,44 +1583,13 @@ namespace
                     osg::Vec4 ulColor = ia(colMin, rowMax);
                     osg::Vec4 lrColor = ia(colMax, rowMin);
 
-                    /*Average Interpolation*/
-                    /*double x_rem = px - (int)px;
-                    double y_rem = py - (int)py;
-
-                    double w00 = (1.0 - y_rem) * (1.0 - x_rem);
-                    double w01 = (1.0 - y_rem) * x_rem;
-                    double w10 = y_rem * (1.0 - x_rem);
-                    double w11 = y_rem * x_rem;
-                    double wsum = w00 + w01 + w10 + w11;
-                    wsum = 1.0/wsum;
-
-                    color.r() = (w00 * llColor.r() + w01 * lrColor.r() + w10 * ulColor.r() + w11 * urColor.r()) * wsum;
-                    color.g() = (w00 * llColor.g() + w01 * lrColor.g() + w10 * ulColor.g() + w11 * urColor.g()) * wsum;
-                    color.b() = (w00 * llColor.b() + w01 * lrColor.b() + w10 * ulColor.b() + w11 * urColor.b()) * wsum;
-                    color.a() = (w00 * llColor.a() + w01 * lrColor.a() + w10 * ulColor.a() + w11 * urColor.a()) * wsum;*/
-
-                    /*Nearest Neighbor Interpolation*/
-                    /*if (px_i >= 0 && px_i < image->s() &&
-                    py_i >= 0 && py_i < image->t())
-                    {
-                    //OE_NOTICE << "[osgEarth::GeoData] Sampling pixel " << px << "," << py << std::endl;
-                    color = ImageUtils::getColor(image, px_i, py_i);
-                    }
-                    else
-                    {
-                    OE_NOTICE << "[osgEarth::GeoData] Pixel out of range " << px_i << "," << py_i << "  image is " << image->s() << "x" << image->t() << std::endl;
-                    }*/
-
-                    /*Bilinear interpolation*/
                     //Check for exact value
                     if ((colMax == colMin) && (rowMax == rowMin))
                     {
-                        //OE_NOTICE << "[osgEarth::GeoData] Exact value" << std::endl;
                         color = ia(px_i, py_i);
                     }
                     else if (colMax == colMin)
                     {
-                        //OE_NOTICE << "[osgEarth::GeoData] Vertically" << std::endl;
                         //Linear interpolate vertically
                         for (unsigned int i = 0; i < 4; ++i)
                         {
@@ -1652,7 +1598,6 @@ namespace
                     }
                     else if (rowMax == rowMin)
                     {
-                        //OE_NOTICE << "[osgEarth::GeoData] Horizontally" << std::endl;
                         //Linear interpolate horizontally
                         for (unsigned int i = 0; i < 4; ++i)
                         {
@@ -1661,7 +1606,6 @@ namespace
                     }
                     else
                     {
-                        //OE_NOTICE << "[osgEarth::GeoData] Bilinear" << std::endl;
                         //Bilinear interpolate
                         float col1 = colMax - px, col2 = px - colMin;
                         float row1 = rowMax - py, row2 = py - rowMin;
@@ -1669,16 +1613,124 @@ namespace
                         {
                             float r1 = col1 * llColor[i] + col2 * lrColor[i];
                             float r2 = col1 * ulColor[i] + col2 * urColor[i];
-
-                            //OE_INFO << "r1, r2 = " << r1 << " , " << r2 << std::endl;
                             color[i] = row1 * r1 + row2 * r2;
                         }
                     }
+
+                    writer(color, c, r);
                 }
+            }
+        }
+    };
 
-                writer(color, c, r);
-                pixel++;
+    // Thread pool shared by all manual reprojections.
+    Threading::Mutex            s_reprojectServiceMutex;
+    osg::ref_ptr<TaskService>   s_reprojectService;
+
+    TaskService* getReprojectService()
+    {
+        Threading::ScopedMutexLock lock( s_reprojectServiceMutex );
+        if ( !s_reprojectService.valid() )
+        {
+            s_reprojectService = new TaskService(
+                "GeoImage reprojection",
+                osg::maximum(OpenThreads::GetNumberOfProcessors(), 1) );
+        }
+        return s_reprojectService.get();
+    }
+
+    osg::Image*
+    manualReproject(
+        const osg::Image* image, 
+        const GeoExtent&  src_extent, 
+        const GeoExtent&  dest_extent,
+        unsigned int      width = 0, 
+        unsigned int      height = 0)
+    {
+        //TODO:  Compute the optimal destination size
+        if (width == 0 || height == 0)
+        {
+            //If no width and height are specified, just use the minimum dimension for the image
+            width = osg::minimum(image->s(), image->t());
+            height = osg::minimum(image->s(), image->t());
+        }
+
+        osg::Image *result = new osg::Image();
+        //result->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        result->allocateImage(width, height, 1, image->getPixelFormat(), GL_UNSIGNED_BYTE);
+
+        //Initialize the image to be completely transparent/black
+        memset(result->data(), 0, result->getImageSizeInBytes());
+
+        const double dx = dest_extent.width() / (double)width;
+        const double dy = dest_extent.height() / (double)height;
+
+        // offset the sample points by 1/2 a pixel so we are sampling "pixel center".
+        // (This is especially useful in the UnifiedCubeProfile since it nullifes the chances for
+        // edge ambiguity.)
+
+        unsigned int numPixels = width * height;
+
+        // Start by creating a sample grid over the destination
+        // extent. These will be the source coordinates. Then, reproject
+        // the sample grid into the source coordinate system, interpolating
+        // where that stays within a fraction of a source pixel.
+        double *srcPointsX = new double[numPixels * 2];
+        double *srcPointsY = srcPointsX + numPixels;
+
+        double tolerance_x = REPROJECT_MAX_ERROR * src_extent.width() / (double)image->s();
+        double tolerance_y = REPROJECT_MAX_ERROR * src_extent.height() / (double)image->t();
+
+        dest_extent.getSRS()->transformExtentPointsOnGrid(
+            src_extent.getSRS(),
+            dest_extent.xMin() + .5 * dx, dest_extent.yMin() + .5 * dy,
+            dest_extent.xMax() - .5 * dx, dest_extent.yMax() - .5 * dy,
+            srcPointsX, srcPointsY, width, height,
+            tolerance_x, tolerance_y, REPROJECT_GRID_SPACING);
+
+        // Next, go through the source-SRS sample grid, read the color at each point from the source image,
+        // and write it to the corresponding pixel in the destination image. Large images are split
+        // into bands of rows; the calling thread samples the first band itself.
+        unsigned numBands = 1;
+        if ( numPixels >= REPROJECT_MIN_PARALLEL_PIXELS )
+        {
+            TaskService* service = getReprojectService();
+            numBands = osg::minimum( (unsigned)service->getNumThreads() + 1, height );
+        }
+
+        std::vector<ReprojectRows> bands( numBands );
+        for( unsigned b = 0; b < numBands; ++b )
+        {
+            ReprojectRows& band = bands[b];
+            band._image      = image;
+            band._result     = result;
+            band._src_extent = &src_extent;
+            band._srcPointsX = srcPointsX;
+            band._srcPointsY = srcPointsY;
+            band._width      = width;
+            band._height     = height;
+            band._rowStart   = (height * b) / numBands;
+            band._rowEnd     = (height * (b+1)) / numBands;
+        }
+
+        if ( numBands > 1 )
+        {
+            Threading::MultiEvent semaphore( numBands-1 );
+            TaskService* service = getReprojectService();
+
+            for( unsigned b = 1; b < numBands; ++b )
+            {
+                ParallelTask<ReprojectRows>* task = new ParallelTask<ReprojectRows>( &semaphore );
+                static_cast<ReprojectRows&>(*task) = bands[b];
+                service->add( task );
             }
+
+            bands[0].execute();
+            semaphore.wait();
+        }
+        else
+        {
+            bands[0].execute();
         }
 
         delete[] srcPointsX;
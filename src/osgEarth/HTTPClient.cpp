@@ -20,6 +20,7 @@
 #include <osgEarth/Registry>
 #include <osgEarth/Version>
 #include <osgEarth/Progress>
+#include <osgEarth/StringUtils>
 #include <osgDB/ReadFile>
 #include <osgDB/Registry>
 #include <osgDB/FileNameUtils>
@@ -212,7 +213,8 @@ HTTPRequest::getURL() const
 
 HTTPResponse::HTTPResponse( long _code )
 : _response_code( _code ),
-  _cancelled(false)
+  _cancelled(false),
+  _lastModified(0)
 {
     _parts.reserve(1);
 }
@@ -221,7 +223,8 @@ HTTPResponse::HTTPResponse( const HTTPResponse& rhs ) :
 _response_code( rhs._response_code ),
 _parts( rhs._parts ),
 _mimeType( rhs._mimeType ),
-_cancelled( rhs._cancelled )
+_cancelled( rhs._cancelled ),
+_lastModified( rhs._lastModified )
 {
     //nop
 }
@@ -273,6 +276,11 @@ HTTPResponse::getMimeType() const {
     return _mimeType;
 }
 
+TimeStamp
+HTTPResponse::getLastModified() const {
+    return _lastModified;
+}
+
 Config
 HTTPResponse::getHeadersAsConfig() const
 {
@@ -311,6 +319,9 @@ namespace
     // HTTP debugging.
     static bool                        s_HTTP_DEBUG = false;
 
+    // route blocking requests through the shared request engine
+    static bool                        s_useRequestEngine = ::getenv("OSGEARTH_HTTP_ENGINE") != 0L;
+
     static osg::ref_ptr< URLRewriter > s_rewriter;
 }
 
@@ -341,17 +352,8 @@ HTTPClient::initialize() const
 void
 HTTPClient::initializeImpl()
 {
-    _previousHttpAuthentication = 0;
     _curl_handle = curl_easy_init();
 
-    //Get the user agent
-    std::string userAgent = s_userAgent;
-    const char* userAgentEnv = getenv("OSGEARTH_USERAGENT");
-    if (userAgentEnv)
-    {
-        userAgent = std::string(userAgentEnv);
-    }
-
     //Check for a response-code simulation (for testing)
     const char* simCode = getenv("OSGEARTH_SIMULATE_HTTP_RESPONSE_CODE");
     if ( simCode )
@@ -367,15 +369,31 @@ HTTPClient::initializeImpl()
         OE_WARN << LC << "HTTP debugging enabled" << std::endl;
     }
 
+    applyDefaultOptions( _curl_handle );
+
+    _initialized = true;
+}
+
+void
+HTTPClient::applyDefaultOptions( void* curl_handle )
+{
+    //Get the user agent
+    std::string userAgent = s_userAgent;
+    const char* userAgentEnv = getenv("OSGEARTH_USERAGENT");
+    if (userAgentEnv)
+    {
+        userAgent = std::string(userAgentEnv);
+    }
+
     OE_DEBUG << LC << "HTTPClient setting userAgent=" << userAgent << std::endl;
 
-    curl_easy_setopt( _curl_handle, CURLOPT_USERAGENT, userAgent.c_str() );
-    curl_easy_setopt( _curl_handle, CURLOPT_WRITEFUNCTION, osgEarth::StreamObjectReadCallback );
-    curl_easy_setopt( _curl_handle, CURLOPT_FOLLOWLOCATION, (void*)1 );
-    curl_easy_setopt( _curl_handle, CURLOPT_MAXREDIRS, (void*)5 );
-    curl_easy_setopt( _curl_handle, CURLOPT_PROGRESSFUNCTION, &CurlProgressCallback);
-    curl_easy_setopt( _curl_handle, CURLOPT_NOPROGRESS, (void*)0 ); //FALSE);
-    curl_easy_setopt( _curl_handle, CURLOPT_FILETIME, true );
+    curl_easy_setopt( curl_handle, CURLOPT_USERAGENT, userAgent.c_str() );
+    curl_easy_setopt( curl_handle, CURLOPT_WRITEFUNCTION, osgEarth::StreamObjectReadCallback );
+    curl_easy_setopt( curl_handle, CURLOPT_FOLLOWLOCATION, (void*)1 );
+    curl_easy_setopt( curl_handle, CURLOPT_MAXREDIRS, (void*)5 );
+    curl_easy_setopt( curl_handle, CURLOPT_PROGRESSFUNCTION, &CurlProgressCallback);
+    curl_easy_setopt( curl_handle, CURLOPT_NOPROGRESS, (void*)0 ); //FALSE);
+    curl_easy_setopt( curl_handle, CURLOPT_FILETIME, true );
 
     long timeout = s_timeout;
     const char* timeoutEnv = getenv("OSGEARTH_HTTP_TIMEOUT");
@@ -384,7 +402,7 @@ HTTPClient::initializeImpl()
         timeout = osgEarth::as<long>(std::string(timeoutEnv), 0);
     }
     OE_DEBUG << LC << "Setting timeout to " << timeout << std::endl;
-    curl_easy_setopt( _curl_handle, CURLOPT_TIMEOUT, timeout );
+    curl_easy_setopt( curl_handle, CURLOPT_TIMEOUT, timeout );
     long connectTimeout = s_connectTimeout;
     const char* connectTimeoutEnv = getenv("OSGEARTH_HTTP_CONNECTTIMEOUT");
     if (connectTimeoutEnv)
@@ -392,9 +410,7 @@ HTTPClient::initializeImpl()
         connectTimeout = osgEarth::as<long>(std::string(connectTimeoutEnv), 0);
     }
     OE_DEBUG << LC << "Setting connect timeout to " << connectTimeout << std::endl;
-    curl_easy_setopt( _curl_handle, CURLOPT_CONNECTTIMEOUT, connectTimeout );
-
-    _initialized = true;
+    curl_easy_setopt( curl_handle, CURLOPT_CONNECTTIMEOUT, connectTimeout );
 }
 
 HTTPClient::~HTTPClient()
@@ -455,7 +471,7 @@ HTTPClient::globalInit()
 }
 
 void
-HTTPClient::readOptions(const osgDB::Options* options, std::string& proxy_host, std::string& proxy_port) const
+HTTPClient::readOptions(const osgDB::Options* options, std::string& proxy_host, std::string& proxy_port)
 {
     // try to set proxy host/port by reading the CURL proxy options
     if ( options )
@@ -509,7 +525,7 @@ namespace
 void
 HTTPClient::decodeMultipartStream(const std::string&   boundary,
                                   HTTPResponse::Part*  input,
-                                  HTTPResponse::Parts& output) const
+                                  HTTPResponse::Parts& output)
 {
     std::string bstr = std::string("--") + boundary;
     std::string line;
@@ -607,6 +623,49 @@ HTTPClient::get( const std::string&    url,
     return getClient().doGet( url, options, callback);
 }
 
+osg::ref_ptr<HTTPFuture>
+HTTPClient::getAsync(const HTTPRequest&    request,
+                     const osgDB::Options* options,
+                     float                 priority,
+                     HTTPFuture::Callback* callback,
+                     ProgressCallback*     progress)
+{
+    return HTTPRequestEngine::instance()->submit( request, options, priority, callback, progress );
+}
+
+void
+HTTPClient::setUseRequestEngine( bool value )
+{
+    s_useRequestEngine = value;
+}
+
+bool
+HTTPClient::getUseRequestEngine()
+{
+    return s_useRequestEngine;
+}
+
+#define HTTP_ENGINE_PLUGIN_DATA "osgEarth::HTTPClient::useRequestEngine"
+
+void
+HTTPClient::setUseRequestEngine( osgDB::Options* options, bool value )
+{
+    if ( !options )
+        return;
+
+    // the pointer value doesn't matter, only its presence does.
+    if ( value )
+        options->setPluginData( HTTP_ENGINE_PLUGIN_DATA, (void*)&s_useRequestEngine );
+    else
+        options->removePluginData( HTTP_ENGINE_PLUGIN_DATA );
+}
+
+bool
+HTTPClient::getUseRequestEngine( const osgDB::Options* options )
+{
+    return options && options->getPluginData( HTTP_ENGINE_PLUGIN_DATA ) != 0L;
+}
+
 ReadResult
 HTTPClient::readImage(const std::string&    location,
                       const osgDB::Options* options,
@@ -646,11 +705,13 @@ HTTPClient::download(const std::string& uri,
     return getClient().doDownload( uri, localPath );
 }
 
-HTTPResponse
-HTTPClient::doGet( const HTTPRequest& request, const osgDB::Options* options, ProgressCallback* callback) const
+std::string
+HTTPClient::setupRequest(void*                 curl_handle,
+                         const HTTPRequest&    request,
+                         const osgDB::Options* options,
+                         std::string&          out_url,
+                         std::string&          inout_credentials)
 {
-    initialize();
-
     const osgDB::AuthenticationMap* authenticationMap = (options && options->getAuthenticationMap()) ? 
             options->getAuthenticationMap() :
             osgDB::Registry::instance()->getAuthenticationMap();
@@ -723,8 +784,8 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::Options* options, Pr
         if ( s_HTTP_DEBUG )
             OE_NOTICE << LC << "Using proxy: " << proxy_addr << std::endl;
 
-        //curl_easy_setopt( _curl_handle, CURLOPT_HTTPPROXYTUNNEL, 1 ); 
-        curl_easy_setopt( _curl_handle, CURLOPT_PROXY, proxy_addr.c_str() );
+        //curl_easy_setopt( curl_handle, CURLOPT_HTTPPROXYTUNNEL, 1 ); 
+        curl_easy_setopt( curl_handle, CURLOPT_PROXY, proxy_addr.c_str() );
 
         //Setup the proxy authentication if setup
         if (!proxy_auth.empty())
@@ -732,13 +793,13 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::Options* options, Pr
             if ( s_HTTP_DEBUG )
                 OE_NOTICE << LC << "Using proxy authentication " << proxy_auth << std::endl;
 
-            curl_easy_setopt( _curl_handle, CURLOPT_PROXYUSERPWD, proxy_auth.c_str());
+            curl_easy_setopt( curl_handle, CURLOPT_PROXYUSERPWD, proxy_auth.c_str());
         }
     }
     else
     {
         OE_DEBUG << "Removing proxy settings" << std::endl;
-        curl_easy_setopt( _curl_handle, CURLOPT_PROXY, 0 );
+        curl_easy_setopt( curl_handle, CURLOPT_PROXY, 0 );
     }
 
     std::string url = request.getURL();
@@ -755,48 +816,131 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::Options* options, Pr
         authenticationMap->getAuthenticationDetails( url ) :
         0;
 
+    // only touch the handle's auth options when the credentials change; a
+    // handle that keeps hitting the same server keeps its negotiated auth.
+    std::string credentials;
     if (details)
     {
-        const std::string colon(":");
-        std::string password(details->username + colon + details->password);
-        curl_easy_setopt(_curl_handle, CURLOPT_USERPWD, password.c_str());
-        const_cast<HTTPClient*>(this)->_previousPassword = password;
+        credentials = Stringify() << details->username << ":" << details->password << "\n" << details->httpAuthentication;
+    }
+
+    if (credentials != inout_credentials)
+    {
+        if (details)
+        {
+            const std::string colon(":");
+            std::string password(details->username + colon + details->password);
+            curl_easy_setopt(curl_handle, CURLOPT_USERPWD, password.c_str());
 
-        // use for https.
-        // curl_easy_setopt(_curl, CURLOPT_KEYPASSWD, password.c_str());
+            // use for https.
+            // curl_easy_setopt(_curl, CURLOPT_KEYPASSWD, password.c_str());
 
 #if LIBCURL_VERSION_NUM >= 0x070a07
-        if (details->httpAuthentication != _previousHttpAuthentication)
-        { 
-            curl_easy_setopt(_curl_handle, CURLOPT_HTTPAUTH, details->httpAuthentication); 
-            const_cast<HTTPClient*>(this)->_previousHttpAuthentication = details->httpAuthentication;
+            curl_easy_setopt(curl_handle, CURLOPT_HTTPAUTH, details->httpAuthentication); 
+#endif
         }
+        else
+        {
+            // need to reset if previously set.
+            curl_easy_setopt(curl_handle, CURLOPT_USERPWD, 0);
+
+#if LIBCURL_VERSION_NUM >= 0x070a07
+            curl_easy_setopt(curl_handle, CURLOPT_HTTPAUTH, 0); 
 #endif
+        }
+        inout_credentials = credentials;
     }
-    else
+
+    curl_easy_setopt( curl_handle, CURLOPT_URL, url.c_str() );
+
+    out_url = url;
+    return proxy_addr;
+}
+
+HTTPResponse
+HTTPClient::makeResponse(void*               curl_handle,
+                         int                 curlCode,
+                         long                response_code,
+                         HTTPResponse::Part* part,
+                         const std::string&  url)
+{
+    CURLcode res = (CURLcode)curlCode;
+
+    HTTPResponse response( response_code );
+    
+    // read the response content type:
+    char* content_type_cp = 0L;
+
+    curl_easy_getinfo( curl_handle, CURLINFO_CONTENT_TYPE, &content_type_cp );    
+
+    if ( content_type_cp != NULL )
     {
-        if (!_previousPassword.empty())
+        response._mimeType = content_type_cp;    
+    }            
+
+    // last-modified (file time)
+    long filetime = -1;
+    if ( CURLE_OK == curl_easy_getinfo(curl_handle, CURLINFO_FILETIME, &filetime) && filetime > 0 )
+    {
+        response._lastModified = (TimeStamp)filetime;
+    }
+
+    if ( s_HTTP_DEBUG )
+    {
+        OE_NOTICE << LC 
+            << "GET(" << response_code << ", " << response._mimeType << ") : \"" 
+            << url << "\" (" << DateTime(response._lastModified).asRFC1123() << ")"<< std::endl;
+    }
+
+    // upon success, parse the data:
+    if ( res != CURLE_ABORTED_BY_CALLBACK && res != CURLE_OPERATION_TIMEDOUT )
+    {        
+        // check for multipart content
+        if (response._mimeType.length() > 9 && 
+            ::strstr( response._mimeType.c_str(), "multipart" ) == response._mimeType.c_str() )
         {
-            curl_easy_setopt(_curl_handle, CURLOPT_USERPWD, 0);
-            const_cast<HTTPClient*>(this)->_previousPassword.clear();
-        }
+            OE_DEBUG << LC << "detected multipart data; decoding..." << std::endl;
 
-#if LIBCURL_VERSION_NUM >= 0x070a07
-        // need to reset if previously set.
-        if (_previousHttpAuthentication!=0)
+            //TODO: parse out the "wcs" -- this is WCS-specific
+            decodeMultipartStream( "wcs", part, response._parts );
+        }
+        else
         {
-            curl_easy_setopt(_curl_handle, CURLOPT_HTTPAUTH, 0); 
-            const_cast<HTTPClient*>(this)->_previousHttpAuthentication = 0;
+            // store headers that we care about
+            part->_headers[IOMetadata::CONTENT_TYPE] = response._mimeType;
+            response._parts.push_back( part );
         }
-#endif
     }
+    else  /*if (res == CURLE_ABORTED_BY_CALLBACK || res == CURLE_OPERATION_TIMEDOUT) */
+    {        
+        //If we were aborted by a callback, then it was cancelled by a user
+        response._cancelled = true;
+    }
+
+    return response;
+}
+
+HTTPResponse
+HTTPClient::doGet( const HTTPRequest& request, const osgDB::Options* options, ProgressCallback* callback) const
+{
+    // hand off to the shared engine if requested, so that all threads draw
+    // from the same pool of kept-alive connections.
+    if ( s_useRequestEngine || getUseRequestEngine(options) )
+    {
+        osg::ref_ptr<HTTPFuture> future = getAsync( request, options, 0.0f, 0L, callback );
+        return future->get();
+    }
+
+    initialize();
+
+    std::string url;
+    std::string proxy_addr = setupRequest( _curl_handle, request, options, url, _credentials );
 
     osg::ref_ptr<HTTPResponse::Part> part = new HTTPResponse::Part();
     StreamObject sp( &part->_stream );
 
     //Take a temporary ref to the callback
     osg::ref_ptr<ProgressCallback> progressCallback = callback;
-    curl_easy_setopt( _curl_handle, CURLOPT_URL, url.c_str() );
     if (callback)
     {
         curl_easy_setopt(_curl_handle, CURLOPT_PROGRESSDATA, progressCallback.get());
@@ -815,6 +959,7 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::Options* options, Pr
         res = curl_easy_perform( _curl_handle );
         curl_easy_setopt( _curl_handle, CURLOPT_WRITEDATA, (void*)0 );
         curl_easy_setopt( _curl_handle, CURLOPT_PROGRESSDATA, (void*)0);
+        curl_easy_setopt( _curl_handle, CURLOPT_ERRORBUFFER, (void*)0 );
 
         //Disable peer certificate verification to allow us to access in https servers where the peer certificate cannot be verified.
         curl_easy_setopt( _curl_handle, CURLOPT_SSL_VERIFYPEER, (void*)0 );
@@ -839,55 +984,7 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::Options* options, Pr
         res = response_code == 408 ? CURLE_OPERATION_TIMEDOUT : CURLE_COULDNT_CONNECT;
     }    
 
-    HTTPResponse response( response_code );
-    
-    // read the response content type:
-    char* content_type_cp;
-
-    curl_easy_getinfo( _curl_handle, CURLINFO_CONTENT_TYPE, &content_type_cp );    
-
-    if ( content_type_cp != NULL )
-    {
-        response._mimeType = content_type_cp;    
-    }            
-
-    if ( s_HTTP_DEBUG )
-    {
-        TimeStamp filetime = 0;
-        if (CURLE_OK != curl_easy_getinfo(_curl_handle, CURLINFO_FILETIME, &filetime))
-            filetime = 0;
-
-        OE_NOTICE << LC 
-            << "GET(" << response_code << ", " << response._mimeType << ") : \"" 
-            << url << "\" (" << DateTime(filetime).asRFC1123() << ")"<< std::endl;
-    }
-
-    // upon success, parse the data:
-    if ( res != CURLE_ABORTED_BY_CALLBACK && res != CURLE_OPERATION_TIMEDOUT )
-    {        
-        // check for multipart content
-        if (response._mimeType.length() > 9 && 
-            ::strstr( response._mimeType.c_str(), "multipart" ) == response._mimeType.c_str() )
-        {
-            OE_DEBUG << LC << "detected multipart data; decoding..." << std::endl;
-
-            //TODO: parse out the "wcs" -- this is WCS-specific
-            decodeMultipartStream( "wcs", part.get(), response._parts );
-        }
-        else
-        {
-            // store headers that we care about
-            part->_headers[IOMetadata::CONTENT_TYPE] = response._mimeType;
-            response._parts.push_back( part.get() );
-        }
-    }
-    else  /*if (res == CURLE_ABORTED_BY_CALLBACK || res == CURLE_OPERATION_TIMEDOUT) */
-    {        
-        //If we were aborted by a callback, then it was cancelled by a user
-        response._cancelled = true;
-    }
-
-    return response;
+    return makeResponse( _curl_handle, res, response_code, part.get(), url );
 }
 
 
@@ -1005,10 +1102,9 @@ HTTPClient::doReadImage(const std::string&    location,
         }
         
         // last-modified (file time)
-        TimeStamp filetime = 0;
-        if ( CURLE_OK == curl_easy_getinfo(_curl_handle, CURLINFO_FILETIME, &filetime) )
+        if ( response.getLastModified() > 0 )
         {
-            result.setLastModifiedTime( filetime );
+            result.setLastModifiedTime( response.getLastModified() );
         }
     }
     else
@@ -1075,10 +1171,9 @@ HTTPClient::doReadNode(const std::string&    location,
         }
         
         // last-modified (file time)
-        TimeStamp filetime = 0;
-        if ( CURLE_OK == curl_easy_getinfo(_curl_handle, CURLINFO_FILETIME, &filetime) )
+        if ( response.getLastModified() > 0 )
         {
-            result.setLastModifiedTime( filetime );
+            result.setLastModifiedTime( response.getLastModified() );
         }
     }
     else
@@ -1141,10 +1236,9 @@ HTTPClient::doReadObject(const std::string&    location,
         }
         
         // last-modified (file time)
-        TimeStamp filetime = 0;
-        if ( CURLE_OK == curl_easy_getinfo(_curl_handle, CURLINFO_FILETIME, &filetime) )
+        if ( response.getLastModified() > 0 )
         {
-            result.setLastModifiedTime( filetime );
+            result.setLastModifiedTime( response.getLastModified() );
         }
     }
     else
@@ -1215,11 +1309,495 @@ HTTPClient::doReadString(const std::string&    location,
     }
 
     // last-modified (file time)
-    TimeStamp filetime = 0;
-    if ( CURLE_OK == curl_easy_getinfo(_curl_handle, CURLINFO_FILETIME, &filetime) )
+    if ( response.getLastModified() > 0 )
     {
-        result.setLastModifiedTime( filetime );
+        result.setLastModifiedTime( response.getLastModified() );
     }
 
     return result;
 }
+
+/****************************************************************************/
+
+namespace
+{
+    static Threading::Mutex                s_engineMutex;
+    static osg::ref_ptr<HTTPRequestEngine> s_engine;
+
+    // "scheme://host:port" portion of a URL, for per-host connection accounting
+    std::string getHostKey( const std::string& url )
+    {
+        std::string::size_type p = url.find( "://" );
+        std::string::size_type start = p == std::string::npos ? 0 : p + 3;
+        return url.substr( 0, url.find_first_of("/?#", start) );
+    }
+
+    int FutureProgressCallback(void *clientp,double dltotal,double dlnow,double ultotal,double ulnow)
+    {
+        HTTPFuture* future = (HTTPFuture*)clientp;
+        return future && future->isCanceled() ? 1 : 0;
+    }
+}
+
+HTTPFuture::HTTPFuture(HTTPRequestEngine*    engine,
+                       const HTTPRequest&    request,
+                       const osgDB::Options* dbOptions,
+                       float                 priority,
+                       Callback*             callback,
+                       ProgressCallback*     progress) :
+_engine   ( engine ),
+_request  ( request ),
+_dbOptions( dbOptions ),
+_priority ( priority ),
+_callback ( callback ),
+_progress ( progress ),
+_canceled ( false )
+{
+    //nop
+}
+
+HTTPFuture::~HTTPFuture()
+{
+    //nop
+}
+
+void
+HTTPFuture::cancel()
+{
+    _canceled = true;
+
+    osg::ref_ptr<HTTPRequestEngine> engine;
+    if ( _engine.lock(engine) )
+        engine->wake();
+}
+
+bool
+HTTPFuture::isCanceled() const
+{
+    return _canceled || (_progress.valid() && _progress->isCanceled());
+}
+
+const HTTPResponse&
+HTTPFuture::get()
+{
+    while( !_done.isSet() )
+        _done.wait();
+    return _response;
+}
+
+//........................................................................
+
+struct HTTPRequestEngine::Transfer
+{
+    Transfer() : _stream(0L), _handle(0L) { _errorBuf[0] = 0; }
+
+    osg::ref_ptr<HTTPFuture>     _future;
+    osg::ref_ptr<osg::Referenced> _part;
+    StreamObject                 _stream;
+    std::string                  _url;
+    std::string                  _host;
+    std::string                  _proxyAddr;
+    void*                        _handle;
+    char                         _errorBuf[CURL_ERROR_SIZE];
+};
+
+class HTTPRequestEngine::NetworkThread : public OpenThreads::Thread
+{
+public:
+    NetworkThread( HTTPRequestEngine* engine ) : _engine(engine) { }
+    void run() { _engine->run(); }
+private:
+    HTTPRequestEngine* _engine;
+};
+
+HTTPRequestEngine*
+HTTPRequestEngine::instance()
+{
+    Threading::ScopedMutexLock lock( s_engineMutex );
+    if ( !s_engine.valid() )
+        s_engine = new HTTPRequestEngine();
+    return s_engine.get();
+}
+
+HTTPRequestEngine::HTTPRequestEngine() :
+_thread               ( 0L ),
+_done                 ( false ),
+_numActive            ( 0 ),
+_maxConnections       ( 32 ),
+_maxConnectionsPerHost( 6 ),
+_simResponseCode      ( -1L ),
+_multi                ( 0L )
+{
+    //Check for a response-code simulation (for testing)
+    const char* simCode = getenv("OSGEARTH_SIMULATE_HTTP_RESPONSE_CODE");
+    if ( simCode )
+    {
+        _simResponseCode = osgEarth::as<long>(std::string(simCode), 404L);
+    }
+}
+
+HTTPRequestEngine::~HTTPRequestEngine()
+{
+    shutdown();
+}
+
+void
+HTTPRequestEngine::setMaxConnections( unsigned value )
+{
+    _maxConnections = osg::maximum( value, 1u );
+}
+
+void
+HTTPRequestEngine::setMaxConnectionsPerHost( unsigned value )
+{
+    _maxConnectionsPerHost = osg::maximum( value, 1u );
+}
+
+unsigned
+HTTPRequestEngine::getNumPending() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    return _pending.size();
+}
+
+osg::ref_ptr<HTTPFuture>
+HTTPRequestEngine::submit(const HTTPRequest&    request,
+                          const osgDB::Options* dbOptions,
+                          float                 priority,
+                          HTTPFuture::Callback* callback,
+                          ProgressCallback*     progress)
+{
+    osg::ref_ptr<HTTPFuture> future = new HTTPFuture( this, request, dbOptions, priority, callback, progress );
+
+    bool accepted = false;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        if ( !_done )
+        {
+            // negate the key so higher priorities come first; equal keys stay in FIFO order.
+            _pending.insert( std::make_pair(-priority, future) );
+            if ( !_thread )
+                startThread();
+            accepted = true;
+        }
+    }
+
+    if ( accepted )
+    {
+        wake();
+    }
+    else
+    {
+        future->_canceled = true;
+        future->_response._cancelled = true;
+        complete( future.get() );
+    }
+
+    // return the ref_ptr itself: once queued, the network thread may complete
+    // the future and drop its reference at any time.
+    return future;
+}
+
+void
+HTTPRequestEngine::startThread()
+{
+    _thread = new NetworkThread( this );
+    _thread->start();
+}
+
+void
+HTTPRequestEngine::shutdown()
+{
+    NetworkThread* thread = 0L;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        _done  = true;
+        thread = _thread;
+        _thread = 0L;
+    }
+
+    if ( thread )
+    {
+        wake();
+        thread->join();
+        delete thread;
+    }
+}
+
+void
+HTTPRequestEngine::run()
+{
+    _multi = curl_multi_init();
+
+    // size of the kept-alive connection cache:
+    curl_multi_setopt( (CURLM*)_multi, CURLMOPT_MAXCONNECTS, (long)_maxConnections );
+
+    while( !_done )
+    {
+        startPending();
+
+        if ( _active.empty() )
+        {
+            // idle; sleep until someone submits or cancels a request.
+            _wakeup.waitAndReset();
+            continue;
+        }
+
+        int running = 0;
+        curl_multi_perform( (CURLM*)_multi, &running );
+
+        // harvest completed transfers:
+        CURLMsg* msg;
+        int      msgsLeft = 0;
+        while( (msg = curl_multi_info_read((CURLM*)_multi, &msgsLeft)) != 0L )
+        {
+            if ( msg->msg == CURLMSG_DONE )
+            {
+                TransferMap::iterator i = _active.find( msg->easy_handle );
+                if ( i != _active.end() )
+                {
+                    Transfer* t = i->second;
+                    _active.erase( i );
+                    _numActive = _active.size();
+                    finish( t, msg->data.result );
+                }
+            }
+        }
+
+        // wait for network activity. The timeout bounds how long a newly
+        // submitted request waits before it's started.
+#if LIBCURL_VERSION_NUM >= 0x071c00
+        int numfds = 0;
+        curl_multi_wait( (CURLM*)_multi, 0L, 0, 10, &numfds );
+#else
+        fd_set fdread, fdwrite, fdexcep;
+        FD_ZERO( &fdread );
+        FD_ZERO( &fdwrite );
+        FD_ZERO( &fdexcep );
+        int maxfd = -1;
+        curl_multi_fdset( (CURLM*)_multi, &fdread, &fdwrite, &fdexcep, &maxfd );
+        if ( maxfd >= 0 )
+        {
+            struct timeval tv;
+            tv.tv_sec  = 0;
+            tv.tv_usec = 10000;
+            ::select( maxfd+1, &fdread, &fdwrite, &fdexcep, &tv );
+        }
+        else
+        {
+            OpenThreads::Thread::microSleep( 10000 );
+        }
+#endif
+    }
+
+    stopped();
+}
+
+void
+HTTPRequestEngine::startPending()
+{
+    // retire active transfers whose futures were canceled:
+    for( TransferMap::iterator i = _active.begin(); i != _active.end(); )
+    {
+        Transfer* t = i->second;
+        if ( t->_future->isCanceled() )
+        {
+            _active.erase( i++ );
+            finish( t, CURLE_ABORTED_BY_CALLBACK );
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    std::vector< osg::ref_ptr<HTTPFuture> > toStart, toCancel;
+    std::vector< std::string >              toStartHosts;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+
+        for( PendingQueue::iterator i = _pending.begin();
+             i != _pending.end() && _active.size() + toStart.size() < _maxConnections; )
+        {
+            HTTPFuture* future = i->second.get();
+            if ( future->isCanceled() )
+            {
+                toCancel.push_back( future );
+                _pending.erase( i++ );
+                continue;
+            }
+
+            std::string host = getHostKey( future->_request.getURL() );
+            unsigned& count = _hostCounts[host];
+            if ( count < _maxConnectionsPerHost )
+            {
+                ++count;
+                toStart.push_back( future );
+                toStartHosts.push_back( host );
+                _pending.erase( i++ );
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    for( unsigned i=0; i<toCancel.size(); ++i )
+    {
+        toCancel[i]->_response._cancelled = true;
+        complete( toCancel[i].get() );
+    }
+
+    for( unsigned i=0; i<toStart.size(); ++i )
+    {
+        HTTPFuture* future = toStart[i].get();
+
+        Transfer* t = new Transfer();
+        t->_future = future;
+        t->_host   = toStartHosts[i];
+
+        HTTPResponse::Part* part = new HTTPResponse::Part();
+        t->_part           = part;
+        t->_stream._stream = &part->_stream;
+
+        if ( !_idleHandles.empty() )
+        {
+            t->_handle = _idleHandles.back();
+            _idleHandles.pop_back();
+            curl_easy_reset( (CURL*)t->_handle );
+        }
+        else
+        {
+            t->_handle = curl_easy_init();
+        }
+
+        // a new or freshly reset handle carries no credentials.
+        std::string credentials;
+        HTTPClient::applyDefaultOptions( t->_handle );
+        t->_proxyAddr = HTTPClient::setupRequest( t->_handle, future->_request, future->_dbOptions.get(), t->_url, credentials );
+
+        CURL* handle = (CURL*)t->_handle;
+        curl_easy_setopt( handle, CURLOPT_PROGRESSFUNCTION, &FutureProgressCallback );
+        curl_easy_setopt( handle, CURLOPT_PROGRESSDATA, (void*)future );
+        curl_easy_setopt( handle, CURLOPT_WRITEDATA, (void*)&t->_stream );
+        curl_easy_setopt( handle, CURLOPT_ERRORBUFFER, (void*)t->_errorBuf );
+        curl_easy_setopt( handle, CURLOPT_SSL_VERIFYPEER, (void*)0 );
+#if LIBCURL_VERSION_NUM >= 0x071900
+        curl_easy_setopt( handle, CURLOPT_TCP_KEEPALIVE, 1L );
+#endif
+
+        _active[t->_handle] = t;
+
+        if ( _simResponseCode >= 0 )
+        {
+            // simulate failure with a custom response code (never hits the network)
+            _active.erase( t->_handle );
+            finish( t, _simResponseCode == 408 ? CURLE_OPERATION_TIMEDOUT : CURLE_COULDNT_CONNECT );
+        }
+        else
+        {
+            curl_multi_add_handle( (CURLM*)_multi, handle );
+        }
+    }
+
+    _numActive = _active.size();
+}
+
+void
+HTTPRequestEngine::finish( Transfer* t, int curlCode )
+{
+    CURL* handle = (CURL*)t->_handle;
+    curl_multi_remove_handle( (CURLM*)_multi, handle );
+
+    osg::ref_ptr<HTTPFuture> future = t->_future.get();
+
+    if ( future->isCanceled() )
+        curlCode = CURLE_ABORTED_BY_CALLBACK;
+
+    long response_code = 0L;
+    if ( _simResponseCode >= 0 )
+        response_code = _simResponseCode;
+    else
+        curl_easy_getinfo( handle, CURLINFO_RESPONSE_CODE, &response_code );
+
+    long connect_code = 0L;
+    if ( !t->_proxyAddr.empty() && _simResponseCode < 0 &&
+         curl_easy_getinfo(handle, CURLINFO_HTTP_CONNECTCODE, &connect_code) != CURLE_OK )
+    {
+        OE_WARN << LC << "Proxy connect error: " << t->_errorBuf << std::endl;
+        future->_response = HTTPResponse(0);
+    }
+    else
+    {
+        HTTPResponse::Part* part = static_cast<HTTPResponse::Part*>( t->_part.get() );
+        future->_response = HTTPClient::makeResponse( handle, curlCode, response_code, part, t->_url );
+    }
+
+    if ( s_HTTP_DEBUG && curlCode != CURLE_OK && curlCode != CURLE_ABORTED_BY_CALLBACK )
+    {
+        OE_NOTICE << LC << "GET failed: \"" << t->_url << "\" (" << t->_errorBuf << ")" << std::endl;
+    }
+
+    // release the host connection slot:
+    HostCounts::iterator h = _hostCounts.find( t->_host );
+    if ( h != _hostCounts.end() && --h->second == 0 )
+        _hostCounts.erase( h );
+
+    // recycle the easy handle; the connection itself lives in the multi handle's cache.
+    curl_easy_setopt( handle, CURLOPT_WRITEDATA, (void*)0 );
+    curl_easy_setopt( handle, CURLOPT_PROGRESSDATA, (void*)0 );
+    curl_easy_setopt( handle, CURLOPT_ERRORBUFFER, (void*)0 );
+    if ( _idleHandles.size() < _maxConnections )
+        _idleHandles.push_back( handle );
+    else
+        curl_easy_cleanup( handle );
+
+    delete t;
+
+    complete( future.get() );
+}
+
+void
+HTTPRequestEngine::complete( HTTPFuture* future )
+{
+    // signal waiters first, so a callback may safely call get().
+    future->_done.set();
+
+    if ( future->_callback.valid() )
+        future->_callback->onComplete( future );
+}
+
+void
+HTTPRequestEngine::stopped()
+{
+    // cancel everything still in flight:
+    while( !_active.empty() )
+    {
+        Transfer* t = _active.begin()->second;
+        _active.erase( _active.begin() );
+        t->_future->_canceled = true;
+        finish( t, CURLE_ABORTED_BY_CALLBACK );
+    }
+    _numActive = 0;
+
+    PendingQueue pending;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        pending.swap( _pending );
+    }
+
+    for( PendingQueue::iterator i = pending.begin(); i != pending.end(); ++i )
+    {
+        i->second->_canceled = true;
+        i->second->_response._cancelled = true;
+        complete( i->second.get() );
+    }
+
+    for( unsigned i=0; i<_idleHandles.size(); ++i )
+        curl_easy_cleanup( (CURL*)_idleHandles[i] );
+    _idleHandles.clear();
+
+    curl_multi_cleanup( (CURLM*)_multi );
+    _multi = 0L;
+}
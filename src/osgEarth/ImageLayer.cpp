@@ -692,11 +692,12 @@ ImageLayer::createImageFromTileSource(const TileKey&    key,
             return GeoImage::INVALID;
         }
 
-        TileKey finalKey = key;
+        // start at the best key that might have data (skipping LODs beyond the
+        // data extents, blacklisted tiles and recent misses) and work up from there.
+        TileKey finalKey = getBestAvailableTileKey( key );
         while( !result.valid() && finalKey.valid() )
         {
-            if ( !source->getBlacklist()->contains( finalKey.getTileId() ) &&
-                source->hasDataForFallback(finalKey))
+            if ( source->hasDataForFallback(finalKey) )
             {
                 result = source->createImage( finalKey, op.get(), progress );
                 if ( result.valid() )
@@ -711,14 +712,19 @@ ImageLayer::createImageFromTileSource(const TileKey&    key,
                         result = cropped.takeImage();
                     }
                 }
+                else if ( !progress || !progress->isCanceled() )
+                {
+                    recordMiss( finalKey );
+                }
             }
             if ( !result.valid() )
             {
-                finalKey = finalKey.createParentKey();
-                out_isFallback = true;
+                finalKey = getBestAvailableTileKey( finalKey.createParentKey() );
             }
         }
 
+        out_isFallback = (finalKey != key);
+
         if ( !result.valid() )
         {
             result = 0L;
@@ -26,6 +26,8 @@
 #include <osgDB/Registry>
 #include <string.h>
 #include <memory.h>
+#include <algorithm>
+#include <vector>
 
 #define LC "[ImageUtils] "
 
@@ -169,11 +171,377 @@ ImageUtils::createBumpMap(const osg::Image* input)
     return output;
 }
 
+namespace
+{
+    // Row kernels for the common uncompressed layouts: interleaved 8-bit
+    // (RGBA8, RGB8, L8, ...) or 32-bit float channels. They work directly on
+    // the image rows, skipping the per-pixel function dispatch and float
+    // conversion of PixelReader/PixelWriter, and the inner loops run over
+    // contiguous memory so the compiler can vectorize them. Anything else
+    // goes through the generic PixelReader/PixelWriter path.
+
+    // Number of interleaved channels in a pixel format, or 0 if the
+    // row kernels don't handle it.
+    unsigned getNumChannels( GLenum pixelFormat )
+    {
+        switch( pixelFormat )
+        {
+        case GL_LUMINANCE:
+        case GL_ALPHA:           return 1;
+        case GL_LUMINANCE_ALPHA: return 2;
+        case GL_RGB:
+        case GL_BGR:             return 3;
+        case GL_RGBA:
+        case GL_BGRA:            return 4;
+        default:                 return 0;
+        }
+    }
+
+    // Index of the alpha channel in a pixel format, or -1 if it has none.
+    int getAlphaChannel( GLenum pixelFormat )
+    {
+        switch( pixelFormat )
+        {
+        case GL_ALPHA:           return 0;
+        case GL_LUMINANCE_ALPHA: return 1;
+        case GL_RGBA:
+        case GL_BGRA:            return 3;
+        default:                 return -1;
+        }
+    }
+
+    bool isByteImage( const osg::Image* image )
+    {
+        return
+            image->getDataType() == GL_UNSIGNED_BYTE &&
+            !image->isCompressed() &&
+            getNumChannels(image->getPixelFormat()) > 0;
+    }
+
+    bool isByteOrFloatImage( const osg::Image* image )
+    {
+        return
+            (image->getDataType() == GL_UNSIGNED_BYTE || image->getDataType() == GL_FLOAT) &&
+            !image->isCompressed() &&
+            getNumChannels(image->getPixelFormat()) > 0;
+    }
+
+    //------------------------------------------------------------------------
+    // Resampling tables, computed once per resize instead of once per pixel.
+
+    // Source index for each output index under nearest-neighbor resampling.
+    // Same arithmetic as the generic path, so both pick the same pixels.
+    void computeNearestTable( unsigned in, unsigned out, std::vector<unsigned>& table )
+    {
+        table.resize( out );
+        for( unsigned i=0; i<out; ++i )
+        {
+            float ratio = (float)i/(float)out;
+            unsigned j = (unsigned)( ratio * (float)in );
+            table[i] = j >= in ? in-1 : j;
+        }
+    }
+
+    // The two source indices that straddle the center of each output pixel,
+    // and the weight of the second one.
+    struct LinearTap
+    {
+        unsigned _i0, _i1;
+        float    _w;
+    };
+
+    void computeLinearTable( unsigned in, unsigned out, std::vector<LinearTap>& table )
+    {
+        table.resize( out );
+        double scale = (double)in/(double)out;
+        for( unsigned i=0; i<out; ++i )
+        {
+            double x = ((double)i + 0.5)*scale - 0.5;
+            if ( x < 0.0 ) x = 0.0;
+            LinearTap& tap = table[i];
+            tap._i0 = (unsigned)x;
+            if ( tap._i0 >= in-1 )
+            {
+                tap._i0 = tap._i1 = in-1;
+                tap._w  = 0.0f;
+            }
+            else
+            {
+                tap._i1 = tap._i0 + 1;
+                tap._w  = (float)(x - (double)tap._i0);
+            }
+        }
+    }
+
+    // The range [i0, i1) of source indices covered by each output pixel.
+    struct BoxSpan
+    {
+        unsigned _i0, _i1;
+    };
+
+    void computeBoxTable( unsigned in, unsigned out, std::vector<BoxSpan>& table )
+    {
+        table.resize( out );
+        for( unsigned i=0; i<out; ++i )
+        {
+            BoxSpan& span = table[i];
+            span._i0 = (unsigned)( ((unsigned long long)i * in) / out );
+            span._i1 = (unsigned)( ((unsigned long long)(i+1) * in + out - 1) / out );
+            if ( span._i1 <= span._i0 ) span._i1 = span._i0 + 1;
+            if ( span._i1 > in )        span._i1 = in;
+        }
+    }
+
+    //------------------------------------------------------------------------
+    // Per-channel arithmetic for the two supported data types.
+
+    template<typename T> struct ChannelMath;
+
+    template<> struct ChannelMath<unsigned char>
+    {
+        // 8-bit weights in [0..256] keep the bilinear math in integers.
+        typedef unsigned           Weight;
+        typedef unsigned long long Sum;
+
+        static Weight weight( float w ) { return (Weight)(w*256.0f + 0.5f); }
+
+        static unsigned char bilinear(
+            unsigned char a, unsigned char b, unsigned char c, unsigned char d,
+            Weight wx, Weight wy )
+        {
+            unsigned top    = a*(256u-wx) + b*wx;
+            unsigned bottom = c*(256u-wx) + d*wx;
+            return (unsigned char)( (top*(256u-wy) + bottom*wy + 32768u) >> 16 );
+        }
+
+        static unsigned char average( Sum sum, unsigned count )
+        {
+            return (unsigned char)( (sum + count/2) / count );
+        }
+    };
+
+    template<> struct ChannelMath<float>
+    {
+        typedef float  Weight;
+        typedef double Sum;
+
+        static Weight weight( float w ) { return w; }
+
+        static float bilinear( float a, float b, float c, float d, Weight wx, Weight wy )
+        {
+            float top    = a + (b-a)*wx;
+            float bottom = c + (d-c)*wx;
+            return top + (bottom-top)*wy;
+        }
+
+        static float average( Sum sum, unsigned count )
+        {
+            return (float)( sum / (double)count );
+        }
+    };
+
+    //------------------------------------------------------------------------
+    // Resize kernels. N is the number of channels; the source is read from
+    // mipmap level 0 and each output row is written at outData + row*outRowSize.
+
+    template<typename T, unsigned N>
+    struct ResizeKernel
+    {
+        typedef ChannelMath<T> Math;
+
+        static void nearest(const osg::Image* input, unsigned out_s, unsigned out_t,
+                            unsigned char* outData, unsigned outRowSize)
+        {
+            std::vector<unsigned> cols, rows;
+            computeNearestTable( input->s(), out_s, cols );
+            computeNearestTable( input->t(), out_t, rows );
+
+            for( unsigned t=0; t<out_t; ++t )
+            {
+                const T* src = reinterpret_cast<const T*>( input->data(0, rows[t]) );
+                T*       dst = reinterpret_cast<T*>( outData + t*outRowSize );
+
+                for( unsigned s=0; s<out_s; ++s, dst += N )
+                {
+                    const T* p = src + cols[s]*N;
+                    for( unsigned c=0; c<N; ++c )
+                        dst[c] = p[c];
+                }
+            }
+        }
+
+        static void bilinear(const osg::Image* input, unsigned out_s, unsigned out_t,
+                             unsigned char* outData, unsigned outRowSize)
+        {
+            std::vector<LinearTap> cols, rows;
+            computeLinearTable( input->s(), out_s, cols );
+            computeLinearTable( input->t(), out_t, rows );
+
+            std::vector<typename Math::Weight> colWeights( out_s );
+            for( unsigned s=0; s<out_s; ++s )
+                colWeights[s] = Math::weight( cols[s]._w );
+
+            for( unsigned t=0; t<out_t; ++t )
+            {
+                const T* src0 = reinterpret_cast<const T*>( input->data(0, rows[t]._i0) );
+                const T* src1 = reinterpret_cast<const T*>( input->data(0, rows[t]._i1) );
+                T*       dst  = reinterpret_cast<T*>( outData + t*outRowSize );
+                typename Math::Weight wy = Math::weight( rows[t]._w );
+
+                for( unsigned s=0; s<out_s; ++s, dst += N )
+                {
+                    const unsigned x0 = cols[s]._i0*N, x1 = cols[s]._i1*N;
+                    for( unsigned c=0; c<N; ++c )
+                    {
+                        dst[c] = Math::bilinear(
+                            src0[x0+c], src0[x1+c], src1[x0+c], src1[x1+c],
+                            colWeights[s], wy );
+                    }
+                }
+            }
+        }
+
+        static void box(const osg::Image* input, unsigned out_s, unsigned out_t,
+                        unsigned char* outData, unsigned outRowSize)
+        {
+            std::vector<BoxSpan> cols, rows;
+            computeBoxTable( input->s(), out_s, cols );
+            computeBoxTable( input->t(), out_t, rows );
+
+            // column sums of the current band of source rows, then reduced
+            // horizontally into the output row.
+            std::vector<typename Math::Sum> sums( input->s() * N );
+
+            for( unsigned t=0; t<out_t; ++t )
+            {
+                std::fill( sums.begin(), sums.end(), typename Math::Sum(0) );
+
+                for( unsigned r=rows[t]._i0; r<rows[t]._i1; ++r )
+                {
+                    const T* src = reinterpret_cast<const T*>( input->data(0, r) );
+                    for( unsigned i=0; i<sums.size(); ++i )
+                        sums[i] += src[i];
+                }
+
+                T* dst = reinterpret_cast<T*>( outData + t*outRowSize );
+                const unsigned numRows = rows[t]._i1 - rows[t]._i0;
+
+                for( unsigned s=0; s<out_s; ++s, dst += N )
+                {
+                    const unsigned count = numRows * (cols[s]._i1 - cols[s]._i0);
+                    for( unsigned c=0; c<N; ++c )
+                    {
+                        typename Math::Sum sum = 0;
+                        for( unsigned x=cols[s]._i0; x<cols[s]._i1; ++x )
+                            sum += sums[x*N+c];
+                        dst[c] = Math::average( sum, count );
+                    }
+                }
+            }
+        }
+
+        static void run(ImageUtils::ResizeFilter filter,
+                        const osg::Image* input, unsigned out_s, unsigned out_t,
+                        unsigned char* outData, unsigned outRowSize)
+        {
+            if ( filter == ImageUtils::RESIZE_BILINEAR )
+                bilinear( input, out_s, out_t, outData, outRowSize );
+            else if ( filter == ImageUtils::RESIZE_BOX )
+                box( input, out_s, out_t, outData, outRowSize );
+            else
+                nearest( input, out_s, out_t, outData, outRowSize );
+        }
+    };
+
+    template<typename T>
+    void resizeRows(ImageUtils::ResizeFilter filter,
+                    const osg::Image* input, unsigned out_s, unsigned out_t,
+                    unsigned char* outData, unsigned outRowSize)
+    {
+        switch( getNumChannels(input->getPixelFormat()) )
+        {
+        case 1: ResizeKernel<T,1>::run( filter, input, out_s, out_t, outData, outRowSize ); break;
+        case 2: ResizeKernel<T,2>::run( filter, input, out_s, out_t, outData, outRowSize ); break;
+        case 3: ResizeKernel<T,3>::run( filter, input, out_s, out_t, outData, outRowSize ); break;
+        case 4: ResizeKernel<T,4>::run( filter, input, out_s, out_t, outData, outRowSize ); break;
+        }
+    }
+
+    // Generic resize for formats without a row kernel.
+    void resizePixels(ImageUtils::ResizeFilter filter,
+                      const osg::Image* input, unsigned out_s, unsigned out_t,
+                      osg::Image* output, unsigned mipmapLevel)
+    {
+        ImageUtils::PixelReader read( input );
+        ImageUtils::PixelWriter write( output );
+
+        unsigned in_s = input->s();
+        unsigned in_t = input->t();
+
+        if ( filter == ImageUtils::RESIZE_BILINEAR )
+        {
+            std::vector<LinearTap> cols, rows;
+            computeLinearTable( in_s, out_s, cols );
+            computeLinearTable( in_t, out_t, rows );
+
+            for( unsigned t=0; t<out_t; ++t )
+            {
+                const LinearTap& ty = rows[t];
+                for( unsigned s=0; s<out_s; ++s )
+                {
+                    const LinearTap& tx = cols[s];
+                    osg::Vec4 top    = read(tx._i0, ty._i0)*(1.0f-tx._w) + read(tx._i1, ty._i0)*tx._w;
+                    osg::Vec4 bottom = read(tx._i0, ty._i1)*(1.0f-tx._w) + read(tx._i1, ty._i1)*tx._w;
+                    write( top*(1.0f-ty._w) + bottom*ty._w, s, t, 0, mipmapLevel );
+                }
+            }
+        }
+
+        else if ( filter == ImageUtils::RESIZE_BOX )
+        {
+            std::vector<BoxSpan> cols, rows;
+            computeBoxTable( in_s, out_s, cols );
+            computeBoxTable( in_t, out_t, rows );
+
+            for( unsigned t=0; t<out_t; ++t )
+            {
+                for( unsigned s=0; s<out_s; ++s )
+                {
+                    osg::Vec4 sum;
+                    for( unsigned y=rows[t]._i0; y<rows[t]._i1; ++y )
+                        for( unsigned x=cols[s]._i0; x<cols[s]._i1; ++x )
+                            sum += read(x, y);
+
+                    float count = (float)( (rows[t]._i1-rows[t]._i0) * (cols[s]._i1-cols[s]._i0) );
+                    write( sum/count, s, t, 0, mipmapLevel );
+                }
+            }
+        }
+
+        else
+        {
+            std::vector<unsigned> cols, rows;
+            computeNearestTable( in_s, out_s, cols );
+            computeNearestTable( in_t, out_t, rows );
+
+            for( unsigned t=0; t<out_t; ++t )
+            {
+                for( unsigned s=0; s<out_s; ++s )
+                {
+                    osg::Vec4 color = read( cols[s], rows[t] ); // read pixel from mip level 0
+                    write( color, s, t, 0, mipmapLevel );       // write to target mip level
+                }
+            }
+        }
+    }
+}
+
 bool
 ImageUtils::resizeImage(const osg::Image* input, 
                         unsigned int out_s, unsigned int out_t, 
                         osg::ref_ptr<osg::Image>& output,
-                        unsigned int mipmapLevel )
+                        unsigned int mipmapLevel,
+                        ResizeFilter filter )
 {
     if ( !input && out_s == 0 && out_t == 0 )
         return false;
@@ -219,35 +587,23 @@ ImageUtils::resizeImage(const osg::Image* input,
     {
         memcpy( output->data(), input->data(), input->getTotalSizeInBytes() );
     }
-    else
+    else if (
+        isByteOrFloatImage(input) &&
+        input->getPixelFormat() == output->getPixelFormat() &&
+        input->getDataType()    == output->getDataType() )
     {
-        PixelReader read( input );
-        PixelWriter write( output.get() );
-
-        unsigned int pixel_size_bytes = input->getRowSizeInBytes() / in_s;
-
+        // same layout on both sides: resample whole rows.
         unsigned char* dataOffset = output->getMipmapData(mipmapLevel);
         unsigned int   dataRowSizeBytes = output->getRowSizeInBytes() >> mipmapLevel;
 
-        for( unsigned int output_row=0; output_row < out_t; output_row++ )
-        {
-            // get an appropriate input row
-            float output_row_ratio = (float)output_row/(float)out_t;
-            int input_row = (unsigned int)( output_row_ratio * (float)in_t );
-            if ( input_row >= input->t() ) input_row = in_t-1;
-            else if ( input_row < 0 ) input_row = 0;
-
-            for( unsigned int output_col = 0; output_col < out_s; output_col++ )
-            {
-                float output_col_ratio = (float)output_col/(float)out_s;
-                int input_col = (unsigned int)( output_col_ratio * (float)in_s );
-                if ( input_col >= (int)in_s ) input_col = in_s-1;
-                else if ( input_row < 0 ) input_row = 0;
-
-                osg::Vec4 color = read( input_col, input_row ); // read pixel from mip level 0
-                write( color, output_col, output_row, 0, mipmapLevel ); // write to target mip level
-            }
-        }
+        if ( input->getDataType() == GL_FLOAT )
+            resizeRows<float>( filter, input, out_s, out_t, dataOffset, dataRowSizeBytes );
+        else
+            resizeRows<unsigned char>( filter, input, out_s, out_t, dataOffset, dataRowSizeBytes );
+    }
+    else
+    {
+        resizePixels( filter, input, out_s, out_t, output.get(), mipmapLevel );
     }
 
     return true;
@@ -327,6 +683,24 @@ namespace
             return true;
         }
     };
+
+    // MixImage for a row of 8-bit RGB/BGR (N=3) or RGBA/BGRA (N=4) pixels,
+    // with the same arithmetic.
+    template<unsigned N>
+    void mixRow(const unsigned char* src, unsigned char* dest, unsigned count,
+                float a, bool srcHasAlpha, bool destHasAlpha)
+    {
+        const float scale = 1.0f/255.0f;
+        for( unsigned i=0; i<count; ++i, src += N, dest += N )
+        {
+            float sa = (N == 4 && srcHasAlpha) ? a * (float(src[N-1])*scale) : a;
+            float da = (N == 4 && destHasAlpha) ? float(dest[N-1])*scale : 1.0f;
+            for( unsigned c=0; c<3; ++c )
+                dest[c] = (unsigned char)( (float(dest[c])*scale*(1.0f-sa) + float(src[c])*scale*sa) / scale );
+            if ( N == 4 )
+                dest[N-1] = (unsigned char)( osg::maximum(sa, da) / scale );
+        }
+    }
 }
 
 bool
@@ -342,9 +716,30 @@ ImageUtils::mix(osg::Image* dest, const osg::Image* src, float a)
     PixelVisitor<MixImage> mixer;
     mixer._a = osg::clampBetween( a, 0.0f, 1.0f );
     mixer._srcHasAlpha = src->getPixelSizeInBits() == 32;
-    mixer._destHasAlpha = src->getPixelSizeInBits() == 32;
+    mixer._destHasAlpha = dest->getPixelSizeInBits() == 32;
 
-    mixer.accept( src, dest );  
+    unsigned numChannels = getNumChannels( src->getPixelFormat() );
+
+    if (isByteImage(src) &&
+        src->getPixelFormat() == dest->getPixelFormat() &&
+        src->getDataType()    == dest->getDataType() &&
+        numChannels >= 3 )
+    {
+        for( int r=0; r<src->r(); ++r )
+        {
+            for( int t=0; t<src->t(); ++t )
+            {
+                if ( numChannels == 4 )
+                    mixRow<4>( src->data(0,t,r), dest->data(0,t,r), src->s(), mixer._a, mixer._srcHasAlpha, mixer._destHasAlpha );
+                else
+                    mixRow<3>( src->data(0,t,r), dest->data(0,t,r), src->s(), mixer._a, mixer._srcHasAlpha, mixer._destHasAlpha );
+            }
+        }
+    }
+    else
+    {
+        mixer.accept( src, dest );
+    }
 
     return true;
 }
@@ -547,6 +942,107 @@ ImageUtils::canConvert( const osg::Image* image, GLenum pixelFormat, GLenum data
     return PixelReader::supports( image ) && PixelWriter::supports(pixelFormat, dataType);
 }
 
+namespace
+{
+    // 8-bit pixel conversions with the same channel semantics as
+    // PixelReader/PixelWriter: a missing alpha reads as opaque, luminance
+    // reads as grey and is written from the red channel.
+    template<int Format> struct BytePixel;
+
+    template<> struct BytePixel<GL_RGBA>
+    {
+        enum { size = 4 };
+        static void read (const unsigned char* p, unsigned char* c) { c[0]=p[0]; c[1]=p[1]; c[2]=p[2]; c[3]=p[3]; }
+        static void write(const unsigned char* c, unsigned char* p) { p[0]=c[0]; p[1]=c[1]; p[2]=c[2]; p[3]=c[3]; }
+    };
+
+    template<> struct BytePixel<GL_BGRA>
+    {
+        enum { size = 4 };
+        static void read (const unsigned char* p, unsigned char* c) { c[0]=p[2]; c[1]=p[1]; c[2]=p[0]; c[3]=p[3]; }
+        static void write(const unsigned char* c, unsigned char* p) { p[0]=c[2]; p[1]=c[1]; p[2]=c[0]; p[3]=c[3]; }
+    };
+
+    template<> struct BytePixel<GL_RGB>
+    {
+        enum { size = 3 };
+        static void read (const unsigned char* p, unsigned char* c) { c[0]=p[0]; c[1]=p[1]; c[2]=p[2]; c[3]=255; }
+        static void write(const unsigned char* c, unsigned char* p) { p[0]=c[0]; p[1]=c[1]; p[2]=c[2]; }
+    };
+
+    template<> struct BytePixel<GL_BGR>
+    {
+        enum { size = 3 };
+        static void write(const unsigned char* c, unsigned char* p) { p[0]=c[2]; p[1]=c[1]; p[2]=c[0]; }
+    };
+
+    template<> struct BytePixel<GL_LUMINANCE>
+    {
+        enum { size = 1 };
+        static void read (const unsigned char* p, unsigned char* c) { c[0]=c[1]=c[2]=p[0]; c[3]=255; }
+        static void write(const unsigned char* c, unsigned char* p) { p[0]=c[0]; }
+    };
+
+    template<> struct BytePixel<GL_LUMINANCE_ALPHA>
+    {
+        enum { size = 2 };
+        static void read (const unsigned char* p, unsigned char* c) { c[0]=c[1]=c[2]=p[0]; c[3]=p[1]; }
+        static void write(const unsigned char* c, unsigned char* p) { p[0]=c[0]; p[1]=c[3]; }
+    };
+
+    template<> struct BytePixel<GL_ALPHA>
+    {
+        enum { size = 1 };
+        static void read (const unsigned char* p, unsigned char* c) { c[0]=c[1]=c[2]=255; c[3]=p[0]; }
+        static void write(const unsigned char* c, unsigned char* p) { p[0]=c[3]; }
+    };
+
+    template<int From, int To>
+    void convertByteRow(const unsigned char* src, unsigned char* dst, unsigned count)
+    {
+        unsigned char c[4];
+        for( unsigned i=0; i<count; ++i, src += BytePixel<From>::size, dst += BytePixel<To>::size )
+        {
+            BytePixel<From>::read( src, c );
+            BytePixel<To>::write( c, dst );
+        }
+    }
+
+    typedef void (*ConvertByteRowFunc)(const unsigned char* src, unsigned char* dst, unsigned count);
+
+    template<int From>
+    ConvertByteRowFunc chooseConvertByteRow(GLenum to)
+    {
+        switch( to )
+        {
+        case GL_RGBA:            return &convertByteRow<From, GL_RGBA>;
+        case GL_BGRA:            return &convertByteRow<From, GL_BGRA>;
+        case GL_RGB:             return &convertByteRow<From, GL_RGB>;
+        case GL_BGR:             return &convertByteRow<From, GL_BGR>;
+        case GL_LUMINANCE:       return &convertByteRow<From, GL_LUMINANCE>;
+        case GL_LUMINANCE_ALPHA: return &convertByteRow<From, GL_LUMINANCE_ALPHA>;
+        case GL_ALPHA:           return &convertByteRow<From, GL_ALPHA>;
+        default:                 return 0L;
+        }
+    }
+
+    // Returns 0L if there is no row converter for the combination.
+    // (BGR sources are left to PixelReader, which reads them its own way.)
+    ConvertByteRowFunc chooseConvertByteRow(GLenum from, GLenum to)
+    {
+        switch( from )
+        {
+        case GL_RGBA:            return chooseConvertByteRow<GL_RGBA>( to );
+        case GL_BGRA:            return chooseConvertByteRow<GL_BGRA>( to );
+        case GL_RGB:             return chooseConvertByteRow<GL_RGB>( to );
+        case GL_LUMINANCE:       return chooseConvertByteRow<GL_LUMINANCE>( to );
+        case GL_LUMINANCE_ALPHA: return chooseConvertByteRow<GL_LUMINANCE_ALPHA>( to );
+        case GL_ALPHA:           return chooseConvertByteRow<GL_ALPHA>( to );
+        default:                 return 0L;
+        }
+    }
+}
+
 osg::Image*
 ImageUtils::convert(const osg::Image* image, GLenum pixelFormat, GLenum dataType)
 {
@@ -574,7 +1070,20 @@ ImageUtils::convert(const osg::Image* image, GLenum pixelFormat, GLenum dataType
     else
         result->setInternalTextureFormat( pixelFormat );
 
-    PixelVisitor<CopyImage>().accept( image, result );
+    ConvertByteRowFunc convertRow = 0L;
+    if ( isByteImage(image) && dataType == GL_UNSIGNED_BYTE )
+        convertRow = chooseConvertByteRow( image->getPixelFormat(), pixelFormat );
+
+    if ( convertRow )
+    {
+        for( int r=0; r<image->r(); ++r )
+            for( int t=0; t<image->t(); ++t )
+                convertRow( image->data(0,t,r), result->data(0,t,r), image->s() );
+    }
+    else
+    {
+        PixelVisitor<CopyImage>().accept( image, result );
+    }
 
     return result;
 }
@@ -656,12 +1165,75 @@ ImageUtils::featherAlphaRegions(osg::Image* image, float maxAlpha)
     if ( !PixelReader::supports(image) || !PixelWriter::supports(image) )
         return false;
 
-    PixelReader read (image);
-    PixelWriter write(image);
-
     int ns = image->s();
     int nt = image->t();
 
+    int alpha = getAlphaChannel( image->getPixelFormat() );
+    if ( isByteImage(image) && alpha >= 0 )
+    {
+        // 8-bit with alpha: test the alpha bytes and copy whole pixels,
+        // with the same threshold decisions as the generic path below.
+        bool clear[256];
+        for( unsigned v=0; v<256; ++v )
+            clear[v] = float(v) * (1.0f/255.0f) <= maxAlpha;
+
+        const unsigned size = getNumChannels( image->getPixelFormat() );
+
+        for( int t=0; t<nt; ++t )
+        {
+            unsigned char* row = image->data(0, t);
+            bool rowdone = false;
+            for( int s=0; s<ns && !rowdone; ++s )
+            {
+                unsigned char* p = row + s*size;
+                if ( clear[p[alpha]] )
+                {
+                    bool wrote = false;
+                    if ( s < ns-1 && !clear[p[size+alpha]] ) {
+                        memcpy( p, p+size, size );
+                        wrote = true;
+                    }
+                    if ( !wrote && s > 0 && !clear[p[alpha-(int)size]] ) {
+                        memcpy( p, p-size, size );
+                        rowdone = true;
+                    }
+                }
+            }
+        }
+
+        for( int s=0; s<ns; ++s )
+        {
+            bool coldone = false;
+            for( int t=0; t<nt && !coldone; ++t )
+            {
+                unsigned char* p = image->data(s, t);
+                if ( clear[p[alpha]] )
+                {
+                    bool wrote = false;
+                    if ( t < nt-1 ) {
+                        unsigned char* n = image->data(s, t+1);
+                        if ( !clear[n[alpha]] ) {
+                            memcpy( p, n, size );
+                            wrote = true;
+                        }
+                    }
+                    if ( !wrote && t > 0 ) {
+                        unsigned char* n = image->data(s, t-1);
+                        if ( !clear[n[alpha]] ) {
+                            memcpy( p, n, size );
+                            coldone = true;
+                        }
+                    }
+                }
+            }
+        }
+
+        return true;
+    }
+
+    PixelReader read (image);
+    PixelWriter write(image);
+
     osg::Vec4 n;
 
     for( int t=0; t<nt; ++t )
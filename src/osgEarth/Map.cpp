@@ -111,6 +111,9 @@ _dataModelRevision   ( 0 )
     // set up a callback that the Map will use to detect Elevation Layer
     // visibility changes
     _elevationLayerCB = new ElevationLayerCB(this);
+
+    // publish the (empty) initial model.
+    publishSnapshot();
 }
 
 Map::~Map()
@@ -126,6 +129,7 @@ Map::notifyElevationLayerVisibleChanged(TerrainLayer* layer)
     {
         Threading::ScopedWriteLock lock( const_cast<Map*>(this)->_mapDataMutex );
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
 
     // a separate block b/c we don't need the mutex   
@@ -159,27 +163,26 @@ Map::setGlobalOptions( const osgDB::Options* options )
 Revision
 Map::getImageLayers( ImageLayerVector& out_list ) const
 {
-    out_list.reserve( _imageLayers.size() );
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
 
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+    out_list.reserve( snapshot->_imageLayers.size() );
+    for( ImageLayerVector::const_iterator i = snapshot->_imageLayers.begin(); i != snapshot->_imageLayers.end(); ++i )
         out_list.push_back( i->get() );
 
-    return _dataModelRevision;
+    return snapshot->_revision;
 }
 
 int
 Map::getNumImageLayers() const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    return _imageLayers.size();
+    return getModelSnapshot()->_imageLayers.size();
 }
 
 ImageLayer*
 Map::getImageLayerByName( const std::string& name ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
+    for( ImageLayerVector::const_iterator i = snapshot->_imageLayers.begin(); i != snapshot->_imageLayers.end(); ++i )
         if ( i->get()->getName() == name )
             return i->get();
     return 0L;
@@ -188,8 +191,8 @@ Map::getImageLayerByName( const std::string& name ) const
 ImageLayer*
 Map::getImageLayerByUID( UID layerUID ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
+    for( ImageLayerVector::const_iterator i = snapshot->_imageLayers.begin(); i != snapshot->_imageLayers.end(); ++i )
         if ( i->get()->getUID() == layerUID )
             return i->get();
     return 0L;
@@ -198,9 +201,9 @@ Map::getImageLayerByUID( UID layerUID ) const
 ImageLayer*
 Map::getImageLayerAt( int index ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    if ( index >= 0 && index < (int)_imageLayers.size() )
-        return _imageLayers[index].get();
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
+    if ( index >= 0 && index < (int)snapshot->_imageLayers.size() )
+        return snapshot->_imageLayers[index].get();
     else
         return 0L;
 }
@@ -208,27 +211,26 @@ Map::getImageLayerAt( int index ) const
 Revision
 Map::getElevationLayers( ElevationLayerVector& out_list ) const
 {
-    out_list.reserve( _elevationLayers.size() );
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
 
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ElevationLayerVector::const_iterator i = _elevationLayers.begin(); i != _elevationLayers.end(); ++i )
+    out_list.reserve( snapshot->_elevationLayers.size() );
+    for( ElevationLayerVector::const_iterator i = snapshot->_elevationLayers.begin(); i != snapshot->_elevationLayers.end(); ++i )
         out_list.push_back( i->get() );
 
-    return _dataModelRevision;
+    return snapshot->_revision;
 }
 
 int
 Map::getNumElevationLayers() const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    return _elevationLayers.size();
+    return getModelSnapshot()->_elevationLayers.size();
 }
 
 ElevationLayer*
 Map::getElevationLayerByName( const std::string& name ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ElevationLayerVector::const_iterator i = _elevationLayers.begin(); i != _elevationLayers.end(); ++i )
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
+    for( ElevationLayerVector::const_iterator i = snapshot->_elevationLayers.begin(); i != snapshot->_elevationLayers.end(); ++i )
         if ( i->get()->getName() == name )
             return i->get();
     return 0L;
@@ -237,8 +239,8 @@ Map::getElevationLayerByName( const std::string& name ) const
 ElevationLayer*
 Map::getElevationLayerByUID( UID layerUID ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ElevationLayerVector::const_iterator i = _elevationLayers.begin(); i != _elevationLayers.end(); ++i )
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
+    for( ElevationLayerVector::const_iterator i = snapshot->_elevationLayers.begin(); i != snapshot->_elevationLayers.end(); ++i )
         if ( i->get()->getUID() == layerUID )
             return i->get();
     return 0L;
@@ -247,9 +249,9 @@ Map::getElevationLayerByUID( UID layerUID ) const
 ElevationLayer*
 Map::getElevationLayerAt( int index ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    if ( index >= 0 && index < (int)_elevationLayers.size() )
-        return _elevationLayers[index].get();
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
+    if ( index >= 0 && index < (int)snapshot->_elevationLayers.size() )
+        return snapshot->_elevationLayers[index].get();
     else
         return 0L;
 }
@@ -257,20 +259,20 @@ Map::getElevationLayerAt( int index ) const
 Revision
 Map::getModelLayers( ModelLayerVector& out_list ) const
 {
-    out_list.reserve( _modelLayers.size() );
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
 
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ModelLayerVector::const_iterator i = _modelLayers.begin(); i != _modelLayers.end(); ++i )
+    out_list.reserve( snapshot->_modelLayers.size() );
+    for( ModelLayerVector::const_iterator i = snapshot->_modelLayers.begin(); i != snapshot->_modelLayers.end(); ++i )
         out_list.push_back( i->get() );
 
-    return _dataModelRevision;
+    return snapshot->_revision;
 }
 
 ModelLayer*
 Map::getModelLayerByName( const std::string& name ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ModelLayerVector::const_iterator i = _modelLayers.begin(); i != _modelLayers.end(); ++i )
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
+    for( ModelLayerVector::const_iterator i = snapshot->_modelLayers.begin(); i != snapshot->_modelLayers.end(); ++i )
         if ( i->get()->getName() == name )
             return i->get();
     return 0L;
@@ -279,8 +281,8 @@ Map::getModelLayerByName( const std::string& name ) const
 ModelLayer*
 Map::getModelLayerByUID( UID layerUID ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    for( ModelLayerVector::const_iterator i = _modelLayers.begin(); i != _modelLayers.end(); ++i )
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
+    for( ModelLayerVector::const_iterator i = snapshot->_modelLayers.begin(); i != snapshot->_modelLayers.end(); ++i )
         if ( i->get()->getUID() == layerUID )
             return i->get();
     return 0L;
@@ -290,9 +292,9 @@ Map::getModelLayerByUID( UID layerUID ) const
 ModelLayer*
 Map::getModelLayerAt( int index ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
-    if ( index >= 0 && index < (int)_modelLayers.size() )
-        return _modelLayers[index].get();
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
+    if ( index >= 0 && index < (int)snapshot->_modelLayers.size() )
+        return snapshot->_modelLayers[index].get();
     else
         return 0L;
 }
@@ -300,20 +302,19 @@ Map::getModelLayerAt( int index ) const
 int
 Map::getNumModelLayers() const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    return _modelLayers.size();
+    return getModelSnapshot()->_modelLayers.size();
 }
 
 int
 Map::getTerrainMaskLayers( MaskLayerVector& out_list ) const
 {
-    out_list.reserve( _terrainMaskLayers.size() );
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
 
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    for( MaskLayerVector::const_iterator i = _terrainMaskLayers.begin(); i != _terrainMaskLayers.end(); ++i )
+    out_list.reserve( snapshot->_maskLayers.size() );
+    for( MaskLayerVector::const_iterator i = snapshot->_maskLayers.begin(); i != snapshot->_maskLayers.end(); ++i )
         out_list.push_back( i->get() );
 
-    return _dataModelRevision;
+    return snapshot->_revision;
 }
 
 void
@@ -324,8 +325,39 @@ Map::setName( const std::string& name ) {
 Revision
 Map::getDataModelRevision() const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-    return _dataModelRevision;
+    return (Revision)(unsigned)_publishedRevision;
+}
+
+osg::ref_ptr<const Map::ModelSnapshot>
+Map::getModelSnapshot() const
+{
+    // the lock only covers taking a reference; snapshots are immutable.
+    Threading::ScopedMutexLock lock( _snapshotMutex );
+    osg::ref_ptr<const ModelSnapshot> snapshot = _snapshot.get();
+    return snapshot;
+}
+
+void
+Map::publishSnapshot()
+{
+    // build the new snapshot outside the pointer lock so that readers
+    // are not held up by the copy.
+    osg::ref_ptr<ModelSnapshot> snapshot = new ModelSnapshot();
+    snapshot->_revision        = _dataModelRevision;
+    snapshot->_imageLayers     = _imageLayers;
+    snapshot->_elevationLayers = _elevationLayers;
+    snapshot->_modelLayers     = _modelLayers;
+    snapshot->_maskLayers      = _terrainMaskLayers;
+
+    // swap, so that the old snapshot (if this was its last reference) is
+    // released after the lock, not under it.
+    osg::ref_ptr<const ModelSnapshot> old = snapshot.get();
+    {
+        Threading::ScopedMutexLock lock( _snapshotMutex );
+        _snapshot.swap( old );
+    }
+
+    _publishedRevision.exchange( (unsigned)_dataModelRevision );
 }
 
 const Profile*
@@ -455,6 +487,7 @@ Map::addImageLayer( ImageLayer* layer )
             _imageLayers.push_back( layer );
             index = _imageLayers.size() - 1;
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // a separate block b/c we don't need the mutex   
@@ -495,6 +528,7 @@ Map::insertImageLayer( ImageLayer* layer, unsigned int index )
                 _imageLayers.insert( _imageLayers.begin() + index, layer );
 
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // a separate block b/c we don't need the mutex   
@@ -532,6 +566,7 @@ Map::addElevationLayer( ElevationLayer* layer )
             _elevationLayers.push_back( layer );
             index = _elevationLayers.size() - 1;
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // listen for changes in the layer.
@@ -565,6 +600,7 @@ Map::removeImageLayer( ImageLayer* layer )
             {
                 _imageLayers.erase( i );
                 newRevision = ++_dataModelRevision;
+                publishSnapshot();
                 break;
             }
         }
@@ -601,6 +637,7 @@ Map::removeElevationLayer( ElevationLayer* layer )
             {
                 _elevationLayers.erase( i );
                 newRevision = ++_dataModelRevision;
+                publishSnapshot();
                 break;
             }
         }
@@ -653,6 +690,7 @@ Map::moveImageLayer( ImageLayer* layer, unsigned int newIndex )
         _imageLayers.insert( _imageLayers.begin() + newIndex, layerToMove.get() );
 
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
 
     // a separate block b/c we don't need the mutex
@@ -700,6 +738,7 @@ Map::moveElevationLayer( ElevationLayer* layer, unsigned int newIndex )
         _elevationLayers.insert( _elevationLayers.begin() + newIndex, layerToMove.get() );
 
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
 
     // a separate block b/c we don't need the mutex
@@ -726,6 +765,7 @@ Map::addModelLayer( ModelLayer* layer )
             _modelLayers.push_back( layer );
             index = _modelLayers.size() - 1;
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // initialize the model layer
@@ -750,6 +790,7 @@ Map::insertModelLayer( ModelLayer* layer, unsigned int index )
             Threading::ScopedWriteLock lock( _mapDataMutex );
             _modelLayers.insert( _modelLayers.begin() + index, layer );
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // initialize the model layer
@@ -781,6 +822,7 @@ Map::removeModelLayer( ModelLayer* layer )
                 {
                     _modelLayers.erase( i );
                     newRevision = ++_dataModelRevision;
+                    publishSnapshot();
                     break;
                 }
             }
@@ -828,6 +870,7 @@ Map::moveModelLayer( ModelLayer* layer, unsigned int newIndex )
         _modelLayers.insert( _modelLayers.begin() + newIndex, layerToMove.get() );
 
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
 
     // a separate block b/c we don't need the mutex
@@ -851,6 +894,7 @@ Map::addTerrainMaskLayer( MaskLayer* layer )
             Threading::ScopedWriteLock lock( _mapDataMutex );
             _terrainMaskLayers.push_back(layer);
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         layer->initialize( _dbOptions.get(), this );
@@ -880,6 +924,7 @@ Map::removeTerrainMaskLayer( MaskLayer* layer )
                 {
                     _terrainMaskLayers.erase( i );
                     newRevision = ++_dataModelRevision;
+                    publishSnapshot();
                     break;
                 }
             }
@@ -913,6 +958,7 @@ Map::clear()
 
         // calculate a new revision.
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
     
     // a separate block b/c we don't need the mutex   
@@ -1095,11 +1141,11 @@ Map::getHeightField(const TileKey&                  key,
                     ElevationSamplePolicy           samplePolicy,
                     ProgressCallback*               progress) const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
 
     ElevationInterpolation interp = getMapOptions().elevationInterpolation().get();    
 
-    return _elevationLayers.createHeightField(
+    return snapshot->_elevationLayers.createHeightField(
         key, 
         fallback, 
         convertToHAE ? _profileNoVDatum.get() : 0L,
@@ -1119,49 +1165,19 @@ Map::getWorldSRS() const
 bool
 Map::sync( MapFrame& frame ) const
 {
-    bool result = false;
+    // cheap check first; this does not lock anything.
+    if ( frame._initialized && frame._mapDataModelRevision == getDataModelRevision() )
+        return false;
 
-    if ( frame._mapDataModelRevision != _dataModelRevision || !frame._initialized )
-    {
-        // hold the read lock while copying the layer lists.
-        Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
-
-        if ( frame._parts & IMAGE_LAYERS )
-        {
-            if ( !frame._initialized )
-                frame._imageLayers.reserve( _imageLayers.size() );
-            frame._imageLayers.clear();
-            std::copy( _imageLayers.begin(), _imageLayers.end(), std::back_inserter(frame._imageLayers) );
-        }
+    osg::ref_ptr<const ModelSnapshot> snapshot = getModelSnapshot();
 
-        if ( frame._parts & ELEVATION_LAYERS )
-        {
-            frame._elevationLayers = _elevationLayers;
-            if ( _mapOptions.elevationTileSize().isSet() )
-                frame._elevationLayers.setExpressTileSize( *_mapOptions.elevationTileSize() );
-        }
+    if ( frame._initialized && frame._mapDataModelRevision == snapshot->_revision )
+        return false;
 
-        if ( frame._parts & MODEL_LAYERS )
-        {
-            if ( !frame._initialized )
-                frame._modelLayers.reserve( _modelLayers.size() );
-            frame._modelLayers.clear();
-            std::copy( _modelLayers.begin(), _modelLayers.end(), std::back_inserter(frame._modelLayers) );
-        }
-
-        if ( frame._parts & MASK_LAYERS )
-        {
-          if ( !frame._initialized )
-              frame._maskLayers.reserve( _terrainMaskLayers.size() );
-          frame._maskLayers.clear();
-          std::copy( _terrainMaskLayers.begin(), _terrainMaskLayers.end(), std::back_inserter(frame._maskLayers) );
-        }
+    // no copying; the frame just shares the published snapshot.
+    frame.setSnapshot( snapshot.get() );
+    frame._initialized = true;
+    frame._mapDataModelRevision = snapshot->_revision;
 
-        // sync the revision numbers.
-        frame._initialized = true;
-        frame._mapDataModelRevision = _dataModelRevision;
-            
-        result = true;
-    }    
-    return result;
+    return true;
 }
@@ -22,6 +22,15 @@ using namespace osgEarth;
 
 #define LC "[MapFrame] "
 
+namespace
+{
+    // stand-ins for the parts of the model a frame does not track.
+    const ImageLayerVector     s_noImageLayers;
+    const ElevationLayerVector s_noElevationLayers;
+    const ModelLayerVector     s_noModelLayers;
+    const MaskLayerVector      s_noMaskLayers;
+}
+
 
 MapFrame::MapFrame( const Map* map, Map::ModelParts parts, const std::string& name ) :
 _initialized( false ),
@@ -30,6 +39,7 @@ _name       ( name ),
 _mapInfo    ( map ),
 _parts      ( parts )
 {
+    setSnapshot( 0L );
     sync();
 }
 
@@ -40,13 +50,22 @@ _map                 ( src._map.get() ),
 _name                ( name ),
 _mapInfo             ( src._mapInfo ),
 _parts               ( src._parts ),
-_mapDataModelRevision( src._mapDataModelRevision ),
-_imageLayers         ( src._imageLayers ),
-_elevationLayers     ( src._elevationLayers ),
-_modelLayers         ( src._modelLayers ),
-_maskLayers          ( src._maskLayers )
+_mapDataModelRevision( src._mapDataModelRevision )
+{
+    //no sync required here; we share the source's snapshot
+    setSnapshot( src._snapshot.get() );
+}
+
+
+void
+MapFrame::setSnapshot( const Map::ModelSnapshot* snapshot )
 {
-    //no sync required here; we copied the arrays etc
+    _snapshot = snapshot;
+
+    _imageLayers     = snapshot && (_parts & Map::IMAGE_LAYERS)     ? &snapshot->_imageLayers     : &s_noImageLayers;
+    _elevationLayers = snapshot && (_parts & Map::ELEVATION_LAYERS) ? &snapshot->_elevationLayers : &s_noElevationLayers;
+    _modelLayers     = snapshot && (_parts & Map::MODEL_LAYERS)     ? &snapshot->_modelLayers     : &s_noModelLayers;
+    _maskLayers      = snapshot && (_parts & Map::MASK_LAYERS)      ? &snapshot->_maskLayers      : &s_noMaskLayers;
 }
 
 
@@ -55,16 +74,14 @@ MapFrame::sync()
 {
     bool changed = false;
 
-    if ( _map.valid() )
+    osg::ref_ptr<const Map> map;
+    if ( _map.lock(map) )
     {
-        changed = _map->sync( *this );        
+        changed = map->sync( *this );
     }
     else
     {
-        _imageLayers.clear();
-        _elevationLayers.clear();
-        _modelLayers.clear();
-        _maskLayers.clear();        
+        setSnapshot( 0L );
     }
 
     return changed;
@@ -94,7 +111,7 @@ MapFrame::getHeightField(const TileKey&                  key,
     
 
 
-    return _elevationLayers.createHeightField(
+    return _elevationLayers->createHeightField(
         key,
         fallback, 
         convertToHAE ? _map->getProfileNoVDatum() : 0L,
@@ -109,31 +126,31 @@ MapFrame::getHeightField(const TileKey&                  key,
 int
 MapFrame::indexOf( ImageLayer* layer ) const
 {
-    ImageLayerVector::const_iterator i = std::find( _imageLayers.begin(), _imageLayers.end(), layer );
-    return i != _imageLayers.end() ? i - _imageLayers.begin() : -1;
+    ImageLayerVector::const_iterator i = std::find( _imageLayers->begin(), _imageLayers->end(), layer );
+    return i != _imageLayers->end() ? i - _imageLayers->begin() : -1;
 }
 
 
 int
 MapFrame::indexOf( ElevationLayer* layer ) const
 {
-    ElevationLayerVector::const_iterator i = std::find( _elevationLayers.begin(), _elevationLayers.end(), layer );
-    return i != _elevationLayers.end() ? i - _elevationLayers.begin() : -1;
+    ElevationLayerVector::const_iterator i = std::find( _elevationLayers->begin(), _elevationLayers->end(), layer );
+    return i != _elevationLayers->end() ? i - _elevationLayers->begin() : -1;
 }
 
 
 int
 MapFrame::indexOf( ModelLayer* layer ) const
 {
-    ModelLayerVector::const_iterator i = std::find( _modelLayers.begin(), _modelLayers.end(), layer );
-    return i != _modelLayers.end() ? i - _modelLayers.begin() : -1;
+    ModelLayerVector::const_iterator i = std::find( _modelLayers->begin(), _modelLayers->end(), layer );
+    return i != _modelLayers->end() ? i - _modelLayers->begin() : -1;
 }
 
 
 ImageLayer*
 MapFrame::getImageLayerByUID( UID uid ) const
 {
-    for(ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+    for(ImageLayerVector::const_iterator i = _imageLayers->begin(); i != _imageLayers->end(); ++i )
         if ( i->get()->getUID() == uid )
             return i->get();
     return 0L;
@@ -143,7 +160,7 @@ MapFrame::getImageLayerByUID( UID uid ) const
 ImageLayer*
 MapFrame::getImageLayerByName( const std::string& name ) const
 {
-    for(ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+    for(ImageLayerVector::const_iterator i = _imageLayers->begin(); i != _imageLayers->end(); ++i )
         if ( i->get()->getName() == name )
             return i->get();
     return 0L;
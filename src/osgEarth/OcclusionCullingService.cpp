@@ -0,0 +1,421 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/OcclusionCullingService>
+#include <osgGA/GUIActionAdapter>
+#include <osgUtil/CullVisitor>
+#include <osg/Timer>
+#include <cmath>
+
+#define LC "[OcclusionCullingService] "
+
+using namespace osgEarth;
+
+namespace
+{
+    // horizon buffer resolution
+    const unsigned NUM_AZIMUTHS = 256;
+    const unsigned NUM_STEPS    = 64;
+
+    // distance of the first terrain sample from the eye
+    const double MIN_STEP = 25.0;
+
+    // the buffer covers this much more than the farthest point, so that
+    // points moving outward do not force a rebuild
+    const double RANGE_MARGIN = 1.25;
+
+    // eye movement (meters) that invalidates the buffer
+    const double EYE_TOLERANCE = 1.0;
+
+    // points are tested against the terrain up to this fraction of their
+    // distance, so the ground under a point does not hide it
+    const double NEAR_FRACTION = 0.95;
+}
+
+//------------------------------------------------------------------------
+
+struct OcclusionCullingService::TestTask : public TaskRequest
+{
+    TestTask( OcclusionCullingService* service, ViewData* data, Batch* batch, osg::View* view ) :
+        _service( service ),
+        _data   ( data ),
+        _batch  ( batch ),
+        _view   ( view ) { }
+
+    void operator()( ProgressCallback* progress )
+    {
+        osg::ref_ptr<Results> results = new Results();
+        _service->test( _data.get(), *_batch.get(), *results.get() );
+
+        bool changed;
+        {
+            Threading::ScopedMutexLock lock( _data->_mutex );
+            changed =
+                !_data->_published.valid() ||
+                _data->_published->_visible != results->_visible;
+            _data->_published = results.get();
+            _data->_busy = false;
+        }
+
+        // new answers only show up in the next frame; make sure there is one.
+        osg::ref_ptr<osg::View> view;
+        if ( changed && _view.lock(view) )
+        {
+            osgGA::GUIActionAdapter* aa = dynamic_cast<osgGA::GUIActionAdapter*>( view.get() );
+            if ( aa )
+                aa->requestRedraw();
+        }
+    }
+
+    OcclusionCullingService*     _service;  // the service outlives its task service
+    osg::ref_ptr<ViewData>       _data;
+    osg::ref_ptr<Batch>          _batch;
+    osg::observer_ptr<osg::View> _view;
+};
+
+//------------------------------------------------------------------------
+
+// Installed on each camera that submits points; ships the points gathered
+// during the camera's cull once the traversal is done.
+struct OcclusionCullingService::FlushCallback : public osg::NodeCallback
+{
+    FlushCallback( OcclusionCullingService* service ) : _service( service ) { }
+
+    void operator()( osg::Node* node, osg::NodeVisitor* nv )
+    {
+        traverse( node, nv );
+
+        osg::ref_ptr<OcclusionCullingService> service;
+        osg::Camera* camera = dynamic_cast<osg::Camera*>( node );
+        if ( camera && _service.lock(service) )
+        {
+            ViewData* view = service->getViewData( camera, false );
+            if ( view )
+                service->flush( view, camera->getView() );
+        }
+    }
+
+    osg::observer_ptr<OcclusionCullingService> _service;
+};
+
+//------------------------------------------------------------------------
+
+OcclusionCullingService::OcclusionCullingService(TerrainHeightIndex*     index,
+                                                 const SpatialReference* srs,
+                                                 bool                    geocentric) :
+_index     ( index ),
+_srs       ( srs ),
+_geocentric( geocentric ),
+_nextID    ( 0 )
+{
+    _taskService = new TaskService( "Occlusion culling", 1 );
+}
+
+OcclusionCullingService::~OcclusionCullingService()
+{
+    // stop the tasks before the state they work on goes away.
+    _taskService = 0L;
+}
+
+unsigned
+OcclusionCullingService::allocateID()
+{
+    Threading::ScopedMutexLock lock( _idMutex );
+    if ( !_freeIDs.empty() )
+    {
+        unsigned id = _freeIDs.back();
+        _freeIDs.pop_back();
+        return id;
+    }
+    return _nextID++;
+}
+
+void
+OcclusionCullingService::releaseID( unsigned id )
+{
+    Threading::ScopedMutexLock lock( _idMutex );
+    _freeIDs.push_back( id );
+}
+
+bool
+OcclusionCullingService::isVisible(osgUtil::CullVisitor* cv,
+                                   unsigned              id,
+                                   const osg::Vec3d&     world,
+                                   double                maxAltitude)
+{
+    osg::Camera* camera = cv->getCurrentCamera();
+    ViewData*    view   = getViewData( camera, true );
+
+    unsigned frame = cv->getFrameStamp() ? cv->getFrameStamp()->getFrameNumber() : 0u;
+    if ( frame != view->_frame )
+    {
+        // first point of a new frame: pick up the latest answers. The cull
+        // of a camera runs on one thread, so the gather state needs no lock.
+        // The points are normally shipped by the camera's FlushCallback; this
+        // catches any left over from a cull that did not run the callback,
+        // such as the one that installed it.
+        flush( view, camera->getView() );
+
+        view->_frame = frame;
+        view->_eye   = cv->getViewPoint();
+
+        Threading::ScopedMutexLock lock( view->_mutex );
+        view->_current = view->_published.get();
+    }
+
+    view->_points.push_back( Point(id, world, maxAltitude) );
+
+    const Results* results = view->_current.get();
+    return
+        !results ||
+        id >= results->_visible.size() ||
+        results->_visible[id] != 0;
+}
+
+unsigned
+OcclusionCullingService::getNumViews() const
+{
+    Threading::ScopedReadLock shared( _viewsMutex );
+    return _views.size();
+}
+
+OcclusionCullingService::ViewData*
+OcclusionCullingService::getViewData( osg::Camera* camera, bool create )
+{
+    // an entry whose camera is gone is stale, even if a new camera now
+    // lives at the same address.
+    {
+        Threading::ScopedReadLock shared( _viewsMutex );
+        ViewDataMap::const_iterator i = _views.find( camera );
+        if ( i != _views.end() && i->second->_camera.get() == camera )
+            return i->second.get();
+    }
+
+    if ( !create )
+        return 0L;
+
+    Threading::ScopedWriteLock exclusive( _viewsMutex );
+
+    ViewDataMap::iterator i = _views.find( camera );
+    if ( i != _views.end() && i->second->_camera.get() == camera )
+        return i->second.get();
+
+    // a new camera; drop the state of cameras that have been deleted.
+    for( i = _views.begin(); i != _views.end(); )
+    {
+        if ( !i->second->_camera.valid() )
+            _views.erase( i++ );
+        else
+            ++i;
+    }
+
+    ViewData* view = new ViewData();
+    view->_camera = camera;
+    _views[camera] = view;
+
+    camera->addCullCallback( new FlushCallback(this) );
+
+    OE_DEBUG << LC << "Tracking " << _views.size() << " cameras" << std::endl;
+    return view;
+}
+
+void
+OcclusionCullingService::flush( ViewData* view, osg::View* osgView )
+{
+    if ( view->_points.empty() )
+        return;
+
+    {
+        Threading::ScopedMutexLock lock( view->_mutex );
+
+        // still working on an earlier batch; drop this one and keep the old
+        // answers. The next frame submits a fresh batch anyway.
+        if ( view->_busy )
+        {
+            view->_points.clear();
+            return;
+        }
+        view->_busy = true;
+    }
+
+    osg::ref_ptr<Batch> batch = new Batch();
+    batch->_eye = view->_eye;
+    batch->_points.swap( view->_points );
+
+    _taskService->add( new TestTask(this, view, batch.get(), osgView) );
+}
+
+void
+OcclusionCullingService::test(ViewData*    view,
+                              const Batch& batch,
+                              Results&     results)
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    unsigned maxID = 0;
+    for( std::vector<Point>::const_iterator p = batch._points.begin(); p != batch._points.end(); ++p )
+        maxID = osg::maximum( maxID, p->_id );
+    results._visible.assign( maxID+1, 1 );
+
+    if ( !_index.valid() || !_srs.valid() )
+        return;
+
+    const osg::Vec3d& eye = batch._eye;
+
+    osg::Vec3d eyeMap;
+    if ( !_srs->transformFromWorld(eye, eyeMap) )
+        return;
+
+    // local tangent frame at the eye:
+    osg::Matrixd local2world;
+    if ( _geocentric && _srs->getEllipsoid() )
+        _srs->getEllipsoid()->computeLocalToWorldTransformFromXYZ( eye.x(), eye.y(), eye.z(), local2world );
+    else
+        local2world.makeTranslate( eye );
+
+    osg::Matrixd world2local = osg::Matrixd::inverse( local2world );
+
+    // collect the points that need a terrain test and the range they span.
+    std::vector<unsigned> candidates;
+    std::vector<osg::Vec3d> locals;
+    double range = 0.0;
+
+    for( unsigned i = 0; i < batch._points.size(); ++i )
+    {
+        const Point& p = batch._points[i];
+        if ( eyeMap.z() > p._maxAltitude )
+            continue;
+
+        osg::Vec3d local = p._world * world2local;
+        range = osg::maximum( range, sqrt(local.x()*local.x() + local.y()*local.y()) );
+        candidates.push_back( i );
+        locals.push_back( local );
+    }
+
+    if ( candidates.empty() )
+        return;
+
+    Horizon& horizon = view->_horizon;
+    if (!horizon._valid ||
+        (horizon._eye - eye).length2() > EYE_TOLERANCE*EYE_TOLERANCE ||
+        horizon._range < range )
+    {
+        buildHorizon( horizon, eye, local2world, range*RANGE_MARGIN );
+    }
+
+    const double twoPI = 2.0*osg::PI;
+
+    for( unsigned c = 0; c < candidates.size(); ++c )
+    {
+        const osg::Vec3d& local = locals[c];
+
+        double dist = NEAR_FRACTION * sqrt(local.x()*local.x() + local.y()*local.y());
+        if ( dist <= MIN_STEP || horizon._logRatio <= 0.0 )
+            continue;
+
+        double len = local.length();
+        if ( len <= 0.0 )
+            continue;
+
+        unsigned step = (unsigned)( log(dist/MIN_STEP) / horizon._logRatio );
+        if ( step >= NUM_STEPS )
+            step = NUM_STEPS-1;
+
+        double az = atan2( local.y(), local.x() );
+        if ( az < 0.0 )
+            az += twoPI;
+        unsigned bin = (unsigned)( az/twoPI * (double)NUM_AZIMUTHS ) % NUM_AZIMUTHS;
+
+        float sinTarget = (float)( local.z()/len );
+        if ( sinTarget < horizon._sinAngles[bin*NUM_STEPS + step] )
+        {
+            results._visible[batch._points[candidates[c]]._id] = 0;
+        }
+    }
+
+    OE_DEBUG << LC << "Tested " << candidates.size() << " points in "
+        << osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() )
+        << " ms" << std::endl;
+}
+
+void
+OcclusionCullingService::buildHorizon(Horizon&            horizon,
+                                      const osg::Vec3d&   eye,
+                                      const osg::Matrixd& local2world,
+                                      double              range)
+{
+    horizon._valid       = true;
+    horizon._eye         = eye;
+    horizon._range       = range;
+    horizon._logRatio    = range > MIN_STEP ? log(range/MIN_STEP) / (double)(NUM_STEPS-1) : 0.0;
+    horizon._sinAngles.assign( NUM_AZIMUTHS*NUM_STEPS, -1.0f );
+
+    if ( horizon._logRatio <= 0.0 )
+        return;
+
+    osg::Vec3d up = osg::Matrixd::transform3x3( osg::Vec3d(0,0,1), local2world );
+    up.normalize();
+
+    // the index holds HAE but transformToWorld expects heights in the SRS's
+    // vertical datum, so samples are converted back to it first.
+    const VerticalDatum* vdatum = _srs->getVerticalDatum();
+
+    // sample distances grow geometrically; nearby relief matters most.
+    std::vector<double> steps( NUM_STEPS );
+    for( unsigned s = 0; s < NUM_STEPS; ++s )
+        steps[s] = MIN_STEP * exp( horizon._logRatio * (double)s );
+
+    for( unsigned a = 0; a < NUM_AZIMUTHS; ++a )
+    {
+        double az = 2.0*osg::PI * ((double)a + 0.5) / (double)NUM_AZIMUTHS;
+        double dx = cos(az), dy = sin(az);
+
+        float maxSin = -1.0f;
+        float* row = &horizon._sinAngles[a*NUM_STEPS];
+
+        for( unsigned s = 0; s < NUM_STEPS; ++s )
+        {
+            osg::Vec3d ground = osg::Vec3d(dx*steps[s], dy*steps[s], 0.0) * local2world;
+
+            osg::Vec3d map;
+            double     height;
+            if (_srs->transformFromWorld(ground, map) &&
+                _index->getHeight(map.x(), map.y(), height) )
+            {
+                if ( vdatum )
+                {
+                    double lon = map.x(), lat = map.y();
+                    if ( !_srs->isGeographic() )
+                        _srs->transform2D( map.x(), map.y(), _srs->getGeographicSRS(), lon, lat );
+                    height = vdatum->hae2msl( lat, lon, height );
+                }
+
+                osg::Vec3d terrain;
+                if ( _srs->transformToWorld(osg::Vec3d(map.x(), map.y(), height), terrain) )
+                {
+                    osg::Vec3d v = terrain - eye;
+                    double len = v.length();
+                    if ( len > 0.0 )
+                        maxSin = osg::maximum( maxSin, (float)((v*up)/len) );
+                }
+            }
+
+            row[s] = maxSin;
+        }
+    }
+}
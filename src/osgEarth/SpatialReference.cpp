@@ -1440,6 +1440,186 @@ bool SpatialReference::transformExtentPoints(const SpatialReference* to_srs,
     return false;
 }
 
+namespace
+{
+    // A cell of the transformExtentPointsOnGrid grid: point index bounds
+    // (inclusive) and the transformed locations of its corners.
+    struct GridCell
+    {
+        unsigned _c0, _c1, _r0, _r1;
+        osg::Vec3d _p00, _p10, _p01, _p11;
+
+        osg::Vec3d interpolate( unsigned c, unsigned r ) const
+        {
+            double u = _c1 > _c0 ? (double)(c - _c0) / (double)(_c1 - _c0) : 0.0;
+            double v = _r1 > _r0 ? (double)(r - _r0) / (double)(_r1 - _r0) : 0.0;
+            return
+                _p00 * ((1.0-u)*(1.0-v)) + _p10 * (u*(1.0-v)) +
+                _p01 * ((1.0-u)*v)       + _p11 * (u*v);
+        }
+    };
+}
+
+bool SpatialReference::transformExtentPointsOnGrid(const SpatialReference* to_srs,
+                                                   double in_xmin, double in_ymin,
+                                                   double in_xmax, double in_ymax,
+                                                   double* x, double* y,
+                                                   unsigned int numx, unsigned int numy,
+                                                   double tolerance_x, double tolerance_y,
+                                                   unsigned int spacing ) const
+{
+    if ( numx < 2 || numy < 2 || spacing < 2 )
+        return transformExtentPoints( to_srs, in_xmin, in_ymin, in_xmax, in_ymax, x, y, numx, numy );
+
+    const double dx = (in_xmax - in_xmin) / (numx - 1);
+    const double dy = (in_ymax - in_ymin) / (numy - 1);
+
+    // grid lines, always including the last column and row.
+    std::vector<unsigned> cols, rows;
+    for( unsigned c = 0; c+1 < numx; c += spacing )
+        cols.push_back( c );
+    cols.push_back( numx-1 );
+    for( unsigned r = 0; r+1 < numy; r += spacing )
+        rows.push_back( r );
+    rows.push_back( numy-1 );
+
+    const unsigned numCols = cols.size();
+    const unsigned numRows = rows.size();
+
+    // transform the grid nodes.
+    std::vector<osg::Vec3d> nodes;
+    nodes.reserve( numCols*numRows );
+    for( unsigned ci = 0; ci < numCols; ++ci )
+        for( unsigned ri = 0; ri < numRows; ++ri )
+            nodes.push_back( osg::Vec3d(in_xmin + (double)cols[ci]*dx, in_ymin + (double)rows[ri]*dy, 0.0) );
+
+    if ( !transform(nodes, to_srs) )
+        return transformExtentPoints( to_srs, in_xmin, in_ymin, in_xmax, in_ymax, x, y, numx, numy );
+
+    const unsigned numCellCols = numCols - 1;
+    const unsigned numCellRows = numRows - 1;
+
+    std::vector<GridCell>   cells( numCellCols*numCellRows );
+    std::vector<osg::Vec3d> probes;
+    std::vector<unsigned>   probeCells, probeCols, probeRows;
+    unsigned                numProbedCells = 0;
+
+    for( unsigned ci = 0; ci < numCellCols; ++ci )
+    {
+        for( unsigned ri = 0; ri < numCellRows; ++ri )
+        {
+            unsigned  i    = ci*numCellRows + ri;
+            GridCell& cell = cells[i];
+            cell._c0 = cols[ci];  cell._c1 = cols[ci+1];
+            cell._r0 = rows[ri];  cell._r1 = rows[ri+1];
+            cell._p00 = nodes[ ci   *numRows + ri  ];
+            cell._p10 = nodes[(ci+1)*numRows + ri  ];
+            cell._p01 = nodes[ ci   *numRows + ri+1];
+            cell._p11 = nodes[(ci+1)*numRows + ri+1];
+
+            // cells with points between their nodes get probed at the center
+            // and at the middle of each edge.
+            if ( cell._c1 - cell._c0 > 1 || cell._r1 - cell._r0 > 1 )
+            {
+                unsigned cm = (cell._c0 + cell._c1) / 2;
+                unsigned rm = (cell._r0 + cell._r1) / 2;
+                const unsigned pc[5] = { cm, cm,        cm,        cell._c0, cell._c1 };
+                const unsigned pr[5] = { rm, cell._r0,  cell._r1,  rm,       rm };
+                for( unsigned k = 0; k < 5; ++k )
+                {
+                    probes.push_back( osg::Vec3d(in_xmin + (double)pc[k]*dx, in_ymin + (double)pr[k]*dy, 0.0) );
+                    probeCells.push_back( i );
+                    probeCols.push_back( pc[k] );
+                    probeRows.push_back( pr[k] );
+                }
+                ++numProbedCells;
+            }
+        }
+    }
+
+    if ( probes.size() > 0 && !transform(probes, to_srs) )
+        return transformExtentPoints( to_srs, in_xmin, in_ymin, in_xmax, in_ymax, x, y, numx, numy );
+
+    std::vector<bool> refine( cells.size(), false );
+    unsigned numRefined = 0;
+    for( unsigned k = 0; k < probes.size(); ++k )
+    {
+        unsigned i = probeCells[k];
+        if ( refine[i] )
+            continue;
+
+        osg::Vec3d p = cells[i].interpolate( probeCols[k], probeRows[k] );
+
+        // (negated so that NaNs also force a refinement)
+        if ( !(fabs(p.x() - probes[k].x()) <= tolerance_x && fabs(p.y() - probes[k].y()) <= tolerance_y) )
+        {
+            refine[i] = true;
+            ++numRefined;
+        }
+    }
+
+    // the grid doesn't fit the transform: there is nothing to gain from it.
+    if ( numRefined*2 > numProbedCells )
+    {
+        OE_DEBUG << LC << "Transform grid: " << numRefined << " of " << numProbedCells
+            << " cells out of tolerance; transforming every point" << std::endl;
+        return transformExtentPoints( to_srs, in_xmin, in_ymin, in_xmax, in_ymax, x, y, numx, numy );
+    }
+
+    // interpolate the cells that passed, and gather the points of the rest.
+    std::vector<osg::Vec3d> exact;
+    for( unsigned i = 0; i < cells.size(); ++i )
+    {
+        const GridCell& cell = cells[i];
+        for( unsigned c = cell._c0; c <= cell._c1; ++c )
+        {
+            for( unsigned r = cell._r0; r <= cell._r1; ++r )
+            {
+                if ( refine[i] )
+                {
+                    exact.push_back( osg::Vec3d(in_xmin + (double)c*dx, in_ymin + (double)r*dy, 0.0) );
+                }
+                else
+                {
+                    osg::Vec3d p = cell.interpolate( c, r );
+                    x[c*numy + r] = p.x();
+                    y[c*numy + r] = p.y();
+                }
+            }
+        }
+    }
+
+    if ( exact.size() > 0 )
+    {
+        OE_DEBUG << LC << "Transform grid: " << exact.size() << " of "
+            << numx*numy << " points transformed exactly" << std::endl;
+
+        if ( !transform(exact, to_srs) )
+            return transformExtentPoints( to_srs, in_xmin, in_ymin, in_xmax, in_ymax, x, y, numx, numy );
+
+        // same traversal as above; refined cells overwrite shared edges
+        // with the exact values.
+        unsigned k = 0;
+        for( unsigned i = 0; i < cells.size(); ++i )
+        {
+            if ( !refine[i] )
+                continue;
+
+            const GridCell& cell = cells[i];
+            for( unsigned c = cell._c0; c <= cell._c1; ++c )
+            {
+                for( unsigned r = cell._r0; r <= cell._r1; ++r, ++k )
+                {
+                    x[c*numy + r] = exact[k].x();
+                    y[c*numy + r] = exact[k].y();
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
 void
 SpatialReference::init()
 {
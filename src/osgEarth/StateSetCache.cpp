@@ -20,6 +20,7 @@
 #include <osg/NodeVisitor>
 #include <osg/Geode>
 #include <osg/BufferIndexBinding>
+#include <osg/Timer>
 
 #define LC "[StateSetCache] "
 
@@ -31,6 +32,22 @@ using namespace osgEarth;
 
 namespace
 {
+    inline void hashCombine( unsigned& h, unsigned value )
+    {
+        h ^= value + 0x9e3779b9 + (h << 6) + (h >> 2);
+    }
+
+    inline unsigned hashString( const char* str )
+    {
+        unsigned h = 2166136261u; // FNV-1a
+        for( ; str && *str; ++str )
+        {
+            h ^= (unsigned char)*str;
+            h *= 16777619u;
+        }
+        return h;
+    }
+
     /**
      * Visitor that calls StateSetCache::share on all attributes found
      * in a scene graph.
@@ -159,15 +176,17 @@ namespace
 //------------------------------------------------------------------------
 
 StateSetCache::StateSetCache() :
-_pruneCount( 0 )
+_maxSize( 16384 ),
+_maxAge ( 5.0 )
 {
     //nop
 }
 
 StateSetCache::~StateSetCache()
 {
-    Threading::ScopedMutexLock lock( _mutex );
-    prune();
+    // releases the GL objects of attributes that nothing else uses.
+    for( unsigned i=0; i<2*NUM_SHARDS; ++i )
+        pruneShard( i, true );
 }
 
 void
@@ -239,50 +258,132 @@ StateSetCache::eligible(osg::StateAttribute* attr) const
 }
 
 
+unsigned
+StateSetCache::hash(const osg::StateSet* stateSet)
+{
+    unsigned h = 0;
+
+    const osg::StateSet::AttributeList& attrs = stateSet->getAttributeList();
+    hashCombine( h, attrs.size() );
+    for( osg::StateSet::AttributeList::const_iterator i = attrs.begin(); i != attrs.end(); ++i )
+    {
+        hashCombine( h, i->first.first );
+        hashCombine( h, i->first.second );
+        hashCombine( h, i->second.second );
+    }
+
+    const osg::StateSet::TextureAttributeList& texAttrs = stateSet->getTextureAttributeList();
+    hashCombine( h, texAttrs.size() );
+    for( unsigned unit=0; unit<texAttrs.size(); ++unit )
+    {
+        const osg::StateSet::AttributeList& attrs = texAttrs[unit];
+        hashCombine( h, attrs.size() );
+        for( osg::StateSet::AttributeList::const_iterator i = attrs.begin(); i != attrs.end(); ++i )
+        {
+            hashCombine( h, i->first.first );
+            hashCombine( h, i->second.second );
+        }
+    }
+
+    const osg::StateSet::ModeList& modes = stateSet->getModeList();
+    hashCombine( h, modes.size() );
+    for( osg::StateSet::ModeList::const_iterator i = modes.begin(); i != modes.end(); ++i )
+    {
+        hashCombine( h, i->first );
+        hashCombine( h, i->second );
+    }
+
+    const osg::StateSet::TextureModeList& texModes = stateSet->getTextureModeList();
+    hashCombine( h, texModes.size() );
+    for( unsigned unit=0; unit<texModes.size(); ++unit )
+    {
+        const osg::StateSet::ModeList& modes = texModes[unit];
+        hashCombine( h, modes.size() );
+        for( osg::StateSet::ModeList::const_iterator i = modes.begin(); i != modes.end(); ++i )
+        {
+            hashCombine( h, i->first );
+            hashCombine( h, i->second );
+        }
+    }
+
+    const osg::StateSet::UniformList& uniforms = stateSet->getUniformList();
+    hashCombine( h, uniforms.size() );
+    for( osg::StateSet::UniformList::const_iterator i = uniforms.begin(); i != uniforms.end(); ++i )
+    {
+        hashCombine( h, hashString(i->first.c_str()) );
+        hashCombine( h, i->second.second );
+    }
+
+    return h;
+}
+
+
+unsigned
+StateSetCache::hash(const osg::StateAttribute* attr)
+{
+    unsigned h = 0;
+    hashCombine( h, attr->getType() );
+    hashCombine( h, attr->getMember() );
+    hashCombine( h, hashString(attr->className()) );
+    return h;
+}
+
+
 bool
 StateSetCache::share(osg::ref_ptr<osg::StateSet>& input,
                      osg::ref_ptr<osg::StateSet>& output,
                      bool                         checkEligible)
 {
-    bool shared     = false;
-    bool shareattrs = true;
+    bool shared = false;
 
     if ( !checkEligible || eligible(input.get()) )
     {
-        Threading::ScopedMutexLock lock( _mutex );
-
         pruneIfNecessary();
 
-        shareattrs = false;
+        Entry<osg::StateSet> probe( hash(input.get()), input.get(), now() );
+
+        Shard<StateSetSet>& shard = _stateSetShards[probe._hash % NUM_SHARDS];
 
-        std::pair<StateSetSet::iterator,bool> result = _stateSetCache.insert( input );
-        if ( result.second )
+        // the common case: it's already there.
         {
-            // first use
-            output = input.get();
-            shareattrs = true;
-            shared = false;
+            Threading::ScopedReadLock reading( shard._mutex );
+            StateSetSet::const_iterator i = shard._entries.find( probe );
+            if ( i != shard._entries.end() )
+            {
+                i->_lastUsed.exchange( (unsigned)probe._lastUsed );
+                output = i->_object.get();
+                shared = true;
+            }
         }
-        else
+
+        if ( !shared )
         {
-            // found a share!
-            output = result.first->get();
-            shared = true;
+            Threading::ScopedWriteLock exclusive( shard._mutex );
+
+            // double-check; another thread may have added it since.
+            std::pair<StateSetSet::iterator,bool> result = shard._entries.insert( probe );
+            output = result.first->_object.get();
+            shared = !result.second;
         }
+
+        if ( shared )
+        {
+            ++_stateSetHits;
+            return true;
+        }
+
+        ++_stateSetMisses;
     }
     else
     {
         output = input.get();
-        shared = false;
     }
 
-    if ( shareattrs )
-    {
-        ShareStateAttributes sa(this);
-        sa.applyStateSet( input.get() );
-    }
+    // first use (or not eligible): share the attributes instead.
+    ShareStateAttributes sa(this);
+    sa.applyStateSet( input.get() );
 
-    return shared;
+    return false;
 }
 
 
@@ -294,23 +395,38 @@ StateSetCache::share(osg::ref_ptr<osg::StateAttribute>& input,
 {
     if ( !checkEligible || eligible(input.get()) )
     {
-        Threading::ScopedMutexLock lock( _mutex );
-
         pruneIfNecessary();
 
-        std::pair<StateAttributeSet::iterator,bool> result = _stateAttributeCache.insert( input );
-        if ( result.second )
+        Entry<osg::StateAttribute> probe( hash(input.get()), input.get(), now() );
+
+        Shard<StateAttributeSet>& shard = _attributeShards[probe._hash % NUM_SHARDS];
+
+        bool shared = false;
         {
-            // first use
-            output = input.get();
-            return false;
+            Threading::ScopedReadLock reading( shard._mutex );
+            StateAttributeSet::const_iterator i = shard._entries.find( probe );
+            if ( i != shard._entries.end() )
+            {
+                i->_lastUsed.exchange( (unsigned)probe._lastUsed );
+                output = i->_object.get();
+                shared = true;
+            }
         }
-        else
+
+        if ( !shared )
         {
-            // found a share!
-            output = result.first->get();
-            return true;
+            Threading::ScopedWriteLock exclusive( shard._mutex );
+            std::pair<StateAttributeSet::iterator,bool> result = shard._entries.insert( probe );
+            output = result.first->_object.get();
+            shared = !result.second;
         }
+
+        if ( shared )
+            ++_attributeHits;
+        else
+            ++_attributeMisses;
+
+        return shared;
     }
     else
     {
@@ -319,60 +435,156 @@ StateSetCache::share(osg::ref_ptr<osg::StateAttribute>& input,
     }
 }
 
+unsigned
+StateSetCache::now() const
+{
+    return (unsigned)osg::Timer::instance()->time_m();
+}
+
+unsigned
+StateSetCache::size() const
+{
+    unsigned count = 0;
+    for( unsigned i=0; i<NUM_SHARDS; ++i )
+    {
+        Threading::ScopedReadLock reading( _stateSetShards[i]._mutex );
+        count += _stateSetShards[i]._entries.size();
+    }
+    return count;
+}
+
+unsigned
+StateSetCache::totalSize() const
+{
+    unsigned count = size();
+    for( unsigned i=0; i<NUM_SHARDS; ++i )
+    {
+        Threading::ScopedReadLock reading( _attributeShards[i]._mutex );
+        count += _attributeShards[i]._entries.size();
+    }
+    return count;
+}
+
 void
 StateSetCache::pruneIfNecessary()
 {
-    // assume an exclusve mutex is taken
-    if ( _pruneCount++ == PRUNE_ACCESS_COUNT )
+    // every so often, prune the next shard in line.
+    if ( (++_accessCount % PRUNE_ACCESS_COUNT) == 0 )
     {
-        prune();
-        _pruneCount = 0;
+        unsigned shard = (++_pruneShard) % (2*NUM_SHARDS);
+        pruneShard( shard, totalSize() > _maxSize );
     }
 }
 
 void
 StateSetCache::prune()
 {
-    // assume an exclusive mutex is taken.
+    bool overSize = totalSize() > _maxSize;
 
+    for( unsigned i=0; i<2*NUM_SHARDS; ++i )
+    {
+        pruneShard( i, overSize );
+    }
+}
+
+void
+StateSetCache::pruneShard(unsigned shard, bool overSize)
+{
+    // An entry is unused when the cache holds the only reference to it.
+    // (The time is taken under the lock, so no entry's tick is later.)
+    unsigned maxAge = (unsigned)(_maxAge * 1000.0);
     unsigned ss_count = 0, sa_count = 0;
 
-    for( StateSetSet::iterator i = _stateSetCache.begin(); i != _stateSetCache.end(); )
+    if ( shard < NUM_SHARDS )
     {
-        if ( i->get()->referenceCount() == 1 )
+        Shard<StateSetSet>& s = _stateSetShards[shard];
+        Threading::ScopedWriteLock exclusive( s._mutex );
+        unsigned t = now();
+
+        for( StateSetSet::iterator i = s._entries.begin(); i != s._entries.end(); )
         {
-            // do not call releaseGLObjects since the attrs themselves might still be shared
-            _stateSetCache.erase( i++ );
-            ss_count++;
+            if ( i->_object->referenceCount() == 1 && (overSize || t - (unsigned)i->_lastUsed >= maxAge) )
+            {
+                // do not call releaseGLObjects since the attrs themselves might still be shared
+                s._entries.erase( i++ );
+                ss_count++;
+            }
+            else
+            {
+                ++i;
+            }
         }
-        else
+        s._evictions += ss_count;
+    }
+    else
+    {
+        Shard<StateAttributeSet>& s = _attributeShards[shard - NUM_SHARDS];
+        Threading::ScopedWriteLock exclusive( s._mutex );
+        unsigned t = now();
+
+        for( StateAttributeSet::iterator i = s._entries.begin(); i != s._entries.end(); )
         {
-            ++i;
+            if ( i->_object->referenceCount() == 1 && (overSize || t - (unsigned)i->_lastUsed >= maxAge) )
+            {
+                i->_object->releaseGLObjects( 0L );
+                s._entries.erase( i++ );
+                sa_count++;
+            }
+            else
+            {
+                ++i;
+            }
         }
+        s._evictions += sa_count;
+    }
+
+    if ( ss_count+sa_count > 0 )
+    {
+        OE_DEBUG << LC << "Pruned " << sa_count << " attributes, " << ss_count << " statesets" << std::endl;
     }
+}
 
-    for( StateAttributeSet::iterator i = _stateAttributeCache.begin(); i != _stateAttributeCache.end(); )
+void
+StateSetCache::getStats(Stats& out) const
+{
+    out._stateSetHits    = _stateSetHits;
+    out._stateSetMisses  = _stateSetMisses;
+    out._attributeHits   = _attributeHits;
+    out._attributeMisses = _attributeMisses;
+    out._evictions       = 0;
+
+    for( unsigned i=0; i<NUM_SHARDS; ++i )
     {
-        if ( i->get()->referenceCount() == 1 )
         {
-            i->get()->releaseGLObjects( 0L );
-            _stateAttributeCache.erase( i++ );
-            sa_count++;
+            Threading::ScopedReadLock reading( _stateSetShards[i]._mutex );
+            out._evictions += _stateSetShards[i]._evictions;
         }
-        else
         {
-            ++i;
+            Threading::ScopedReadLock reading( _attributeShards[i]._mutex );
+            out._evictions += _attributeShards[i]._evictions;
         }
     }
-
-    OE_DEBUG << LC << "Pruned " << sa_count << " attributes, " << ss_count << " statesets" << std::endl;
 }
 
 void
 StateSetCache::clear()
 {
-    Threading::ScopedMutexLock lock( _mutex );
+    for( unsigned i=0; i<NUM_SHARDS; ++i )
+    {
+        {
+            Threading::ScopedWriteLock exclusive( _stateSetShards[i]._mutex );
+            _stateSetShards[i]._entries.clear();
+            _stateSetShards[i]._evictions = 0;
+        }
+        {
+            Threading::ScopedWriteLock exclusive( _attributeShards[i]._mutex );
+            _attributeShards[i]._entries.clear();
+            _attributeShards[i]._evictions = 0;
+        }
+    }
 
-    _stateAttributeCache.clear();
-    _stateSetCache.clear();
+    _stateSetHits.exchange( 0 );
+    _stateSetMisses.exchange( 0 );
+    _attributeHits.exchange( 0 );
+    _attributeMisses.exchange( 0 );
 }
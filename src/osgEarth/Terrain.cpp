@@ -22,6 +22,7 @@
 #include <osgUtil/IntersectionVisitor>
 #include <osgUtil/LineSegmentIntersector>
 #include <osgViewer/View>
+#include <algorithm>
 
 #define LC "[Terrain] "
 
@@ -37,46 +38,52 @@ namespace
         osg::ref_ptr<Terrain> _terrain;
     };
 
-    struct OnTileAddedOperation : public BaseOp
+    // Drains the tiles queued by notifyTileAdded once per update traversal,
+    // so a burst of tile arrivals is dispatched as one batch.
+    struct FlushTilesAddedOperation : public BaseOp
     {
-        TileKey _key;
-        osg::observer_ptr<osg::Node> _node;
-        unsigned _count;
-        //osg::ref_ptr<osg::Node> _node;
-
-        OnTileAddedOperation(const TileKey& key, osg::Node* node, Terrain* terrain)
-            : BaseOp(terrain), _key(key), _node(node), _count(0) { }
+        FlushTilesAddedOperation(Terrain* terrain)
+            : BaseOp(terrain) { }
 
         void operator()(osg::Object*)
         {
-            ++_count;
-            this->setKeep( false );
-
-            osg::ref_ptr<osg::Node> node;
-            if ( _terrain.valid() && _node.lock(node) )
-            {
-                if ( node->getNumParents() > 0 )
-                {
-                    //OE_NOTICE << LC << "FIRING onTileAdded for " << _key.str() << " (tries=" << _count << ")" << std::endl;
-                    _terrain->fireTileAdded( _key, node.get() );
-                }
-                else
-                {
-                    //OE_NOTICE << LC << "Deferring onTileAdded for " << _key.str() << std::endl;
-                    this->setKeep( true );
-                }
-            }
-            else
-            {
-                // nop; tile expired; let it go.
-                //OE_NOTICE << "Tile expired before notification: " << _key.str() << std::endl;
-            }
-            //if ( _node.valid() && _node->referenceCount() > 1 && _terrain.valid() )
-            //{
-            //    _terrain->fireTileAdded( _key, _node.get() );
-            //}
+            // keep running while tiles remain queued (i.e. not yet in the graph).
+            this->setKeep( _terrain.valid() && _terrain->flushTilesAdded() );
         }
     };
+
+    // maximum quadtree depth of the local callback index.
+    const unsigned MAX_CALLBACK_LOD = 23;
+
+    // interleaves the bits of x and y (a Z-order curve), so that the
+    // descendants of a tile at any deeper LOD form one contiguous range.
+    unsigned long long spreadBits(unsigned v)
+    {
+        unsigned long long x = v;
+        x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+        x = (x | (x <<  8)) & 0x00FF00FF00FF00FFULL;
+        x = (x | (x <<  4)) & 0x0F0F0F0F0F0F0F0FULL;
+        x = (x | (x <<  2)) & 0x3333333333333333ULL;
+        x = (x | (x <<  1)) & 0x5555555555555555ULL;
+        return x;
+    }
+
+    unsigned long long morton(unsigned x, unsigned y)
+    {
+        return spreadBits(x) | (spreadBits(y) << 1);
+    }
+
+    // inverse of spreadBits: gathers the even bits of x.
+    unsigned compactBits(unsigned long long x)
+    {
+        x &= 0x5555555555555555ULL;
+        x = (x | (x >>  1)) & 0x3333333333333333ULL;
+        x = (x | (x >>  2)) & 0x0F0F0F0F0F0F0F0FULL;
+        x = (x | (x >>  4)) & 0x00FF00FF00FF00FFULL;
+        x = (x | (x >>  8)) & 0x0000FFFF0000FFFFULL;
+        x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+        return (unsigned)x;
+    }
 }
 
 //---------------------------------------------------------------------------
@@ -85,9 +92,25 @@ Terrain::Terrain(osg::Node* graph, const Profile* mapProfile, bool geocentric, c
 _graph         ( graph ),
 _profile       ( mapProfile ),
 _geocentric    ( geocentric ),
-_terrainOptions( terrainOptions )
+_terrainOptions( terrainOptions ),
+_flushQueued   ( false )
 {
-    //nop
+    _localCallbacksPerLevel.resize( MAX_CALLBACK_LOD+2, 0u );
+    _heightIndex = new TerrainHeightIndex( mapProfile );
+}
+
+OcclusionCullingService*
+Terrain::getOcclusionCullingService() const
+{
+    Threading::ScopedMutexLock lock( _occlusionServiceMutex );
+    if ( !_occlusionService.valid() )
+    {
+        _occlusionService = new OcclusionCullingService(
+            _heightIndex.get(),
+            getSRS(),
+            isGeocentric() );
+    }
+    return _occlusionService.get();
 }
 
 bool
@@ -111,6 +134,30 @@ Terrain::getHeight(osg::Node*              patch,
     if ( !getProfile()->getExtent().contains(x, y) )
         return 0L;
 
+    // try the loaded-tile index first; fall back on intersecting the graph.
+    // (the index samples the engine's heightfields, which are HAE.)
+    double hae;
+    if ( !patch && _heightIndex->getHeight(x, y, hae) )
+    {
+        if ( out_hae )
+            *out_hae = hae;
+
+        if ( out_hamsl )
+        {
+            *out_hamsl = hae;
+
+            const VerticalDatum* vdatum = getSRS()->getVerticalDatum();
+            if ( vdatum )
+            {
+                double lon = x, lat = y;
+                if ( !getSRS()->isGeographic() )
+                    getSRS()->transform2D( x, y, getSRS()->getGeographicSRS(), lon, lat );
+                *out_hamsl = vdatum->hae2msl( lat, lon, hae );
+            }
+        }
+        return true;
+    }
+
     const osg::EllipsoidModel* em = getSRS()->getEllipsoid();
     double r = std::min( em->getRadiusEquator(), em->getRadiusPolar() );
 
@@ -290,6 +337,56 @@ Terrain::addTerrainCallback( TerrainCallback* cb )
     }
 }
 
+void
+Terrain::addTerrainCallback( TerrainCallback* cb, const GeoExtent& extent )
+{
+    if ( !cb )
+        return;
+
+    GeoExtent mapExtent = extent;
+    if ( extent.isValid() && !extent.getSRS()->isHorizEquivalentTo(getSRS()) )
+        mapExtent = extent.transform( getSRS() );
+
+    if ( !mapExtent.isValid() )
+    {
+        OE_WARN << LC << "Illegal extent for terrain callback; registering it globally" << std::endl;
+        addTerrainCallback( cb );
+        return;
+    }
+
+    LocalCallback local;
+    local._callback = cb;
+    local._xmin     = mapExtent.xMin();
+    local._ymin     = mapExtent.yMin();
+    local._xmax     = mapExtent.xMax();
+    local._ymax     = mapExtent.yMax();
+
+    CellID cell = getCell( local._xmin, local._ymin, local._xmax, local._ymax );
+
+    // An extent that fits in a cell of the deepest level (a point, typically)
+    // is registered as that whole cell. Any tile down to MAX_CALLBACK_LOD that
+    // touches the cell contains it, so dispatch is the same; and moving the
+    // extent around within the cell leaves the registration as it is.
+    if ( cell.first == MAX_CALLBACK_LOD+1 )
+    {
+        {
+            Threading::ScopedReadLock sharedLock( _callbacksMutex );
+            LocalCallbackCellMap::const_iterator c = _localCallbackCells.find( cb );
+            if ( c != _localCallbackCells.end() && c->second == cell )
+                return;
+        }
+
+        getCellBounds( cell, local._xmin, local._ymin, local._xmax, local._ymax );
+    }
+
+    Threading::ScopedWriteLock exclusiveLock( _callbacksMutex );
+
+    removeLocalCallback( cb );
+    _localCallbacks.insert( std::make_pair(cell, local) );
+    _localCallbackCells[cb] = cell;
+    ++_localCallbacksPerLevel[cell.first];
+}
+
 void
 Terrain::removeTerrainCallback( TerrainCallback* cb )
 {
@@ -306,6 +403,89 @@ Terrain::removeTerrainCallback( TerrainCallback* cb )
             ++i;
         }
     }
+
+    removeLocalCallback( cb );
+}
+
+void
+Terrain::removeLocalCallback( TerrainCallback* cb )
+{
+    // assumes the callbacks mutex is write-locked.
+    LocalCallbackCellMap::iterator c = _localCallbackCells.find( cb );
+    if ( c != _localCallbackCells.end() )
+    {
+        std::pair<LocalCallbackMap::iterator, LocalCallbackMap::iterator> range =
+            _localCallbacks.equal_range( c->second );
+
+        for( LocalCallbackMap::iterator i = range.first; i != range.second; ++i )
+        {
+            if ( i->second._callback.get() == cb )
+            {
+                _localCallbacks.erase( i );
+                --_localCallbacksPerLevel[c->second.first];
+                break;
+            }
+        }
+        _localCallbackCells.erase( c );
+    }
+}
+
+Terrain::CellID
+Terrain::getCell( double xmin, double ymin, double xmax, double ymax ) const
+{
+    const GeoExtent& pex = getProfile()->getExtent();
+
+    unsigned tilesX, tilesY;
+    getProfile()->getNumTiles( MAX_CALLBACK_LOD, tilesX, tilesY );
+
+    // tile coordinates of the extent's corners at the deepest LOD (y runs north to south):
+    double rx0 = osg::clampBetween( (xmin - pex.xMin()) / pex.width(),  0.0, 1.0 );
+    double rx1 = osg::clampBetween( (xmax - pex.xMin()) / pex.width(),  0.0, 1.0 );
+    double ry0 = osg::clampBetween( (pex.yMax() - ymax) / pex.height(), 0.0, 1.0 );
+    double ry1 = osg::clampBetween( (pex.yMax() - ymin) / pex.height(), 0.0, 1.0 );
+
+    unsigned x0 = osg::minimum( (unsigned)(rx0 * (double)tilesX), tilesX-1 );
+    unsigned x1 = osg::minimum( (unsigned)(rx1 * (double)tilesX), tilesX-1 );
+    unsigned y0 = osg::minimum( (unsigned)(ry0 * (double)tilesY), tilesY-1 );
+    unsigned y1 = osg::minimum( (unsigned)(ry1 * (double)tilesY), tilesY-1 );
+
+    // walk up to the deepest tile that contains the whole extent:
+    for( int lod = MAX_CALLBACK_LOD; lod >= 0; --lod )
+    {
+        unsigned s = MAX_CALLBACK_LOD - lod;
+        if ( (x0 >> s) == (x1 >> s) && (y0 >> s) == (y1 >> s) )
+        {
+            return CellID( lod+1, morton(x0 >> s, y0 >> s) );
+        }
+    }
+
+    // spans more than one LOD 0 tile.
+    return CellID( 0, 0ULL );
+}
+
+void
+Terrain::getCellBounds( const CellID& cell, double& xmin, double& ymin, double& xmax, double& ymax ) const
+{
+    const GeoExtent& pex = getProfile()->getExtent();
+
+    if ( cell.first == 0 )
+    {
+        xmin = pex.xMin(); ymin = pex.yMin(); xmax = pex.xMax(); ymax = pex.yMax();
+        return;
+    }
+
+    unsigned tilesX, tilesY;
+    getProfile()->getNumTiles( cell.first-1, tilesX, tilesY );
+
+    double w = pex.width()  / (double)tilesX;
+    double h = pex.height() / (double)tilesY;
+    unsigned x = compactBits( cell.second );
+    unsigned y = compactBits( cell.second >> 1 );
+
+    xmin = pex.xMin() + w * (double)x;
+    xmax = xmin + w;
+    ymax = pex.yMax() - h * (double)y;
+    ymin = ymax - h;
 }
 
 void
@@ -318,25 +498,206 @@ Terrain::notifyTileAdded( const TileKey& key, osg::Node* node )
 
     if ( _updateOperationQueue.valid() )
     {
-        _updateOperationQueue->add( new OnTileAddedOperation(key, node, this) );
+        Threading::ScopedMutexLock lock( _pendingTilesMutex );
+
+        PendingTile pending;
+        pending._key  = key;
+        pending._node = node;
+        _pendingTiles.push_back( pending );
+
+        if ( !_flushQueued )
+        {
+            _flushQueued = true;
+            _updateOperationQueue->add( new FlushTilesAddedOperation(this) );
+        }
+    }
+}
+
+bool
+Terrain::flushTilesAdded()
+{
+    std::vector<PendingTile> pending;
+    {
+        Threading::ScopedMutexLock lock( _pendingTilesMutex );
+        pending.swap( _pendingTiles );
+    }
+
+    AddedTileList            ready;
+    std::vector<PendingTile> deferred;
+
+    for( std::vector<PendingTile>::iterator i = pending.begin(); i != pending.end(); ++i )
+    {
+        osg::ref_ptr<osg::Node> node;
+        if ( i->_node.lock(node) )
+        {
+            // hold off until the tile is actually in the graph.
+            if ( node->getNumParents() > 0 )
+                ready.push_back( std::make_pair(i->_key, node) );
+            else
+                deferred.push_back( *i );
+        }
+        // else: tile expired before notification; let it go.
+    }
+
+    if ( !ready.empty() )
+    {
+        fireTilesAdded( ready );
     }
+
+    Threading::ScopedMutexLock lock( _pendingTilesMutex );
+    _pendingTiles.insert( _pendingTiles.end(), deferred.begin(), deferred.end() );
+    _flushQueued = !_pendingTiles.empty();
+    return _flushQueued;
 }
 
 void
 Terrain::fireTileAdded( const TileKey& key, osg::Node* node )
 {
-    Threading::ScopedReadLock sharedLock( _callbacksMutex );
+    AddedTileList tiles;
+    tiles.push_back( std::make_pair(key, osg::ref_ptr<osg::Node>(node)) );
+    fireTilesAdded( tiles );
+}
 
-    for( CallbackList::iterator i = _callbacks.begin(); i != _callbacks.end(); )
-    {       
-        TerrainCallbackContext context( this );
-        i->get()->onTileAdded( key, node, context );
+void
+Terrain::fireTilesAdded( const AddedTileList& tiles )
+{
+    // Collect the callbacks under the lock, but invoke them without it so that
+    // a callback may add or remove callbacks.
+    std::vector< osg::ref_ptr<TerrainCallback> > global;
+    std::vector< LocalHits >                     locals;
+    {
+        Threading::ScopedReadLock sharedLock( _callbacksMutex );
 
-        // if the callback set the "remove" flag, discard the callback.
-        if ( !context._remove )
-            ++i;
-        else
-            i = _callbacks.erase( i );
+        global.insert( global.end(), _callbacks.begin(), _callbacks.end() );
+
+        if ( !_localCallbacks.empty() )
+        {
+            std::map<TerrainCallback*, unsigned> hitIndex;
+
+            for( unsigned t = 0; t < tiles.size(); ++t )
+            {
+                const TileKey&   key = tiles[t].first;
+                const GeoExtent& ex  = key.getExtent();
+                unsigned         lod = key.getLOD();
+                unsigned         x   = key.getTileX();
+                unsigned         y   = key.getTileY();
+
+                std::vector<const LocalCallback*> found;
+
+                // callbacks stored at this tile or an ancestor may or may not
+                // overlap the tile, so test them:
+                unsigned maxLevel = osg::minimum( lod, MAX_CALLBACK_LOD );
+                for( int level = -1; level <= (int)maxLevel; ++level )
+                {
+                    CellID cell = level < 0 ?
+                        CellID( 0, 0ULL ) :
+                        CellID( level+1, morton(x >> (lod-level), y >> (lod-level)) );
+
+                    if ( _localCallbacksPerLevel[cell.first] == 0 )
+                        continue;
+
+                    std::pair<LocalCallbackMap::const_iterator, LocalCallbackMap::const_iterator> range =
+                        _localCallbacks.equal_range( cell );
+
+                    for( LocalCallbackMap::const_iterator i = range.first; i != range.second; ++i )
+                    {
+                        const LocalCallback& lc = i->second;
+                        if ( lc._xmin <= ex.xMax() && lc._xmax >= ex.xMin() &&
+                             lc._ymin <= ex.yMax() && lc._ymax >= ex.yMin() )
+                        {
+                            found.push_back( &lc );
+                        }
+                    }
+                }
+
+                // callbacks stored under this tile lie entirely within it; their
+                // cells form one contiguous morton range per level.
+                unsigned long long code = morton( x, y );
+                for( unsigned level = lod+1; level <= MAX_CALLBACK_LOD; ++level )
+                {
+                    if ( _localCallbacksPerLevel[level+1] == 0 )
+                        continue;
+
+                    unsigned shift = 2 * (level - lod);
+                    LocalCallbackMap::const_iterator i   = _localCallbacks.lower_bound( CellID(level+1, code << shift) );
+                    LocalCallbackMap::const_iterator end = _localCallbacks.lower_bound( CellID(level+1, (code+1) << shift) );
+                    for( ; i != end; ++i )
+                    {
+                        found.push_back( &i->second );
+                    }
+                }
+
+                for( std::vector<const LocalCallback*>::const_iterator f = found.begin(); f != found.end(); ++f )
+                {
+                    TerrainCallback* cb = (*f)->_callback.get();
+                    std::map<TerrainCallback*, unsigned>::iterator h = hitIndex.find( cb );
+                    if ( h == hitIndex.end() )
+                    {
+                        h = hitIndex.insert( std::make_pair(cb, (unsigned)locals.size()) ).first;
+                        locals.push_back( LocalHits() );
+                        locals.back()._local = *(*f);
+                    }
+                    locals[h->second]._tiles.push_back( t );
+                }
+            }
+        }
+    }
+
+    std::set<TerrainCallback*> removed;
+
+    // global callbacks see every tile, in arrival order:
+    for( unsigned t = 0; t < tiles.size(); ++t )
+    {
+        for( std::vector< osg::ref_ptr<TerrainCallback> >::iterator i = global.begin(); i != global.end(); ++i )
+        {
+            if ( removed.find(i->get()) != removed.end() )
+                continue;
+
+            TerrainCallbackContext context( this );
+            i->get()->onTileAdded( tiles[t].first, tiles[t].second.get(), context );
+
+            // if the callback set the "remove" flag, discard the callback.
+            if ( context._remove )
+                removed.insert( i->get() );
+        }
+    }
+
+    // local callbacks see the tiles that overlap their extent, finest first,
+    // skipping any tile superseded by a finer one that covers the whole extent:
+    for( std::vector<LocalHits>::iterator h = locals.begin(); h != locals.end(); ++h )
+    {
+        const LocalCallback& lc = h->_local;
+
+        std::vector< std::pair<unsigned, unsigned> > order; // (LOD, tile)
+        for( std::vector<unsigned>::const_iterator t = h->_tiles.begin(); t != h->_tiles.end(); ++t )
+            order.push_back( std::make_pair(tiles[*t].first.getLOD(), *t) );
+        std::sort( order.rbegin(), order.rend() );
+
+        for( unsigned k = 0; k < order.size(); ++k )
+        {
+            if ( removed.find(lc._callback.get()) != removed.end() )
+                break;
+
+            const TileKey& key = tiles[order[k].second].first;
+
+            TerrainCallbackContext context( this );
+            lc._callback->onTileAdded( key, tiles[order[k].second].second.get(), context );
+
+            if ( context._remove )
+                removed.insert( lc._callback.get() );
+
+            const GeoExtent& ex = key.getExtent();
+            if ( ex.xMin() <= lc._xmin && ex.xMax() >= lc._xmax &&
+                 ex.yMin() <= lc._ymin && ex.yMax() >= lc._ymax )
+            {
+                break;
+            }
+        }
+    }
+
+    for( std::set<TerrainCallback*>::iterator i = removed.begin(); i != removed.end(); ++i )
+    {
+        removeTerrainCallback( *i );
     }
 }
 
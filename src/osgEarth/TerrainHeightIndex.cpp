@@ -0,0 +1,160 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/TerrainHeightIndex>
+#include <osgEarth/HeightFieldUtils>
+#include <osgEarth/Profile>
+
+#define LC "[TerrainHeightIndex] "
+
+using namespace osgEarth;
+
+//---------------------------------------------------------------------------
+
+TerrainHeightIndex::TerrainHeightIndex( const Profile* profile ) :
+_profile      ( profile ),
+_verticalScale( 1.0f )
+{
+    //nop
+}
+
+TerrainHeightIndex::TileID
+TerrainHeightIndex::makeID( unsigned lod, unsigned x, unsigned y )
+{
+    // 8 bits of LOD, 28 bits each of x and y: plenty for any real profile.
+    return
+        ((TileID)(lod & 0xff) << 56) |
+        ((TileID)(x & 0x0fffffff) << 28) |
+        ((TileID)(y & 0x0fffffff));
+}
+
+void
+TerrainHeightIndex::add( const TileKey& key, osg::HeightField* hf )
+{
+    if ( !key.valid() || !hf || hf->getNumColumns() < 2 || hf->getNumRows() < 2 )
+        return;
+
+    Entry entry;
+    entry._hf     = hf;
+    entry._xmin   = key.getExtent().xMin();
+    entry._ymin   = key.getExtent().yMin();
+    entry._width  = key.getExtent().width();
+    entry._height = key.getExtent().height();
+
+    unsigned lod = key.getLOD();
+    TileID   id  = makeID( lod, key.getTileX(), key.getTileY() );
+
+    Threading::ScopedWriteLock exclusive( _mutex );
+
+    std::pair<EntryMap::iterator, bool> result = _entries.insert( std::make_pair(id, entry) );
+    if ( result.second )
+    {
+        if ( lod >= _tilesPerLOD.size() )
+            _tilesPerLOD.resize( lod+1, 0u );
+        ++_tilesPerLOD[lod];
+    }
+    else
+    {
+        result.first->second = entry;
+    }
+}
+
+void
+TerrainHeightIndex::remove( const TileKey& key )
+{
+    if ( !key.valid() )
+        return;
+
+    unsigned lod = key.getLOD();
+    TileID   id  = makeID( lod, key.getTileX(), key.getTileY() );
+
+    Threading::ScopedWriteLock exclusive( _mutex );
+
+    if ( _entries.erase(id) > 0 )
+    {
+        --_tilesPerLOD[lod];
+
+        // trim empty trailing levels so queries start at the deepest populated LOD.
+        while( !_tilesPerLOD.empty() && _tilesPerLOD.back() == 0 )
+            _tilesPerLOD.pop_back();
+    }
+}
+
+void
+TerrainHeightIndex::clear()
+{
+    Threading::ScopedWriteLock exclusive( _mutex );
+    _entries.clear();
+    _tilesPerLOD.clear();
+}
+
+unsigned
+TerrainHeightIndex::size() const
+{
+    Threading::ScopedReadLock shared( _mutex );
+    return _entries.size();
+}
+
+bool
+TerrainHeightIndex::getHeight( double x, double y, double& out_height ) const
+{
+    if ( !_profile.valid() )
+        return false;
+
+    const GeoExtent& pex = _profile->getExtent();
+    if ( !pex.contains(x, y) )
+        return false;
+
+    // normalized location within the profile; y runs top-down in tile space.
+    double rx = (x - pex.xMin()) / pex.width();
+    double ry = 1.0 - (y - pex.yMin()) / pex.height();
+
+    Threading::ScopedReadLock shared( _mutex );
+
+    for( int lod = (int)_tilesPerLOD.size()-1; lod >= 0; --lod )
+    {
+        if ( _tilesPerLOD[lod] == 0 )
+            continue;
+
+        unsigned tilesX, tilesY;
+        _profile->getNumTiles( (unsigned)lod, tilesX, tilesY );
+
+        unsigned tx = osg::minimum( (unsigned)(rx * (double)tilesX), tilesX-1 );
+        unsigned ty = osg::minimum( (unsigned)(ry * (double)tilesY), tilesY-1 );
+
+        EntryMap::const_iterator i = _entries.find( makeID((unsigned)lod, tx, ty) );
+        if ( i == _entries.end() )
+            continue;
+
+        const Entry& e = i->second;
+        double nx = (x - e._xmin) / e._width;
+        double ny = (y - e._ymin) / e._height;
+
+        float h = HeightFieldUtils::getHeightAtNormalizedLocation(
+            e._hf.get(), nx, ny, INTERP_BILINEAR );
+
+        // a NO_DATA hole in this tile; a coarser tile may still cover it.
+        if ( h == NO_DATA_VALUE )
+            continue;
+
+        out_height = (double)h * (double)_verticalScale;
+        return true;
+    }
+
+    return false;
+}
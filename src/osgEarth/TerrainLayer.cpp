@@ -26,12 +26,21 @@
 #include <osg/Version>
 #include <OpenThreads/ScopedLock>
 #include <memory.h>
+#include <time.h>
 
 using namespace osgEarth;
 using namespace OpenThreads;
 
 #define LC "[TerrainLayer] \"" << getName() << "\": "
 
+namespace
+{
+    // how many misses to remember per layer, and for how long (seconds). The 
+    // expiry lets transient failures (e.g. a server hiccup) heal on their own.
+    const unsigned  MISS_CACHE_SIZE   = 4096;
+    const TimeStamp MISS_CACHE_EXPIRY = 60;
+}
+
 //------------------------------------------------------------------------
 
 TerrainLayerOptions::TerrainLayerOptions( const ConfigOptions& options ) :
@@ -149,7 +158,8 @@ TerrainLayerOptions::mergeConfig( const Config& conf )
 TerrainLayer::TerrainLayer(const TerrainLayerOptions& initOptions,
                            TerrainLayerOptions*       runtimeOptions ) :
 _initOptions   ( initOptions ),
-_runtimeOptions( runtimeOptions )
+_runtimeOptions( runtimeOptions ),
+_missCache     ( true, MISS_CACHE_SIZE )
 {
     init();
 }
@@ -159,7 +169,8 @@ TerrainLayer::TerrainLayer(const TerrainLayerOptions& initOptions,
                            TileSource*                tileSource ) :
 _initOptions   ( initOptions ),
 _runtimeOptions( runtimeOptions ),
-_tileSource    ( tileSource )
+_tileSource    ( tileSource ),
+_missCache     ( true, MISS_CACHE_SIZE )
 {
     init();
 }
@@ -622,6 +633,98 @@ TerrainLayer::isKeyValid(const TileKey& key) const
 	return true;
 }
 
+TileKey
+TerrainLayer::getBestAvailableTileKey(const TileKey& key) const
+{
+    if ( !key.valid() )
+        return TileKey::INVALID;
+
+    TileKey best = key;
+
+    // Respect the layer's own data level limit.
+    if ( _runtimeOptions->maxDataLevel().isSet() && best.getLOD() > _runtimeOptions->maxDataLevel().value() )
+    {
+        best = best.createAncestorKey( _runtimeOptions->maxDataLevel().value() );
+    }
+
+    // Consult the data extents. We can only compare LODs directly when the key
+    // is in the layer's own profile; otherwise just check for coverage.
+    TileSource* source = getTileSource();
+    if ( source && source->getDataExtents().size() > 0 )
+    {
+        const DataExtentList& extents = source->getDataExtents();
+        const GeoExtent&      keyExtent = key.getExtent();
+
+        bool     covered   = false;
+        bool     unlimited = false;
+        unsigned maxLevel  = 0;
+
+        for( DataExtentList::const_iterator i = extents.begin(); i != extents.end(); ++i )
+        {
+            if ( keyExtent.intersects(*i) )
+            {
+                covered = true;
+                if ( i->maxLevel().isSet() )
+                    maxLevel = osg::maximum( maxLevel, i->maxLevel().value() );
+                else
+                    unlimited = true;
+            }
+        }
+
+        if ( !covered )
+            return TileKey::INVALID;
+
+        const Profile* profile = getProfile();
+        if ( !unlimited && profile && key.getProfile()->isHorizEquivalentTo(profile) && best.getLOD() > maxLevel )
+        {
+            best = best.createAncestorKey( maxLevel );
+        }
+    }
+
+    // Skip past anything that recently failed or was blacklisted.
+    bool checkBlacklist = source && getProfile() && key.getProfile()->isHorizEquivalentTo(getProfile());
+    while( best.valid() )
+    {
+        if ( isMiss(best) )
+            best = best.createParentKey();
+        else if ( checkBlacklist && source->getBlacklist()->contains(best.getTileId()) )
+            best = best.createParentKey();
+        else
+            break;
+    }
+
+    return best;
+}
+
+void
+TerrainLayer::recordMiss(const TileKey& key) const
+{
+    // dynamic sources can have new data at any time.
+    if ( key.valid() && !isDynamic() )
+    {
+        _missCache.insert( MissKey(key.getProfile()->getHorizSignature(), key), ::time(0L) );
+    }
+}
+
+bool
+TerrainLayer::isMiss(const TileKey& key) const
+{
+    if ( !key.valid() )
+        return false;
+
+    MissKey missKey( key.getProfile()->getHorizSignature(), key );
+
+    MissCache::Record rec;
+    if ( _missCache.get(missKey, rec) )
+    {
+        if ( ::time(0L) - rec.value() < MISS_CACHE_EXPIRY )
+            return true;
+
+        _missCache.erase( missKey );
+    }
+    return false;
+}
+
 bool
 TerrainLayer::isCached(const TileKey& key) const
 {
@@ -0,0 +1,489 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/TriangleBVH>
+#include <osg/TriangleIndexFunctor>
+#include <osg/UserDataContainer>
+#include <OpenThreads/ScopedLock>
+#include <algorithm>
+#include <cfloat>
+
+#define LC "[TriangleBVH] "
+
+using namespace osgEarth;
+
+#define BVH_NAME "osgEarth.TriangleBVH"
+
+namespace
+{
+    // maximum number of triangles in a leaf node.
+    const unsigned LEAF_SIZE = 4;
+
+    struct CollectTriangles
+    {
+        CollectTriangles() : _numVerts(0), _index(0) { }
+
+        // counts every triangle (like osg::TriangleFunctor) so that primitive
+        // indices match the ones the standard intersectors report.
+        void operator()(unsigned p1, unsigned p2, unsigned p3)
+        {
+            unsigned index = _index++;
+            if ( p1 == p2 || p2 == p3 || p1 == p3 )
+                return;
+            if ( p1 >= _numVerts || p2 >= _numVerts || p3 >= _numVerts )
+                return;
+            _tris.push_back( p1 );
+            _tris.push_back( p2 );
+            _tris.push_back( p3 );
+            _primIndex.push_back( index );
+        }
+
+        unsigned              _numVerts;
+        unsigned              _index;
+        std::vector<unsigned> _tris;
+        std::vector<unsigned> _primIndex;
+    };
+
+    struct LessThanSplit
+    {
+        LessThanSplit(const std::vector<osg::Vec3d>& c, int axis, double split)
+            : _c(c), _axis(axis), _split(split) { }
+        bool operator()(unsigned t) const { return _c[t][_axis] < _split; }
+        const std::vector<osg::Vec3d>& _c;
+        int    _axis;
+        double _split;
+    };
+
+    struct LessOnAxis
+    {
+        LessOnAxis(const std::vector<osg::Vec3d>& c, int axis) : _c(c), _axis(axis) { }
+        bool operator()(unsigned a, unsigned b) const { return _c[a][_axis] < _c[b][_axis]; }
+        const std::vector<osg::Vec3d>& _c;
+        int _axis;
+    };
+
+    // Clips the segment s + t*d (t in [0..tmax]) against a box; returns the
+    // entry parameter in out_tnear.
+    inline bool hitBox(const double* bmin, const double* bmax,
+                       const osg::Vec3d& s, const osg::Vec3d& d, const double* inv,
+                       double tmax, double& out_tnear)
+    {
+        double tnear = 0.0, tfar = tmax;
+        for( int a = 0; a < 3; ++a )
+        {
+            if ( d[a] == 0.0 )
+            {
+                if ( s[a] < bmin[a] || s[a] > bmax[a] )
+                    return false;
+            }
+            else
+            {
+                double t0 = (bmin[a] - s[a]) * inv[a];
+                double t1 = (bmax[a] - s[a]) * inv[a];
+                if ( t0 > t1 ) std::swap( t0, t1 );
+                if ( t0 > tnear ) tnear = t0;
+                if ( t1 < tfar )  tfar  = t1;
+                if ( tnear > tfar )
+                    return false;
+            }
+        }
+        out_tnear = tnear;
+        return true;
+    }
+
+    bool lessRatio(const TriangleBVH::Hit& lhs, const TriangleBVH::Hit& rhs)
+    {
+        return lhs._ratio < rhs._ratio;
+    }
+}
+
+//------------------------------------------------------------------------
+
+TriangleBVH::TriangleBVH() :
+_state             ( PENDING ),
+_vertsModifiedCount( 0 )
+{
+    //nop
+}
+
+TriangleBVH::TriangleBVH(const TriangleBVH& rhs, const osg::CopyOp& op) :
+osg::Object        ( rhs, op ),
+_state             ( (unsigned)rhs._state ),
+_verts             ( rhs._verts ),
+_vertsModifiedCount( rhs._vertsModifiedCount ),
+_nodes             ( rhs._nodes ),
+_tris              ( rhs._tris ),
+_primIndex         ( rhs._primIndex )
+{
+    //nop
+}
+
+TriangleBVH*
+TriangleBVH::build(const osg::Geometry* geometry)
+{
+    osg::ref_ptr<TriangleBVH> bvh = new TriangleBVH();
+    if ( !bvh->buildFrom(geometry) )
+        return 0L;
+    return bvh.release();
+}
+
+bool
+TriangleBVH::buildFrom(const osg::Geometry* geometry)
+{
+    if ( !geometry )
+    {
+        _state.exchange( EMPTY );
+        return false;
+    }
+
+    const osg::Vec3Array* verts = dynamic_cast<const osg::Vec3Array*>( geometry->getVertexArray() );
+    if ( !verts || verts->empty() )
+    {
+        _state.exchange( EMPTY );
+        return false;
+    }
+
+    osg::TriangleIndexFunctor<CollectTriangles> collect;
+    collect._numVerts = verts->size();
+    geometry->accept( collect );
+
+    unsigned numTris = collect._primIndex.size();
+    if ( numTris == 0 )
+    {
+        _state.exchange( EMPTY );
+        return false;
+    }
+
+    setName( BVH_NAME );
+    _verts              = verts;
+    _vertsModifiedCount = verts->getModifiedCount();
+
+    std::vector<osg::Vec3d> centroids( numTris );
+    std::vector<unsigned>   order( numTris );
+    for( unsigned t = 0; t < numTris; ++t )
+    {
+        const unsigned* tri = &collect._tris[3*t];
+        centroids[t] = (osg::Vec3d((*verts)[tri[0]]) + osg::Vec3d((*verts)[tri[1]]) + osg::Vec3d((*verts)[tri[2]])) / 3.0;
+        order[t] = t;
+    }
+
+    // build over the triangles in collection order, then store them in leaf order.
+    _tris = collect._tris;
+    _nodes.clear();
+    _nodes.reserve( 2 * (numTris / LEAF_SIZE + 1) );
+    _nodes.resize( 1 );
+    buildNode( 0, order, centroids, 0, numTris );
+
+    _primIndex.resize( numTris );
+    for( unsigned i = 0; i < numTris; ++i )
+    {
+        unsigned t = order[i];
+        _tris[3*i+0]  = collect._tris[3*t+0];
+        _tris[3*i+1]  = collect._tris[3*t+1];
+        _tris[3*i+2]  = collect._tris[3*t+2];
+        _primIndex[i] = collect._primIndex[t];
+    }
+
+    _state.exchange( READY );
+    return true;
+}
+
+void
+TriangleBVH::buildNode(unsigned                       nodeIndex,
+                       std::vector<unsigned>&         order,
+                       const std::vector<osg::Vec3d>& centroids,
+                       unsigned                       first,
+                       unsigned                       count)
+{
+    const osg::Vec3Array& verts = *_verts.get();
+
+    // bounds of the triangles, and of their centroids:
+    double bmin[3] = {  DBL_MAX,  DBL_MAX,  DBL_MAX };
+    double bmax[3] = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+    double cmin[3] = {  DBL_MAX,  DBL_MAX,  DBL_MAX };
+    double cmax[3] = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+
+    for( unsigned i = first; i < first+count; ++i )
+    {
+        unsigned t = order[i];
+        for( unsigned k = 0; k < 3; ++k )
+        {
+            const osg::Vec3& v = verts[ _tris[3*t+k] ];
+            for( int a = 0; a < 3; ++a )
+            {
+                bmin[a] = std::min( bmin[a], (double)v[a] );
+                bmax[a] = std::max( bmax[a], (double)v[a] );
+            }
+        }
+        for( int a = 0; a < 3; ++a )
+        {
+            cmin[a] = std::min( cmin[a], centroids[t][a] );
+            cmax[a] = std::max( cmax[a], centroids[t][a] );
+        }
+    }
+
+    Node& node = _nodes[nodeIndex];
+    for( int a = 0; a < 3; ++a )
+    {
+        node._min[a] = bmin[a];
+        node._max[a] = bmax[a];
+    }
+
+    // split on the longest axis of the centroid bounds:
+    int axis = 0;
+    for( int a = 1; a < 3; ++a )
+    {
+        if ( cmax[a]-cmin[a] > cmax[axis]-cmin[axis] )
+            axis = a;
+    }
+
+    if ( count <= LEAF_SIZE || cmax[axis] <= cmin[axis] )
+    {
+        node._first = first;
+        node._count = count;
+        return;
+    }
+
+    double split = 0.5 * (cmin[axis] + cmax[axis]);
+    unsigned mid = std::partition( order.begin()+first, order.begin()+first+count, LessThanSplit(centroids, axis, split) ) - order.begin();
+
+    // fall back on a median split if the midpoint puts everything on one side:
+    if ( mid == first || mid == first+count )
+    {
+        mid = first + count/2;
+        std::nth_element( order.begin()+first, order.begin()+mid, order.begin()+first+count, LessOnAxis(centroids, axis) );
+    }
+
+    unsigned left = _nodes.size();
+    node._first = left;
+    node._count = 0;
+
+    // note: "node" is invalid once the vector grows.
+    _nodes.resize( left + 2 );
+    buildNode( left,   order, centroids, first, mid-first );
+    buildNode( left+1, order, centroids, mid,   first+count-mid );
+}
+
+void
+TriangleBVH::install(osg::Geometry* geometry)
+{
+    if ( !geometry )
+        return;
+
+    TriangleBVH* bvh = new TriangleBVH();
+    bvh->setName( BVH_NAME );
+
+    osg::UserDataContainer* udc = geometry->getOrCreateUserDataContainer();
+    unsigned index = udc->getUserObjectIndex( BVH_NAME );
+    if ( index < udc->getNumUserObjects() )
+        udc->removeUserObject( index );
+    udc->addUserObject( bvh );
+}
+
+const TriangleBVH*
+TriangleBVH::get(const osg::Drawable* drawable)
+{
+    const osg::UserDataContainer* udc = drawable ? drawable->getUserDataContainer() : 0L;
+    if ( !udc )
+        return 0L;
+
+    unsigned index = udc->getUserObjectIndex( BVH_NAME );
+    if ( index >= udc->getNumUserObjects() )
+        return 0L;
+
+    const TriangleBVH* bvh = dynamic_cast<const TriangleBVH*>( udc->getUserObject(index) );
+    if ( !bvh )
+        return 0L;
+
+    const osg::Geometry* geom = drawable->asGeometry();
+    if ( !geom )
+        return 0L;
+
+    // first intersection: build it. Concurrent queries wait for the one build.
+    if ( (unsigned)bvh->_state == PENDING )
+    {
+        TriangleBVH* building = const_cast<TriangleBVH*>( bvh );
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( building->_buildMutex );
+        if ( (unsigned)building->_state == PENDING )
+            building->buildFrom( geom );
+    }
+
+    if ( (unsigned)bvh->_state != READY )
+        return 0L;
+
+    // ignore a stale BVH:
+    if ( geom->getVertexArray() != bvh->_verts.get() ||
+         bvh->_verts->getModifiedCount() != bvh->_vertsModifiedCount )
+    {
+        return 0L;
+    }
+
+    return bvh;
+}
+
+bool
+TriangleBVH::intersect(const osg::Vec3d& start,
+                       const osg::Vec3d& end,
+                       HitList&          out,
+                       bool              nearestOnly) const
+{
+    std::vector<unsigned> stack;
+    stack.reserve( 64 );
+    return traverse( start, end-start, out, nearestOnly, stack );
+}
+
+bool
+TriangleBVH::traverse(const osg::Vec3d&      s,
+                      const osg::Vec3d&      d,
+                      HitList&               out,
+                      bool                   nearestOnly,
+                      std::vector<unsigned>& stack) const
+{
+    if ( _nodes.empty() || !_verts.valid() )
+        return false;
+
+    double inv[3];
+    for( int a = 0; a < 3; ++a )
+        inv[a] = d[a] != 0.0 ? 1.0/d[a] : 0.0;
+
+    unsigned firstHit = out.size();
+    Hit      best;
+    double   tmax = 1.0;
+
+    stack.clear();
+    stack.push_back( 0 );
+
+    while( !stack.empty() )
+    {
+        const Node& node = _nodes[stack.back()];
+        stack.pop_back();
+
+        double tnear;
+        if ( !hitBox(node._min, node._max, s, d, inv, tmax, tnear) )
+            continue;
+
+        if ( node._count > 0 )
+        {
+            for( unsigned t = node._first; t < node._first + node._count; ++t )
+            {
+                Hit hit;
+                if ( intersectTriangle(t, s, d, tmax, hit) )
+                {
+                    if ( nearestOnly )
+                    {
+                        best = hit;
+                        tmax = hit._ratio;
+                    }
+                    else
+                    {
+                        out.push_back( hit );
+                    }
+                }
+            }
+        }
+        else
+        {
+            // visit the nearer child first so a nearest-only query can cull the other.
+            const Node& left  = _nodes[node._first];
+            const Node& right = _nodes[node._first+1];
+            double tl, tr;
+            bool hitL = hitBox(left._min,  left._max,  s, d, inv, tmax, tl);
+            bool hitR = hitBox(right._min, right._max, s, d, inv, tmax, tr);
+            if ( hitL && hitR )
+            {
+                if ( tl <= tr )
+                {
+                    stack.push_back( node._first+1 );
+                    stack.push_back( node._first );
+                }
+                else
+                {
+                    stack.push_back( node._first );
+                    stack.push_back( node._first+1 );
+                }
+            }
+            else if ( hitL )
+            {
+                stack.push_back( node._first );
+            }
+            else if ( hitR )
+            {
+                stack.push_back( node._first+1 );
+            }
+        }
+    }
+
+    if ( nearestOnly )
+    {
+        if ( best._ratio < 0.0 )
+            return false;
+        out.push_back( best );
+        return true;
+    }
+
+    std::sort( out.begin()+firstHit, out.end(), lessRatio );
+    return out.size() > firstHit;
+}
+
+bool
+TriangleBVH::intersectTriangle(unsigned          t,
+                               const osg::Vec3d& s,
+                               const osg::Vec3d& d,
+                               double            maxRatio,
+                               Hit&              hit) const
+{
+    const osg::Vec3Array& verts = *_verts.get();
+    const unsigned* tri = &_tris[3*t];
+
+    osg::Vec3d v0( verts[tri[0]] );
+    osg::Vec3d e1 = osg::Vec3d(verts[tri[1]]) - v0;
+    osg::Vec3d e2 = osg::Vec3d(verts[tri[2]]) - v0;
+
+    osg::Vec3d p = d ^ e2;
+    double det = e1 * p;
+    if ( det == 0.0 )
+        return false; // segment is parallel to the triangle
+
+    double invDet = 1.0 / det;
+    osg::Vec3d tv = s - v0;
+
+    double u = (tv * p) * invDet;
+    if ( u < 0.0 || u > 1.0 )
+        return false;
+
+    osg::Vec3d q = tv ^ e1;
+    double v = (d * q) * invDet;
+    if ( v < 0.0 || u + v > 1.0 )
+        return false;
+
+    double r = (e2 * q) * invDet;
+    if ( r < 0.0 || r > maxRatio )
+        return false;
+
+    hit._ratio          = r;
+    hit._primitiveIndex = _primIndex[t];
+    hit._index[0]       = tri[0];
+    hit._index[1]       = tri[1];
+    hit._index[2]       = tri[2];
+    hit._weight[0]      = 1.0 - u - v;
+    hit._weight[1]      = u;
+    hit._weight[2]      = v;
+    hit._normal         = e1 ^ e2;
+    hit._normal.normalize();
+    return true;
+}
@@ -28,6 +28,7 @@
 #include <osg/Notify>
 #include <sstream>
 #include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
 
 #define LC "[VirtualProgram] "
 
@@ -56,6 +57,55 @@ namespace
 
     bool s_dumpShaders = false;        // debugging
 
+    // source of the VP data stamps; see VirtualProgram::getDataStamp()
+    OpenThreads::Atomic s_dataStampGenerator;
+
+    // the per-context program lookup starts over when it grows past this size,
+    // which happens only when VPs in the scene keep changing.
+    const unsigned MAX_PROGRAM_LOOKUP_SIZE = 64;
+
+    // The data stamps of the VPs contributing to a program, in stack order.
+    // Held on the stack unless there are unusually many.
+    class StampList
+    {
+    public:
+        StampList() : _size(0) { }
+
+        void push_back( unsigned stamp )
+        {
+            if ( _size < LOCAL )
+                _local[_size] = stamp;
+            else
+                _more.push_back( stamp );
+            ++_size;
+        }
+
+        unsigned operator[]( unsigned i ) const { return i < LOCAL ? _local[i] : _more[i-LOCAL]; }
+
+        bool operator == ( const std::vector<unsigned>& rhs ) const
+        {
+            if ( rhs.size() != _size )
+                return false;
+            for( unsigned i=0; i<_size; ++i )
+                if ( rhs[i] != (*this)[i] )
+                    return false;
+            return true;
+        }
+
+        void copyTo( std::vector<unsigned>& out ) const
+        {
+            out.resize( _size );
+            for( unsigned i=0; i<_size; ++i )
+                out[i] = (*this)[i];
+        }
+
+    private:
+        enum { LOCAL = 16 };
+        unsigned              _local[LOCAL];
+        std::vector<unsigned> _more;
+        unsigned              _size;
+    };
+
     /** A device that lets us do a const search on the State's attribute map. OSG does not yet
         have a const way to do this. It has getAttributeVec() but that is non-const (it creates
         the vector if it doesn't exist); Newer versions have getAttributeMap(), but that does not
@@ -465,6 +515,8 @@ _inheritSet        ( false )
     // a template object to hold program data (so we don't have to dupliate all the 
     // osg::Program methods..)
     _template = new osg::Program();
+
+    dirtyDataStamp();
 }
 
 
@@ -477,7 +529,13 @@ _inherit           ( rhs._inherit ),
 _inheritSet        ( rhs._inheritSet ),
 _template          ( osg::clone(rhs._template.get()) )
 {
-    //nop
+    dirtyDataStamp();
+}
+
+void
+VirtualProgram::dirtyDataStamp()
+{
+    _dataStamp = ++s_dataStampGenerator;
 }
 
 int
@@ -537,6 +595,8 @@ VirtualProgram::addBindAttribLocation( const std::string& name, GLuint index )
 #else
     _attribBindingList[name] = index;
 #endif
+
+    dirtyDataStamp();
 }
 
 void
@@ -551,6 +611,8 @@ VirtualProgram::removeBindAttribLocation( const std::string& name )
 #else
     _attribBindingList.erase(name);
 #endif
+
+    dirtyDataStamp();
 }
 
 void
@@ -571,6 +633,8 @@ VirtualProgram::resizeGLObjectBuffers(unsigned maxSize)
   {
     i->second->resizeGLObjectBuffers(maxSize);
   }
+
+  _programLookup.resize(maxSize);
 }
 
 void
@@ -585,6 +649,11 @@ VirtualProgram::releaseGLObjects(osg::State* state) const
   {
     i->second->releaseGLObjects(state);
   }
+
+  if ( state )
+      _programLookup[state->getContextID()].clear();
+  else
+      _programLookup.setAllElementsTo( ProgramLookup() );
 }
 
 osg::Shader*
@@ -622,6 +691,7 @@ VirtualProgram::setShader(const std::string&                 shaderID,
     {
         Threading::ScopedWriteLock exclusive( _dataModelMutex );
         _shaderMap[shaderID] = ShaderEntry(shader, ov);
+        dirtyDataStamp();
     }
 
     return shader;
@@ -655,6 +725,7 @@ VirtualProgram::setShader(osg::Shader*                       shader,
     {
         Threading::ScopedWriteLock exclusive( _dataModelMutex );
         _shaderMap[shader->getName()] = ShaderEntry(shader, ov);
+        dirtyDataStamp();
     }
 
     return shader;
@@ -708,6 +779,7 @@ VirtualProgram::setFunction(const std::string& functionName,
         ShaderPreProcessor::run( shader );
 
         _shaderMap[functionName] = ShaderEntry(shader, osg::StateAttribute::ON);
+        dirtyDataStamp();
 
     } // release lock
 }
@@ -719,6 +791,7 @@ VirtualProgram::removeShader( const std::string& shaderID )
     Threading::ScopedWriteLock exclusive( _dataModelMutex );
 
     _shaderMap.erase( shaderID );
+    dirtyDataStamp();
 
     for(FunctionLocationMap::iterator i = _functions.begin(); i != _functions.end(); ++i )
     {
@@ -756,6 +829,7 @@ VirtualProgram::setInheritShaders( bool value )
         }
 
         _inheritSet = true;
+        dirtyDataStamp();
     }
 }
 
@@ -783,48 +857,76 @@ VirtualProgram::apply( osg::State& state ) const
         return;
     }
 
+    // Find the range of the attribute stack that contributes to this program:
+    // from the deepest VP that doesn't inherit, up to the top.
+    const StateHack::AttributeVec* av = _inherit ? StateHack::GetAttributeVec( state, this ) : 0L;
+    unsigned start = 0, end = 0;
+    if ( av && av->size() > 0 )
+    {
+        end = av->size();
+        for( start = end-1; start > 0; --start )
+        {
+            const VirtualProgram* vp = dynamic_cast<const VirtualProgram*>( (*av)[start].first );
+            if ( vp && (vp->_mask & _mask) && vp->_inherit == false )
+                break;
+        }
+    }
+
+    // Look for the program in this context's lookup table first. The key
+    // derives from the data stamps of the contributing VPs, so a hit needs
+    // neither the shader accumulation below nor any locks. One walk of the
+    // stack gathers the stamps for the key and for ruling out a collision;
+    // on a miss they are recorded as they were before the accumulation read
+    // the data they stand for.
+    StampList  stamps;
+    ProgramKey key = getProgramKeySeed();
+    for( unsigned i=start; i<end; ++i )
+    {
+        const VirtualProgram* vp = dynamic_cast<const VirtualProgram*>( (*av)[i].first );
+        if ( vp && (vp->_mask & _mask) )
+        {
+            unsigned stamp = vp->_dataStamp;
+            stamps.push_back( stamp );
+            key = extendProgramKey( key, stamp );
+        }
+    }
+    unsigned ownStamp = _dataStamp;
+    stamps.push_back( ownStamp );
+    key = extendProgramKey( key, ownStamp );
+
+    ProgramLookup& lookup = _programLookup[state.getContextID()];
+    ProgramLookup::const_iterator hit = lookup.find( key );
+    if ( hit != lookup.end() && stamps == hit->second._stamps )
+    {
+        hit->second._program->apply( state );
+        return;
+    }
+
     // first, find and collect all the VirtualProgram attributes:
     ShaderMap         accumShaderMap;
     AttribBindingList accumAttribBindings;
     AttribAliasMap    accumAttribAliases;
     
-    if ( _inherit )
+    for( unsigned i=start; i<end; ++i )
     {
-        const StateHack::AttributeVec* av = StateHack::GetAttributeVec( state, this );
-        if ( av && av->size() > 0 )
+        const VirtualProgram* vp = dynamic_cast<const VirtualProgram*>( (*av)[i].first );
+        if ( vp && (vp->_mask & _mask) )
         {
-            // find the deepest VP that doesn't inherit:
-            unsigned start = 0;
-            for( start = (int)av->size()-1; start > 0; --start )
+            ShaderMap vpShaderMap;
+            vp->getShaderMap( vpShaderMap );
+
+            for( ShaderMap::const_iterator j = vpShaderMap.begin(); j != vpShaderMap.end(); ++j )
             {
-                const VirtualProgram* vp = dynamic_cast<const VirtualProgram*>( (*av)[start].first );
-                if ( vp && (vp->_mask & _mask) && vp->_inherit == false )
-                    break;
+                addToAccumulatedMap( accumShaderMap, j->first, j->second );
             }
-            
-            // collect shaders from there to here:
-            for( unsigned i=start; i<av->size(); ++i )
-            {
-                const VirtualProgram* vp = dynamic_cast<const VirtualProgram*>( (*av)[i].first );
-                if ( vp && (vp->_mask && _mask) )
-                {
-                    ShaderMap vpShaderMap;
-                    vp->getShaderMap( vpShaderMap );
 
-                    for( ShaderMap::const_iterator i = vpShaderMap.begin(); i != vpShaderMap.end(); ++i )
-                    {
-                        addToAccumulatedMap( accumShaderMap, i->first, i->second );
-                    }
-
-                    const AttribBindingList& abl = vp->getAttribBindingList();
-                    accumAttribBindings.insert( abl.begin(), abl.end() );
+            const AttribBindingList& abl = vp->getAttribBindingList();
+            accumAttribBindings.insert( abl.begin(), abl.end() );
 
 #ifdef USE_ATTRIB_ALIASES
-                    const AttribAliasMap& aliases = vp->getAttribAliases();
-                    accumAttribAliases.insert( aliases.begin(), aliases.end() );
+            const AttribAliasMap& aliases = vp->getAttribAliases();
+            accumAttribAliases.insert( aliases.begin(), aliases.end() );
 #endif
-                }
-            }
         }
     }
 
@@ -917,11 +1019,18 @@ VirtualProgram::apply( osg::State& state ) const
             }
         }
         
-        // finally, apply the program attribute.
+        // finally, apply the program attribute and remember it for next time.
         if ( program.valid() )
         {
             program->apply( state );
 
+            if ( lookup.size() >= MAX_PROGRAM_LOOKUP_SIZE )
+                lookup.clear();
+
+            ProgramLookupEntry& entry = lookup[key];
+            stamps.copyTo( entry._stamps );
+            entry._program = program.get();
+
 #if 0 // test code for detecting race conditions
             for(int i=0; i<10000; ++i) {
                 state.setLastAppliedProgramObject(0L);
@@ -972,7 +1081,7 @@ VirtualProgram::accumulateFunctions(const osg::State&                state,
             for( unsigned i=start; i<av->size(); ++i )
             {
                 const VirtualProgram* vp = dynamic_cast<const VirtualProgram*>( (*av)[i].first );
-                if ( vp && (vp->_mask && _mask) && (vp != this) )
+                if ( vp && (vp->_mask & _mask) && (vp != this) )
                 {
                     FunctionLocationMap rhs;
                     vp->getFunctions( rhs );
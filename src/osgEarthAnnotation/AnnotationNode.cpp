@@ -132,7 +132,7 @@ AnnotationNode::setMapNode( MapNode* mapNode )
             {
                 oldMapNode->getTerrain()->removeTerrainCallback( _autoClampCallback.get() );
                 if ( mapNode )
-                    mapNode->getTerrain()->addTerrainCallback( _autoClampCallback.get() );
+                    addAutoClampCallback( mapNode );
             }
         }		
 
@@ -176,7 +176,7 @@ AnnotationNode::setCPUAutoClamping( bool value )
             if ( AnnotationSettings::getContinuousClamping() )
             {
                 _autoClampCallback = new AutoClampCallback( this );
-                getMapNode()->getTerrain()->addTerrainCallback( _autoClampCallback.get() );
+                addAutoClampCallback( getMapNode() );
             }
         }
         else if ( _autoclamp && !value && _autoClampCallback.valid())
@@ -211,6 +211,31 @@ AnnotationNode::setCPUAutoClamping( bool value )
     }
 }
 
+void
+AnnotationNode::setAutoClampExtent( const GeoExtent& extent )
+{
+    bool wasLocal = _autoClampExtent.isValid();
+    _autoClampExtent = extent;
+
+    if ( _autoClampCallback.valid() && getMapNode() )
+    {
+        // re-registering a local callback just moves it; a global one must go first.
+        if ( !wasLocal || !_autoClampExtent.isValid() )
+            getMapNode()->getTerrain()->removeTerrainCallback( _autoClampCallback.get() );
+
+        addAutoClampCallback( getMapNode() );
+    }
+}
+
+void
+AnnotationNode::addAutoClampCallback( MapNode* mapNode )
+{
+    if ( _autoClampExtent.isValid() )
+        mapNode->getTerrain()->addTerrainCallback( _autoClampCallback.get(), _autoClampExtent );
+    else
+        mapNode->getTerrain()->addTerrainCallback( _autoClampCallback.get() );
+}
+
 void
 AnnotationNode::setDepthAdjustment( bool enable )
 {
@@ -160,7 +160,8 @@ FeatureNode::init()
                 // The polytope will ensure we only clamp to intersecting tiles:
                 _feature->getWorldBoundingPolytope( getMapNode()->getMapSRS(), _featurePolytope );
 
-                // activate the terrain callback:
+                // activate the terrain callback for tiles under the feature:
+                setAutoClampExtent( extent );
                 setCPUAutoClamping( true );
 
                 // set default lighting based on whether we are extruding:
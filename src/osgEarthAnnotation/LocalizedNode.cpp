@@ -108,6 +108,9 @@ LocalizedNode::setPosition( const GeoPoint& pos )
                 return false;
 
             _mapPosition = mapPos;
+
+            // only tiles under the position matter for clamping:
+            setAutoClampExtent( GeoExtent(mapSRS, mapPos.x(), mapPos.y(), mapPos.x(), mapPos.y()) );
         }
         else
         {
@@ -262,6 +262,9 @@ OrthoNode::setPosition( const GeoPoint& position )
             return false;
 
         _mapPosition = mapPos;
+
+        // only tiles under the position matter for clamping:
+        setAutoClampExtent( GeoExtent(mapSRS, mapPos.x(), mapPos.y(), mapPos.x(), mapPos.y()) );
     }
     else
     {
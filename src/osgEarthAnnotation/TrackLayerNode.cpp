@@ -0,0 +1,751 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthAnnotation/TrackLayerNode>
+#include <osgEarthAnnotation/AnnotationUtils>
+#include <osgEarth/MapNode>
+#include <osgEarth/Registry>
+#include <osgEarth/Capabilities>
+#include <osgEarth/CullingUtils>
+#include <osgEarth/ShaderGenerator>
+#include <osgEarth/VirtualProgram>
+#include <osgUtil/CullVisitor>
+#include <osg/Depth>
+#include <algorithm>
+#include <float.h>
+
+#define LC "[TrackLayerNode] "
+
+using namespace osgEarth;
+using namespace osgEarth::Annotation;
+using namespace osgEarth::Symbology;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // Moves each vertex by a pixel offset after projection. Icons carry the
+    // offsets of their quad corners in texture unit 1; labels get a constant
+    // per-field offset from a uniform.
+    const char* TrackLayerClipShader =
+        "#version " GLSL_VERSION_STR "\n"
+#ifdef OSG_GLES2_AVAILABLE
+        "precision mediump float; \n"
+#endif
+        "uniform vec2 oe_tracks_viewport; \n"
+        "uniform vec2 oe_tracks_pixelOffset; \n"
+        "uniform bool oe_tracks_isIcon; \n"
+
+        "void oe_tracks_clip(inout vec4 VertexCLIP) \n"
+        "{ \n"
+        "    vec2 pixels = oe_tracks_pixelOffset; \n"
+        "    if ( oe_tracks_isIcon ) \n"
+        "        pixels += gl_MultiTexCoord1.xy; \n"
+        "    VertexCLIP.xy += pixels * 2.0 / oe_tracks_viewport * VertexCLIP.w; \n"
+        "} \n";
+
+    // whether a point is inside every plane, or outside by no more than "pad".
+    inline bool containsPadded( const osg::Polytope::PlaneList& planes, const osg::Vec3d& p, double pad )
+    {
+        for( osg::Polytope::PlaneList::const_iterator i = planes.begin(); i != planes.end(); ++i )
+        {
+            if ( i->distance(p) < -pad )
+                return false;
+        }
+        return true;
+    }
+}
+
+//------------------------------------------------------------------------
+
+TrackLayerNode::TrackLayerNode(MapNode*                    mapNode,
+                               const TrackNodeFieldSchema& fieldSchema) :
+_geocentric      ( false ),
+_radius          ( 0.0 ),
+_hasAnchor       ( false ),
+_batchRevision   ( 0 ),
+_positionRevision( 0 ),
+_labelRange      ( 0.0 ),
+_horizonCulling  ( true )
+{
+    if ( mapNode )
+    {
+        _mapSRS     = mapNode->getMapSRS();
+        _geocentric = mapNode->isGeocentric();
+
+        if ( _mapSRS.valid() && _mapSRS->getEllipsoid() )
+            _radius = _mapSRS->getEllipsoid()->getRadiusPolar();
+    }
+
+    for( TrackNodeFieldSchema::const_iterator i = fieldSchema.begin(); i != fieldSchema.end(); ++i )
+    {
+        _fieldNames.push_back( i->first );
+        _fields.push_back( i->second );
+    }
+    _fieldStateSets.resize( _fields.size() );
+
+    init();
+}
+
+void
+TrackLayerNode::init()
+{
+    // the bound only spans the track positions (a single track gives it zero
+    // radius), not the screen-space icons, so OSG's own culling -- small
+    // feature culling in particular -- would drop visible tracks. cull()
+    // tests every track against the frustum instead.
+    this->setCullingActive( false );
+
+    osg::StateSet* stateSet = this->getOrCreateStateSet();
+
+    // ensure depth testing always passes, and disable depth buffer writes.
+    stateSet->setAttributeAndModes( new osg::Depth(osg::Depth::ALWAYS, 0, 1, false), 1 );
+    stateSet->setMode( GL_LIGHTING, 0 );
+    stateSet->setMode( GL_BLEND, 1 );
+
+    if ( Registry::capabilities().supportsGLSL() )
+    {
+        VirtualProgram* vp = VirtualProgram::getOrCreate( stateSet );
+        vp->setName( "osgEarth.TrackLayerNode" );
+        vp->setFunction( "oe_tracks_clip", TrackLayerClipShader, ShaderComp::LOCATION_VERTEX_CLIP );
+
+        stateSet->getOrCreateUniform( "oe_tracks_isIcon",      osg::Uniform::BOOL )->set( false );
+        stateSet->getOrCreateUniform( "oe_tracks_pixelOffset", osg::Uniform::FLOAT_VEC2 )->set( osg::Vec2f(0,0) );
+    }
+    else
+    {
+        OE_WARN << LC << "GLSL is not available; tracks will not render properly" << std::endl;
+    }
+}
+
+unsigned
+TrackLayerNode::addIcon( osg::Image* image, float scale )
+{
+    _batches.push_back( IconBatch() );
+    IconBatch& batch = _batches.back();
+
+    batch._size.set(
+        image ? scale * (float)image->s() : 0.0f,
+        image ? scale * (float)image->t() : 0.0f );
+
+    // the arrays are shared by the geometries of every view, so assign their
+    // buffer objects up front instead of letting each geometry do it at cull time.
+    osg::VertexBufferObject* vbo = new osg::VertexBufferObject();
+    batch._verts     = new osg::Vec3Array();
+    batch._corners   = new osg::Vec2Array();
+    batch._texCoords = new osg::Vec2Array();
+    batch._verts->setVertexBufferObject( vbo );
+    batch._corners->setVertexBufferObject( vbo );
+    batch._texCoords->setVertexBufferObject( vbo );
+
+    // borrow the texturing state of a regular annotation icon and generate
+    // shaders for it.
+    osg::ref_ptr<osg::Geometry> iconGeom = AnnotationUtils::createImageGeometry(
+        image, osg::Vec2s(0,0), 0, 0.0, 1.0 );
+
+    if ( iconGeom.valid() )
+    {
+        osg::ref_ptr<osg::Geode> geode = new osg::Geode();
+        geode->addDrawable( iconGeom.get() );
+
+        ShaderGenerator gen;
+        gen.setProgramName( "osgEarth.TrackLayerNode" );
+        gen.run( geode.get() );
+
+        batch._stateSet = iconGeom->getStateSet();
+    }
+    else
+    {
+        OE_WARN << LC << "Icon " << (_batches.size()-1) << " has no image" << std::endl;
+    }
+
+    if ( !batch._stateSet.valid() )
+        batch._stateSet = new osg::StateSet();
+
+    batch._stateSet->getOrCreateUniform( "oe_tracks_isIcon", osg::Uniform::BOOL )->set( true );
+
+    ++_batchRevision;
+    return _batches.size()-1;
+}
+
+bool
+TrackLayerNode::toWorld( const GeoPoint& position, osg::Vec3d& out_world ) const
+{
+    if ( _mapSRS.valid() )
+    {
+        GeoPoint mapPos = position.transform( _mapSRS.get() );
+        return mapPos.isValid() && mapPos.toWorld( out_world );
+    }
+    else
+    {
+        out_world = position.vec3d();
+        return true;
+    }
+}
+
+void
+TrackLayerNode::setAnchor( const osg::Vec3d& world )
+{
+    // vertices are stored relative to the anchor to keep float precision
+    // near the tracks. It only changes while the layer is empty.
+    _anchor    = world;
+    _hasAnchor = true;
+}
+
+TrackLayerNode::Track*
+TrackLayerNode::getTrack( TrackID id )
+{
+    if ( id < 0 || id >= (TrackID)_indexOfID.size() || _indexOfID[id] < 0 )
+        return 0L;
+    return &_tracks[_indexOfID[id]];
+}
+
+TrackLayerNode::TrackID
+TrackLayerNode::addTrack( const GeoPoint& position, unsigned icon, double heading )
+{
+    if ( icon >= _batches.size() )
+    {
+        OE_WARN << LC << "Illegal: icon index " << icon << " is out of range" << std::endl;
+        return -1;
+    }
+
+    osg::Vec3d world;
+    if ( !toWorld(position, world) )
+        return -1;
+
+    if ( !_hasAnchor )
+        setAnchor( world );
+
+    TrackID id;
+    if ( !_freeIDs.empty() )
+    {
+        id = _freeIDs.back();
+        _freeIDs.pop_back();
+    }
+    else
+    {
+        id = _indexOfID.size();
+        _indexOfID.push_back( -1 );
+    }
+
+    _tracks.push_back( Track() );
+    Track& track = _tracks.back();
+    track._id      = id;
+    track._world   = world;
+    track._heading = heading;
+    track._icon    = icon;
+    track._slot    = 0;
+
+    _indexOfID[id] = _tracks.size()-1;
+    addToBatch( _tracks.size()-1 );
+
+    positionsChanged();
+    return id;
+}
+
+bool
+TrackLayerNode::removeTrack( TrackID id )
+{
+    if ( !getTrack(id) )
+        return false;
+
+    unsigned index = _indexOfID[id];
+    removeFromBatch( index );
+
+    // fill the hole with the last track:
+    unsigned last = _tracks.size()-1;
+    if ( index != last )
+    {
+        std::swap( _tracks[index], _tracks[last] );
+        Track& moved = _tracks[index];
+        _indexOfID[moved._id] = index;
+        _batches[moved._icon]._tracks[moved._slot] = index;
+    }
+    _tracks.pop_back();
+
+    _indexOfID[id] = -1;
+    _freeIDs.push_back( id );
+
+    positionsChanged();
+    return true;
+}
+
+void
+TrackLayerNode::clear()
+{
+    _tracks.clear();
+    _indexOfID.clear();
+    _freeIDs.clear();
+
+    for( std::vector<IconBatch>::iterator b = _batches.begin(); b != _batches.end(); ++b )
+    {
+        b->_tracks.clear();
+        b->_verts->clear();
+        b->_corners->clear();
+        b->_texCoords->clear();
+    }
+
+    _hasAnchor = false;
+    positionsChanged();
+}
+
+bool
+TrackLayerNode::setPosition( TrackID id, const GeoPoint& position, double heading )
+{
+    Track* track = getTrack( id );
+    if ( !track )
+        return false;
+
+    osg::Vec3d world;
+    if ( !toWorld(position, world) )
+        return false;
+
+    track->_world = world;
+    writePosition( *track );
+
+    if ( track->_heading != (float)heading )
+    {
+        track->_heading = heading;
+        writeCorners( *track );
+    }
+
+    positionsChanged();
+    return true;
+}
+
+void
+TrackLayerNode::setPositions( const std::vector<TrackUpdate>& updates )
+{
+    osg::Vec3d world;
+
+    for( std::vector<TrackUpdate>::const_iterator u = updates.begin(); u != updates.end(); ++u )
+    {
+        Track* track = getTrack( u->_id );
+        if ( !track )
+            continue;
+
+        if ( _mapSRS.valid() )
+        {
+            if ( !_mapSRS->transformToWorld(u->_position, world) )
+                continue;
+        }
+        else
+        {
+            world = u->_position;
+        }
+
+        track->_world = world;
+        writePosition( *track );
+
+        if ( track->_heading != (float)u->_heading )
+        {
+            track->_heading = u->_heading;
+            writeCorners( *track );
+        }
+    }
+
+    positionsChanged();
+}
+
+bool
+TrackLayerNode::setIcon( TrackID id, unsigned icon )
+{
+    Track* track = getTrack( id );
+    if ( !track || icon >= _batches.size() )
+        return false;
+
+    if ( track->_icon != icon )
+    {
+        unsigned index = _indexOfID[id];
+        removeFromBatch( index );
+        track->_icon = icon;
+        addToBatch( index );
+        positionsChanged();
+    }
+    return true;
+}
+
+void
+TrackLayerNode::setFieldValue( TrackID id, const std::string& name, const osgText::String& value )
+{
+    Track* track = getTrack( id );
+    if ( !track )
+        return;
+
+    unsigned f = std::find( _fieldNames.begin(), _fieldNames.end(), name ) - _fieldNames.begin();
+    if ( f == _fieldNames.size() || !_fields[f]._symbol.valid() )
+        return;
+
+    if ( track->_labels.size() < _fields.size() )
+        track->_labels.resize( _fields.size() );
+
+    osg::ref_ptr<osgText::Text>& label = track->_labels[f];
+
+    if ( label.valid() )
+    {
+        // only permit updates if the field was declared dynamic, OR
+        // this node is not connected yet
+        if ( label->getDataVariance() == osg::Object::DYNAMIC || this->getNumParents() == 0 )
+        {
+            label->setText( value );
+        }
+        else
+        {
+            OE_WARN << LC
+                << "Illegal: attempt to modify a track field value that is not marked as dynamic"
+                << std::endl;
+        }
+        return;
+    }
+
+    const TrackNodeField& field = _fields[f];
+
+    label = dynamic_cast<osgText::Text*>( AnnotationUtils::createTextDrawable(
+        std::string(),
+        field._symbol.get(),
+        osg::Vec3(0,0,0) ) );
+
+    if ( !label.valid() )
+        return;
+
+    label->setText( value );
+
+    // the label sits at the track's position and faces the screen; the
+    // symbol's pixel offset is applied by the clip shader instead.
+    label->setAutoRotateToScreen( true );
+    label->setCharacterSizeMode( osgText::Text::SCREEN_COORDS );
+    label->setPosition( osg::Vec3f(track->_world - _anchor) );
+    label->setDataVariance( field._dynamic ? osg::Object::DYNAMIC : osg::Object::STATIC );
+
+    // all the labels of a field share one shader-generated state set.
+    if ( !_fieldStateSets[f].valid() )
+    {
+        osg::ref_ptr<osg::Geode> geode = new osg::Geode();
+        geode->addDrawable( label.get() );
+
+        ShaderGenerator gen;
+        gen.setProgramName( "osgEarth.TrackLayerNode" );
+        gen.run( geode.get() );
+
+        geode->removeDrawable( label.get() );
+
+        osg::StateSet* stateSet = label->getStateSet() ? label->getStateSet() : new osg::StateSet();
+
+        osg::Vec2f offset(0,0);
+        if ( field._symbol->pixelOffset().isSet() )
+            offset.set( field._symbol->pixelOffset()->x(), field._symbol->pixelOffset()->y() );
+
+        stateSet->getOrCreateUniform( "oe_tracks_pixelOffset", osg::Uniform::FLOAT_VEC2 )->set( offset );
+
+        _fieldStateSets[f] = stateSet;
+    }
+
+    label->setStateSet( _fieldStateSets[f].get() );
+}
+
+void
+TrackLayerNode::addToBatch( unsigned index )
+{
+    Track& track = _tracks[index];
+    IconBatch& batch = _batches[track._icon];
+
+    track._slot = batch._tracks.size();
+    batch._tracks.push_back( index );
+
+    batch._verts->resize( batch._verts->size() + 4 );
+    batch._corners->resize( batch._corners->size() + 4 );
+
+    batch._texCoords->push_back( osg::Vec2(0,0) );
+    batch._texCoords->push_back( osg::Vec2(1,0) );
+    batch._texCoords->push_back( osg::Vec2(1,1) );
+    batch._texCoords->push_back( osg::Vec2(0,1) );
+
+    writePosition( track );
+    writeCorners( track );
+}
+
+void
+TrackLayerNode::removeFromBatch( unsigned index )
+{
+    Track& track = _tracks[index];
+    IconBatch& batch = _batches[track._icon];
+
+    // fill the hole with the batch's last quad:
+    unsigned slot = track._slot;
+    unsigned last = batch._tracks.size()-1;
+    if ( slot != last )
+    {
+        unsigned moved = batch._tracks[last];
+        batch._tracks[slot] = moved;
+        _tracks[moved]._slot = slot;
+
+        for( unsigned k = 0; k < 4; ++k )
+        {
+            (*batch._verts)[slot*4+k]   = (*batch._verts)[last*4+k];
+            (*batch._corners)[slot*4+k] = (*batch._corners)[last*4+k];
+        }
+    }
+
+    batch._tracks.pop_back();
+    batch._verts->resize( last*4 );
+    batch._corners->resize( last*4 );
+    batch._texCoords->resize( last*4 );
+}
+
+void
+TrackLayerNode::writePosition( Track& track )
+{
+    IconBatch& batch = _batches[track._icon];
+
+    osg::Vec3f local( track._world - _anchor );
+
+    osg::Vec3Array& verts = *batch._verts;
+    unsigned v = track._slot*4;
+    verts[v] = verts[v+1] = verts[v+2] = verts[v+3] = local;
+
+    for( unsigned f = 0; f < track._labels.size(); ++f )
+    {
+        if ( track._labels[f].valid() )
+            track._labels[f]->setPosition( local );
+    }
+}
+
+void
+TrackLayerNode::writeCorners( Track& track )
+{
+    IconBatch& batch = _batches[track._icon];
+
+    float w = 0.5f * batch._size.x();
+    float h = 0.5f * batch._size.y();
+
+    // heading is clockwise; screen rotation is counter-clockwise.
+    double a = -osg::DegreesToRadians( (double)track._heading );
+    float c = cos(a), s = sin(a);
+
+    osg::Vec2Array& corners = *batch._corners;
+    unsigned v = track._slot*4;
+    corners[v  ].set( -w*c + h*s, -w*s - h*c );
+    corners[v+1].set(  w*c + h*s,  w*s - h*c );
+    corners[v+2].set(  w*c - h*s,  w*s + h*c );
+    corners[v+3].set( -w*c - h*s, -w*s + h*c );
+}
+
+void
+TrackLayerNode::positionsChanged()
+{
+    for( std::vector<IconBatch>::iterator b = _batches.begin(); b != _batches.end(); ++b )
+    {
+        b->_verts->dirty();
+        b->_corners->dirty();
+        b->_texCoords->dirty();
+    }
+
+    ++_positionRevision;
+    dirtyBound();
+}
+
+void
+TrackLayerNode::initPerViewData( PerViewData& data )
+{
+    if ( !data._stateSet.valid() )
+    {
+        data._stateSet = new osg::StateSet();
+        data._stateSet->setDataVariance( osg::Object::DYNAMIC );
+        data._viewport = data._stateSet->getOrCreateUniform( "oe_tracks_viewport", osg::Uniform::FLOAT_VEC2 );
+        data._viewport->setDataVariance( osg::Object::DYNAMIC );
+        data._viewport->set( osg::Vec2f(1,1) );
+    }
+
+    // one geometry per icon; they share the layer's vertex arrays but
+    // carry their own list of visible quads.
+    data._geode = new osg::Geode();
+    data._geode->setCullingActive( false );
+    data._geoms.clear();
+    data._elements.clear();
+
+    for( std::vector<IconBatch>::const_iterator b = _batches.begin(); b != _batches.end(); ++b )
+    {
+        osg::Geometry* geom = new osg::Geometry();
+        geom->setDataVariance( osg::Object::DYNAMIC );
+        geom->setUseDisplayList( false );
+        geom->setUseVertexBufferObjects( true );
+        geom->setVertexArray( b->_verts.get() );
+        geom->setTexCoordArray( 0, b->_texCoords.get() );
+        geom->setTexCoordArray( 1, b->_corners.get() );
+
+        osg::Vec4Array* colors = new osg::Vec4Array(1);
+        (*colors)[0].set( 1.0f, 1.0f, 1.0f, 1.0f );
+        geom->setColorArray( colors );
+        geom->setColorBinding( osg::Geometry::BIND_OVERALL );
+
+        osg::DrawElementsUInt* elements = new osg::DrawElementsUInt( GL_QUADS );
+        geom->addPrimitiveSet( elements );
+        geom->setStateSet( b->_stateSet.get() );
+
+        data._geode->addDrawable( geom );
+        data._geoms.push_back( geom );
+        data._elements.push_back( elements );
+    }
+
+    data._batchRevision    = _batchRevision;
+    data._positionRevision = -1;
+}
+
+void
+TrackLayerNode::cull( osgUtil::CullVisitor* cv )
+{
+    PerViewData& data = _perViewData.get( cv->getCurrentCamera() );
+
+    if ( data._batchRevision != _batchRevision )
+        initPerViewData( data );
+
+    // the bounds feed the near/far computation:
+    if ( data._positionRevision != _positionRevision )
+    {
+        for( unsigned i = 0; i < data._geoms.size(); ++i )
+            data._geoms[i]->dirtyBound();
+        data._geode->dirtyBound();
+        data._positionRevision = _positionRevision;
+    }
+
+    const osg::Viewport* viewport = cv->getViewport();
+    if ( viewport )
+        data._viewport->set( osg::Vec2f(viewport->width(), viewport->height()) );
+
+    // everything below happens in anchor-relative coordinates.
+    osg::ref_ptr<osg::RefMatrix> mv = new osg::RefMatrix( *cv->getModelViewMatrix() );
+    mv->preMultTranslate( _anchor );
+    cv->pushModelViewMatrix( mv.get(), osg::Transform::RELATIVE_RF );
+
+    // an icon reaches past its anchor by up to half its diagonal in pixels,
+    // so the frustum test is padded by that much at each track's distance.
+    // (The pixel size vector gives the size of a pixel at a point.)
+    const osg::Polytope::PlaneList& planes = cv->getCurrentCullingSet().getFrustum().getPlaneList();
+    const osg::Vec4& pixelSize = cv->getCurrentCullingSet().getPixelSizeVector();
+    osg::Vec3d eye = cv->getEyeLocal();
+
+    // horizon test against the polar-radius sphere, which is conservative.
+    bool horizon = _horizonCulling && _geocentric && _radius > 0.0;
+    osg::Vec3d vc = (eye + _anchor) / _radius;
+    double vh2 = vc.length2() - 1.0;
+    if ( vh2 <= 0.0 )
+        horizon = false;
+
+    double labelRange2 = _labelRange > 0.0 ? _labelRange*_labelRange : DBL_MAX;
+    bool labels = !_fields.empty();
+    data._labeled.clear();
+
+    for( unsigned b = 0; b < _batches.size(); ++b )
+    {
+        const IconBatch& batch = _batches[b];
+        const osg::Vec3Array& verts = *batch._verts;
+        osg::DrawElementsUInt& elements = *data._elements[b];
+        elements.clear();
+
+        double radius = 0.5 * batch._size.length();
+
+        for( unsigned slot = 0; slot < batch._tracks.size(); ++slot )
+        {
+            unsigned v = slot*4;
+            const osg::Vec3f& local = verts[v];
+
+            double pad = radius * (
+                pixelSize.x()*local.x() + pixelSize.y()*local.y() + pixelSize.z()*local.z() + pixelSize.w() );
+
+            if ( !containsPadded(planes, local, pad) )
+                continue;
+
+            const Track& track = _tracks[batch._tracks[slot]];
+
+            if ( horizon )
+            {
+                osg::Vec3d vt = track._world / _radius - vc;
+                double vtDotVc = -(vt * vc);
+                if ( vtDotVc > vh2 && vtDotVc*vtDotVc / vt.length2() > vh2 )
+                    continue;
+            }
+
+            elements.push_back( v );
+            elements.push_back( v+1 );
+            elements.push_back( v+2 );
+            elements.push_back( v+3 );
+
+            if ( labels && !track._labels.empty() && (osg::Vec3d(local) - eye).length2() <= labelRange2 )
+                data._labeled.push_back( batch._tracks[slot] );
+        }
+
+        elements.dirty();
+    }
+
+    cv->pushStateSet( data._stateSet.get() );
+
+    data._geode->accept( *cv );
+
+    // emit the labels field by field so each field's state is pushed once.
+    if ( !data._labeled.empty() )
+    {
+        for( unsigned f = 0; f < _fields.size(); ++f )
+        {
+            if ( !_fieldStateSets[f].valid() )
+                continue;
+
+            cv->pushStateSet( _fieldStateSets[f].get() );
+
+            for( std::vector<unsigned>::const_iterator i = data._labeled.begin(); i != data._labeled.end(); ++i )
+            {
+                const Track& track = _tracks[*i];
+                if ( f < track._labels.size() && track._labels[f].valid() )
+                {
+                    osgText::Text* label = track._labels[f].get();
+                    float depth = cv->getDistanceFromEyePoint( label->getPosition(), false );
+                    cv->addDrawableAndDepth( label, mv.get(), depth );
+                }
+            }
+
+            cv->popStateSet();
+        }
+    }
+
+    cv->popStateSet();
+    cv->popModelViewMatrix();
+}
+
+void
+TrackLayerNode::traverse( osg::NodeVisitor& nv )
+{
+    if ( nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR && !_tracks.empty() )
+    {
+        osgUtil::CullVisitor* cv = Culling::asCullVisitor( nv );
+        if ( cv )
+            cull( cv );
+    }
+
+    osg::Node::traverse( nv );
+}
+
+osg::BoundingSphere
+TrackLayerNode::computeBound() const
+{
+    osg::BoundingBox box;
+    for( std::vector<Track>::const_iterator t = _tracks.begin(); t != _tracks.end(); ++t )
+        box.expandBy( t->_world );
+
+    osg::BoundingSphere bs;
+    bs.expandBy( box );
+    return bs;
+}
@@ -36,6 +36,7 @@ using namespace osgEarth;
 MPGeometry::MPGeometry(const TileKey& key, const MapFrame& frame, int imageUnit) : 
 osg::Geometry    ( ),
 _frame           ( frame ),
+_pendingLayersChanged( 0 ),
 _imageUnit       ( imageUnit )
 {
     unsigned tw, th;
@@ -61,17 +62,39 @@ void
 MPGeometry::renderPrimitiveSets(osg::State& state,
                                 bool        usingVBOs) const
 {
-    // check the map frame to see if it's up to date
-    if ( _frame.needsSync() )
+    // check the map frame to see if it's up to date, and pick up any layers
+    // patched into the tile since the last draw.
+    if ( _frame.needsSync() || (unsigned)_pendingLayersChanged != 0 )
     {
-        // this lock protects a MapFrame sync when we have multiple DRAW threads.
+        // this lock protects a MapFrame sync when we have multiple DRAW threads,
+        // and the pending layers against addLayer().
         Threading::ScopedMutexLock exclusive( _frameSyncMutex );
 
+        bool reorder = false;
+
+        if ( _pendingLayersChanged.exchange(0) != 0 )
+        {
+            for( std::vector<Layer>::const_iterator i = _pendingLayers.begin(); i != _pendingLayers.end(); ++i )
+            {
+                std::vector<Layer>::iterator j = std::find( _layers.begin(), _layers.end(), i->_layerID );
+                if ( j != _layers.end() )
+                    *j = *i;
+                else
+                    _layers.push_back( *i );
+            }
+            _pendingLayers.clear();
+            reorder = true;
+        }
+
         if ( _frame.needsSync() && _frame.sync() ) // always double check
         {
-            // This should only happen is the layer ordering changes;
-            // If layers are added or removed, the Tile gets rebuilt and
-            // the point is moot.
+            reorder = true;
+        }
+
+        if ( reorder )
+        {
+            // Match the map's layer order. This also drops layers that were
+            // removed from the map; added layers arrive through addLayer().
             std::vector<Layer> reordered;
             const ImageLayerVector& layers = _frame.imageLayers();
             reordered.reserve( layers.size() );
@@ -288,6 +311,21 @@ MPGeometry::renderPrimitiveSets(osg::State& state,
 }
 
 
+void
+MPGeometry::addLayer(const Layer& layer)
+{
+    Threading::ScopedMutexLock exclusive( _frameSyncMutex );
+
+    std::vector<Layer>::iterator i = std::find( _pendingLayers.begin(), _pendingLayers.end(), layer._layerID );
+    if ( i != _pendingLayers.end() )
+        *i = layer;
+    else
+        _pendingLayers.push_back( layer );
+
+    _pendingLayersChanged.exchange( 1 );
+}
+
+
 osg::BoundingBox
 MPGeometry::computeBound() const
 {
@@ -24,6 +24,7 @@
 #include "TilePagedLOD"
 
 #include <osgEarth/HeightFieldUtils>
+#include <osgEarth/NodeUtils>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/Registry>
 #include <osgEarth/VirtualProgram>
@@ -37,6 +38,7 @@
 #include <osg/Timer>
 #include <osg/Depth>
 #include <osg/BlendFunc>
+#include <osg/ValueObject>
 #include <osgDB/DatabasePager>
 
 #define LC "[MPTerrainEngineNode] "
@@ -146,7 +148,8 @@ _primaryUnit          ( 0 ),
 _secondaryUnit        ( 1 ),
 _batchUpdateInProgress( false ),
 _refreshRequired      ( false ),
-_shaderUpdateRequired ( false )
+_shaderUpdateRequired ( false ),
+_layerUpdatePending   ( false )
 {
     _uid = Registry::instance()->createUID();
 
@@ -195,6 +198,11 @@ MPTerrainEngineNode::postInitialize( const Map* map, const TerrainOptions& optio
     _liveTiles->setRevisioningEnabled( _terrainOptions.incrementalUpdate() == true );
     _liveTiles->setMapRevision( _update_mapf->getRevision() );
 
+    // Publish the elevation data of live tiles so that height queries against
+    // the terrain can sample it directly.
+    getTerrain()->getHeightIndex()->setVerticalScale( *_terrainOptions.verticalScale() );
+    _liveTiles->setHeightIndex( getTerrain()->getHeightIndex() );
+
     // set up a registry for quick release:
     if ( _terrainOptions.quickReleaseGLObjects() == true )
     {
@@ -205,6 +213,28 @@ MPTerrainEngineNode::postInitialize( const Map* map, const TerrainOptions& optio
     //_tileModelFactory = new TileModelFactory(getMap(), _liveTiles.get(), _terrainOptions );
     _tileModelFactory = new TileModelFactory(_liveTiles.get(), _terrainOptions );
 
+    // set up the optional cache of compiled tile geometry, following the
+    // same cache policy precedence as the map layers.
+    if ( _terrainOptions.geometryCaching() == true && map->getCache() )
+    {
+        optional<CachePolicy> cp;
+        if ( Registry::instance()->overrideCachePolicy().isSet() )
+            cp = Registry::instance()->overrideCachePolicy().get();
+        else if ( map->getMapOptions().cachePolicy().isSet() )
+            cp = map->getMapOptions().cachePolicy().get();
+        else if ( Registry::instance()->defaultCachePolicy().isSet() )
+            cp = Registry::instance()->defaultCachePolicy().get();
+
+        _geometryCachePolicy = cp.isSet() ? cp.get() : CachePolicy();
+
+        if ( _geometryCachePolicy.isCacheReadable() )
+        {
+            _geometryCacheBin = map->getCache()->addBin( "engine_mp_geometry" );
+            _geometryStats    = new GeometryCacheStats();
+            OE_INFO << LC << "Caching compiled tile geometry" << std::endl;
+        }
+    }
+
     // handle an already-established map profile:
     if ( _update_mapf->getProfile() )
     {
@@ -238,6 +268,9 @@ MPTerrainEngineNode::postInitialize( const Map* map, const TerrainOptions& optio
 
     _batchUpdateInProgress = false;
 
+    // from now on, image layer changes are patched into the live tiles.
+    _layerUpdater = new TileLayerUpdater( map, _tileModelFactory.get(), _liveTiles.get() );
+
     // install some terrain-wide uniforms
     this->getOrCreateStateSet()->getOrCreateUniform(
         "oe_min_tile_range_factor",
@@ -359,9 +392,25 @@ MPTerrainEngineNode::createTerrain()
 
     _rootTilesRegistered = false;
 
+    publishGeometryCacheStats();
+
     updateShaders();
 }
 
+
+void
+MPTerrainEngineNode::publishGeometryCacheStats()
+{
+    if ( !_geometryStats.valid() )
+        return;
+
+    Threading::ScopedMutexLock lock( _geometryStats->_mutex );
+    setUserValue( "mp.geometryCompiled",  _geometryStats->_compiled );
+    setUserValue( "mp.geometryLoaded",    _geometryStats->_loaded );
+    setUserValue( "mp.geometryCompileMs", _geometryStats->_compileMs );
+    setUserValue( "mp.geometryLoadMs",    _geometryStats->_loadMs );
+}
+
 namespace
 {
     // debugging
@@ -404,6 +453,23 @@ MPTerrainEngineNode::traverse(osg::NodeVisitor& nv)
         }
     }
 
+    else if ( nv.getVisitorType() == nv.UPDATE_VISITOR && _layerUpdatePending )
+    {
+        bool busy = _layerUpdater->update();
+
+        setUserValue( "mp.liveTiles",    _liveTiles->size() );
+        setUserValue( "mp.tilesPatched", _layerUpdater->getNumTilesPatched() );
+        setUserValue( "mp.tilesRebuilt", _layerUpdater->getNumTilesRebuilt() );
+        setUserValue( "mp.layerUpdatePending", busy ? 1u : 0u );
+        publishGeometryCacheStats();
+
+        if ( !busy )
+        {
+            _layerUpdatePending = false;
+            ADJUST_UPDATE_TRAV_COUNT( this, -1 );
+        }
+    }
+
 #if 0
     static int c = 0;
     if ( ++c % 60 == 0 )
@@ -429,11 +495,13 @@ MPTerrainEngineNode::getKeyNodeFactory()
 
         // A compiler specific to this thread:
         TileModelCompiler* compiler = new TileModelCompiler(
-            _update_mapf->terrainMaskLayers(),
+            getMap(),
             _primaryUnit,
             optimizeTriangleOrientation,
             _terrainOptions );
 
+        compiler->setGeometryCache( _geometryCacheBin.get(), _geometryCachePolicy, _geometryStats.get() );
+
         // initialize a key node factory.
         knf = new SingleKeyNodeFactory(
             getMap(),
@@ -509,7 +577,18 @@ MPTerrainEngineNode::onMapModelChanged( const MapModelChange& change )
         // update the thread-safe map model copy:
         if ( _update_mapf->sync() )
         {
-            _liveTiles->setMapRevision( _update_mapf->getRevision() );
+            // image layer changes that we patch into the live tiles must not
+            // mark those tiles out of date.
+            bool patched =
+                (change.getAction() == MapModelChange::ADD_IMAGE_LAYER    ||
+                 change.getAction() == MapModelChange::REMOVE_IMAGE_LAYER ||
+                 change.getAction() == MapModelChange::MOVE_IMAGE_LAYER ) &&
+                canPatchImageLayers();
+
+            if ( patched )
+                _liveTiles->setMapRevisionForNewTiles( _update_mapf->getRevision() );
+            else
+                _liveTiles->setMapRevision( _update_mapf->getRevision() );
         }
 
         // dispatch the change handler
@@ -579,6 +658,14 @@ MPTerrainEngineNode::addImageLayer( ImageLayer* layerAdded )
                 }
             }
         }
+
+        if ( canPatchImageLayers() )
+        {
+            _layerUpdater->addLayer( layerAdded );
+            requestLayerUpdate();
+            updateShaders();
+            return;
+        }
     }
 
     refresh();
@@ -599,11 +686,41 @@ MPTerrainEngineNode::removeImageLayer( ImageLayer* layerRemoved )
                 layerRemoved->shareImageUnit().unset();
             }
         }
+
+        if ( canPatchImageLayers() )
+        {
+            _layerUpdater->removeLayer( layerRemoved );
+            requestLayerUpdate();
+            updateShaders();
+            return;
+        }
     }
 
     refresh();
 }
 
+bool
+MPTerrainEngineNode::canPatchImageLayers() const
+{
+    // masking geometry shares texture coordinates across the tile in ways
+    // the updater does not reproduce, so masked terrain still rebuilds.
+    return
+        _layerUpdater.valid() &&
+        _terrain != 0L        &&
+        _update_mapf->terrainMaskLayers().size() == 0;
+}
+
+void
+MPTerrainEngineNode::requestLayerUpdate()
+{
+    if ( !_layerUpdatePending )
+    {
+        _layerUpdatePending = true;
+        ADJUST_UPDATE_TRAV_COUNT( this, 1 );
+        setUserValue( "mp.layerUpdatePending", 1u );
+    }
+}
+
 void
 MPTerrainEngineNode::moveImageLayer( unsigned int oldIndex, unsigned int newIndex )
 {
@@ -0,0 +1,517 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "TileLayerUpdater"
+
+#include <osg/Geode>
+#include <algorithm>
+
+using namespace osgEarth_engine_mp;
+using namespace osgEarth;
+
+#define LC "[TileLayerUpdater] "
+
+//----------------------------------------------------------------------------
+
+namespace
+{
+    // The pager may still deliver tiles built from the map model as it was
+    // before a layer change. The updater keeps looking for them for this many
+    // seconds after the last change.
+    const double QUIET_PERIOD = 5.0;
+
+    // Minimum number of seconds between two scans of the live tiles.
+    const double SCAN_INTERVAL = 0.5;
+
+    struct CollectTiles : public TileNodeRegistry::ConstOperation
+    {
+        CollectTiles( TileNodeVector& tiles ) : _tiles(tiles) { }
+        void operator()( const TileNodeRegistry::TileNodeMap& tiles ) const
+        {
+            for( TileNodeRegistry::TileNodeMap::const_iterator i = tiles.begin(); i != tiles.end(); ++i )
+                _tiles.push_back( i->second.get() );
+        }
+        TileNodeVector& _tiles;
+    };
+}
+
+//----------------------------------------------------------------------------
+
+struct TileLayerUpdater::PatchTask : public TaskRequest
+{
+    // coarser tiles first; they cover the most ground and children
+    // blend from their textures.
+    PatchTask( TileLayerUpdater* updater, TileNode* tile ) :
+        TaskRequest( (float)tile->getKey().getLOD() ),
+        _updater   ( updater ),
+        _tile      ( tile ),
+        _key       ( tile->getKey() ) { }
+
+    void operator()( ProgressCallback* progress )
+    {
+        osg::ref_ptr<Patch>    patch;
+        osg::ref_ptr<TileNode> tile;
+        if ( _tile.lock(tile) )
+            _updater->createPatch( tile.get(), patch );
+
+        Threading::ScopedMutexLock lock( _updater->_mutex );
+        if ( patch.valid() )
+            _updater->_results.push_back( patch.get() );
+        _updater->_scheduled.erase( _key );
+    }
+
+    TileLayerUpdater*           _updater; // the updater outlives its task service
+    osg::observer_ptr<TileNode> _tile;
+    TileKey                     _key;
+};
+
+//----------------------------------------------------------------------------
+
+TileLayerUpdater::TileLayerUpdater(const Map*        map,
+                                   TileModelFactory* factory,
+                                   TileNodeRegistry* liveTiles) :
+_frame          ( map, Map::IMAGE_LAYERS, "mp-layer-updater" ),
+_factory        ( factory ),
+_liveTiles      ( liveTiles ),
+_lastChange     ( 0 ),
+_lastScan       ( 0 ),
+_numTilesPatched( 0 ),
+_numTilesRebuilt( 0 )
+{
+    _service = new TaskService( "engine_mp layer updater", 2 );
+}
+
+
+TileLayerUpdater::~TileLayerUpdater()
+{
+    // stop the tasks before the state they work on goes away.
+    _service = 0L;
+}
+
+
+void
+TileLayerUpdater::addLayer( ImageLayer* layer )
+{
+    if ( !layer )
+        return;
+
+    _frame.sync();
+
+    unsigned order = 0;
+    const ImageLayerVector& layers = _frame.imageLayers();
+    for( ; order < layers.size() && layers[order].get() != layer; ++order );
+
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+
+        AddedLayer& added = _addedLayers[layer->getUID()];
+        added._layer    = layer;
+        added._revision = _frame.getRevision();
+        added._order    = order;
+
+        _revision = _frame.getRevision();
+
+        // a layer removed and re-added before the removal was applied:
+        _removals.erase(
+            std::remove( _removals.begin(), _removals.end(), layer->getUID() ),
+            _removals.end() );
+    }
+
+    _lastChange = osg::Timer::instance()->tick();
+    _lastScan   = 0;
+
+    OE_DEBUG << LC << "Adding layer \"" << layer->getName() << "\" to the live tiles" << std::endl;
+}
+
+
+void
+TileLayerUpdater::removeLayer( ImageLayer* layer )
+{
+    if ( !layer )
+        return;
+
+    _frame.sync();
+
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        _addedLayers.erase( layer->getUID() );
+        _removals.push_back( layer->getUID() );
+        _revision = _frame.getRevision();
+    }
+
+    _lastChange = osg::Timer::instance()->tick();
+
+    OE_DEBUG << LC << "Removing layer \"" << layer->getName() << "\" from the live tiles" << std::endl;
+}
+
+
+bool
+TileLayerUpdater::update()
+{
+    applyRemovals();
+
+    // install the finished patches:
+    std::vector< osg::ref_ptr<Patch> > results;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        results.swap( _results );
+    }
+
+    for( std::vector< osg::ref_ptr<Patch> >::iterator i = results.begin(); i != results.end(); ++i )
+    {
+        applyPatch( i->get() );
+    }
+
+    // look for tiles that still need a patch. (This also picks up tiles that
+    // the pager built from an older map model.)
+    osg::Timer_t now = osg::Timer::instance()->tick();
+    if ( _lastScan == 0 || osg::Timer::instance()->delta_s(_lastScan, now) >= SCAN_INTERVAL )
+    {
+        scheduleTiles();
+        _lastScan = now;
+    }
+
+    bool busy;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        busy =
+            !_scheduled.empty() ||
+            !_results.empty()   ||
+            osg::Timer::instance()->delta_s(_lastChange, now) < QUIET_PERIOD;
+
+        // done; tiles built from now on already carry the layers.
+        if ( !busy )
+            _addedLayers.clear();
+    }
+
+    if ( !busy )
+    {
+        OE_DEBUG << LC << "Layer update complete; "
+            << _numTilesPatched << " tiles patched in place, "
+            << _numTilesRebuilt << " left to rebuild (totals)" << std::endl;
+    }
+
+    return busy;
+}
+
+
+bool
+TileLayerUpdater::needsPatch( const TileModel* model ) const
+{
+    for( AddedLayers::const_iterator i = _addedLayers.begin(); i != _addedLayers.end(); ++i )
+    {
+        if ( model->_revision < i->second._revision && model->_colorData.find(i->first) == model->_colorData.end() )
+            return true;
+    }
+    return false;
+}
+
+
+void
+TileLayerUpdater::scheduleTiles()
+{
+    Revision newest;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        for( AddedLayers::const_iterator i = _addedLayers.begin(); i != _addedLayers.end(); ++i )
+        {
+            if ( i->second._revision > newest )
+                newest = i->second._revision;
+        }
+    }
+
+    if ( newest < 0 )
+        return;
+
+    TileNodeVector tiles;
+    _liveTiles->getTilesOlderThan( newest, tiles );
+
+    for( TileNodeVector::iterator i = tiles.begin(); i != tiles.end(); ++i )
+    {
+        schedule( i->get() );
+    }
+}
+
+
+void
+TileLayerUpdater::schedule( TileNode* tile )
+{
+    osg::ref_ptr<const TileModel> model;
+    tile->getTileModel( model );
+    if ( !model.valid() )
+        return;
+
+    Threading::ScopedMutexLock lock( _mutex );
+
+    if ( !needsPatch(model.get()) || _scheduled.find(tile->getKey()) != _scheduled.end() )
+        return;
+
+    // tiles with masking geometry have to be rebuilt.
+    if ( !getSurface(tile) )
+    {
+        if ( !tile->isDirty() )
+        {
+            tile->setDirty();
+            ++_numTilesRebuilt;
+        }
+        return;
+    }
+
+    _scheduled.insert( tile->getKey() );
+    _service->add( new PatchTask(this, tile) );
+}
+
+
+MPGeometry*
+TileLayerUpdater::getSurface( TileNode* tile )
+{
+    // the tile compiler puts the surface geometry alone in the tile's
+    // first geode, unless there are masks.
+    osg::Geode* geode = tile->getNumChildren() > 0 ? dynamic_cast<osg::Geode*>(tile->getChild(0)) : 0L;
+    if ( geode && geode->getNumDrawables() == 1 )
+        return dynamic_cast<MPGeometry*>( geode->getDrawable(0) );
+    return 0L;
+}
+
+
+void
+TileLayerUpdater::createPatch( TileNode* tile, osg::ref_ptr<Patch>& out_patch )
+{
+    osg::ref_ptr<const TileModel> base;
+    tile->getTileModel( base );
+
+    MPGeometry* surface = getSurface( tile );
+    if ( !base.valid() || !surface )
+        return;
+
+    AddedLayers added;
+    Revision    revision;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        added    = _addedLayers;
+        revision = _revision;
+    }
+
+    osg::ref_ptr<Patch> patch = new Patch();
+    patch->_tile      = tile;
+    patch->_baseModel = base.get();
+    patch->_model     = new TileModel( *base.get() );
+    patch->_model->_revision = revision;
+
+    // the live parent tile's model is the current one; the base model's
+    // pointer may refer to a model that has since been patched.
+    osg::ref_ptr<const TileModel> parentModel;
+    osg::ref_ptr<TileNode>        parentTile;
+    if ( _liveTiles->get(base->_tileKey.createParentKey(), parentTile) )
+        parentTile->getTileModel( parentModel );
+    patch->_model->_parentModel = parentModel.valid() ? parentModel.get() : base->getParentTileModel();
+
+    // fetch the imagery of each layer that the tile is missing:
+    std::vector<UID> newLayers;
+    for( AddedLayers::iterator i = added.begin(); i != added.end(); ++i )
+    {
+        if ( base->_revision < i->second._revision && base->_colorData.find(i->first) == base->_colorData.end() )
+        {
+            if ( _factory->createColorData(base->_tileKey, i->second._layer.get(), i->second._order, patch->_model.get()) )
+            {
+                newLayers.push_back( i->first );
+            }
+        }
+    }
+
+    if ( newLayers.size() > 0 )
+    {
+        // Locate each vertex of the existing geometry (including the skirts)
+        // in the tile's unit space. The vertices are relative to the tile center.
+        const osg::Vec3Array* verts = dynamic_cast<const osg::Vec3Array*>( surface->getVertexArray() );
+        if ( !verts )
+            return;
+
+        const GeoLocator* tileLocator = base->_tileLocator.get();
+        osg::ref_ptr<const GeoLocator> geoLocator = tileLocator->getCoordinateSystemType() == GeoLocator::GEOCENTRIC ?
+            tileLocator->getGeographicFromGeocentric() :
+            tileLocator;
+
+        osg::Vec3d center = tile->getMatrix().getTrans();
+
+        std::vector<osg::Vec3d> ndc( verts->size() );
+        for( unsigned v = 0; v < verts->size(); ++v )
+        {
+            tileLocator->convertModelToLocal( osg::Vec3d((*verts)[v]) + center, ndc[v] );
+        }
+
+        for( std::vector<UID>::const_iterator uid = newLayers.begin(); uid != newLayers.end(); ++uid )
+        {
+            TileModel::ColorData color;
+            patch->_model->getColorData( *uid, color );
+
+            osg::ref_ptr<const GeoLocator> locator = color.getLocator();
+            if ( locator->getCoordinateSystemType() == osgTerrain::Locator::GEOCENTRIC )
+                locator = locator->getGeographicFromGeocentric();
+
+            // texture coordinates, as the tile compiler would generate them:
+            osg::Vec2Array* texCoords = new osg::Vec2Array();
+            texCoords->reserve( ndc.size() );
+
+            if ( locator->isEquivalentTo(*geoLocator.get()) )
+            {
+                for( unsigned v = 0; v < ndc.size(); ++v )
+                    texCoords->push_back( osg::Vec2(ndc[v].x(), ndc[v].y()) );
+            }
+            else
+            {
+                osg::Vec3d color_ndc;
+                for( unsigned v = 0; v < ndc.size(); ++v )
+                {
+                    osgTerrain::Locator::convertLocalCoordBetween( *geoLocator.get(), ndc[v], *locator.get(), color_ndc );
+                    texCoords->push_back( osg::Vec2(color_ndc.x(), color_ndc.y()) );
+                }
+            }
+
+            // the parent's color data for LOD blending; a root tile blends with itself.
+            TileModel::ColorData colorParent;
+            if ( parentModel.valid() )
+                parentModel->getColorData( *uid, colorParent );
+            else
+                colorParent = color;
+
+            MPGeometry::Layer layer;
+            layer._layerID    = *uid;
+            layer._imageLayer = color.getMapLayer();
+            layer._tex        = color.getTexture();
+            layer._texParent  = colorParent.getTexture();
+            layer._texCoords  = texCoords;
+
+            layer._opaque =
+                (color.getMapLayer()->getColorFilters().size() == 0 ) &&
+                (layer._tex.valid() && !color.hasAlpha()) &&
+                (!layer._texParent.valid() || !colorParent.hasAlpha());
+
+            if ( colorParent.getLocator() )
+            {
+                osg::Matrixd sbmatrix;
+                colorParent.getLocator()->createScaleBiasMatrix(
+                    color.getLocator()->getDataExtent(),
+                    sbmatrix );
+                layer._texMatParent = sbmatrix;
+            }
+
+            patch->_layers.push_back( layer );
+        }
+    }
+
+    out_patch = patch.get();
+}
+
+
+void
+TileLayerUpdater::applyPatch( Patch* patch )
+{
+    osg::ref_ptr<TileNode> tile;
+    if ( !patch->_tile.lock(tile) )
+        return;
+
+    // skip tiles that left the scene graph in the meantime:
+    osg::ref_ptr<TileNode> live;
+    if ( !_liveTiles->get(tile->getKey(), live) || live.get() != tile.get() )
+        return;
+
+    osg::ref_ptr<const TileModel> current;
+    tile->getTileModel( current );
+
+    bool stale = current.get() != patch->_baseModel.get();
+    if ( !stale )
+    {
+        // a layer removed while the patch was in progress:
+        Threading::ScopedMutexLock lock( _mutex );
+        for( std::vector<MPGeometry::Layer>::const_iterator i = patch->_layers.begin(); i != patch->_layers.end() && !stale; ++i )
+            stale = _addedLayers.find( i->_layerID ) == _addedLayers.end();
+    }
+
+    if ( stale )
+    {
+        // the tile changed under the patch; start over.
+        schedule( tile.get() );
+        return;
+    }
+
+    MPGeometry* surface = getSurface( tile.get() );
+    if ( !surface )
+        return;
+
+    // Bring the tile's revision along, unless the tile is already waiting to
+    // be rebuilt for some other map change.
+    bool inSync = tile->getMapRevision() == current->_revision;
+
+    tile->setTileModel( patch->_model.get() );
+    if ( inSync )
+        tile->setMapRevision( patch->_model->_revision );
+
+    for( std::vector<MPGeometry::Layer>::const_iterator i = patch->_layers.begin(); i != patch->_layers.end(); ++i )
+        surface->addLayer( *i );
+
+    ++_numTilesPatched;
+}
+
+
+void
+TileLayerUpdater::applyRemovals()
+{
+    std::vector<UID> removals;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        removals.swap( _removals );
+    }
+
+    if ( removals.empty() )
+        return;
+
+    TileNodeVector tiles;
+    _liveTiles->run( CollectTiles(tiles) );
+
+    for( TileNodeVector::iterator t = tiles.begin(); t != tiles.end(); ++t )
+    {
+        TileNode* tile = t->get();
+
+        osg::ref_ptr<const TileModel> model;
+        tile->getTileModel( model );
+        if ( !model.valid() )
+            continue;
+
+        osg::ref_ptr<TileModel> newModel;
+        for( std::vector<UID>::const_iterator uid = removals.begin(); uid != removals.end(); ++uid )
+        {
+            if ( model->_colorData.find(*uid) != model->_colorData.end() )
+            {
+                if ( !newModel.valid() )
+                {
+                    newModel = new TileModel( *model.get() );
+                    newModel->_parentModel = model->getParentTileModel();
+                }
+                newModel->_colorData.erase( *uid );
+            }
+        }
+
+        // The revision stays as it is; a removal never needs a tile to catch up.
+        // The MPGeometry drops the layer by itself when its map frame syncs.
+        if ( newModel.valid() )
+        {
+            tile->setTileModel( newModel.get() );
+        }
+    }
+}
@@ -18,6 +18,7 @@
 */
 #include "TileModelCompiler"
 #include "MPGeometry"
+#include "GridTransform"
 
 #include <osgEarth/Locators>
 #include <osgEarth/Registry>
@@ -26,6 +27,9 @@
 #include <osgEarth/HeightFieldUtils>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/Utils>
+#include <osgEarth/TriangleBVH>
+#include <osgEarth/StringUtils>
+#include <osgEarth/IOTypes>
 #include <osgEarthSymbology/Geometry>
 #include <osgEarthSymbology/MeshConsolidator>
 
@@ -36,6 +40,8 @@
 #include <osgUtil/DelaunayTriangulator>
 #include <osgUtil/Optimizer>
 #include <osgUtil/MeshOptimizers>
+#include <osg/Timer>
+#include <cstring>
 
 using namespace osgEarth_engine_mp;
 using namespace osgEarth;
@@ -71,6 +77,33 @@ CompilerCache::TexCoordArrayCache::get(const osg::Vec4d& mat,
 }
 
 
+CompilerCache::IndexTable&
+CompilerCache::IndexTableCache::get(unsigned cols,
+                                    unsigned rows,
+                                    bool     swapOrientation,
+                                    bool     diagonal00to11)
+{
+    for( iterator i = begin(); i != end(); ++i )
+    {
+        CompilerCache::IndexTableKey& key = i->first;
+        if ( key._cols == cols && key._rows == rows && 
+             key._swapOrientation == swapOrientation &&
+             key._diagonal00to11 == diagonal00to11 )
+        {
+            return i->second;
+        }
+    }
+
+    CompilerCache::IndexTableKey newKey;
+    newKey._cols            = cols;
+    newKey._rows            = rows;
+    newKey._swapOrientation = swapOrientation;
+    newKey._diagonal00to11  = diagonal00to11;
+    this->push_back( std::make_pair(newKey, CompilerCache::IndexTable()) );
+    return this->back().second;
+}
+
+
 //------------------------------------------------------------------------
 
 
@@ -132,6 +165,7 @@ namespace
             ownsTileCoords   = false;
             stitchTileCoords = 0L;
 //            stitchSkirtTileCoords = 0L;
+            fullSurfaceGrid  = false;
         }
 
         const MapFrame& frame;
@@ -164,6 +198,7 @@ namespace
         osg::ref_ptr<osg::FloatArray> elevations;
         Indices                       indices;
         osg::BoundingSphere           surfaceBound;
+        bool                          fullSurfaceGrid;          // true if every grid point made a vertex
 
         // skirt data:
         //MPGeometry*              skirt;
@@ -485,6 +520,66 @@ namespace
     }
 
 
+    /**
+     * Samples an ElevationData's heightfield at tile NDC coordinates. When both
+     * locators are linear the tile->heightfield NDC mapping is a scale/bias, so we
+     * solve it once up front instead of running each sample through both locators.
+     */
+    struct HeightSampler
+    {
+        HeightSampler() : _data(0L), _ndcLocator(0L), _linear(false) { }
+
+        void init( const TileModel::ElevationData& data, const GeoLocator* ndcLocator )
+        {
+            _data       = &data;
+            _ndcLocator = ndcLocator;
+            _linear     = false;
+
+            const GeoLocator* hfLocator = data.getLocator();
+            if ( !hfLocator || !ndcLocator || !data.getHeightField() )
+                return;
+
+            if ( !hfLocator->isLinear() || !ndcLocator->isLinear() ||
+                 hfLocator->getCoordinateSystemType() != ndcLocator->getCoordinateSystemType() )
+                return;
+
+            osg::Vec3d a, b, c;
+            GeoLocator::convertLocalCoordBetween( *ndcLocator, osg::Vec3d(0.0, 0.0, 0.0),   *hfLocator, a );
+            GeoLocator::convertLocalCoordBetween( *ndcLocator, osg::Vec3d(1.0, 1.0, 0.0),   *hfLocator, b );
+            GeoLocator::convertLocalCoordBetween( *ndcLocator, osg::Vec3d(0.25, 0.75, 0.0), *hfLocator, c );
+
+            _x0 = a.x();
+            _y0 = a.y();
+            _sx = b.x() - a.x();
+            _sy = b.y() - a.y();
+
+            // make sure the mapping really is linear before we trust it.
+            _linear =
+                osg::equivalent( c.x(), _x0 + 0.25*_sx, MATCH_TOLERANCE ) &&
+                osg::equivalent( c.y(), _y0 + 0.75*_sy, MATCH_TOLERANCE );
+        }
+
+        bool getHeight( const osg::Vec3d& ndc, float& output ) const
+        {
+            if ( _linear )
+            {
+                output = HeightFieldUtils::getHeightAtNormalizedLocation(
+                    _data->getHeightField(),
+                    _x0 + ndc.x()*_sx,
+                    _y0 + ndc.y()*_sy,
+                    INTERP_TRIANGULATE );
+                return true;
+            }
+            return _data->getHeight( ndc, _ndcLocator, output, INTERP_TRIANGULATE );
+        }
+
+        const TileModel::ElevationData* _data;
+        const GeoLocator*               _ndcLocator;
+        bool                            _linear;
+        double                          _x0, _y0, _sx, _sy;
+    };
+
+
     /**
      * Iterate over the sampling grid and calculate the vertex positions and normals
      * for each sampling point.
@@ -493,10 +588,22 @@ namespace
     {
         d.surfaceBound.init();
 
-        //osgTerrain::HeightFieldLayer* elevationLayer = d.model->_elevationData.getHFLayer();
+        osg::HeightField* hf = d.model->_elevationData.getHeightField();
+
+        // per-row/per-column grid terms:
+        GridTransform grid;
+        grid.init( d.model->_tileLocator.get(), d.numCols, d.numRows );
+
+        HeightSampler heights;
+        if ( hf )
+            heights.init( d.model->_elevationData, d.model->_tileLocator.get() );
+
+        // Parent heights are only usable if the tile size is an odd number in both directions.
+        bool useParent = d.model->_tileKey.getLOD() > 0 && (d.numCols&1) && (d.numRows&1) && d.parentModel.valid();
 
-        osg::HeightField* hf            = d.model->_elevationData.getHeightField();
-        GeoLocator*       hfLocator     = d.model->_elevationData.getLocator();
+        HeightSampler parentHeights;
+        if ( useParent )
+            parentHeights.init( d.parentModel->_elevationData, d.model->_tileLocator.get() );
 
         // populate vertex and tex coord arrays    
         for(unsigned j=0; j < d.numRows; ++j)
@@ -512,7 +619,7 @@ namespace
 
                 if ( hf )
                 {
-                    validValue = d.model->_elevationData.getHeight( ndc, d.model->_tileLocator, heightValue, INTERP_TRIANGULATE );
+                    validValue = heights.getHeight( ndc, heightValue );
                 }
 
                 ndc.z() = heightValue * d.scaleHeight;
@@ -545,8 +652,9 @@ namespace
                 {
                     d.indices[iv] = d.surfaceVerts->size();
 
-                    osg::Vec3d model;
-                    d.model->_tileLocator->unitToModel( ndc, model );
+                    // model point and local normal (up vector)
+                    osg::Vec3d model, model_up;
+                    grid.toModel( i, j, ndc, model, model_up );
 
                     (*d.surfaceVerts).push_back(model - d.centerModel);
 
@@ -579,13 +687,6 @@ namespace
                     // record the raw elevation value in our float array for later
                     (*d.elevations).push_back(ndc.z());
 
-                    // compute the local normal (up vector)
-                    osg::Vec3d ndc_plus_one(ndc.x(), ndc.y(), ndc.z() + 1.0);
-                    osg::Vec3d model_up;
-                    d.model->_tileLocator->unitToModel(ndc_plus_one, model_up);
-                    model_up = model_up - model;
-                    model_up.normalize();
-
                     (*d.normals).push_back(model_up);
 
                     // Calculate and store the "old height", i.e the height value from
@@ -593,10 +694,9 @@ namespace
                     float     oldHeightValue = heightValue;
                     osg::Vec3 oldNormal;
 
-                    // This only works if the tile size is an odd number in both directions.
-                    if (d.model->_tileKey.getLOD() > 0 && (d.numCols&1) && (d.numRows&1) && d.parentModel.valid())
+                    if ( useParent )
                     {
-                        d.parentModel->_elevationData.getHeight( ndc, d.model->_tileLocator.get(), oldHeightValue, INTERP_TRIANGULATE );
+                        parentHeights.getHeight( ndc, oldHeightValue );
                         d.parentModel->_elevationData.getNormal( ndc, d.model->_tileLocator.get(), oldNormal, INTERP_TRIANGULATE );
                     }
                     else
@@ -622,6 +722,8 @@ namespace
             }
         }
 
+        d.fullSurfaceGrid = (d.surfaceVerts->size() == d.numRows*d.numCols);
+
         //if ( d.renderLayers[0]._texCoords->size() < d.surfaceVerts->size() )
         //{
         //    OE_WARN << LC << "not good. mask error." << std::endl;
@@ -991,7 +1093,11 @@ namespace
         osg::Vec4Array* skirtAttribs = static_cast<osg::Vec4Array*>(d.surface->getVertexAttribArray(osg::Drawable::ATTRIBUTE_6)); //new osg::Vec4Array();
         osg::Vec4Array* skirtAttribs2 = static_cast<osg::Vec4Array*>(d.surface->getVertexAttribArray(osg::Drawable::ATTRIBUTE_7)); //new osg::Vec4Array();
 
+        // the vertex and attribute arrays were sized for the skirt in setupGeometryAttributes;
+        // size the strip too (two indices per skirt vertex pair) so that an unbroken skirt
+        // never grows it.
         osg::ref_ptr<osg::DrawElementsUShort> elements = new osg::DrawElementsUShort(GL_TRIANGLE_STRIP);
+        elements->reserveElements( d.numVerticesInSkirt );
 
         // bottom:
         for( unsigned int c=0; c<d.numCols-1; ++c )
@@ -1030,6 +1136,12 @@ namespace
                     }
                 }
 
+                if ( d.ownsTileCoords )
+                {
+                    osg::Vec2 tc = (*d.renderTileCoords)[orig_i];
+                    d.renderTileCoords->push_back( tc );
+                }
+
                 elements->addElement(orig_i);
                 elements->addElement(skirtVerts->size()-1);
             }
@@ -1071,6 +1183,12 @@ namespace
                     }
                 }
 
+                if ( d.ownsTileCoords )
+                {
+                    osg::Vec2 tc = (*d.renderTileCoords)[orig_i];
+                    d.renderTileCoords->push_back( tc );
+                }
+
                 elements->addElement(orig_i);
                 elements->addElement(skirtVerts->size()-1);
             }
@@ -1112,6 +1230,12 @@ namespace
                     }
                 }
 
+                if ( d.ownsTileCoords )
+                {
+                    osg::Vec2 tc = (*d.renderTileCoords)[orig_i];
+                    d.renderTileCoords->push_back( tc );
+                }
+
                 elements->addElement(orig_i);
                 elements->addElement(skirtVerts->size()-1);
             }
@@ -1153,6 +1277,12 @@ namespace
                     }
                 }
 
+                if ( d.ownsTileCoords )
+                {
+                    osg::Vec2 tc = (*d.renderTileCoords)[orig_i];
+                    d.renderTileCoords->push_back( tc );
+                }
+
                 elements->addElement(orig_i);
                 elements->addElement(skirtVerts->size()-1);
             }
@@ -1167,21 +1297,61 @@ namespace
 
 
 
+    /**
+     * Builds the triangulation of a complete, unmasked surface grid. Since every grid
+     * point is a vertex, the vertex index of grid point (i,j) is just j*numCols+i and
+     * the result depends only on the grid shape.
+     */
+    void buildSurfaceIndexTable( CompilerCache::IndexTable& table, unsigned numCols, unsigned numRows, bool swapOrientation, bool diagonal00to11 )
+    {
+        table.resize( (numRows-1) * (numCols-1) * 6 );
+        unsigned k = 0;
+
+        for(unsigned j=0; j<numRows-1; ++j)
+        {
+            for(unsigned i=0; i<numCols-1; ++i)
+            {
+                GLushort i00, i01;
+                if (swapOrientation)
+                {
+                    i01 = j*numCols + i;
+                    i00 = i01+numCols;
+                }
+                else
+                {
+                    i00 = j*numCols + i;
+                    i01 = i00+numCols;
+                }
+
+                GLushort i10 = i00+1;
+                GLushort i11 = i01+1;
+
+                if ( diagonal00to11 )
+                {
+                    table[k++] = i01; table[k++] = i00; table[k++] = i11;
+                    table[k++] = i00; table[k++] = i10; table[k++] = i11;
+                }
+                else
+                {
+                    table[k++] = i01; table[k++] = i00; table[k++] = i10;
+                    table[k++] = i01; table[k++] = i10; table[k++] = i11;
+                }
+            }
+        }
+    }
+
+
     /**
      * Builds triangles for the surface geometry, and recalculates the surface normals
      * to be optimized for slope.
      */
-    void tessellateSurfaceGeometry( Data& d, bool optimizeTriangleOrientation, bool normalizeEdges )
+    void tessellateSurfaceGeometry( Data& d, CompilerCache& cache, bool optimizeTriangleOrientation, bool normalizeEdges )
     {    
         bool swapOrientation = !(d.model->_tileLocator->orientationOpenGL());
 
         bool recalcNormals   = d.model->hasElevation();
         unsigned numSurfaceNormals = d.numRows * d.numCols;
 
-        osg::DrawElements* elements = new osg::DrawElementsUShort(GL_TRIANGLES);
-        elements->reserveElements((d.numRows-1) * (d.numCols-1) * 6);
-        d.surface->insertPrimitiveSet(0, elements); // because we always want this first.
-
         if ( recalcNormals )
         {
             // first clear out all the normals on the surface (but not the skirts)
@@ -1193,7 +1363,51 @@ namespace
             }
         }
 
-        for(unsigned j=0; j<d.numRows-1; ++j)
+        // A complete, unmasked grid has a fixed triangulation as long as the diagonals
+        // don't depend on the elevation data (no orientation optimization, or a flat
+        // tile where the optimization always picks the 01-10 diagonal).
+        bool useIndexTable =
+            d.fullSurfaceGrid &&
+            d.maskRecords.size() == 0 &&
+            (!optimizeTriangleOrientation || !d.model->hasElevation());
+
+        osg::DrawElements* elements = 0L;
+
+        if ( useIndexTable )
+        {
+            bool diagonal00to11 = !optimizeTriangleOrientation;
+
+            CompilerCache::IndexTable& table = cache._surfaceIndexTables.get(
+                d.numCols, d.numRows, swapOrientation, diagonal00to11 );
+
+            if ( table.empty() )
+                buildSurfaceIndexTable( table, d.numCols, d.numRows, swapOrientation, diagonal00to11 );
+
+            elements = new osg::DrawElementsUShort(GL_TRIANGLES, table.size(), &table.front());
+            d.surface->insertPrimitiveSet(0, elements); // because we always want this first.
+
+            if ( recalcNormals )
+            {
+                for(unsigned t=0; t<table.size(); t += 3)
+                {
+                    const osg::Vec3f& v0 = (*d.surfaceVerts)[table[t]];
+                    const osg::Vec3f& v1 = (*d.surfaceVerts)[table[t+1]];
+                    const osg::Vec3f& v2 = (*d.surfaceVerts)[table[t+2]];
+                    osg::Vec3 normal = (v1-v0) ^ (v2-v0);
+                    (*d.normals)[table[t]]   += normal;
+                    (*d.normals)[table[t+1]] += normal;
+                    (*d.normals)[table[t+2]] += normal;
+                }
+            }
+        }
+        else
+        {
+            elements = new osg::DrawElementsUShort(GL_TRIANGLES);
+            elements->reserveElements((d.numRows-1) * (d.numCols-1) * 6);
+            d.surface->insertPrimitiveSet(0, elements); // because we always want this first.
+        }
+
+        for(unsigned j=0; !useIndexTable && j<d.numRows-1; ++j)
         {
             for(unsigned i=0; i<d.numCols-1; ++i)
             {
@@ -1808,6 +2022,188 @@ namespace
     }
 
 
+    // Compiled geometry cache records are flat binary blobs in native byte
+    // order: a header (magic, version, vertex count, primitive set count),
+    // the per-vertex arrays (vertices, normals, both attribute sets and the
+    // tile coordinates), then each primitive set as mode, index count and
+    // 32-bit indices.
+    const unsigned GEOMETRY_RECORD_MAGIC   = 0x4d47454f; // "OEGM"
+    const unsigned GEOMETRY_RECORD_VERSION = 1;
+
+    template<typename T>
+    void appendData( std::string& buf, const T* data, unsigned count )
+    {
+        if ( count > 0 )
+            buf.append( reinterpret_cast<const char*>(data), count*sizeof(T) );
+    }
+
+    template<typename T>
+    bool readData( const std::string& buf, unsigned& offset, T* data, unsigned count )
+    {
+        if ( count > (buf.size() - offset) / sizeof(T) )
+            return false;
+        if ( count > 0 )
+            ::memcpy( data, buf.data() + offset, count*sizeof(T) );
+        offset += count*sizeof(T);
+        return true;
+    }
+
+    /**
+     * Serializes the compiled surface geometry. Fails if the geometry has
+     * anything the record cannot represent.
+     */
+    bool writeGeometryRecord( const Data& d, std::string& out )
+    {
+        unsigned numVerts = d.surfaceVerts->size();
+        if (numVerts == 0 ||
+            d.normals->size()         != numVerts ||
+            d.surfaceAttribs->size()  != numVerts ||
+            d.surfaceAttribs2->size() != numVerts ||
+            !d.renderTileCoords.valid() ||
+            d.renderTileCoords->size() != numVerts )
+        {
+            return false;
+        }
+
+        unsigned header[4] = {
+            GEOMETRY_RECORD_MAGIC, GEOMETRY_RECORD_VERSION, numVerts, d.surface->getNumPrimitiveSets() };
+        appendData( out, header, 4 );
+
+        appendData( out, &(*d.surfaceVerts)[0],     numVerts );
+        appendData( out, &(*d.normals)[0],          numVerts );
+        appendData( out, &(*d.surfaceAttribs)[0],   numVerts );
+        appendData( out, &(*d.surfaceAttribs2)[0],  numVerts );
+        appendData( out, &(*d.renderTileCoords)[0], numVerts );
+
+        std::vector<unsigned> indices;
+        for( unsigned p = 0; p < d.surface->getNumPrimitiveSets(); ++p )
+        {
+            const osg::PrimitiveSet* primSet = d.surface->getPrimitiveSet(p);
+            const osg::DrawElements* de = primSet->getDrawElements();
+            if ( !de )
+                return false;
+
+            indices.resize( de->getNumIndices() );
+            for( unsigned i = 0; i < indices.size(); ++i )
+                indices[i] = de->index(i);
+
+            unsigned info[2] = { (unsigned)primSet->getMode(), (unsigned)indices.size() };
+            appendData( out, info, 2 );
+            if ( !indices.empty() )
+                appendData( out, &indices[0], indices.size() );
+        }
+
+        return true;
+    }
+
+    /**
+     * Installs cached surface geometry in place of the mesh generation
+     * passes. Leaves the tile untouched if the record is unusable.
+     */
+    bool readGeometryRecord( Data& d, const std::string& buf )
+    {
+        unsigned offset = 0;
+        unsigned header[4];
+        if (!readData( buf, offset, header, 4 ) ||
+            header[0] != GEOMETRY_RECORD_MAGIC ||
+            header[1] != GEOMETRY_RECORD_VERSION ||
+            header[2] == 0 )
+        {
+            return false;
+        }
+
+        unsigned numVerts = header[2];
+
+        osg::ref_ptr<osg::Vec3Array> verts      = new osg::Vec3Array( numVerts );
+        osg::ref_ptr<osg::Vec3Array> normals    = new osg::Vec3Array( numVerts );
+        osg::ref_ptr<osg::Vec4Array> attribs    = new osg::Vec4Array( numVerts );
+        osg::ref_ptr<osg::Vec4Array> attribs2   = new osg::Vec4Array( numVerts );
+        osg::ref_ptr<osg::Vec2Array> tileCoords = new osg::Vec2Array( numVerts );
+
+        if (!readData( buf, offset, &(*verts)[0],      numVerts ) ||
+            !readData( buf, offset, &(*normals)[0],    numVerts ) ||
+            !readData( buf, offset, &(*attribs)[0],    numVerts ) ||
+            !readData( buf, offset, &(*attribs2)[0],   numVerts ) ||
+            !readData( buf, offset, &(*tileCoords)[0], numVerts ) )
+        {
+            return false;
+        }
+
+        std::vector< osg::ref_ptr<osg::PrimitiveSet> > primSets;
+        std::vector<unsigned> indices;
+
+        for( unsigned p = 0; p < header[3]; ++p )
+        {
+            unsigned info[2];
+            if ( !readData( buf, offset, info, 2 ) )
+                return false;
+
+            indices.resize( info[1] );
+            if ( info[1] > 0 && !readData( buf, offset, &indices[0], info[1] ) )
+                return false;
+
+            for( unsigned i = 0; i < indices.size(); ++i )
+            {
+                if ( indices[i] >= numVerts )
+                    return false;
+            }
+
+            if ( numVerts <= 0x10000 )
+            {
+                osg::DrawElementsUShort* de = new osg::DrawElementsUShort( info[0] );
+                de->reserve( indices.size() );
+                for( unsigned i = 0; i < indices.size(); ++i )
+                    de->push_back( (GLushort)indices[i] );
+                primSets.push_back( de );
+            }
+            else
+            {
+                osg::DrawElementsUInt* de = new osg::DrawElementsUInt( info[0] );
+                de->reserve( indices.size() );
+                for( unsigned i = 0; i < indices.size(); ++i )
+                    de->push_back( indices[i] );
+                primSets.push_back( de );
+            }
+        }
+
+        // the record is good; install it.
+        d.surfaceVerts->asVector().swap( verts->asVector() );
+        d.normals->asVector().swap( normals->asVector() );
+        d.surfaceAttribs->asVector().swap( attribs->asVector() );
+        d.surfaceAttribs2->asVector().swap( attribs2->asVector() );
+        d.renderTileCoords->asVector().swap( tileCoords->asVector() );
+
+        for( unsigned p = 0; p < primSets.size(); ++p )
+            d.surface->addPrimitiveSet( primSets[p].get() );
+
+        // regenerate the per-layer texture coordinates from the tile coordinates.
+        for( RenderLayerVector::iterator r = d.renderLayers.begin(); r != d.renderLayers.end(); ++r )
+        {
+            if ( !r->_ownsTexCoords )
+                continue;
+
+            bool sameLocator = r->_locator->isEquivalentTo( *d.geoLocator.get() );
+
+            r->_texCoords->reserve( numVerts );
+            for( osg::Vec2Array::const_iterator tc = d.renderTileCoords->begin(); tc != d.renderTileCoords->end(); ++tc )
+            {
+                if ( !sameLocator )
+                {
+                    osg::Vec3d color_ndc;
+                    osgTerrain::Locator::convertLocalCoordBetween( *d.geoLocator.get(), osg::Vec3d(tc->x(), tc->y(), 0.0), *r->_locator.get(), color_ndc );
+                    r->_texCoords->push_back( osg::Vec2( color_ndc.x(), color_ndc.y() ) );
+                }
+                else
+                {
+                    r->_texCoords->push_back( *tc );
+                }
+            }
+        }
+
+        return true;
+    }
+
+
     struct CullByTraversalMask : public osg::Drawable::CullCallback
     {
         CullByTraversalMask( unsigned mask ) : _mask(mask) { }
@@ -1822,16 +2218,64 @@ namespace
 
 //------------------------------------------------------------------------
 
-TileModelCompiler::TileModelCompiler(const MaskLayerVector&              masks,
+TileModelCompiler::TileModelCompiler(const Map*                          map,
                                      int                                 texImageUnit,
                                      bool                                optimizeTriOrientation,
                                      const MPTerrainEngineOptions& options) :
-_masks                 ( masks ),
+_maskFrame             ( map, Map::MASK_LAYERS, "mp-compiler" ),
 _optimizeTriOrientation( optimizeTriOrientation ),
 _options               ( options ),
 _textureImageUnit      ( texImageUnit )
 {
+    _masks = _maskFrame.terrainMaskLayers();
     _cullByTraversalMask = new CullByTraversalMask(*options.secondaryTraversalMask());
+    _elevationTileSize = map->getMapOptions().elevationTileSize();
+}
+
+
+void
+TileModelCompiler::setGeometryCache(CacheBin*           bin,
+                                    const CachePolicy&  policy,
+                                    GeometryCacheStats* stats)
+{
+    _geometryCache       = bin;
+    _geometryCachePolicy = policy;
+    _geometryStats       = stats;
+}
+
+
+std::string
+TileModelCompiler::getGeometryCacheKey(const TileKey&  key,
+                                       const MapFrame& frame) const
+{
+    // everything besides the tile key that shapes the compiled mesh:
+    std::stringstream buf;
+    buf << frame.getProfile()->getFullSignature()
+        << ";" << frame.getMapInfo().isGeocentric()
+        << ";" << frame.getMapInfo().getElevationInterpolation()
+        << ";" << (_elevationTileSize.isSet() ? *_elevationTileSize : 0u)
+        << ";" << *_options.verticalScale()
+        << ";" << *_options.heightFieldSampleRatio()
+        << ";" << *_options.heightFieldSkirtRatio()
+        << ";" << *_options.normalizeEdges()
+        << ";" << _optimizeTriOrientation;
+
+    for( ElevationLayerVector::const_iterator i = frame.elevationLayers().begin(); i != frame.elevationLayers().end(); ++i )
+    {
+        const ElevationLayer* layer = i->get();
+        if ( layer->getVisible() )
+        {
+            // dynamic sources can change at any time, so their tiles are not cacheable.
+            if ( layer->isDynamic() )
+                return "";
+
+            buf << ";" << *layer->getTerrainLayerRuntimeOptions().cacheId();
+        }
+    }
+
+    std::stringstream keyBuf;
+    keyBuf << key.str() << "_" << std::hex << hashString( buf.str() );
+    return keyBuf.str();
 }
 
 
@@ -1841,6 +2285,11 @@ TileModelCompiler::compile(const TileModel* model,
 {
     TileNode* tile = new TileNode( model->_tileKey, model );
 
+    // pick up mask changes. The masks are copied out of the frame so that
+    // nothing refers into the snapshot it holds.
+    if ( _maskFrame.sync() )
+        _masks = _maskFrame.terrainMaskLayers();
+
     // Working data for the build.
     Data d(model, frame, _masks);
 
@@ -1885,25 +2334,98 @@ TileModelCompiler::compile(const TileModel* model,
     // set up the list of layers to render and their shared arrays.
     setupTextureAttributes( d, _cache );
 
-    // calculate the vertex and normals for the surface geometry.
-    createSurfaceGeometry( d );
+    // check the geometry cache. Masked tiles carry extra geometries that
+    // the cache records do not hold, so they always compile.
+    std::string cacheKey;
+    bool        fromCache = false;
 
-    // build geometry for the masked areas, if applicable
-    if ( d.maskRecords.size() > 0 )
-        createMaskGeometry( d );
+    if ( _geometryCache.valid() && d.maskLayers.size() == 0 )
+    {
+        cacheKey = getGeometryCacheKey( model->_tileKey, frame );
 
-    // build the skirts.
-    if ( d.createSkirt )
-        createSkirtGeometry( d, *_options.heightFieldSkirtRatio() );
+        // fallback elevation is temporary: the tile will recompile once the
+        // real data arrives, and the key cannot tell the two apart. So it
+        // neither reads nor writes the cache.
+        if ( !cacheKey.empty() && _geometryCachePolicy.isCacheReadable() && !model->_elevationData.isFallbackData() )
+        {
+            osg::Timer_t start = osg::Timer::instance()->tick();
 
-    // tesselate the surface verts into triangles.
-    tessellateSurfaceGeometry( d, _optimizeTriOrientation, *_options.normalizeEdges() );
+            ReadResult r = _geometryCache->readString( cacheKey, _geometryCachePolicy.getMinAcceptTime() );
+            if ( r.succeeded() )
+            {
+                fromCache = readGeometryRecord( d, r.getString() );
+                if ( fromCache )
+                {
+                    double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+                    OE_DEBUG << LC << "Loaded " << cacheKey << " from cache in " << ms << " ms" << std::endl;
 
-    // installs the per-layer rendering data into the Geometry objects.
-    installRenderData( d );
+                    if ( _geometryStats.valid() )
+                    {
+                        Threading::ScopedMutexLock lock( _geometryStats->_mutex );
+                        ++_geometryStats->_loaded;
+                        _geometryStats->_loadMs += ms;
+                    }
+                }
+                else
+                {
+                    OE_DEBUG << LC << "Ignoring unusable cache record " << cacheKey << std::endl;
+                }
+            }
+        }
+    }
+
+    if ( fromCache )
+    {
+        // installs the per-layer rendering data into the Geometry objects.
+        installRenderData( d );
+    }
+    else
+    {
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
+        // calculate the vertex and normals for the surface geometry.
+        createSurfaceGeometry( d );
+
+        // build geometry for the masked areas, if applicable
+        if ( d.maskRecords.size() > 0 )
+            createMaskGeometry( d );
+
+        // build the skirts.
+        if ( d.createSkirt )
+            createSkirtGeometry( d, *_options.heightFieldSkirtRatio() );
+
+        // tesselate the surface verts into triangles.
+        tessellateSurfaceGeometry( d, _cache, _optimizeTriOrientation, *_options.normalizeEdges() );
+
+        // installs the per-layer rendering data into the Geometry objects.
+        installRenderData( d );
 
-    // performance optimizations.
-    optimize( d );
+        // performance optimizations.
+        optimize( d );
+
+        if ( _geometryCache.valid() && _geometryStats.valid() )
+        {
+            double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+            Threading::ScopedMutexLock lock( _geometryStats->_mutex );
+            ++_geometryStats->_compiled;
+            _geometryStats->_compileMs += ms;
+        }
+
+        // (see above on fallback elevation.)
+        if ( !cacheKey.empty() && _geometryCachePolicy.isCacheWriteable() && !model->_elevationData.isFallbackData() )
+        {
+            OE_DEBUG << LC << "Compiled " << cacheKey << " in "
+                << osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() )
+                << " ms" << std::endl;
+
+            std::string record;
+            if ( writeGeometryRecord( d, record ) )
+            {
+                osg::ref_ptr<StringObject> object = new StringObject( record );
+                _geometryCache->write( cacheKey, object.get() );
+            }
+        }
+    }
 
 #if 0 // this is covered by the opt above.
     // convert mask geometry to tris.
@@ -1919,6 +2441,13 @@ TileModelCompiler::compile(const TileModel* model,
         osg::ref_ptr<osg::KdTreeBuilder> builder = osgDB::Registry::instance()->getKdTreeBuilder()->clone();
         tile->accept(*builder);
     }
+    else
+    {
+        // accelerate intersections (picking, height queries, line of sight) against
+        // the surface. The BVH is built on the first intersection that reaches it;
+        // install it after the optimization pass, which rewrites the arrays.
+        TriangleBVH::install( d.surface );
+    }
 
     // Temporary solution to the OverlayDecorator techniques' inappropriate setting of
     // uniform values during the CULL traversal, which causes corruption of the RTT 
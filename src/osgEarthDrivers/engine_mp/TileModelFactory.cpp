@@ -313,7 +313,26 @@ TileModelFactory::createTileModel(const TileKey&           key,
     // look up the parent model and cache it.
     osg::ref_ptr<TileNode> parentTile;
     if ( _liveTiles->get(key.createParentKey(), parentTile) )
-        model->_parentModel = parentTile->getTileModel();
+    {
+        osg::ref_ptr<const TileModel> parentModel;
+        parentTile->getTileModel( parentModel );
+        model->_parentModel = parentModel.get();
+    }
 
     out_model = model.release();
 }
+
+
+bool
+TileModelFactory::createColorData(const TileKey& key,
+                                  ImageLayer*    layer,
+                                  unsigned       order,
+                                  TileModel*     model)
+{
+    if ( !layer || !model || !layer->getEnabled() )
+        return false;
+
+    BuildColorData build;
+    build.init( key, layer, order, model->_mapInfo, _terrainOptions, model );
+    return build.execute();
+}
@@ -47,6 +47,26 @@ _outOfDate         ( false )
 }
 
 
+void
+TileNode::getTileModel( osg::ref_ptr<const TileModel>& out_model ) const
+{
+    Threading::ScopedMutexLock lock( _modelMutex );
+    out_model = _model.get();
+}
+
+
+void
+TileNode::setTileModel( const TileModel* model )
+{
+    // hold the old model until after the lock, in case this is its last reference
+    osg::ref_ptr<const TileModel> old = _model.get();
+    {
+        Threading::ScopedMutexLock lock( _modelMutex );
+        _model = model;
+    }
+}
+
+
 void
 TileNode::setLastTraversalFrame(unsigned frame)
 {
@@ -81,8 +101,10 @@ TileNode::releaseGLObjects(osg::State* state) const
 {
     osg::MatrixTransform::releaseGLObjects( state );
 
-    if ( _model.valid() )
-        _model->releaseGLObjects( state );
+    osg::ref_ptr<const TileModel> model;
+    getTileModel( model );
+    if ( model.valid() )
+        model->releaseGLObjects( state );
 }
 
 void
@@ -90,6 +112,8 @@ TileNode::resizeGLObjectBuffers(unsigned maxSize)
 {
     osg::MatrixTransform::resizeGLObjectBuffers( maxSize );
 
-    if ( _model.valid() )
-        const_cast<TileModel*>(_model.get())->resizeGLObjectBuffers( maxSize );
+    osg::ref_ptr<const TileModel> model;
+    getTileModel( model );
+    if ( model.valid() )
+        const_cast<TileModel*>(model.get())->resizeGLObjectBuffers( maxSize );
 }
@@ -70,6 +70,17 @@ TileNodeRegistry::setMapRevision(const Revision& rev,
 }
 
 
+void
+TileNodeRegistry::setMapRevisionForNewTiles(const Revision& rev)
+{
+    if ( _revisioningEnabled )
+    {
+        Threading::ScopedWriteLock exclusive( _tilesMutex );
+        _maprev = rev;
+    }
+}
+
+
 void
 TileNodeRegistry::add( TileNode* tile )
 {
@@ -79,6 +90,7 @@ TileNodeRegistry::add( TileNode* tile )
         _tiles[ tile->getKey() ] = tile;
         if ( _revisioningEnabled )
             tile->setMapRevision( _maprev );
+        publish( tile );
         OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
     }
 }
@@ -93,6 +105,7 @@ TileNodeRegistry::add( const TileNodeVector& tiles )
         for( TileNodeVector::const_iterator i = tiles.begin(); i != tiles.end(); ++i )
         {
             _tiles[ i->get()->getKey() ] = i->get();
+            publish( i->get() );
         }
         OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
     }
@@ -106,6 +119,7 @@ TileNodeRegistry::remove( TileNode* tile )
     {
         Threading::ScopedWriteLock exclusive( _tilesMutex );
         _tiles.erase( tile->getKey() );
+        withdraw( tile->getKey() );
         OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
     }
 }
@@ -150,6 +164,7 @@ TileNodeRegistry::take( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
     {
         out_tile = i->second.get();
         _tiles.erase( i );
+        withdraw( key );
         OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
         return true;
     }
@@ -177,9 +192,51 @@ TileNodeRegistry::run( const TileNodeRegistry::ConstOperation& op ) const
 }
 
 
+void
+TileNodeRegistry::getTilesOlderThan(const Revision& rev, TileNodeVector& out_tiles) const
+{
+    Threading::ScopedReadLock shared( _tilesMutex );
+
+    for( TileNodeMap::const_iterator i = _tiles.begin(); i != _tiles.end(); ++i )
+    {
+        osg::ref_ptr<const TileModel> model;
+        i->second->getTileModel( model );
+        if ( model.valid() && model->_revision < rev )
+            out_tiles.push_back( i->second.get() );
+    }
+}
+
+
 bool
 TileNodeRegistry::empty() const
 {
     // don't bother mutex-protecteding this.
     return _tiles.empty();
 }
+
+
+void
+TileNodeRegistry::publish( TileNode* tile )
+{
+    osg::ref_ptr<TerrainHeightIndex> index;
+    if ( _heightIndex.lock(index) )
+    {
+        osg::ref_ptr<const TileModel> model;
+        tile->getTileModel( model );
+        if ( model.valid() && model->hasElevation() )
+            index->add( tile->getKey(), model->_elevationData.getHeightField() );
+        else
+            index->remove( tile->getKey() );
+    }
+}
+
+
+void
+TileNodeRegistry::withdraw( const TileKey& key )
+{
+    osg::ref_ptr<TerrainHeightIndex> index;
+    if ( _heightIndex.lock(index) )
+    {
+        index->remove( key );
+    }
+}
@@ -837,7 +837,20 @@ OSGTerrainEngineNode::traverse( osg::NodeVisitor& nv )
 
             // TODO: address the fact that this can happen from multiple threads.
             // Really we need a _cull_mapf PER view. -gw
-            _cull_mapf->sync();
+            // Until then, tiles on other cull threads may be reading the frame's
+            // layer lists, which a sync releases; so sync under the write lock.
+            if ( _cull_mapf->needsSync() )
+            {
+                if ( _tileFactory.valid() )
+                {
+                    Threading::ScopedWriteLock lock( _tileFactory->getCullThreadMapFrameMutex() );
+                    _cull_mapf->sync();
+                }
+                else
+                {
+                    _cull_mapf->sync();
+                }
+            }
         }
     }
 
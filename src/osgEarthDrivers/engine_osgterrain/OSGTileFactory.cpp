@@ -56,7 +56,8 @@ namespace
     //TODO: get rid of this, and move it to the CustomTerrain CULL traversal....?????
     struct PopulateStreamingTileDataCallback : public osg::NodeCallback
     {
-        PopulateStreamingTileDataCallback( const MapFrame& mapf ) : _mapf(mapf) { }
+        PopulateStreamingTileDataCallback( const MapFrame& mapf, Threading::ReadWriteMutex& mapfMutex )
+            : _mapf(mapf), _mapfMutex(mapfMutex) { }
 
         void operator()( osg::Node* node, osg::NodeVisitor* nv )
         {
@@ -65,13 +66,15 @@ namespace
                 if ( node->asGroup()->getNumChildren() > 0 )
                 {
                     StreamingTile* tile = static_cast<StreamingTile*>( node->asGroup()->getChild(0) );
+                    Threading::ScopedReadLock lock( _mapfMutex );
                     tile->servicePendingImageRequests( _mapf, nv->getFrameStamp()->getFrameNumber() );
                 }
             }
             traverse( node, nv );
         }
 
-        const MapFrame& _mapf;
+        const MapFrame&            _mapf;
+        Threading::ReadWriteMutex& _mapfMutex;
     };
 }
 
@@ -486,7 +489,7 @@ OSGTileFactory::createPlaceholderTile(const MapFrame&   mapf,
     result = plod;
 
     // Install a callback that will load the actual tile data via the pager.
-    result->addCullCallback( new PopulateStreamingTileDataCallback( _cull_thread_mapf ) );
+    result->addCullCallback( new PopulateStreamingTileDataCallback( _cull_thread_mapf, _cull_thread_mapf_mutex ) );
 
     // Install a cluster culler (FIXME for cube mode)
     //bool isCube = map->getMapOptions().coordSysType() == MapOptions::CSTYPE_GEOCENTRIC_CUBE;
@@ -792,7 +795,7 @@ OSGTileFactory::createPopulatedTile(const MapFrame&  mapf,
         result = plod;
 
         if ( isStreaming )
-            result->addCullCallback( new PopulateStreamingTileDataCallback( _cull_thread_mapf ) );
+            result->addCullCallback( new PopulateStreamingTileDataCallback( _cull_thread_mapf, _cull_thread_mapf_mutex ) );
     }
     else
     {
@@ -331,7 +331,7 @@ QuadTreeTerrainEngineNode::getKeyNodeFactory()
 
         // A compiler specific to this thread:
         TileModelCompiler* compiler = new TileModelCompiler(
-            _update_mapf->terrainMaskLayers(),
+            getMap(),
             _texCompositor.get(),
             optimizeTriangleOrientation,
             _terrainOptions );
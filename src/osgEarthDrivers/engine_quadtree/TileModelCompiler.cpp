@@ -1812,15 +1812,16 @@ namespace
 
 //------------------------------------------------------------------------
 
-TileModelCompiler::TileModelCompiler(const MaskLayerVector&              masks,
+TileModelCompiler::TileModelCompiler(const Map*                          map,
                                      TextureCompositor*                  texCompositor,
                                      bool                                optimizeTriOrientation,
                                      const QuadTreeTerrainEngineOptions& options) :
-_masks                 ( masks ),
+_maskFrame             ( map, Map::MASK_LAYERS, "quadtree-compiler" ),
 _texCompositor         ( texCompositor ),
 _optimizeTriOrientation( optimizeTriOrientation ),
 _options               ( options )
 {
+    _masks = _maskFrame.terrainMaskLayers();
     _cullByTraversalMask = new CullByTraversalMask(*options.secondaryTraversalMask());
 }
 
@@ -1830,6 +1831,11 @@ TileModelCompiler::compile(const TileModel* model,
                            osg::Node*&      out_node,
                            osg::StateSet*&  out_stateSet)
 {
+    // pick up mask changes. The masks are copied out of the frame so that
+    // nothing refers into the snapshot it holds.
+    if ( _maskFrame.sync() )
+        _masks = _maskFrame.terrainMaskLayers();
+
     // Working data for the build.
     Data d(model, _masks);
 
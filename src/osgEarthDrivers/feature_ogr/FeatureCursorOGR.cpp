@@ -83,6 +83,7 @@ _filters          ( filters )
         OGR_SCOPED_LOCK;
 
         std::string expr;
+        bool        customSelect = false;
         std::string from = OGR_FD_GetName( OGR_L_GetLayerDefn( _layerHandle ));        
         
         
@@ -110,7 +111,8 @@ _filters          ( filters )
             std::string temp = expr;
             std::transform( temp.begin(), temp.end(), temp.begin(), ::tolower );
             //bool complete = temp.find( "select" ) == 0;
-            if ( temp.find( "select" ) != 0 )
+            customSelect = temp.find( "select" ) == 0;
+            if ( !customSelect )
             {
                 std::stringstream buf;
                 buf << "SELECT * FROM " << from << " WHERE " << expr;
@@ -168,6 +170,13 @@ _filters          ( filters )
         {
             OGR_L_ResetReading( _resultSetHandle );
         }
+
+        // "SELECT *" returns the layer's own fields, so the features can share the
+        // profile's attribute layout. A custom SELECT builds a layout of its own.
+        if ( !customSelect && _profile.valid() )
+        {
+            _attrLayout = _profile->getAttributeLayout();
+        }
     }
 
     readChunk();
@@ -229,7 +238,7 @@ FeatureCursorOGR::readChunk()
 
     if ( _nextHandleToQueue )
     {
-        osg::ref_ptr<Feature> f = OgrUtils::createFeature( _nextHandleToQueue, _profile->getSRS() );
+        osg::ref_ptr<Feature> f = OgrUtils::createFeature( _nextHandleToQueue, _profile->getSRS(), _attrLayout );
         if ( f.valid() && !_source->isBlacklisted(f->getFID()) )
         {
             if ( isGeometryValid( f->getGeometry() ) )
@@ -256,7 +265,7 @@ FeatureCursorOGR::readChunk()
         OGRFeatureH handle = OGR_L_GetNextFeature( _resultSetHandle );
         if ( handle )
         {
-            osg::ref_ptr<Feature> f = OgrUtils::createFeature( handle, _profile->getSRS() );
+            osg::ref_ptr<Feature> f = OgrUtils::createFeature( handle, _profile->getSRS(), _attrLayout );
             if ( f.valid() && !_source->isBlacklisted(f->getFID()) )
             {
                 if (isGeometryValid( f->getGeometry() ) )
@@ -216,6 +216,12 @@ public:
 
                     initSchema();
 
+                    // every cursor's features share one copy of the field names.
+                    if ( result )
+                    {
+                        result->setAttributeLayout( OgrUtils::createAttributeLayout(OGR_L_GetLayerDefn(_layerHandle)) );
+                    }
+
                     OGRwkbGeometryType wkbType = OGR_FD_GetGeomType( OGR_L_GetLayerDefn( _layerHandle ) );
                     if (
                         wkbType == wkbPolygon ||
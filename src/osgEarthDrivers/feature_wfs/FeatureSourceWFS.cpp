@@ -242,13 +242,16 @@ public:
             FeatureProfile* fp = getFeatureProfile();
             const SpatialReference* srs = fp ? fp->getSRS() : 0L;
 
+            // all features in the layer share one set of attribute names.
+            osg::ref_ptr<AttributeLayout> attrLayout;
+
             OGR_L_ResetReading(layer);                                
             OGRFeatureH feat_handle;
             while ((feat_handle = OGR_L_GetNextFeature( layer )) != NULL)
             {
                 if ( feat_handle )
                 {
-                    osg::ref_ptr<Feature> f = OgrUtils::createFeature( feat_handle, srs );
+                    osg::ref_ptr<Feature> f = OgrUtils::createFeature( feat_handle, srs, attrLayout );
                     if ( f.valid() && !isBlacklisted(f->getFID()) )
                     {
                         features.push_back( f.release() );
@@ -18,6 +18,7 @@
  */
 #include <osgEarthFeatures/LabelSource>
 #include <osgEarthFeatures/FeatureSourceIndexNode>
+#include <osgEarthFeatures/CompiledExpression>
 #include <osgEarthAnnotation/LabelNode>
 #include <osgEarthAnnotation/PlaceNode>
 #include <osgEarth/DepthOffset>
@@ -57,11 +58,11 @@ public:
 
         osg::Group* group = new osg::Group();
         
-        StringExpression  textContentExpr ( text ? *text->content()  : StringExpression() );
-        NumericExpression textPriorityExpr( text ? *text->priority() : NumericExpression() );
-        StringExpression  iconUrlExpr     ( icon ? *icon->url()      : StringExpression() );
-        NumericExpression iconScaleExpr   ( icon ? *icon->scale()    : NumericExpression() );
-        NumericExpression iconHeadingExpr ( icon ? *icon->heading()  : NumericExpression() );
+        CompiledStringExpression  textContentExpr ( text ? *text->content()  : StringExpression() );
+        CompiledNumericExpression textPriorityExpr( text ? *text->priority() : NumericExpression() );
+        CompiledStringExpression  iconUrlExpr     ( icon ? *icon->url()      : StringExpression() );
+        CompiledNumericExpression iconScaleExpr   ( icon ? *icon->scale()    : NumericExpression() );
+        CompiledNumericExpression iconHeadingExpr ( icon ? *icon->heading()  : NumericExpression() );
 
         for( FeatureList::const_iterator i = input.begin(); i != input.end(); ++i )
         {
@@ -82,19 +83,19 @@ public:
             if ( text )
             {
                 if ( text->content().isSet() )
-                    tempStyle.get<TextSymbol>()->content()->setLiteral( feature->eval( textContentExpr, &context ) );
+                    tempStyle.get<TextSymbol>()->content()->setLiteral( textContentExpr.eval( feature, &context ) );
             }
 
             if ( icon )
             {
                 if ( icon->url().isSet() )
-                    tempStyle.get<IconSymbol>()->url()->setLiteral( feature->eval(iconUrlExpr, &context) );
+                    tempStyle.get<IconSymbol>()->url()->setLiteral( iconUrlExpr.eval( feature, &context ) );
 
                 if ( icon->scale().isSet() )
-                    tempStyle.get<IconSymbol>()->scale()->setLiteral( feature->eval(iconScaleExpr, &context) );
+                    tempStyle.get<IconSymbol>()->scale()->setLiteral( iconScaleExpr.eval( feature, &context ) );
 
                 if ( icon->heading().isSet() )
-                    tempStyle.get<IconSymbol>()->heading()->setLiteral( feature->eval(iconHeadingExpr, &context) );
+                    tempStyle.get<IconSymbol>()->heading()->setLiteral( iconHeadingExpr.eval( feature, &context ) );
             }
             
             osg::Node* node = makePlaceNode(
@@ -121,7 +122,7 @@ public:
     osg::Node* makePlaceNode(const FilterContext& context,
                              const Feature*       feature, 
                              const Style&         style, 
-                             NumericExpression&   priorityExpr )
+                             const CompiledNumericExpression& priorityExpr )
     {
         osg::Vec3d center = feature->getGeometry()->getBounds().center();
         GeoPoint point(feature->getSRS(), center.x(), center.y());
@@ -131,7 +132,7 @@ public:
         if ( !priorityExpr.empty() )
         {
             AnnotationData* data = new AnnotationData();
-            data->setPriority( feature->eval(priorityExpr, &context) );
+            data->setPriority( priorityExpr.eval( feature, &context ) );
             placeNode->setAnnotationData( data );
         }
 
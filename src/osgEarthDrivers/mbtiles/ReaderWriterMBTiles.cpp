@@ -23,6 +23,8 @@
 #include <osgEarth/Registry>
 #include <osgEarth/FileUtils>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/StringUtils>
+#include <osgEarth/ThreadingUtils>
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -33,6 +35,8 @@
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <vector>
+#include <cstring>
 
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
@@ -42,16 +46,77 @@ using namespace osgEarth::Drivers;
 
 #define LC "[MBTilesSource] "
 
+namespace
+{
+    // A database connection and the statement prepared on it for reading tiles.
+    // A connection is only ever used by one thread at a time.
+    struct Connection
+    {
+        Connection() : _db( NULL ), _selectTile( NULL ) { }
+
+        void close()
+        {
+            if ( _selectTile )
+                sqlite3_finalize( _selectTile );
+            if ( _db )
+                sqlite3_close( _db );
+            _selectTile = NULL;
+            _db = NULL;
+        }
+
+        sqlite3*      _db;
+        sqlite3_stmt* _selectTile;
+    };
+
+    // 64-bit FNV-1a hash of a tile blob, plus its length: the first choice
+    // of ID for the tile in the images table.
+    std::string makeTileID( const std::string& data )
+    {
+        unsigned long long h = 14695981039346656037ULL;
+        for( std::string::const_iterator i = data.begin(); i != data.end(); ++i )
+        {
+            h ^= (unsigned char)(*i);
+            h *= 1099511628211ULL;
+        }
+        std::stringstream buf;
+        buf << std::hex << std::setw(16) << std::setfill('0') << h << "-" << std::dec << data.size();
+        return buf.str();
+    }
+}
+
 class MBTilesSource : public TileSource
 {
 public:
     MBTilesSource( const TileSourceOptions& options ) :
       TileSource( options ),
       _options( options ),      
-      _database( NULL ),
       _minLevel( 0 ),
-      _maxLevel( 20 )
+      _maxLevel( 20 ),
+      _empty( true ),
+      _writable( false ),
+      _dedup( false ),
+      _levelsChanged( false ),
+      _insertImage( NULL ),
+      _selectImage( NULL ),
+      _insertMap( NULL ),
+      _insertTile( NULL ),
+      _pendingWrites( 0 )
+    {
+    }
+
+    virtual ~MBTilesSource()
     {
+        flush();
+
+        if ( _insertImage ) sqlite3_finalize( _insertImage );
+        if ( _selectImage ) sqlite3_finalize( _selectImage );
+        if ( _insertMap )   sqlite3_finalize( _insertMap );
+        if ( _insertTile )  sqlite3_finalize( _insertTile );
+
+        for( std::vector<Connection>::iterator i = _idle.begin(); i != _idle.end(); ++i )
+            i->close();
+
+        _shared.close();
     }
 
     // override
@@ -61,18 +126,31 @@ public:
         _dbOptions = Registry::instance()->cloneOrCreateOptions( dbOptions );
         CachePolicy::NO_CACHE.apply( _dbOptions.get() );
 
-                   
+        _writable = _options.writable() == true;
+
+        std::string fullFilename = _options.filename()->full();
+
+        if ( _writable )
+        {
+            std::string path = osgDB::getFilePath( fullFilename );
+            if ( !path.empty() && !osgDB::fileExists(path) )
+                osgDB::makeDirectory( path );
+        }
 
-        int flags = SQLITE_OPEN_READONLY;
-        std::string fullFilename = _options.filename()->full();        
-        int rc = sqlite3_open_v2( fullFilename.c_str(), &_database, flags, 0L );
-        if ( rc != 0 )
-        {                        
+        if ( !openConnection(fullFilename, _writable, _shared) )
+        {
             std::stringstream buf;
-            buf << "Failed to open database \"" << fullFilename << "\": " << sqlite3_errmsg(_database);
+            buf << "Failed to open database \"" << fullFilename << "\": " << sqlite3_errmsg(_shared._db);
+            _shared.close();
             return Status::Error(buf.str());
         }
 
+        bool created = false;
+        if ( _writable && !createTables(created) )
+        {
+            return Status::Error( Stringify() << "Failed to create tables in \"" << fullFilename << "\"" );
+        }
+
         //Print out some metadata
         std::string name, type, version, description, format, profileStr;
         getMetaData( "name", name );
@@ -128,8 +206,25 @@ public:
         //Get the ReaderWriter
         _rw = osgDB::Registry::instance()->getReaderWriterForExtension( _tileFormat );                
 
+        if ( created )
+        {
+            setMetaData( "name", osgDB::getStrippedName(fullFilename) );
+            setMetaData( "type", "baselayer" );
+            setMetaData( "version", "1.1" );
+            setMetaData( "format", _tileFormat );
+            setMetaData( "profile", getProfileString(getProfile()) );
+        }
+
         computeLevels();
 
+        // have the next flush record the zoom range, in case the database lacks it.
+        _levelsChanged = _writable && !_empty;
+
+        if ( !prepareSelect(_shared) )
+        {
+            return Status::Error( Stringify() << "Failed to prepare tile query on \"" << fullFilename << "\"" );
+        }
+
         _emptyImage = ImageUtils::createEmptyImage( 256, 256 );
         
         return STATUS_OK;
@@ -158,48 +253,138 @@ public:
         key.getProfile()->getNumTiles(key.getLevelOfDetail(), numCols, numRows);
         y  = numRows - y - 1;
 
-        //Get the image
-        sqlite3_stmt* select = NULL;
-        std::string query = "SELECT tile_data from tiles where zoom_level = ? AND tile_column = ? AND tile_row = ?";
-        int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &select, 0L );
-        if ( rc != SQLITE_OK )
+        //Get the image data. Each read borrows a connection of its own from the pool;
+        //a writable database has only the one (which sees the uncommitted writes).
+        std::string imageString;
+        bool found = false;
+
+        Connection conn;
+        if ( !_writable && acquireConnection(conn) )
+        {
+            found = readTile( conn, z, x, y, imageString );
+            releaseConnection( conn );
+        }
+        else
+        {
+            Threading::ScopedMutexLock lock( _sharedMutex );
+            found = readTile( _shared, z, x, y, imageString );
+        }
+
+        if ( !found || !_rw.valid() )
         {
-            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
             return NULL;
         }
 
-        bool valid = true;        
-        sqlite3_bind_int( select, 1, z );
-        sqlite3_bind_int( select, 2, x );
-        sqlite3_bind_int( select, 3, y );
+        // deserialize the image from the buffer:
+        osg::Image* result = NULL;
+        std::stringstream imageBufStream( imageString );
+        osgDB::ReaderWriter::ReadResult rr = _rw->readImage( imageBufStream );
+        if (rr.validImage())
+        {
+            result = rr.takeImage();                
+        }            
 
+        return result;
+    }
 
-        osg::Image* result = NULL;
-        rc = sqlite3_step( select );
-        if ( rc == SQLITE_ROW)
-        {                     
-            // the pointer returned from _blob gets freed internally by sqlite, supposedly
-            const char* data = (const char*)sqlite3_column_blob( select, 0 );
-            int imageBufLen = sqlite3_column_bytes( select, 0 );
+    // override
+    bool isWritable() const
+    {
+        return _writable;
+    }
 
-            // deserialize the image from the buffer:
-            std::string imageString( data, imageBufLen );
-            std::stringstream imageBufStream( imageString );
-            osgDB::ReaderWriter::ReadResult rr = _rw->readImage( imageBufStream );
-            if (rr.validImage())
-            {
-                result = rr.takeImage();                
-            }            
+    // override
+    bool storeImage( const TileKey& key, osg::Image* image, ProgressCallback* progress )
+    {
+        if ( !_writable || !image || !_rw.valid() )
+            return false;
+
+        // encode the tile outside the lock so that callers can encode in parallel.
+        osg::ref_ptr<osg::Image> final = image;
+        if ( (_tileFormat == "jpg" || _tileFormat == "jpeg") && final->getPixelFormat() != GL_RGB )
+            final = ImageUtils::convertToRGB8( image );
+
+        if ( !final.valid() )
+            return false;
+
+        std::stringstream buf;
+        osgDB::ReaderWriter::WriteResult wr = _rw->writeImage( *final.get(), buf, _dbOptions.get() );
+        if ( !wr.success() )
+        {
+            OE_WARN << LC << "Failed to encode tile " << key.str() << " as " << _tileFormat << std::endl;
+            return false;
+        }
+        std::string data = buf.str();
+
+        int z = key.getLevelOfDetail();
+        int x = key.getTileX();
+        unsigned int numRows, numCols;
+        key.getProfile()->getNumTiles(key.getLevelOfDetail(), numCols, numRows);
+        int y = numRows - key.getTileY() - 1;
+
+        Threading::ScopedMutexLock lock( _sharedMutex );
+
+        if ( _pendingWrites == 0 && !exec("BEGIN TRANSACTION") )
+            return false;
+
+        bool ok;
+        if ( _dedup )
+        {
+            std::string tileID;
+            ok = storeUniqueImage( data, tileID );
+
+            sqlite3_bind_int ( _insertMap, 1, z );
+            sqlite3_bind_int ( _insertMap, 2, x );
+            sqlite3_bind_int ( _insertMap, 3, y );
+            sqlite3_bind_text( _insertMap, 4, tileID.c_str(), tileID.length(), SQLITE_STATIC );
+            ok = ok && step( _insertMap );
         }
         else
         {
-            OE_DEBUG << LC << "SQL QUERY failed for " << query << ": " << std::endl;
-            valid = false;
+            sqlite3_bind_int ( _insertTile, 1, z );
+            sqlite3_bind_int ( _insertTile, 2, x );
+            sqlite3_bind_int ( _insertTile, 3, y );
+            sqlite3_bind_blob( _insertTile, 4, data.data(), data.size(), SQLITE_STATIC );
+            ok = step( _insertTile );
         }
 
-        sqlite3_finalize( select );
-        return result;
+        if ( !ok )
+        {
+            OE_WARN << LC << "Failed to store tile " << key.str() << ": " << sqlite3_errmsg(_shared._db) << std::endl;
+        }
+        else if ( _empty )
+        {
+            _minLevel = _maxLevel = z;
+            _empty = false;
+            _levelsChanged = true;
+        }
+        else if ( (unsigned)z < _minLevel || (unsigned)z > _maxLevel )
+        {
+            _minLevel = osg::minimum( _minLevel, (unsigned)z );
+            _maxLevel = osg::maximum( _maxLevel, (unsigned)z );
+            _levelsChanged = true;
+        }
 
+        // the transaction counts every attempt, so that it is committed on schedule.
+        if ( ++_pendingWrites >= osg::maximum(_options.writeBatchSize().value(), 1u) )
+            commit();
+
+        return ok;
+    }
+
+    // override
+    void flush()
+    {
+        Threading::ScopedMutexLock lock( _sharedMutex );
+        commit();
+
+        // record the zoom range of the tiles written so far (MBTiles 1.2 metadata).
+        if ( _levelsChanged )
+        {
+            setMetaData( "minzoom", Stringify() << _minLevel );
+            setMetaData( "maxzoom", Stringify() << _maxLevel );
+            _levelsChanged = false;
+        }
     }
 
     bool getMetaData( const std::string& key, std::string& value )
@@ -207,10 +392,10 @@ public:
         //get the metadata
         sqlite3_stmt* select = NULL;
         std::string query = "SELECT value from metadata where name = ?";
-        int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &select, 0L );
+        int rc = sqlite3_prepare_v2( _shared._db, query.c_str(), -1, &select, 0L );
         if ( rc != SQLITE_OK )
         {
-            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_shared._db) << std::endl;
             return false;
         }
 
@@ -220,7 +405,8 @@ public:
         rc = sqlite3_bind_text( select, 1, keyStr.c_str(), keyStr.length(), SQLITE_STATIC );
         if (rc != SQLITE_OK )
         {
-            OE_WARN << LC << "Failed to bind text: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+            OE_WARN << LC << "Failed to bind text: " << query << "; " << sqlite3_errmsg(_shared._db) << std::endl;
+            sqlite3_finalize( select );
             return false;
         }
 
@@ -239,21 +425,53 @@ public:
         return valid;
     }
 
+    bool setMetaData( const std::string& key, const std::string& value )
+    {
+        // the metadata table need not have a unique index on name, so replace by hand.
+        sqlite3_stmt* del = NULL;
+        std::string query = "DELETE FROM metadata WHERE name = ?";
+        if ( sqlite3_prepare_v2( _shared._db, query.c_str(), -1, &del, 0L ) == SQLITE_OK )
+        {
+            sqlite3_bind_text( del, 1, key.c_str(), key.length(), SQLITE_STATIC );
+            sqlite3_step( del );
+        }
+        sqlite3_finalize( del );
+
+        sqlite3_stmt* insert = NULL;
+        query = "INSERT INTO metadata (name, value) VALUES (?, ?)";
+        int rc = sqlite3_prepare_v2( _shared._db, query.c_str(), -1, &insert, 0L );
+        if ( rc != SQLITE_OK )
+        {
+            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_shared._db) << std::endl;
+            return false;
+        }
+
+        sqlite3_bind_text( insert, 1, key.c_str(), key.length(), SQLITE_STATIC );
+        sqlite3_bind_text( insert, 2, value.c_str(), value.length(), SQLITE_STATIC );
+        rc = sqlite3_step( insert );
+        sqlite3_finalize( insert );
+        return rc == SQLITE_DONE;
+    }
+
     void computeLevels()
     {        
+        _empty = true;
+
         sqlite3_stmt* select = NULL;
         std::string query = "SELECT min(zoom_level), max(zoom_level) from tiles";
-        int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &select, 0L );
+        int rc = sqlite3_prepare_v2( _shared._db, query.c_str(), -1, &select, 0L );
         if ( rc != SQLITE_OK )
         {
-            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_shared._db) << std::endl;
+            return;
         }
 
         rc = sqlite3_step( select );
-        if ( rc == SQLITE_ROW)
+        if ( rc == SQLITE_ROW && sqlite3_column_type(select, 0) != SQLITE_NULL )
         {                     
             _minLevel = sqlite3_column_int( select, 0 );
             _maxLevel = sqlite3_column_int( select, 1 );
+            _empty = false;
             OE_NOTICE << "Min=" << _minLevel << " Max=" << _maxLevel << std::endl;
         }
         else
@@ -270,17 +488,274 @@ public:
         return _tileFormat;
     }
 
+private:
+    // opens a connection with the settings used for all of them.
+    bool openConnection( const std::string& filename, bool writable, Connection& conn )
+    {
+        // every connection is used by one thread at a time, so SQLite's own mutexes are not needed.
+        int flags = writable ? (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) : SQLITE_OPEN_READONLY;
+        flags |= SQLITE_OPEN_NOMUTEX;
+
+        int rc = sqlite3_open_v2( filename.c_str(), &conn._db, flags, 0L );
+        if ( rc != SQLITE_OK )
+            return false;
+
+        // wait out locks held by other connections (e.g. another process writing).
+        sqlite3_busy_timeout( conn._db, 60000 );
+
+        // read through a memory map instead of copying pages into the page cache.
+        // (ignored by SQLite versions that predate memory-mapped I/O.)
+        if ( _options.mmapSize().value() > 0 )
+        {
+            std::string pragma = Stringify() << "PRAGMA mmap_size=" << _options.mmapSize().value();
+            sqlite3_exec( conn._db, pragma.c_str(), 0L, 0L, 0L );
+        }
+
+        return true;
+    }
+
+    bool prepareSelect( Connection& conn )
+    {
+        std::string query = "SELECT tile_data from tiles where zoom_level = ? AND tile_column = ? AND tile_row = ?";
+        int rc = sqlite3_prepare_v2( conn._db, query.c_str(), -1, &conn._selectTile, 0L );
+        if ( rc != SQLITE_OK )
+        {
+            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(conn._db) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // takes an idle read connection from the pool, or opens a new one.
+    bool acquireConnection( Connection& out_conn )
+    {
+        {
+            Threading::ScopedMutexLock lock( _idleMutex );
+            if ( !_idle.empty() )
+            {
+                out_conn = _idle.back();
+                _idle.pop_back();
+                return true;
+            }
+        }
+
+        if ( !openConnection(_options.filename()->full(), false, out_conn) || !prepareSelect(out_conn) )
+        {
+            OE_WARN << LC << "Failed to open a read connection" << std::endl;
+            out_conn.close();
+            return false;
+        }
+
+        OE_DEBUG << LC << "Opened a read connection" << std::endl;
+        return true;
+    }
+
+    // returns a read connection to the pool.
+    void releaseConnection( const Connection& conn )
+    {
+        Threading::ScopedMutexLock lock( _idleMutex );
+        _idle.push_back( conn );
+    }
+
+    // reads the blob of one tile; the statement is reset for reuse.
+    bool readTile( Connection& conn, int z, int x, int y, std::string& out_data )
+    {
+        sqlite3_stmt* select = conn._selectTile;
+        sqlite3_bind_int( select, 1, z );
+        sqlite3_bind_int( select, 2, x );
+        sqlite3_bind_int( select, 3, y );
+
+        bool found = false;
+        int rc = sqlite3_step( select );
+        if ( rc == SQLITE_ROW)
+        {                     
+            // the pointer returned from _blob gets freed internally by sqlite, supposedly
+            const char* data = (const char*)sqlite3_column_blob( select, 0 );
+            int imageBufLen = sqlite3_column_bytes( select, 0 );
+            out_data.assign( data, imageBufLen );
+            found = true;
+        }
+        else
+        {
+            OE_DEBUG << LC << "No tile for " << z << "/" << x << "/" << y << std::endl;
+        }
+
+        sqlite3_reset( select );
+        return found;
+    }
+
+    // inserts a tile blob into the images table unless an identical one is
+    // there already, and returns the ID of the row holding it. IDs are hashes,
+    // so a hit is checked against the stored blob; a different blob under the
+    // same ID moves on to the next ID in line ("<hash>-<length>-1", ...).
+    bool storeUniqueImage( const std::string& data, std::string& out_tileID )
+    {
+        std::string baseID = makeTileID( data );
+
+        for( unsigned n = 0; ; ++n )
+        {
+            out_tileID = n == 0 ? baseID : (std::string)(Stringify() << baseID << "-" << n);
+
+            sqlite3_bind_blob( _insertImage, 1, data.data(), data.size(), SQLITE_STATIC );
+            sqlite3_bind_text( _insertImage, 2, out_tileID.c_str(), out_tileID.length(), SQLITE_STATIC );
+            if ( !step( _insertImage ) )
+                return false;
+
+            // inserted: the ID was free.
+            if ( sqlite3_changes(_shared._db) > 0 )
+                return true;
+
+            // ignored: the ID is taken. Share the row only if it holds the same blob.
+            bool same = false;
+            sqlite3_bind_text( _selectImage, 1, out_tileID.c_str(), out_tileID.length(), SQLITE_STATIC );
+            if ( sqlite3_step(_selectImage) == SQLITE_ROW )
+            {
+                const void* stored = sqlite3_column_blob( _selectImage, 0 );
+                int         len    = sqlite3_column_bytes( _selectImage, 0 );
+                same = len == (int)data.size() && (len == 0 || ::memcmp(stored, data.data(), len) == 0);
+            }
+            sqlite3_reset( _selectImage );
+            sqlite3_clear_bindings( _selectImage );
+
+            if ( same )
+                return true;
+
+            OE_DEBUG << LC << "Tile ID " << out_tileID << " collides with a different image" << std::endl;
+        }
+    }
+
+    // creates the MBTiles tables if the database has none; existing tile tables are used as is.
+    bool createTables( bool& out_created )
+    {
+        out_created = false;
+
+        std::string tilesType;
+        sqlite3_stmt* select = NULL;
+        if ( sqlite3_prepare_v2( _shared._db, "SELECT type FROM sqlite_master WHERE name = 'tiles'", -1, &select, 0L ) == SQLITE_OK &&
+             sqlite3_step( select ) == SQLITE_ROW )
+        {
+            tilesType = (const char*)sqlite3_column_text( select, 0 );
+        }
+        sqlite3_finalize( select );
+
+        if ( tilesType.empty() )
+        {
+            // deduplicating layout: "tiles" is a view joining the tile map to unique images.
+            out_created =
+                exec("CREATE TABLE IF NOT EXISTS metadata (name text, value text)") &&
+                exec("CREATE UNIQUE INDEX IF NOT EXISTS name ON metadata (name)") &&
+                exec("CREATE TABLE map (zoom_level INTEGER, tile_column INTEGER, tile_row INTEGER, tile_id TEXT)") &&
+                exec("CREATE UNIQUE INDEX map_index ON map (zoom_level, tile_column, tile_row)") &&
+                exec("CREATE TABLE images (tile_data BLOB, tile_id TEXT)") &&
+                exec("CREATE UNIQUE INDEX images_id ON images (tile_id)") &&
+                exec("CREATE VIEW tiles AS SELECT map.zoom_level AS zoom_level, map.tile_column AS tile_column, "
+                     "map.tile_row AS tile_row, images.tile_data AS tile_data FROM map JOIN images ON images.tile_id = map.tile_id");
+            if ( !out_created )
+                return false;
+            tilesType = "view";
+        }
+
+        // a "tiles" view is assumed to be the deduplicating layout above.
+        _dedup = tilesType == "view";
+
+        if ( _dedup )
+        {
+            return
+                prepare( "INSERT OR IGNORE INTO images (tile_data, tile_id) VALUES (?, ?)", _insertImage ) &&
+                prepare( "SELECT tile_data FROM images WHERE tile_id = ?", _selectImage ) &&
+                prepare( "INSERT OR REPLACE INTO map (zoom_level, tile_column, tile_row, tile_id) VALUES (?, ?, ?, ?)", _insertMap );
+        }
+        else
+        {
+            return
+                prepare( "INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?)", _insertTile );
+        }
+    }
+
+    // the name of a profile, as stored in the "profile" metadata entry
+    std::string getProfileString( const Profile* profile ) const
+    {
+        if ( !profile )
+            return "";
+        if ( profile->isHorizEquivalentTo(Registry::instance()->getGlobalGeodeticProfile()) )
+            return "global-geodetic";
+        if ( profile->isHorizEquivalentTo(Registry::instance()->getSphericalMercatorProfile()) )
+            return "spherical-mercator";
+        return profile->getSRS()->getHorizInitString();
+    }
+
+    bool prepare( const std::string& query, sqlite3_stmt*& out_stmt )
+    {
+        int rc = sqlite3_prepare_v2( _shared._db, query.c_str(), -1, &out_stmt, 0L );
+        if ( rc != SQLITE_OK )
+        {
+            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_shared._db) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool exec( const std::string& sql )
+    {
+        char* err = 0L;
+        int rc = sqlite3_exec( _shared._db, sql.c_str(), 0L, 0L, &err );
+        if ( rc != SQLITE_OK )
+        {
+            OE_WARN << LC << "SQL failed: " << sql << "; " << (err ? err : "") << std::endl;
+            sqlite3_free( err );
+            return false;
+        }
+        return true;
+    }
+
+    // steps an insert statement and resets it for reuse.
+    bool step( sqlite3_stmt* stmt )
+    {
+        int rc = sqlite3_step( stmt );
+        sqlite3_reset( stmt );
+        sqlite3_clear_bindings( stmt );
+        return rc == SQLITE_DONE;
+    }
+
+    // commits the open write transaction (caller holds _sharedMutex).
+    void commit()
+    {
+        if ( _pendingWrites > 0 )
+        {
+            exec( "COMMIT TRANSACTION" );
+            _pendingWrites = 0;
+        }
+    }
+
 private:
     const MBTilesOptions _options;    
-    sqlite3* _database;
     unsigned int _minLevel;
     unsigned int _maxLevel;
+    bool _empty;
     osg::ref_ptr< osg::Image> _emptyImage;
 
     osg::ref_ptr<osgDB::ReaderWriter> _rw;
     osg::ref_ptr<osgDB::Options> _dbOptions;
     std::string _tileFormat;
 
+    // connection opened by initialize; the only one when writable.
+    Connection         _shared;
+    Threading::Mutex   _sharedMutex;
+
+    // idle read-only connections. A read holds one only while it runs, so the
+    // pool grows to the peak number of concurrent reads and no connection
+    // belongs to a thread (or outlives the threads that used it).
+    std::vector<Connection> _idle;
+    Threading::Mutex   _idleMutex;
+
+    bool               _writable;
+    bool               _dedup;
+    bool               _levelsChanged;
+    sqlite3_stmt*      _insertImage;
+    sqlite3_stmt*      _selectImage;
+    sqlite3_stmt*      _insertMap;
+    sqlite3_stmt*      _insertTile;
+    unsigned           _pendingWrites;
 };
 
 
@@ -307,5 +782,3 @@ public:
 };
 
 REGISTER_OSGPLUGIN(osgearth_mbtiles, MBTilesTileSourceFactory)
-
-
@@ -29,16 +29,129 @@
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 #include <sstream>
-
-#include <noise/noise.h>
-
-using namespace noise;
+#include <vector>
+#include <cmath>
 
 #include "NoiseOptions"
+#include "PerlinBatch"
 
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
 
+namespace
+{
+    /**
+     * Sample positions for a regular grid over a tile extent (plus an optional
+     * border of extra samples). For geographic extents the positions are the
+     * geocentric (ECEF) coordinates at zero height, computed analytically from
+     * the ellipsoid. A lat/long grid is separable, so all the trig happens once
+     * per row and once per column instead of running every sample through the
+     * SRS transform.
+     */
+    class SampleGrid
+    {
+    public:
+        SampleGrid( const GeoExtent& ex, int cols, int rows, int border =0 ) :
+            _cols( cols + 2*border ),
+            _rows( rows + 2*border )
+        {
+            const SpatialReference* srs = ex.getSRS();
+            _geocentric = srs->isGeographic();
+
+            double dx = ex.width()  / (double)(cols-1);
+            double dy = ex.height() / (double)(rows-1);
+
+            _colA.resize( _cols );
+            _colB.resize( _cols );
+            _rowA.resize( _rows );
+            _rowB.resize( _rows );
+
+            if ( _geocentric )
+            {
+                const osg::EllipsoidModel* em = srs->getEllipsoid();
+                double a  = em->getRadiusEquator();
+                double b  = em->getRadiusPolar();
+                double e2 = 1.0 - (b*b)/(a*a);
+
+                for( int c=0; c<_cols; ++c )
+                {
+                    double lon = osg::DegreesToRadians( ex.xMin() + (double)(c-border) * dx );
+                    _colA[c] = cos(lon);
+                    _colB[c] = sin(lon);
+                }
+
+                for( int r=0; r<_rows; ++r )
+                {
+                    double lat    = osg::DegreesToRadians( ex.yMin() + (double)(r-border) * dy );
+                    double sinLat = sin(lat);
+                    double N      = a / sqrt(1.0 - e2*sinLat*sinLat);
+                    _rowA[r] = N * cos(lat);
+                    _rowB[r] = N * (1.0-e2) * sinLat;
+                }
+            }
+            else
+            {
+                for( int c=0; c<_cols; ++c )
+                    _colA[c] = ex.xMin() + (double)(c-border) * dx;
+
+                for( int r=0; r<_rows; ++r )
+                    _rowA[r] = ex.yMin() + (double)(r-border) * dy;
+            }
+        }
+
+        int getNumColumns() const { return _cols; }
+        int getNumRows()    const { return _rows; }
+
+        /** Writes the sample positions of one row of the grid. */
+        void getRow( int r, double* x, double* y, double* z ) const
+        {
+            if ( _geocentric )
+            {
+                const double ra = _rowA[r], rb = _rowB[r];
+                for( int c=0; c<_cols; ++c )
+                {
+                    x[c] = ra * _colA[c];
+                    y[c] = ra * _colB[c];
+                    z[c] = rb;
+                }
+            }
+            else
+            {
+                const double ra = _rowA[r];
+                for( int c=0; c<_cols; ++c )
+                {
+                    x[c] = _colA[c];
+                    y[c] = ra;
+                    z[c] = 0.0;
+                }
+            }
+        }
+
+    private:
+        int                 _cols, _rows;
+        bool                _geocentric;
+        std::vector<double> _colA, _colB;
+        std::vector<double> _rowA, _rowB;
+    };
+
+
+    /** Evaluates the noise over every sample of a grid, row-major. */
+    void sampleGrid( const SampleGrid& grid, PerlinBatch& noise, std::vector<double>& out )
+    {
+        int cols = grid.getNumColumns();
+        int rows = grid.getNumRows();
+
+        out.resize( cols*rows );
+        std::vector<double> x(cols), y(cols), z(cols);
+
+        for( int r=0; r<rows; ++r )
+        {
+            grid.getRow( r, &x[0], &y[0], &z[0] );
+            noise.getValues( &x[0], &y[0], &z[0], &out[r*cols], cols );
+        }
+    }
+}
+
 class NoiseSource : public TileSource
 {
 public:
@@ -70,31 +183,6 @@ public:
         return CachePolicy::NO_CACHE;
     }
 
-    inline double sample(module::Perlin& noise, double x, double y, double z)
-    {
-        return noise.GetValue(x, y, z);
-    }
-
-    inline double sample(module::Perlin& noise, const osg::Vec3d& v)
-    {
-        return noise.GetValue(v.x(), v.y(), v.z());
-    }
-
-    inline double turbulence(module::Perlin& noise, const osg::Vec3d& v, double f )
-    {
-        double t = -0.5;
-        for( ; f<getPixelsPerTile()/2; f *= 2 ) 
-            t += abs(noise.GetValue(v.x(), v.y(), v.z())/f);
-        return t;
-    }
-
-    inline double stripes(double x, double f)
-    {
-        double t = 0.5 + 0.5 * asin(f * 2*osg::PI * x);
-        return t * t - 0.5;
-    }
-
-
     osg::Image* createImage(const TileKey&        key,
                             ProgressCallback*     progress )
     {
@@ -104,41 +192,25 @@ public:
         }
         else
         {
-            module::Perlin noise;
-            noise.SetFrequency  ( _options.frequency().get() );
-            noise.SetPersistence( _options.persistence().get() );
-            noise.SetLacunarity ( _options.lacunarity().get() );
-            noise.SetOctaveCount( _options.octaves().get() );
-
-            const SpatialReference* srs = key.getProfile()->getSRS();
-
             osg::Image* image = new osg::Image();
             image->allocateImage( getPixelsPerTile(), getPixelsPerTile(), 1, GL_RGB, GL_UNSIGNED_BYTE );
 
-            double dx = key.getExtent().width()  / (double)(image->s()-1);
-            double dy = key.getExtent().height() / (double)(image->t()-1);
+            PerlinBatch noise( _options );
+            SampleGrid  grid ( key.getExtent(), image->s(), image->t() );
+
+            std::vector<double> values;
+            sampleGrid( grid, noise, values );
 
             ImageUtils::PixelWriter write(image);
-            for(int s=0; s<image->s(); ++s)
+            for(int t=0; t<image->t(); ++t)
             {
-                for(int t=0; t<image->t(); ++t)
+                const double* row = &values[t*image->s()];
+                for(int s=0; s<image->s(); ++s)
                 {
-                    double lon = key.getExtent().xMin() + (double)s * dx;
-                    double lat = key.getExtent().yMin() + (double)t * dy;
-
-                    osg::Vec3d world(lon, lat, 0.0);
-                    if ( srs->isGeographic() )
-                        srs->transform(world, srs->getECEF(), world);
-
-                    double n = noise.GetValue(world.x(), world.y(), world.z());
-                    //world.normalize();
-                    //double n = 0.1 * stripes(world.x() + 2.0*turbulence(noise, world, 1.0), 1.6);
-                    //double n = -.10 * turbulence(noise, world, 0.2);
-
                     // scale and bias from[-1..1] to [0..1] for coloring. It should be noted that
                     // the Perlin noise function can generate values outside this range, hence
                     // the clamp!
-                    n = osg::clampBetween( (n+1.0)*0.5, 0.0, 1.0 );
+                    double n = osg::clampBetween( (row[s]+1.0)*0.5, 0.0, 1.0 );
 
                     write(osg::Vec4f(n,n,n,1), s, t);
                 }
@@ -152,49 +224,30 @@ public:
     osg::HeightField* createHeightField(const TileKey&        key,
                                         ProgressCallback*     progress )
     {
-        module::Perlin noise;
-        noise.SetFrequency  ( _options.frequency().get() );
-        noise.SetPersistence( _options.persistence().get() );
-        noise.SetLacunarity ( _options.lacunarity().get() );
-        noise.SetOctaveCount( _options.octaves().get() );
-
-        const SpatialReference* srs = key.getProfile()->getSRS();
-
         osg::HeightField* hf = new osg::HeightField();
         hf->allocate( getPixelsPerTile(), getPixelsPerTile() );
 
-        double dx = key.getExtent().width() / (double)(hf->getNumColumns()-1);
-        double dy = key.getExtent().height() / (double)(hf->getNumRows()-1);
+        PerlinBatch noise( _options );
+        SampleGrid  grid ( key.getExtent(), hf->getNumColumns(), hf->getNumRows() );
+
+        std::vector<double> values;
+        sampleGrid( grid, noise, values );
 
         double bias  = _options.bias().get();
         double scale = _options.scale().get();
 
-        //Initialize the heightfield
-        for (unsigned int c = 0; c < hf->getNumColumns(); c++) 
+        osg::FloatArray* heights = hf->getFloatArray();
+        for (unsigned int i = 0; i < heights->size(); ++i)
         {
-            for (unsigned int r = 0; r < hf->getNumRows(); r++)
-            {                
-                double lon = key.getExtent().xMin() + (double)c * dx;
-                double lat = key.getExtent().yMin() + (double)r * dy;
-
-                osg::Vec3d world(lon, lat, 0.0);
-                if ( srs->isGeographic() )
-                    srs->transform(world, srs->getECEF(), world);
-
-                double n = noise.GetValue(world.x(), world.y(), world.z());
-
-                // Scale the noise value which is between -1 and 1...ish
-                double h = osg::clampBetween(
-                    (float)(bias + scale * n),
-                    *_options.minElevation(),
-                    *_options.maxElevation() );
-
-                hf->setHeight( c, r, h );
-
-                // NOTE! The elevation engine treats extreme values (>32000, etc)
-                // as "no data" so be careful with your scale.
-            }
-        }     
+            // Scale the noise value which is between -1 and 1...ish
+            (*heights)[i] = osg::clampBetween(
+                (float)(bias + scale * values[i]),
+                *_options.minElevation(),
+                *_options.maxElevation() );
+
+            // NOTE! The elevation engine treats extreme values (>32000, etc)
+            // as "no data" so be careful with your scale.
+        }
 
         return hf;
     }
@@ -202,12 +255,6 @@ public:
 
     osg::Image* createNormalMap(const TileKey& key, ProgressCallback* progress)
     {
-        module::Perlin noise;
-        noise.SetFrequency  ( _options.frequency().get() );
-        noise.SetPersistence( _options.persistence().get() );
-        noise.SetLacunarity ( _options.lacunarity().get() );
-        noise.SetOctaveCount( _options.octaves().get() );
-
         // set up the image and prepare to write to it.
         osg::Image* image = new osg::Image();
         image->allocateImage( getPixelsPerTile(), getPixelsPerTile(), 1, GL_RGB, GL_UNSIGNED_BYTE );
@@ -233,39 +280,26 @@ public:
             udy = srs->transformUnits(dy, ecef, ex.south()+0.5*dy);
         }
 
-        double z = 0.0;
-        std::vector<osg::Vec3d> v(4);
-        double samples[4];
+        // sample the noise with a one-pixel border so every pixel has 
+        // all four neighbors:
+        PerlinBatch noise( _options );
+        SampleGrid  grid ( ex, image->s(), image->t(), 1 );
+
+        std::vector<double> values;
+        sampleGrid( grid, noise, values );
+
+        int cols = grid.getNumColumns();
 
-        for(int s=0; s<image->s(); ++s)
+        for(int t=0; t<image->t(); ++t)
         {
-            for(int t=0; t<image->t(); ++t)
+            for(int s=0; s<image->s(); ++s)
             {
-                double x = ex.xMin() + (double)s * dx;
-                double y = ex.yMin() + (double)t * dy;
-
-                if ( isGeo )
-                {
-                    v[0].set(x-dx, y, z);
-                    v[1].set(x+dx, y, z);
-                    v[2].set(x, y+dy, z);
-                    v[3].set(x, y-dy, z);
-                    srs->transform(v, ecef);
-                    for(int i=0; i<4; ++i )
-                        samples[i] = bias + scale * sample(noise, v[i]);
-                }
-                else
-                {
-                    samples[0] = bias + scale * sample(noise, osg::Vec3d(x-dx, y, z));
-                    samples[1] = bias + scale * sample(noise, osg::Vec3d(x+dx, y, z));
-                    samples[2] = bias + scale * sample(noise, osg::Vec3d(x, y+dy, z));
-                    samples[3] = bias + scale * sample(noise, osg::Vec3d(x, y-dy, z));
-                }
+                int i = (t+1)*cols + (s+1);
 
-                osg::Vec3d west (-udx,    0, samples[0]);
-                osg::Vec3d east ( udx,    0, samples[1]);
-                osg::Vec3d north(   0,  udy, samples[2]);
-                osg::Vec3d south(   0, -udy, samples[3]);
+                osg::Vec3d west (-udx,    0, bias + scale * values[i-1]);
+                osg::Vec3d east ( udx,    0, bias + scale * values[i+1]);
+                osg::Vec3d north(   0,  udy, bias + scale * values[i+cols]);
+                osg::Vec3d south(   0, -udy, bias + scale * values[i-cols]);
 
                 // calculate the normal at the center point.
                 osg::Vec3 normal = (east-west) ^ (north-south);
@@ -21,6 +21,7 @@
 #include <osgEarth/FileUtils>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/Registry>
+#include <osgEarth/HTTPClient>
 #include <osgEarthUtil/TMS>
 
 #include <osg/Notify>
@@ -55,6 +56,8 @@ public:
     Status initialize(const osgDB::Options* dbOptions)
     {
         _dbOptions = Registry::instance()->cloneOrCreateOptions(dbOptions);
+        // tile fetches share the request engine's pool of kept-alive connections.
+        HTTPClient::setUseRequestEngine( _dbOptions.get(), true );
 
         const Profile* profile = getProfile();
 
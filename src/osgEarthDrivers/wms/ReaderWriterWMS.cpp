@@ -20,8 +20,11 @@
 #include <osgEarth/TileSource>
 #include <osgEarth/ImageToHeightFieldConverter>
 #include <osgEarth/Registry>
+#include <osgEarth/HTTPClient>
 #include <osgEarth/TimeControl>
 #include <osgEarth/XmlUtils>
+#include <osgEarth/TaskService>
+#include <osgEarth/Containers>
 #include <osgEarthUtil/WMS>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -60,6 +63,85 @@ namespace
             osg::ImageSequence::update( nv );
         }
     };
+
+    // Collects the frames of a WMS-T time series as they arrive (in any order).
+    // If there's a target sequence, frames are appended to it in time order as
+    // soon as all the frames before them are in, so playback can start early.
+    struct TimeStepCollector : public osg::Referenced
+    {
+        TimeStepCollector( unsigned numFrames, osg::ImageSequence* seq =0L ) :
+            _seq     ( seq ),
+            _hasSeq  ( seq != 0L ),
+            _frames  ( numFrames ),
+            _arrived ( numFrames, false ),
+            _next    ( 0 ),
+            _numAdded( 0 ) { }
+
+        void deliver( unsigned index, osg::Image* image )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+
+            _frames[index]  = image;
+            _arrived[index] = true;
+
+            osg::ref_ptr<osg::ImageSequence> seq;
+            if ( _hasSeq && _seq.lock(seq) )
+            {
+                for( ; _next < _frames.size() && _arrived[_next]; ++_next )
+                {
+                    if ( _frames[_next].valid() )
+                    {
+                        seq->addImage( _frames[_next].get() );
+                        ++_numAdded;
+                    }
+                    _frames[_next] = 0L;
+                }
+            }
+            else
+            {
+                while( _next < _frames.size() && _arrived[_next] )
+                    ++_next;
+            }
+
+            if ( _numAdded > 0 || _next == _frames.size() )
+                _first.set();
+
+            if ( _next == _frames.size() )
+                _all.set();
+        }
+
+        // true if the target sequence went away; no point fetching anything else.
+        bool isAbandoned() const { return _hasSeq && !_seq.valid(); }
+
+        // these return false if the caller's request is canceled while waiting.
+        bool waitForFirst( ProgressCallback* progress ) { return waitFor( _first, progress ); }
+        bool waitForAll( ProgressCallback* progress )   { return waitFor( _all, progress ); }
+
+        bool waitFor( Threading::Event& e, ProgressCallback* progress )
+        {
+            while( !e.wait(100u) )
+            {
+                if ( progress && progress->isCanceled() )
+                    return false;
+            }
+            return true;
+        }
+
+        unsigned getNumAdded() const { return _numAdded; }
+
+        // only valid for sequence-less collection, after waitForAll.
+        osg::Image* getFrame( unsigned index ) const { return _frames[index].get(); }
+
+        osg::observer_ptr<osg::ImageSequence>    _seq;
+        bool                                     _hasSeq;
+        std::vector< osg::ref_ptr<osg::Image> >  _frames;
+        std::vector< bool >                      _arrived;
+        unsigned                                 _next;
+        unsigned                                 _numAdded;
+        Threading::Mutex                         _mutex;
+        Threading::Event                         _first;
+        Threading::Event                         _all;
+    };
 }
 
 //----------------------------------------------------------------------------
@@ -67,7 +149,10 @@ namespace
 class WMSSource : public TileSource, public SequenceControl
 {
 public:
-	WMSSource( const TileSourceOptions& options ) : TileSource( options ), _options(options)
+	WMSSource( const TileSourceOptions& options ) : 
+      TileSource( options ),
+      _options(options),
+      _frameCache( true, _options.timeFrameCacheSize().value() )
     {
         _isPlaying     = false;
 
@@ -81,6 +166,14 @@ public:
                 _seqFrameInfoVec.push_back(SequenceFrameInfo());
                 _seqFrameInfoVec.back().timeIdentifier = _timesVec[i];
             }
+
+            // fetch time steps in parallel.
+            if ( _timesVec.size() > 1 )
+            {
+                _timeStepService = new TaskService(
+                    "WMS-T",
+                    osg::maximum( _options.maxConcurrentTimeRequests().value(), 1u ) );
+            }
         }
 
         // localize it since we might override them:
@@ -272,6 +365,8 @@ public:
             // set up the cache options properly for a TileSource.
             _dbOptions = Registry::instance()->cloneOrCreateOptions( dbOptions );
             CachePolicy::NO_CACHE.apply( _dbOptions.get() );
+            // tile fetches share the request engine's pool of kept-alive connections.
+            HTTPClient::setUseRequestEngine( _dbOptions.get(), true );
 
             return STATUS_OK;
         }
@@ -372,17 +467,105 @@ public:
         return image.release();
     }
 
+    /**
+     * Fetches the image for one time step, sharing frames through the frame
+     * cache so that a tile that pages back in doesn't fetch them again.
+     */
+    osg::Image* fetchTimeStep( const TileKey& key, unsigned index, ProgressCallback* progress )
+    {
+        std::string cacheKey = Stringify() << key.str() << "@" << _timesVec[index];
+
+        FrameCache::Record rec;
+        if ( _frameCache.get(cacheKey, rec) )
+        {
+            osg::ref_ptr<osg::Image> cached = rec.value().get();
+            return cached.release();
+        }
+
+        std::string extraAttrs = std::string("TIME=") + _timesVec[index];
+        ReadResult response;
+        osg::ref_ptr<osg::Image> image = fetchTileImage( key, extraAttrs, progress, response );
+
+        if ( image.valid() )
+            _frameCache.insert( cacheKey, image.get() );
+
+        return image.release();
+    }
+
+    /**
+     * Background task that fetches one time step and hands it to a collector.
+     * A task that never runs (canceled, or dropped when the service shuts down)
+     * still delivers an empty frame from its destructor, so waiters always wake.
+     */
+    struct FetchTimeStepTask : public TaskRequest
+    {
+        FetchTimeStepTask( WMSSource* source, const TileKey& key, unsigned index, TimeStepCollector* collector, ProgressCallback* progress ) :
+            TaskRequest( (float)index ), // lower values run first
+            _source    ( source ),
+            _key       ( key ),
+            _index     ( index ),
+            _collector ( collector ),
+            _callerProgress( progress ),
+            _delivered ( false ) { }
+
+        virtual ~FetchTimeStepTask()
+        {
+            if ( !_delivered )
+                _collector->deliver( _index, 0L );
+        }
+
+        void operator()( ProgressCallback* progress )
+        {
+            // the caller's callback carries the pager's cancelation, so that's the one
+            // the HTTP fetch should watch.
+            ProgressCallback* fetchProgress = _callerProgress.valid() ? _callerProgress.get() : progress;
+
+            osg::ref_ptr<osg::Image> image;
+            if ( !_collector->isAbandoned() && !progress->isCanceled() && !fetchProgress->isCanceled() )
+                image = _source->fetchTimeStep( _key, _index, fetchProgress );
+            _collector->deliver( _index, image.get() );
+            _delivered = true;
+        }
+
+        WMSSource*                       _source;
+        TileKey                          _key;
+        unsigned                         _index;
+        osg::ref_ptr<TimeStepCollector>  _collector;
+        osg::ref_ptr<ProgressCallback>   _callerProgress;
+        bool                             _delivered;
+    };
+
+    /** queues up a fetch for every time step. */
+    void fetchTimeSteps( const TileKey& key, TimeStepCollector* collector, ProgressCallback* progress )
+    {
+        for( unsigned int r=0; r<_timesVec.size(); ++r )
+        {
+            _timeStepService->add( new FetchTimeStepTask(this, key, r, collector, progress) );
+        }
+    }
+
     /** creates a 3D image from timestamped data. */
     osg::Image* createImage3D( const TileKey& key, ProgressCallback* progress )
     {
+        if ( _timesVec.empty() )
+            return 0L;
+
         osg::ref_ptr<osg::Image> image;
 
+        osg::ref_ptr<TimeStepCollector> collector = new TimeStepCollector( _timesVec.size() );
+        if ( _timeStepService.valid() )
+            fetchTimeSteps( key, collector.get(), progress );
+        else
+            collector->deliver( 0, fetchTimeStep(key, 0, progress) );
+
+        if ( !collector->waitForAll(progress) )
+            return 0L;
+
         for( unsigned int r=0; r<_timesVec.size(); ++r )
         {
-            std::string extraAttrs = std::string("TIME=") + _timesVec[r];
-            ReadResult response;
-            
-            osg::ref_ptr<osg::Image> timeImage = fetchTileImage( key, extraAttrs, progress, response );
+            osg::Image* timeImage = collector->getFrame( r );
+            if ( !timeImage )
+                continue;
 
             if ( !image.valid() )
             {
@@ -403,30 +586,34 @@ public:
         return image.release();
     }
 
-    /** creates a 3D image from timestamped data. */
+    /**
+     * Creates an image sequence from timestamped data. The time steps are fetched
+     * in parallel, and we return as soon as the first frame is available; the 
+     * rest are appended to the sequence (in order) as they arrive.
+     */
     osg::Image* createImageSequence( const TileKey& key, ProgressCallback* progress )
     {
-        osg::ImageSequence* seq = new SyncImageSequence();
+        osg::ref_ptr<osg::ImageSequence> seq = new SyncImageSequence();
         
         seq->setLoopingMode( osg::ImageStream::LOOPING );
         seq->setLength( _options.secondsPerFrame().value() * (double)_timesVec.size() );
         if ( this->isSequencePlaying() )
             seq->play();
 
-        for( unsigned int r=0; r<_timesVec.size(); ++r )
-        {
-            std::string extraAttrs = std::string("TIME=") + _timesVec[r];
+        osg::ref_ptr<TimeStepCollector> collector = new TimeStepCollector( _timesVec.size(), seq.get() );
+        fetchTimeSteps( key, collector.get(), progress );
 
-            ReadResult response;
-            osg::ref_ptr<osg::Image> image = fetchTileImage( key, extraAttrs, progress, response );
-            if ( image.get() )
-            {
-                seq->addImage( image );
-            }
+        if ( !collector->waitForFirst(progress) )
+            return 0L;
+
+        if ( collector->getNumAdded() == 0 )
+        {
+            // every time step failed.
+            return 0L;
         }
 
-        _sequenceCache.insert( seq );
-        return seq;
+        _sequenceCache.insert( seq.get() );
+        return seq.release();
     }
 
 
@@ -548,6 +735,13 @@ private:
     std::vector<SequenceFrameInfo>   _seqFrameInfoVec;
 
     mutable Threading::ThreadSafeObserverSet<osg::ImageSequence> _sequenceCache;
+
+    typedef LRUCache< std::string, osg::ref_ptr<osg::Image> > FrameCache;
+    FrameCache                       _frameCache;
+
+    // declared last so it shuts down (and finishes running tasks) before
+    // any of the members those tasks use are destroyed.
+    osg::ref_ptr<TaskService>        _timeStepService;
 };
 
 
@@ -21,6 +21,7 @@
 #include <osgEarth/FileUtils>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/Registry>
+#include <osgEarth/HTTPClient>
 
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
@@ -57,6 +58,8 @@ public:
     {
         _dbOptions = Registry::instance()->cloneOrCreateOptions(dbOptions);
         CachePolicy::NO_CACHE.apply( _dbOptions.get() );
+        // tile fetches share the request engine's pool of kept-alive connections.
+        HTTPClient::setUseRequestEngine( _dbOptions.get(), true );
 
         URI xyzURI = _options.url().value();
         if ( xyzURI.empty() )
@@ -444,7 +444,9 @@ BuildGeometryFilter::buildPolygon(Geometry*               ring,
     }
     osgGeom->setVertexArray( allPoints );
 
-    if ( tessellate )
+    // try the fast ear-clipping tessellator first; fall back on GLU for
+    // anything it cannot handle (e.g., self-intersecting rings)
+    if ( tessellate && !_tessellator.tessellateGeometry(*osgGeom) )
     {
         osgUtil::Tessellator tess;
         tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
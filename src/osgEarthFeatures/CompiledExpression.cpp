@@ -0,0 +1,209 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/CompiledExpression>
+#include <osgEarthFeatures/Session>
+#include <osgEarthFeatures/ScriptEngine>
+#include <osgEarth/StringUtils>
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+#define LC "[CompiledExpression] "
+
+namespace
+{
+    // Runs a variable that isn't a feature attribute through the script engine.
+    ScriptResult runScript( const std::string& code, const Feature* feature, FilterContext const* context )
+    {
+        ScriptEngine* engine = context && context->getSession() ? context->getSession()->getScriptEngine() : 0L;
+        if ( engine )
+        {
+            ScriptResult result = engine->run( code, feature, context );
+            if ( !result.success() )
+                OE_WARN << LC << "Script error:" << result.message() << std::endl;
+            return result;
+        }
+        return ScriptResult( EMPTY_STRING, false );
+    }
+}
+
+//------------------------------------------------------------------------
+
+CompiledNumericExpression::CompiledNumericExpression()
+{
+    //nop
+}
+
+CompiledNumericExpression::CompiledNumericExpression( const NumericExpression& expr ) :
+_expr( expr )
+{
+    const NumericExpression::Variables& vars = _expr.variables();
+    _names.reserve( vars.size() );
+    for( NumericExpression::Variables::const_iterator i = vars.begin(); i != vars.end(); ++i )
+    {
+        _names.push_back( toLower(i->first) );
+    }
+}
+
+double
+CompiledNumericExpression::eval( const Feature* feature, FilterContext const* context ) const
+{
+    unsigned numVars = _names.size();
+    if ( numVars == 0 || !feature )
+        return _expr.eval( (const double*)0L );
+
+    double  fixedValues[8];
+    std::vector<double> heapValues;
+    double* values = fixedValues;
+    if ( numVars > 8 )
+    {
+        heapValues.resize( numVars );
+        values = &heapValues[0];
+    }
+
+    const AttributeTable& attrs = feature->getAttrs();
+    const NumericExpression::Variables& vars = _expr.variables();
+
+    for( unsigned i=0; i<numVars; ++i )
+    {
+        values[i] = 0.0;
+
+        AttributeTable::const_iterator ai = attrs.find( _names[i] );
+        if ( ai != attrs.end() )
+        {
+            values[i] = ai->second.getDouble( 0.0 );
+        }
+        else if ( context )
+        {
+            ScriptResult result = runScript( vars[i].first, feature, context );
+            if ( result.success() )
+                values[i] = result.asDouble();
+        }
+    }
+
+    return _expr.eval( values );
+}
+
+void
+CompiledNumericExpression::evalAll(const FeatureList&   features,
+                                   std::vector<double>& out_results,
+                                   FilterContext const* context ) const
+{
+    out_results.resize( features.size() );
+
+    unsigned numVars = _names.size();
+
+    // Features in a batch usually share one attribute layout, so resolve the
+    // variable names to layout slots once and reuse them until it changes.
+    const AttributeLayout* boundLayout = 0L;
+    std::vector<int>       slots ( numVars, -1 );
+    std::vector<double>    values( numVars, 0.0 );
+
+    const NumericExpression::Variables& vars = _expr.variables();
+
+    unsigned k = 0;
+    for( FeatureList::const_iterator f = features.begin(); f != features.end(); ++f, ++k )
+    {
+        const Feature* feature = f->get();
+        const AttributeLayout* layout = feature ? feature->getAttrs().getLayout() : 0L;
+
+        if ( numVars == 0 || !layout )
+        {
+            out_results[k] = eval( feature, context );
+            continue;
+        }
+
+        if ( layout != boundLayout )
+        {
+            for( unsigned i=0; i<numVars; ++i )
+                slots[i] = layout->indexOf( _names[i] );
+            boundLayout = layout;
+        }
+
+        const AttributeTable& attrs = feature->getAttrs();
+
+        for( unsigned i=0; i<numVars; ++i )
+        {
+            values[i] = 0.0;
+
+            const AttributeValue* value = slots[i] >= 0 ? attrs.getValue( (unsigned)slots[i] ) : 0L;
+            if ( value )
+            {
+                values[i] = value->getDouble( 0.0 );
+            }
+            else if ( context )
+            {
+                ScriptResult result = runScript( vars[i].first, feature, context );
+                if ( result.success() )
+                    values[i] = result.asDouble();
+            }
+        }
+
+        out_results[k] = _expr.eval( &values[0] );
+    }
+}
+
+//------------------------------------------------------------------------
+
+CompiledStringExpression::CompiledStringExpression()
+{
+    //nop
+}
+
+CompiledStringExpression::CompiledStringExpression( const StringExpression& expr ) :
+_expr( expr )
+{
+    const StringExpression::Variables& vars = _expr.variables();
+    _names.reserve( vars.size() );
+    for( StringExpression::Variables::const_iterator i = vars.begin(); i != vars.end(); ++i )
+    {
+        _names.push_back( toLower(i->first) );
+    }
+}
+
+const std::string&
+CompiledStringExpression::eval( const Feature* feature, FilterContext const* context )
+{
+    if ( feature )
+    {
+        const AttributeTable& attrs = feature->getAttrs();
+        const StringExpression::Variables& vars = _expr.variables();
+
+        for( unsigned i=0; i<_names.size(); ++i )
+        {
+            AttributeTable::const_iterator ai = attrs.find( _names[i] );
+            if ( ai != attrs.end() )
+            {
+                _expr.set( vars[i], ai->second.getString() );
+            }
+            else if ( context )
+            {
+                ScriptResult result = runScript( vars[i].first, feature, context );
+                _expr.set( vars[i], result.success() ? result.asString() : EMPTY_STRING );
+            }
+            else
+            {
+                _expr.set( vars[i], EMPTY_STRING );
+            }
+        }
+    }
+
+    return _expr.eval();
+}
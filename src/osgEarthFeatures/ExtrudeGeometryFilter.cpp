@@ -19,8 +19,8 @@
 #include <osgEarthFeatures/ExtrudeGeometryFilter>
 #include <osgEarthFeatures/Session>
 #include <osgEarthFeatures/FeatureSourceIndexNode>
+#include <osgEarthFeatures/CompiledExpression>
 #include <osgEarthSymbology/MeshSubdivider>
-#include <osgEarthSymbology/MeshConsolidator>
 #include <osgEarthSymbology/ResourceCache>
 #include <osgEarth/ECEF>
 #include <osgEarth/ImageUtils>
@@ -69,6 +69,242 @@ namespace
 
         return atan2( p2.x()-p1.x(), p2.y()-p1.y() );
     }
+
+    // Triangulates a roof/base cap. The ear-clipping tessellator handles simple
+    // footprints without inserting vertices; anything else goes to GLU.
+    void tessellate( PolygonTessellator& tessellator, osg::Geometry* geom )
+    {
+        if ( !tessellator.tessellateGeometry(*geom) )
+        {
+            osgUtil::Tessellator tess;
+            tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
+            tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_ODD );
+            tess.retessellatePolygons( *geom );
+        }
+    }
+
+    // upper limit on the size of a merged geometry; past this, parts go into
+    // a new geometry so the result still culls reasonably.
+    const unsigned MAX_MERGED_VERTS = 100000;
+
+    // Returns the scratch geometry, emptied of primitives, when recycling;
+    // otherwise a brand new geometry.
+    osg::Geometry* prepGeometry( osg::ref_ptr<osg::Geometry>& scratch, bool recycle, bool useVBOs )
+    {
+        if ( recycle && scratch.valid() )
+        {
+            scratch->removePrimitiveSet( 0, scratch->getNumPrimitiveSets() );
+            return scratch.get();
+        }
+
+        osg::Geometry* geom = new osg::Geometry();
+        geom->setUseVertexBufferObjects( useVBOs );
+        if ( recycle )
+            scratch = geom;
+        return geom;
+    }
+
+    // Returns "existing" resized to "size" if it is an unshared array of the
+    // right type; otherwise allocates a new one.
+    template<typename T>
+    T* recycleArray( osg::Array* existing, unsigned size )
+    {
+        T* array = dynamic_cast<T*>( existing );
+        if ( array && array->referenceCount() == 1 )
+        {
+            array->resize( size );
+            return array;
+        }
+        return new T( size );
+    }
+
+    // Appends a part's per-vertex array to the merged array "dst". If either
+    // side lacks the array, that side is padded with "fill". Returns the merged
+    // array (which is new, with room for "reserve" elements, if "dst" was NULL),
+    // or NULL if neither has one.
+    template<typename T>
+    T* appendArray(osg::Array*                        dstArray,
+                   const osg::Array*                  srcArray,
+                   unsigned                           offset,
+                   unsigned                           count,
+                   unsigned                           reserve,
+                   const typename T::ElementDataType& fill )
+    {
+        T*       dst = dynamic_cast<T*>( dstArray );
+        const T* src = dynamic_cast<const T*>( srcArray );
+        if ( src && src->size() != count )
+            src = 0L;
+
+        if ( !dst && !src )
+            return 0L;
+
+        if ( !dst )
+        {
+            dst = new T();
+            dst->reserve( osg::maximum(reserve, offset + count) );
+        }
+
+        dst->resize( offset, fill );
+        if ( src )
+            dst->insert( dst->end(), src->begin(), src->end() );
+        else
+            dst->resize( offset + count, fill );
+
+        return dst;
+    }
+
+    bool isLineMode( GLenum mode )
+    {
+        return
+            mode == GL_LINES ||
+            mode == GL_LINE_STRIP ||
+            mode == GL_LINE_LOOP;
+    }
+
+    // Decodes a run of "n" indices starting at "start" in a primitive set into
+    // GL_TRIANGLES or GL_LINES, offsetting each index by "offset".
+    void appendRun(const osg::PrimitiveSet* ps,
+                   unsigned                 start,
+                   unsigned                 n,
+                   unsigned                 offset,
+                   osg::DrawElementsUInt*   out )
+    {
+        #define IDX(I) (offset + ps->index(start + (I)))
+
+        switch( ps->getMode() )
+        {
+        case GL_TRIANGLES:
+            for( unsigned i=0; i+2<n; i+=3 ) {
+                out->push_back( IDX(i) ); out->push_back( IDX(i+1) ); out->push_back( IDX(i+2) );
+            }
+            break;
+
+        case GL_TRIANGLE_STRIP:
+            for( unsigned i=2; i<n; ++i ) {
+                if ( i%2 == 0 ) {
+                    out->push_back( IDX(i-2) ); out->push_back( IDX(i-1) ); out->push_back( IDX(i) );
+                }
+                else {
+                    out->push_back( IDX(i-1) ); out->push_back( IDX(i-2) ); out->push_back( IDX(i) );
+                }
+            }
+            break;
+
+        case GL_TRIANGLE_FAN:
+        case GL_POLYGON:
+            for( unsigned i=2; i<n; ++i ) {
+                out->push_back( IDX(0) ); out->push_back( IDX(i-1) ); out->push_back( IDX(i) );
+            }
+            break;
+
+        case GL_QUADS:
+            for( unsigned i=0; i+3<n; i+=4 ) {
+                out->push_back( IDX(i) ); out->push_back( IDX(i+1) ); out->push_back( IDX(i+2) );
+                out->push_back( IDX(i) ); out->push_back( IDX(i+2) ); out->push_back( IDX(i+3) );
+            }
+            break;
+
+        case GL_QUAD_STRIP:
+            for( unsigned i=0; i+3<n; i+=2 ) {
+                out->push_back( IDX(i) ); out->push_back( IDX(i+1) ); out->push_back( IDX(i+3) );
+                out->push_back( IDX(i) ); out->push_back( IDX(i+3) ); out->push_back( IDX(i+2) );
+            }
+            break;
+
+        case GL_LINES:
+            for( unsigned i=0; i+1<n; i+=2 ) {
+                out->push_back( IDX(i) ); out->push_back( IDX(i+1) );
+            }
+            break;
+
+        case GL_LINE_STRIP:
+        case GL_LINE_LOOP:
+            for( unsigned i=1; i<n; ++i ) {
+                out->push_back( IDX(i-1) ); out->push_back( IDX(i) );
+            }
+            if ( ps->getMode() == GL_LINE_LOOP && n > 2 ) {
+                out->push_back( IDX(n-1) ); out->push_back( IDX(0) );
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        #undef IDX
+    }
+
+    // Number of indices appendRun() emits for a run of "n" indices in "mode".
+    unsigned countRun( GLenum mode, unsigned n )
+    {
+        switch( mode )
+        {
+        case GL_TRIANGLES:      return (n/3)*3;
+        case GL_TRIANGLE_STRIP:
+        case GL_TRIANGLE_FAN:
+        case GL_POLYGON:        return n > 2 ? 3*(n-2) : 0;
+        case GL_QUADS:          return (n/4)*6;
+        case GL_QUAD_STRIP:     return n > 3 ? 6*((n-2)/2) : 0;
+        case GL_LINES:          return (n/2)*2;
+        case GL_LINE_STRIP:     return n > 1 ? 2*(n-1) : 0;
+        case GL_LINE_LOOP:      return n > 2 ? 2*n : n > 1 ? 2 : 0;
+        default:                return 0;
+        }
+    }
+
+    unsigned countPrimitives( const osg::PrimitiveSet* ps )
+    {
+        const osg::DrawArrayLengths* dal = dynamic_cast<const osg::DrawArrayLengths*>( ps );
+        if ( !dal )
+            return countRun( ps->getMode(), ps->getNumIndices() );
+
+        unsigned total = 0;
+        for( osg::DrawArrayLengths::const_iterator i = dal->begin(); i != dal->end(); ++i )
+            total += countRun( ps->getMode(), *i );
+        return total;
+    }
+
+    void appendPrimitives( const osg::PrimitiveSet* ps, unsigned offset, osg::DrawElementsUInt* out )
+    {
+        const osg::DrawArrayLengths* dal = dynamic_cast<const osg::DrawArrayLengths*>( ps );
+        if ( dal )
+        {
+            unsigned start = 0;
+            for( osg::DrawArrayLengths::const_iterator i = dal->begin(); i != dal->end(); ++i )
+            {
+                appendRun( ps, start, *i, offset, out );
+                start += *i;
+            }
+        }
+        else
+        {
+            appendRun( ps, 0, ps->getNumIndices(), offset, out );
+        }
+    }
+
+    // Shrinks a merged array whose up-front reservation turned out well
+    // larger than what went into it.
+    template<typename T>
+    void trimArray( osg::Array* array )
+    {
+        T* a = dynamic_cast<T*>( array );
+        if ( a && a->capacity() > a->size() + a->size()/4 )
+            a->trim();
+    }
+
+    // What the first pass of ExtrudeGeometryFilter::process() decides for
+    // each part, so the second pass can extrude it.
+    struct PartPlan
+    {
+        Feature*                    _feature;
+        Geometry*                   _part;
+        float                       _height;
+        float                       _offset;
+        SkinResource*               _wallSkin;
+        SkinResource*               _roofSkin;
+        osg::ref_ptr<osg::StateSet> _wallStateSet;
+        osg::ref_ptr<osg::StateSet> _roofStateSet;
+    };
 }
 
 //------------------------------------------------------------------------
@@ -96,6 +332,7 @@ ExtrudeGeometryFilter::reset( const FilterContext& context )
 {
     _cosWallAngleThresh = cos( _wallAngleThresh_deg );
     _geodes.clear();
+    _merged.clear();
     
     if ( _styleDirty )
     {
@@ -228,27 +465,40 @@ ExtrudeGeometryFilter::extrudeGeometry(const Geometry*         input,
     // points can have unique texture coordinates)
     unsigned numWallVerts = 2 * pointCount + (isSkinnedPolygon? (2 * input->getNumGeometries()) : 0);
 
-    // create all the OSG geometry components
-    osg::Vec3Array* verts = new osg::Vec3Array( numWallVerts );
+    // create all the OSG geometry components. (Arrays left over on a recycled
+    // scratch geometry are reused, except for normals, which the smoother
+    // regenerates anyway.)
+    walls->setNormalArray( 0L );
+    if ( roof )
+        roof->setNormalArray( 0L );
+
+    osg::Vec3Array* verts = recycleArray<osg::Vec3Array>( walls->getVertexArray(), numWallVerts );
     walls->setVertexArray( verts );
 
     osg::Vec2Array* wallTexcoords = 0L;
     if ( wallSkin )
     { 
-        wallTexcoords = new osg::Vec2Array( numWallVerts );
+        wallTexcoords = recycleArray<osg::Vec2Array>( walls->getTexCoordArray(0), numWallVerts );
         walls->setTexCoordArray( 0, wallTexcoords );
     }
+    else
+    {
+        walls->setTexCoordArray( 0, 0L );
+    }
 
     osg::Vec4Array* colors = 0L;
     if ( useColor )
     {
-        // per-vertex colors are necessary if we are going to use the MeshConsolidator -gw
-        colors = new osg::Vec4Array();
-        colors->reserve( numWallVerts );
+        // per-vertex colors are necessary if we are going to merge geometry -gw
+        colors = recycleArray<osg::Vec4Array>( walls->getColorArray(), 0 );
         colors->assign( numWallVerts, wallColor );
         walls->setColorArray( colors );
         walls->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
     }
+    else
+    {
+        walls->setColorArray( 0L );
+    }
 
     // set up rooftop tessellation and texturing, if necessary:
     osg::Vec3Array* roofVerts     = 0L;
@@ -261,22 +511,25 @@ ExtrudeGeometryFilter::extrudeGeometry(const Geometry*         input,
 
     if ( roof )
     {
-        roofVerts = new osg::Vec3Array( pointCount );
+        roofVerts = recycleArray<osg::Vec3Array>( roof->getVertexArray(), pointCount );
         roof->setVertexArray( roofVerts );
 
-        // per-vertex colors are necessary if we are going to use the MeshConsolidator -gw
+        // per-vertex colors are necessary if we are going to merge geometry -gw
         if ( useColor )
         {
-            osg::Vec4Array* roofColors = new osg::Vec4Array();
-            roofColors->reserve( pointCount );
+            osg::Vec4Array* roofColors = recycleArray<osg::Vec4Array>( roof->getColorArray(), 0 );
             roofColors->assign( pointCount, roofColor );
             roof->setColorArray( roofColors );
             roof->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
         }
+        else
+        {
+            roof->setColorArray( 0L );
+        }
 
         if ( roofSkin )
         {
-            roofTexcoords = new osg::Vec2Array( pointCount );
+            roofTexcoords = recycleArray<osg::Vec2Array>( roof->getTexCoordArray(0), pointCount );
             roof->setTexCoordArray( 0, roofTexcoords );
 
             roofBounds = input->getBounds();
@@ -317,12 +570,16 @@ ExtrudeGeometryFilter::extrudeGeometry(const Geometry*         input,
                 if ( roofTexSpanY <= 0.0 ) roofTexSpanY = 10.0;
             }
         }
+        else
+        {
+            roof->setTexCoordArray( 0, 0L );
+        }
     }
 
     osg::Vec3Array* baseVerts = NULL;
     if ( base )
     {
-        baseVerts = new osg::Vec3Array( pointCount );
+        baseVerts = recycleArray<osg::Vec3Array>( base->getVertexArray(), pointCount );
         base->setVertexArray( baseVerts );
     }
 
@@ -330,18 +587,16 @@ ExtrudeGeometryFilter::extrudeGeometry(const Geometry*         input,
     osg::Vec3Array* outlineNormals = 0L;
     if ( outline )
     {
-        outlineVerts = new osg::Vec3Array( numWallVerts );
+        outlineVerts = recycleArray<osg::Vec3Array>( outline->getVertexArray(), numWallVerts );
         outline->setVertexArray( outlineVerts );
 
-        osg::Vec4Array* outlineColors = new osg::Vec4Array();
-        outlineColors->reserve( numWallVerts );
+        osg::Vec4Array* outlineColors = recycleArray<osg::Vec4Array>( outline->getColorArray(), 0 );
         outlineColors->assign( numWallVerts, outlineColor );
         outline->setColorArray( outlineColors );
         outline->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
 
         // cop out, just point all the outline normals up. fix this later.
-        outlineNormals = new osg::Vec3Array();
-        outlineNormals->reserve( numWallVerts );
+        outlineNormals = recycleArray<osg::Vec3Array>( outline->getNormalArray(), 0 );
         outlineNormals->assign( numWallVerts, osg::Vec3(0,0,1) );
         outline->setNormalArray( outlineNormals );
     }
@@ -408,6 +663,7 @@ ExtrudeGeometryFilter::extrudeGeometry(const Geometry*         input,
 
         //osg::DrawElementsUShort* idx = new osg::DrawElementsUShort( GL_TRIANGLES );
         osg::DrawElementsUInt* idx = new osg::DrawElementsUInt( GL_TRIANGLES );
+        idx->reserve( 6 * part->size() );
 
         for( Geometry::const_iterator m = part->begin(); m != part->end(); ++m )
         {
@@ -612,12 +868,8 @@ ExtrudeGeometryFilter::extrudeGeometry(const Geometry*         input,
     return made_geom;
 }
 
-void
-ExtrudeGeometryFilter::addDrawable(osg::Drawable*      drawable,
-                                   osg::StateSet*      stateSet,
-                                   const std::string&  name,
-                                   Feature*            feature,
-                                   FeatureSourceIndex* index )
+osg::Geode*
+ExtrudeGeometryFilter::getGeode( osg::StateSet* stateSet )
 {
     // find the geode for the active stateset, creating a new one if necessary. NULL is a 
     // valid key as well.
@@ -628,8 +880,170 @@ ExtrudeGeometryFilter::addDrawable(osg::Drawable*      drawable,
         geode->setStateSet( stateSet );
         _geodes[stateSet] = geode;
     }
+    return geode;
+}
+
+void
+ExtrudeGeometryFilter::countMerged(const Geometry*     part,
+                                   bool                wallSkinned,
+                                   osg::StateSet*      wallStateSet,
+                                   osg::StateSet*      roofStateSet )
+{
+    // Counts what extrudeGeometry() will make of this part. Indices are exact
+    // except for the caps, whose triangulation is estimated as a fan.
+    // Crease smoothing splits wall vertices at sharp corners, so walls
+    // reserve for the worst case (every corner sharp) and the surplus is
+    // trimmed once the batch is done.
+    bool     isPolygon = part->getComponentType() == Geometry::TYPE_POLYGON;
+    unsigned n         = part->getTotalPointCount();
+    unsigned rings     = part->getNumGeometries();
+    unsigned wallVerts = 2*n + (isPolygon && wallSkinned ? 2*rings : 0);
+    unsigned segments  = isPolygon ? n : (n > rings ? n - rings : 0);
+
+    MergedGeometry& walls = _merged[ std::make_pair(wallStateSet, (int)MERGED_WALLS) ];
+    walls._vertsLeft   += 2*wallVerts;
+    walls._indicesLeft += 6*segments;
+
+    if ( isPolygon )
+    {
+        MergedGeometry& roofs = _merged[ std::make_pair(roofStateSet, (int)MERGED_ROOFS) ];
+        roofs._vertsLeft   += n;
+        roofs._indicesLeft += 3*n;
 
-    geode->addDrawable( drawable );
+        if ( _makeStencilVolume )
+        {
+            MergedGeometry& bases = _merged[ std::make_pair((osg::StateSet*)0L, (int)MERGED_BASES) ];
+            bases._vertsLeft   += n;
+            bases._indicesLeft += 3*n;
+        }
+    }
+
+    if ( _outlineSymbol.valid() )
+    {
+        MergedGeometry& outlines = _merged[ std::make_pair((osg::StateSet*)0L, (int)MERGED_OUTLINES) ];
+        outlines._vertsLeft   += wallVerts;
+        outlines._indicesLeft += 2*segments + 2*n;
+    }
+}
+
+void
+ExtrudeGeometryFilter::addToMerged(osg::Geometry*      part,
+                                   osg::StateSet*      stateSet,
+                                   MergedType          type,
+                                   Feature*            feature,
+                                   FeatureSourceIndex* index )
+{
+    const osg::Vec3Array* partVerts = dynamic_cast<const osg::Vec3Array*>( part->getVertexArray() );
+    if ( !partVerts || partVerts->empty() || part->getNumPrimitiveSets() == 0 )
+        return;
+
+    MergedGeometry& merged = _merged[ std::make_pair(stateSet, (int)type) ];
+
+    unsigned count = partVerts->size();
+
+    // start a new merged geometry once the current one is full. It gets room
+    // for what the counting pass says is still to come, up to the size limit,
+    // and a share of the remaining indices to match.
+    if ( !merged._geom.valid() ||
+         merged._geom->getVertexArray()->getNumElements() + count > MAX_MERGED_VERTS )
+    {
+        merged._reserveVerts   = osg::maximum( osg::minimum(merged._vertsLeft, MAX_MERGED_VERTS), count );
+        merged._reserveIndices =
+            merged._vertsLeft == 0 ? 0u :
+            merged._vertsLeft <= merged._reserveVerts ? merged._indicesLeft :
+            (unsigned)( (double)merged._indicesLeft * (double)merged._reserveVerts / (double)merged._vertsLeft );
+
+        osg::Vec3Array* mergedVerts = new osg::Vec3Array();
+        mergedVerts->reserve( merged._reserveVerts );
+
+        merged._geom = new osg::Geometry();
+        merged._geom->setUseVertexBufferObjects( _useVertexBufferObjects.get() );
+        merged._geom->setVertexArray( mergedVerts );
+        merged._tris    = 0L;
+        merged._lines   = 0L;
+        merged._feature = 0L;
+
+        if ( type == MERGED_OUTLINES )
+            applyLineSymbology( merged._geom->getOrCreateStateSet(), _outlineSymbol.get() );
+
+        getGeode( stateSet )->addDrawable( merged._geom.get() );
+    }
+
+    osg::Geometry*  geom   = merged._geom.get();
+    osg::Vec3Array* verts  = static_cast<osg::Vec3Array*>( geom->getVertexArray() );
+    unsigned        offset = verts->size();
+    unsigned        room   = merged._reserveVerts;
+
+    verts->insert( verts->end(), partVerts->begin(), partVerts->end() );
+
+    osg::Vec3Array* normals = appendArray<osg::Vec3Array>(
+        geom->getNormalArray(), part->getNormalArray(), offset, count, room, osg::Vec3(0,0,1) );
+    if ( normals && normals != geom->getNormalArray() )
+    {
+        geom->setNormalArray( normals );
+        geom->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+    }
+
+    osg::Vec4Array* colors = appendArray<osg::Vec4Array>(
+        geom->getColorArray(), part->getColorArray(), offset, count, room, osg::Vec4(1,1,1,1) );
+    if ( colors && colors != geom->getColorArray() )
+    {
+        geom->setColorArray( colors );
+        geom->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
+    }
+
+    osg::Vec2Array* texcoords = appendArray<osg::Vec2Array>(
+        geom->getTexCoordArray(0), part->getTexCoordArray(0), offset, count, room, osg::Vec2(0,0) );
+    if ( texcoords && texcoords != geom->getTexCoordArray(0) )
+    {
+        geom->setTexCoordArray( 0, texcoords );
+    }
+
+    // each feature gets primitive sets of its own when indexing, so that
+    // they can carry the feature's tag.
+    if ( index && merged._feature != feature )
+    {
+        merged._tris    = 0L;
+        merged._lines   = 0L;
+        merged._feature = feature;
+    }
+
+    unsigned numIndices = 0;
+    for( unsigned i=0; i<part->getNumPrimitiveSets(); ++i )
+    {
+        const osg::PrimitiveSet* ps = part->getPrimitiveSet(i);
+        bool isLine = isLineMode( ps->getMode() );
+
+        osg::ref_ptr<osg::DrawElementsUInt>& target = isLine ? merged._lines : merged._tris;
+        if ( !target.valid() )
+        {
+            target = new osg::DrawElementsUInt( isLine ? GL_LINES : GL_TRIANGLES );
+
+            // an indexed feature's primitive set holds just that feature.
+            target->reserve( index ? countPrimitives(ps) : merged._reserveIndices );
+
+            geom->addPrimitiveSet( target.get() );
+            if ( index )
+                index->tagPrimitiveSet( target.get(), feature );
+        }
+
+        unsigned before = target->size();
+        appendPrimitives( ps, offset, target.get() );
+        numIndices += target->size() - before;
+    }
+
+    merged._vertsLeft   -= osg::minimum( merged._vertsLeft,   count );
+    merged._indicesLeft -= osg::minimum( merged._indicesLeft, numIndices );
+}
+
+void
+ExtrudeGeometryFilter::addDrawable(osg::Drawable*      drawable,
+                                   osg::StateSet*      stateSet,
+                                   const std::string&  name,
+                                   Feature*            feature,
+                                   FeatureSourceIndex* index )
+{
+    getGeode( stateSet )->addDrawable( drawable );
 
     if ( !name.empty() )
     {
@@ -649,7 +1063,28 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
     Random wallSkinPRNG( _wallSkinSymbol.valid()? *_wallSkinSymbol->randomSeed() : 0, Random::METHOD_FAST );
     Random roofSkinPRNG( _roofSkinSymbol.valid()? *_roofSkinSymbol->randomSeed() : 0, Random::METHOD_FAST );
 
-    for( FeatureList::iterator f = features.begin(); f != features.end(); ++f )
+    // evaluate the height expressions for the whole batch of features up front.
+    std::vector<double> heights, offsets;
+    if ( !_heightCallback.valid() && _heightExpr.isSet() )
+        CompiledNumericExpression( *_heightExpr ).evalAll( features, heights, &context );
+    if ( _heightOffsetExpr.isSet() )
+        CompiledNumericExpression( *_heightOffsetExpr ).evalAll( features, offsets, &context );
+
+    CompiledStringExpression featureNameExpr( _featureNameExpr );
+
+    // When merging, each part is extruded into scratch geometry that is recycled
+    // from one part to the next, and then appended into the merged geometry for
+    // its state set. Otherwise every part becomes a drawable of its own.
+    bool merge = _mergeGeometry == true && _featureNameExpr.empty();
+    osg::ref_ptr<osg::Geometry> scratchWalls, scratchRoofs, scratchBases, scratchOutlines;
+
+    // First pass: settle each part's height and skins (in the same order as
+    // always, so the skin PRNGs pick the same skins) and, when merging, count
+    // what each merged bin will receive.
+    std::vector<PartPlan> plans;
+
+    unsigned featureIndex = 0;
+    for( FeatureList::iterator f = features.begin(); f != features.end(); ++f, ++featureIndex )
     {
         Feature* input = f->get();
 
@@ -658,35 +1093,16 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
         {
             Geometry* part = iter.next();
 
-            osg::ref_ptr<osg::Geometry> walls = new osg::Geometry();
-            walls->setUseVertexBufferObjects( _useVertexBufferObjects.get() );
-            
-            osg::ref_ptr<osg::Geometry> rooflines = 0L;
-            osg::ref_ptr<osg::Geometry> baselines = 0L;
-            osg::ref_ptr<osg::Geometry> outlines  = 0L;
-            
+            // prep the shapes by making sure all polys are open:
             if ( part->getType() == Geometry::TYPE_POLYGON )
             {
-                rooflines = new osg::Geometry();
-                rooflines->setUseVertexBufferObjects( _useVertexBufferObjects.get() );
-
-                // prep the shapes by making sure all polys are open:
                 static_cast<Polygon*>(part)->open();
             }
 
-            // fire up the outline geometry if we have a line symbol.
-            if ( _outlineSymbol != 0L )
-            {
-                outlines = new osg::Geometry();
-                outlines->setUseVertexBufferObjects( _useVertexBufferObjects.get() );
-            }
-
-            // make a base cap if we're doing stencil volumes.
-            if ( _makeStencilVolume )
-            {
-                baselines = new osg::Geometry();
-                baselines->setUseVertexBufferObjects( _useVertexBufferObjects.get() );
-            }
+            plans.push_back( PartPlan() );
+            PartPlan& plan = plans.back();
+            plan._feature  = input;
+            plan._part     = part;
 
             // calculate the extrusion height:
             float height;
@@ -697,7 +1113,7 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
             }
             else if ( _heightExpr.isSet() )
             {
-                height = input->eval( _heightExpr.mutable_value(), &context );
+                height = heights[featureIndex];
             }
             else
             {
@@ -708,11 +1124,11 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
             float offset = 0.0;
             if ( _heightOffsetExpr.isSet() )
             {
-                offset = input->eval( _heightOffsetExpr.mutable_value(), &context );
+                offset = offsets[featureIndex];
             }
 
-            osg::ref_ptr<osg::StateSet> wallStateSet;
-            osg::ref_ptr<osg::StateSet> roofStateSet;
+            plan._height = height;
+            plan._offset = offset;
 
             // calculate the wall texturing:
             SkinResource* wallSkin = 0L;
@@ -747,101 +1163,151 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
                 }
             }
 
-            // calculate the colors:
-            osg::Vec4f wallColor(1,1,1,0), wallBaseColor(1,1,1,0), roofColor(1,1,1,0), outlineColor(1,1,1,1);
+            plan._wallSkin = wallSkin;
+            plan._roofSkin = roofSkin;
 
-            if ( _wallPolygonSymbol.valid() )
+            if ( wallSkin )
             {
-                wallColor = _wallPolygonSymbol->fill()->color();
-                if ( _extrusionSymbol->wallGradientPercentage().isSet() )
-                {
-                    wallBaseColor = Color(wallColor).brightness( 1.0 - *_extrusionSymbol->wallGradientPercentage() );
-                }
-                else
-                {
-                    wallBaseColor = wallColor;
-                }
+                context.resourceCache()->getOrCreateStateSet( wallSkin, plan._wallStateSet );
             }
-            if ( _roofPolygonSymbol.valid() )
+
+            if ( roofSkin )
             {
-                roofColor = _roofPolygonSymbol->fill()->color();
+                context.resourceCache()->getOrCreateStateSet( roofSkin, plan._roofStateSet );
             }
-            if ( _outlineSymbol.valid() )
+
+            if ( merge )
             {
-                outlineColor = _outlineSymbol->stroke()->color();
+                countMerged( part, wallSkin != 0L, plan._wallStateSet.get(), plan._roofStateSet.get() );
             }
+        }
+    }
 
-            // Create the extruded geometry!
-            if (extrudeGeometry( 
-                    part, height, offset, 
-                    *_extrusionSymbol->flatten(),
-                    walls.get(), rooflines.get(), baselines.get(), outlines.get(),
-                    wallColor, wallBaseColor, roofColor, outlineColor,
-                    wallSkin, roofSkin,
-                    context ) )
-            {      
-                if ( wallSkin )
-                {
-                    context.resourceCache()->getOrCreateStateSet( wallSkin, wallStateSet );
-                }
+    // calculate the colors:
+    osg::Vec4f wallColor(1,1,1,0), wallBaseColor(1,1,1,0), roofColor(1,1,1,0), outlineColor(1,1,1,1);
 
-                // generate per-vertex normals, altering the geometry as necessary to avoid
-                // smoothing around sharp corners
-                osgUtil::SmoothingVisitor::smooth(
-                    *walls.get(), 
-                    osg::DegreesToRadians(_wallAngleThresh_deg) );
+    if ( _wallPolygonSymbol.valid() )
+    {
+        wallColor = _wallPolygonSymbol->fill()->color();
+        if ( _extrusionSymbol->wallGradientPercentage().isSet() )
+        {
+            wallBaseColor = Color(wallColor).brightness( 1.0 - *_extrusionSymbol->wallGradientPercentage() );
+        }
+        else
+        {
+            wallBaseColor = wallColor;
+        }
+    }
+    if ( _roofPolygonSymbol.valid() )
+    {
+        roofColor = _roofPolygonSymbol->fill()->color();
+    }
+    if ( _outlineSymbol.valid() )
+    {
+        outlineColor = _outlineSymbol->stroke()->color();
+    }
 
-                // tessellate and add the roofs if necessary:
-                if ( rooflines.valid() )
-                {
-                    osgUtil::Tessellator tess;
-                    tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
-                    tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_ODD );
-                    tess.retessellatePolygons( *(rooflines.get()) );
+    // Second pass: extrude.
+    for( std::vector<PartPlan>::iterator plan = plans.begin(); plan != plans.end(); ++plan )
+    {
+        Feature*       input        = plan->_feature;
+        Geometry*      part         = plan->_part;
+        osg::StateSet* wallStateSet = plan->_wallStateSet.get();
+        osg::StateSet* roofStateSet = plan->_roofStateSet.get();
+
+        osg::ref_ptr<osg::Geometry> walls = prepGeometry( scratchWalls, merge, _useVertexBufferObjects.get() );
+        
+        osg::ref_ptr<osg::Geometry> rooflines = 0L;
+        osg::ref_ptr<osg::Geometry> baselines = 0L;
+        osg::ref_ptr<osg::Geometry> outlines  = 0L;
+        
+        if ( part->getType() == Geometry::TYPE_POLYGON )
+        {
+            rooflines = prepGeometry( scratchRoofs, merge, _useVertexBufferObjects.get() );
+        }
 
-                    // generate default normals (no crease angle necessary; they are all pointing up)
-                    // TODO do this manually; probably faster
-                    if ( !_makeStencilVolume )
-                        osgUtil::SmoothingVisitor::smooth( *rooflines.get() );
+        // fire up the outline geometry if we have a line symbol.
+        if ( _outlineSymbol != 0L )
+        {
+            outlines = prepGeometry( scratchOutlines, merge, _useVertexBufferObjects.get() );
+        }
 
-                    if ( roofSkin )
-                    {
-                        context.resourceCache()->getOrCreateStateSet( roofSkin, roofStateSet );
-                    }
-                }
+        // make a base cap if we're doing stencil volumes.
+        if ( _makeStencilVolume )
+        {
+            baselines = prepGeometry( scratchBases, merge, _useVertexBufferObjects.get() );
+        }
 
-                if ( baselines.valid() )
-                {
-                    osgUtil::Tessellator tess;
-                    tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
-                    tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_ODD );
-                    tess.retessellatePolygons( *(baselines.get()) );
-                }
+        // Create the extruded geometry!
+        if (extrudeGeometry( 
+                part, plan->_height, plan->_offset, 
+                *_extrusionSymbol->flatten(),
+                walls.get(), rooflines.get(), baselines.get(), outlines.get(),
+                wallColor, wallBaseColor, roofColor, outlineColor,
+                plan->_wallSkin, plan->_roofSkin,
+                context ) )
+        {      
+            // generate per-vertex normals, altering the geometry as necessary to avoid
+            // smoothing around sharp corners
+            osgUtil::SmoothingVisitor::smooth(
+                *walls.get(), 
+                osg::DegreesToRadians(_wallAngleThresh_deg) );
+
+            // tessellate and add the roofs if necessary:
+            if ( rooflines.valid() )
+            {
+                tessellate( _tessellator, rooflines.get() );
 
-                std::string name;
-                if ( !_featureNameExpr.empty() )
-                    name = input->eval( _featureNameExpr, &context );
+                // generate default normals (no crease angle necessary; they are all pointing up)
+                // TODO do this manually; probably faster
+                if ( !_makeStencilVolume )
+                    osgUtil::SmoothingVisitor::smooth( *rooflines.get() );
+            }
 
-                FeatureSourceIndex* index = context.featureIndex();
+            if ( baselines.valid() )
+            {
+                tessellate( _tessellator, baselines.get() );
+            }
 
-                addDrawable( walls.get(), wallStateSet.get(), name, input, index );
+            FeatureSourceIndex* index = context.featureIndex();
+
+            if ( merge )
+            {
+                addToMerged( walls.get(), wallStateSet, MERGED_WALLS, input, index );
 
                 if ( rooflines.valid() )
-                {
-                    addDrawable( rooflines.get(), roofStateSet.get(), name, input, index );
-                }
+                    addToMerged( rooflines.get(), roofStateSet, MERGED_ROOFS, input, index );
 
                 if ( baselines.valid() )
-                {
-                    addDrawable( baselines.get(), 0L, name, input, index );
-                }
+                    addToMerged( baselines.get(), 0L, MERGED_BASES, input, index );
 
                 if ( outlines.valid() )
-                {
-                    addDrawable( outlines.get(), 0L, name, input, index );
-                }
-            }   
-        }
+                    addToMerged( outlines.get(), 0L, MERGED_OUTLINES, input, index );
+
+                continue;
+            }
+
+            std::string name;
+            if ( !_featureNameExpr.empty() )
+                name = featureNameExpr.eval( input, &context );
+
+            addDrawable( walls.get(), wallStateSet, name, input, index );
+
+            if ( rooflines.valid() )
+            {
+                addDrawable( rooflines.get(), roofStateSet, name, input, index );
+            }
+
+            if ( baselines.valid() )
+            {
+                addDrawable( baselines.get(), 0L, name, input, index );
+            }
+
+            if ( outlines.valid() )
+            {
+                addDrawable( outlines.get(), 0L, name, input, index );
+            }
+        }   
     }
 
     return true;
@@ -897,32 +1363,33 @@ ExtrudeGeometryFilter::push( FeatureList& input, FilterContext& context )
     // push all the features through the extruder.
     bool ok = process( input, context );
 
-    // convert everything to triangles and combine drawables.
-    if ( _mergeGeometry == true && _featureNameExpr.empty() )
+    // give back what the counting pass over-reserved in the last geometry of
+    // each merged bin (the wall estimate assumes every corner is creased).
+    for( MergedGeometryMap::iterator m = _merged.begin(); m != _merged.end(); ++m )
     {
-        for( SortedGeodeMap::iterator i = _geodes.begin(); i != _geodes.end(); ++i )
+        osg::Geometry* geom = m->second._geom.get();
+        if ( geom )
         {
-            if ( context.featureIndex() )
-            {
-                // The MC will recognize the presence of feature indexing tags and
-                // preserve them. The Cache optimizer however will not, so it is
-                // out for now.
-                MeshConsolidator::run( *i->second.get() );
+            trimArray<osg::Vec3Array>( geom->getVertexArray() );
+            trimArray<osg::Vec3Array>( geom->getNormalArray() );
+            trimArray<osg::Vec4Array>( geom->getColorArray() );
+            trimArray<osg::Vec2Array>( geom->getTexCoordArray(0) );
+        }
+    }
 
-                //VertexCacheOptimizer vco;
-                //i->second->accept( vco );
-            }
-            else
-            {
-                //TODO: try this -- issues: it won't work on lines, and will it screw up
-                // feature indexing?
-                osgUtil::Optimizer o;
-                o.optimize( i->second.get(),
-                    osgUtil::Optimizer::MERGE_GEOMETRY |
-                    osgUtil::Optimizer::VERTEX_PRETRANSFORM |
-                    osgUtil::Optimizer::INDEX_MESH |
-                    osgUtil::Optimizer::VERTEX_POSTTRANSFORM );
-            }
+    // the geometry was merged as it was built; all that's left is to optimize
+    // the vertex order for the cache. (The cache optimizer does not preserve
+    // feature indexing tags, so skip it when indexing.)
+    if ( _mergeGeometry == true && _featureNameExpr.empty() && !context.featureIndex() )
+    {
+        for( SortedGeodeMap::iterator i = _geodes.begin(); i != _geodes.end(); ++i )
+        {
+            //TODO: issues: it won't work on lines
+            osgUtil::Optimizer o;
+            o.optimize( i->second.get(),
+                osgUtil::Optimizer::VERTEX_PRETRANSFORM |
+                osgUtil::Optimizer::INDEX_MESH |
+                osgUtil::Optimizer::VERTEX_POSTTRANSFORM );
         }
     }
 
@@ -935,6 +1402,7 @@ ExtrudeGeometryFilter::push( FeatureList& input, FilterContext& context )
         group->addChild( i->second.get() );
     }
     _geodes.clear();
+    _merged.clear();
 
     // if we drew outlines, apply a poly offset too.
     if ( _outlineSymbol.valid() )
@@ -143,6 +143,135 @@ AttributeValue::getBool( bool defaultValue ) const
 
 //----------------------------------------------------------------------------
 
+AttributeLayout::AttributeLayout( const AttributeLayout& rhs ) :
+osg::Referenced( rhs ),
+_names         ( rhs._names ),
+_index         ( rhs._index )
+{
+    //nop
+}
+
+int
+AttributeLayout::indexOf( const std::string& name ) const
+{
+    IndexMap::const_iterator i = _index.find( name );
+    return i != _index.end() ? (int)i->second : -1;
+}
+
+unsigned
+AttributeLayout::add( const std::string& name )
+{
+    IndexMap::const_iterator i = _index.find( name );
+    if ( i != _index.end() )
+        return i->second;
+
+    unsigned index = _names.size();
+    _names.push_back( name );
+    _index[name] = index;
+    return index;
+}
+
+//----------------------------------------------------------------------------
+
+AttributeTable::AttributeTable( const AttributeTable& rhs ) :
+_layout    ( rhs._layout ),
+_values    ( rhs._values ),
+_present   ( rhs._present ),
+_size      ( rhs._size ),
+_ownsLayout( false )
+{
+    // the layout is now shared, so the original may not change it either.
+    rhs._ownsLayout = false;
+}
+
+AttributeTable&
+AttributeTable::operator = ( const AttributeTable& rhs )
+{
+    if ( this != &rhs )
+    {
+        _layout     = rhs._layout;
+        _values     = rhs._values;
+        _present    = rhs._present;
+        _size       = rhs._size;
+        _ownsLayout = false;
+        rhs._ownsLayout = false;
+    }
+    return *this;
+}
+
+AttributeTable::const_iterator
+AttributeTable::find( const std::string& name ) const
+{
+    if ( _layout.valid() )
+    {
+        int i = _layout->indexOf( name );
+        if ( i >= 0 && i < (int)_values.size() && _present[i] )
+            return const_iterator( this, (unsigned)i );
+    }
+    return end();
+}
+
+AttributeValue&
+AttributeTable::operator[]( const std::string& name )
+{
+    if ( !_layout.valid() )
+    {
+        _layout     = new AttributeLayout();
+        _ownsLayout = true;
+    }
+
+    int i = _layout->indexOf( name );
+    if ( i < 0 )
+    {
+        // never modify a layout someone else is using.
+        if ( !_ownsLayout )
+        {
+            _layout     = new AttributeLayout( *_layout.get() );
+            _ownsLayout = true;
+        }
+
+        i = (int)_layout->add( name );
+    }
+
+    if ( i >= (int)_values.size() )
+    {
+        _values.resize( _layout->size() );
+        _present.resize( _layout->size(), false );
+    }
+
+    if ( !_present[i] )
+    {
+        _present[i] = true;
+        ++_size;
+    }
+
+    return _values[i];
+}
+
+void
+AttributeTable::setLayout( AttributeLayout* layout )
+{
+    if ( _size == 0 )
+    {
+        _layout     = layout;
+        _ownsLayout = false;
+        _values.clear();
+        _present.clear();
+    }
+}
+
+unsigned
+AttributeTable::next( int i ) const
+{
+    unsigned n = _values.size();
+    unsigned j = (unsigned)(i+1);
+    while( j < n && !_present[j] )
+        ++j;
+    return j;
+}
+
+//----------------------------------------------------------------------------
+
 Feature::Feature( FeatureID fid ) :
 _fid( fid ),
 _srs( 0L )
@@ -158,6 +158,21 @@ FeatureSourceIndexNode::tagPrimitiveSets(osg::Drawable* drawable, Feature* featu
 }
 
 
+void
+FeatureSourceIndexNode::tagPrimitiveSet(osg::PrimitiveSet* primSet, Feature* feature) const
+{
+    if ( primSet == 0L )
+        return;
+
+    primSet->setUserData( new RefFeatureID(feature->getFID()) );
+
+    if ( _options.embedFeatures() == true )
+    {
+        _features[feature->getFID()] = feature;
+    }
+}
+
+
 void
 FeatureSourceIndexNode::tagNode( osg::Node* node, Feature* feature ) const
 {
@@ -260,8 +260,29 @@ OGRGeometryH
     }
 }
 
+AttributeLayout*
+OgrUtils::createAttributeLayout( OGRFeatureDefnH defn )
+{
+    AttributeLayout* layout = new AttributeLayout();
+    int numFields = OGR_FD_GetFieldCount( defn );
+    for (int i = 0; i < numFields; ++i)
+    {
+        std::string name = OGR_Fld_GetNameRef( OGR_FD_GetFieldDefn(defn, i) );
+        std::transform( name.begin(), name.end(), name.begin(), ::tolower ); 
+        layout->add( name );
+    }
+    return layout;
+}
+
 Feature*
     OgrUtils::createFeature( OGRFeatureH handle, const SpatialReference* srs )
+{
+    osg::ref_ptr<AttributeLayout> layout;
+    return createFeature( handle, srs, layout );
+}
+
+Feature*
+    OgrUtils::createFeature( OGRFeatureH handle, const SpatialReference* srs, osg::ref_ptr<AttributeLayout>& layout )
 {
     long fid = OGR_F_GetFID( handle );
 
@@ -277,6 +298,13 @@ Feature*
     Feature* feature = new Feature( geom, srs, Style(), fid );
 
     int numAttrs = OGR_F_GetFieldCount(handle); 
+
+    // intern the field names, in field order, the first time through.
+    if ( !layout.valid() )
+    {
+        layout = createAttributeLayout( OGR_F_GetDefnRef(handle) );
+    }
+    feature->setAttributeLayout( layout.get() );
     for (int i = 0; i < numAttrs; ++i) 
     { 
         OGRFieldDefnH field_handle_ref = OGR_F_GetFieldDefnRef( handle, i ); 
@@ -18,6 +18,7 @@
  */
 #include <osgEarthFeatures/SubstituteModelFilter>
 #include <osgEarthFeatures/FeatureSourceIndexNode>
+#include <osgEarthFeatures/CompiledExpression>
 #include <osgEarthFeatures/Session>
 #include <osgEarthSymbology/MeshConsolidator>
 #include <osgEarth/ECEF>
@@ -139,23 +140,24 @@ SubstituteModelFilter::process(const FeatureList&           features,
     // keep track of failed URIs so we don't waste time or warning messages on them
     std::set< URI > missing;
 
-    StringExpression  uriEx   = *symbol->url();
-    NumericExpression scaleEx = *symbol->scale();
+    // prepare the expressions once for the whole batch of features.
+    CompiledStringExpression  uriEx  ( *symbol->url() );
+    CompiledNumericExpression scaleEx( *symbol->scale() );
+    CompiledStringExpression  nameEx ( _featureNameExpr );
 
     const ModelSymbol* modelSymbol = dynamic_cast<const ModelSymbol*>(symbol);
     const IconSymbol*  iconSymbol  = dynamic_cast<const IconSymbol*> (symbol);
 
-    NumericExpression headingEx;
+    CompiledNumericExpression headingEx;
     if ( modelSymbol )
-        headingEx = *modelSymbol->heading();
+        headingEx = CompiledNumericExpression( *modelSymbol->heading() );
 
     for( FeatureList::const_iterator f = features.begin(); f != features.end(); ++f )
     {
         Feature* input = f->get();
 
         // evaluate the instance URI expression:
-        StringExpression uriEx = *symbol->url();
-        URI instanceURI( input->eval(uriEx, &context), uriEx.uriContext() );
+        URI instanceURI( uriEx.eval(input, &context), uriEx.uriContext() );
 
         // find the corresponding marker in the cache
         osg::ref_ptr<InstanceResource> instance;
@@ -168,7 +170,7 @@ SubstituteModelFilter::process(const FeatureList&           features,
 
         if ( symbol->scale().isSet() )
         {
-            scale = input->eval( scaleEx, &context );
+            scale = scaleEx.eval( input, &context );
             if ( scale == 0.0 )
                 scale = 1.0;
             if ( scale != 1.0 )
@@ -180,7 +182,7 @@ SubstituteModelFilter::process(const FeatureList&           features,
 
         if ( modelSymbol && modelSymbol->heading().isSet() )
         {
-            float heading = input->eval(headingEx, &context);
+            float heading = headingEx.eval( input, &context );
             rotationMatrix.makeRotate( osg::Quat(osg::DegreesToRadians(heading), osg::Vec3(0,0,1)) );
         }
 
@@ -257,7 +259,7 @@ SubstituteModelFilter::process(const FeatureList&           features,
                     // name the feature if necessary
                     if ( !_featureNameExpr.empty() )
                     {
-                        const std::string& name = input->eval( _featureNameExpr, &context);
+                        const std::string& name = nameEx.eval( input, &context );
                         if ( !name.empty() )
                             xform->setName( name );
                     }
@@ -307,9 +309,9 @@ struct ClusterVisitor : public osg::NodeVisitor
     {
         _modelSymbol = dynamic_cast<const ModelSymbol*>( symbol );
         if ( _modelSymbol )
-            _headingExpr = *_modelSymbol->heading();
+            _headingExpr = CompiledNumericExpression( *_modelSymbol->heading() );
 
-        _scaleExpr = *_symbol->scale();
+        _scaleExpr = CompiledNumericExpression( *_symbol->scale() );
 
         _makeECEF  = _cx.getSession()->getMapInfo().isGeocentric();
         _srs       = _cx.profile()->getSRS();
@@ -342,14 +344,14 @@ struct ClusterVisitor : public osg::NodeVisitor
 
                 if ( _symbol->scale().isSet() )
                 {
-                    double scale = feature->eval( _scaleExpr, &_cx );
+                    double scale = _scaleExpr.eval( feature, &_cx );
                     scaleMatrix.makeScale( scale, scale, scale );
                 }
 
                 osg::Matrixd rotationMatrix;
                 if ( _modelSymbol && _modelSymbol->heading().isSet() )
                 {
-                    float heading = feature->eval( _headingExpr, &_cx );
+                    float heading = _headingExpr.eval( feature, &_cx );
                     rotationMatrix.makeRotate( osg::Quat(osg::DegreesToRadians(heading), osg::Vec3(0,0,1)) );
                 }
 
@@ -418,8 +420,8 @@ private:
     const InstanceSymbol*   _symbol;
     const ModelSymbol*      _modelSymbol;
     FeaturesToNodeFilter*   _f2n;
-    NumericExpression       _scaleExpr;
-    NumericExpression       _headingExpr;
+    CompiledNumericExpression _scaleExpr;
+    CompiledNumericExpression _headingExpr;
     bool                    _makeECEF;
     const SpatialReference* _srs;
     const SpatialReference* _targetSRS;
@@ -446,6 +448,8 @@ SubstituteModelFilter::cluster(const FeatureList&           features,
 
     std::set<URI> missing;
 
+    CompiledStringExpression uriEx( *symbol->url() );
+
     // first, sort the features into buckets, each bucket corresponding to a
     // unique marker.
     for (FeatureList::const_iterator i = features.begin(); i != features.end(); ++i)
@@ -453,8 +457,7 @@ SubstituteModelFilter::cluster(const FeatureList&           features,
         Feature* f = i->get();
 
         // resolve the URI for the marker:
-        StringExpression uriEx( *symbol->url() );
-        URI instanceURI( f->eval( uriEx, &context ), uriEx.uriContext() );
+        URI instanceURI( uriEx.eval( f, &context ), uriEx.uriContext() );
 
         // find and load the corresponding marker model. We're using the session-level
         // object store to cache models. This is thread-safe sine we are always going
@@ -34,11 +34,12 @@ _dirty( true )
 }
 
 NumericExpression::NumericExpression( const NumericExpression& rhs ) :
-_src  ( rhs._src ),
-_rpn  ( rhs._rpn ),
-_vars ( rhs._vars ),
-_value( rhs._value ),
-_dirty( rhs._dirty )
+_src          ( rhs._src ),
+_rpn          ( rhs._rpn ),
+_vars         ( rhs._vars ),
+_value        ( rhs._value ),
+_dirty        ( rhs._dirty ),
+_maxStackDepth( rhs._maxStackDepth )
 {
     //nop
 }
@@ -51,7 +52,9 @@ _dirty( false )
     init();
 }
 
-NumericExpression::NumericExpression( const Config& conf )
+NumericExpression::NumericExpression( const Config& conf ) :
+_value( 0.0 ),
+_dirty( true )
 {
     mergeConfig( conf );
     init();
@@ -252,6 +255,18 @@ NumericExpression::init()
         _rpn.push_back( s.top() );
         s.pop();
     }
+
+    // figure out how deep the evaluation stack can get, so eval can use
+    // a fixed-size stack instead of allocating one each time.
+    unsigned depth = 0;
+    _maxStackDepth = 0;
+    for( unsigned i=0; i<_rpn.size(); ++i )
+    {
+        if ( _rpn[i].first == OPERAND || _rpn[i].first == VARIABLE )
+            _maxStackDepth = osg::maximum( _maxStackDepth, ++depth );
+        else if ( depth >= 2 )
+            --depth;
+    }
 }
 
 void 
@@ -270,86 +285,71 @@ NumericExpression::eval() const
 {
     if ( _dirty )
     {
-        std::stack<double> s;
+        const_cast<NumericExpression*>(this)->_value = eval( 0L );
+        const_cast<NumericExpression*>(this)->_dirty = false;
+    }
+
+    return !osg::isNaN( _value ) ? _value : 0.0;
+}
+
+double
+NumericExpression::eval( const double* variableValues ) const
+{
+    // most expressions are tiny; only go to the heap for really big ones.
+    double stack[16];
+    if ( _maxStackDepth <= 16 )
+    {
+        return evalRPN( variableValues, stack );
+    }
+    else
+    {
+        std::vector<double> heapStack( _maxStackDepth );
+        return evalRPN( variableValues, &heapStack[0] );
+    }
+}
 
-        for( unsigned i=0; i<_rpn.size(); ++i )
+double
+NumericExpression::evalRPN( const double* variableValues, double* s ) const
+{
+    unsigned size = 0;
+    unsigned var  = 0;
+
+    for( unsigned i=0; i<_rpn.size(); ++i )
+    {
+        const Atom& a = _rpn[i];
+
+        if ( a.first == OPERAND )
+        {
+            s[size++] = a.second;
+        }
+        else if ( a.first == VARIABLE )
         {
-            const Atom& a = _rpn[i];
+            // variables appear in the RPN in the same order as in _vars.
+            s[size++] = variableValues ? variableValues[var] : a.second;
+            ++var;
+        }
+        else if ( size >= 2 )
+        {
+            double op2 = s[--size];
+            double op1 = s[size-1];
+            double& r  = s[size-1];
 
-            if ( a.first == ADD )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 + op2 );
-                }
-            }
-            else if ( a.first == SUB )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 - op2 );
-                }
-            }
-            else if ( a.first == MULT )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 * op2 );
-                }
-            }
-            else if ( a.first == DIV )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 / op2 );
-                }
-            }
-            else if ( a.first == MOD )
+            switch( a.first )
             {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( fmod(op1, op2) );
-                }
-            }
-            else if ( a.first == MIN )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( std::min(op1, op2) );
-                }
-            }
-            else if ( a.first == MAX )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( std::max(op1, op2) );
-                }
-            }
-            else // OPERAND or VARIABLE
-            {
-                s.push( a.second );
+            case ADD:  r = op1 + op2; break;
+            case SUB:  r = op1 - op2; break;
+            case MULT: r = op1 * op2; break;
+            case DIV:  r = op1 / op2; break;
+            case MOD:  r = fmod(op1, op2); break;
+            case MIN:  r = std::min(op1, op2); break;
+            case MAX:  r = std::max(op1, op2); break;
+            default:   ++size; break; // not an operator; leave the stack alone
             }
         }
-
-        const_cast<NumericExpression*>(this)->_value = s.size() > 0 ? s.top() : 0.0;
-        const_cast<NumericExpression*>(this)->_dirty = false;
     }
 
-    return !osg::isNaN( _value ) ? _value : 0.0;
+    double value = size > 0 ? s[size-1] : 0.0;
+    return !osg::isNaN( value ) ? value : 0.0;
 }
 
 //------------------------------------------------------------------------
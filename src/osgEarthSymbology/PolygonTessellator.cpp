@@ -0,0 +1,600 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthSymbology/PolygonTessellator>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#define LC "[PolygonTessellator] "
+
+using namespace osgEarth;
+using namespace osgEarth::Symbology;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // Projects a vertex onto the coordinate plane that drops "axis". The
+    // remaining axes are taken in cyclic order so the projection never
+    // mirrors the polygon.
+    inline void project( const osg::Vec3f& v, int axis, double& x, double& y )
+    {
+        if      ( axis == 0 ) { x = v.y(); y = v.z(); }
+        else if ( axis == 1 ) { x = v.z(); y = v.x(); }
+        else                  { x = v.x(); y = v.y(); }
+    }
+
+    // picks the projection axis for a ring from its Newell normal; returns
+    // -1 if the ring has no area.
+    int projectionAxis( const osg::Vec3Array& verts, const PolygonTessellator::Ring& ring )
+    {
+        osg::Vec3d n;
+        for( unsigned i=0; i<ring._count; ++i )
+        {
+            const osg::Vec3d a = verts[ring._first + i];
+            const osg::Vec3d b = verts[ring._first + (i+1) % ring._count];
+            n.x() += (a.y() - b.y()) * (a.z() + b.z());
+            n.y() += (a.z() - b.z()) * (a.x() + b.x());
+            n.z() += (a.x() - b.x()) * (a.y() + b.y());
+        }
+
+        double ax = fabs(n.x()), ay = fabs(n.y()), az = fabs(n.z());
+        if ( ax == 0.0 && ay == 0.0 && az == 0.0 )
+            return -1;
+
+        return
+            ax >= ay && ax >= az ? 0 :
+            ay >= az             ? 1 :
+            2;
+    }
+
+    // twice the signed area of a ring in the projection plane; positive when
+    // the ring is counter-clockwise.
+    double signedArea( const osg::Vec3Array& verts, const PolygonTessellator::Ring& ring, int axis )
+    {
+        double area = 0.0;
+        double x0, y0, x1, y1;
+        project( verts[ring._first + ring._count - 1], axis, x0, y0 );
+        for( unsigned i=0; i<ring._count; ++i )
+        {
+            project( verts[ring._first + i], axis, x1, y1 );
+            area += x0*y1 - x1*y0;
+            x0 = x1, y0 = y1;
+        }
+        return area;
+    }
+
+    // positive if a->b->c turns left (counter-clockwise)
+    inline double cross( double ax, double ay, double bx, double by, double cx, double cy )
+    {
+        return (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+    }
+
+    // true if p lies inside or on the edge of the counter-clockwise triangle abc
+    inline bool inTriangle( double ax, double ay, double bx, double by, double cx, double cy, double px, double py )
+    {
+        return
+            cross(ax, ay, bx, by, px, py) >= 0.0 &&
+            cross(bx, by, cx, cy, px, py) >= 0.0 &&
+            cross(cx, cy, ax, ay, px, py) >= 0.0;
+    }
+}
+
+//------------------------------------------------------------------------
+
+PolygonTessellator::PolygonTessellator() :
+_maxVertices( 4096 )
+{
+    //nop
+}
+
+bool
+PolygonTessellator::tessellateGeometry( osg::Geometry& geom )
+{
+    osg::Vec3Array* verts = dynamic_cast<osg::Vec3Array*>( geom.getVertexArray() );
+    if ( !verts || geom.getNumPrimitiveSets() == 0 )
+        return false;
+
+    RingList rings;
+    rings.reserve( geom.getNumPrimitiveSets() );
+
+    for( unsigned i=0; i<geom.getNumPrimitiveSets(); ++i )
+    {
+        const osg::DrawArrays* da = dynamic_cast<const osg::DrawArrays*>( geom.getPrimitiveSet(i) );
+        if ( !da )
+            return false;
+
+        if ( da->getMode() != GL_LINE_LOOP && da->getMode() != GL_POLYGON )
+            return false;
+
+        if ( da->getFirst() < 0 || (unsigned)(da->getFirst() + da->getCount()) > verts->size() )
+            return false;
+
+        rings.push_back( Ring(da->getFirst(), da->getCount()) );
+    }
+
+    osg::ref_ptr<osg::DrawElementsUInt> tris = new osg::DrawElementsUInt( GL_TRIANGLES );
+    if ( !tessellate(*verts, rings, *tris.get()) )
+        return false;
+
+    geom.removePrimitiveSet( 0, geom.getNumPrimitiveSets() );
+    if ( tris->size() > 0 )
+        geom.addPrimitiveSet( tris.get() );
+
+    return true;
+}
+
+bool
+PolygonTessellator::tessellate(const osg::Vec3Array&  verts,
+                               const RingList&        rings,
+                               osg::DrawElementsUInt& out)
+{
+    if ( rings.empty() || rings[0]._count < 3 )
+        return false;
+
+    unsigned total = 0;
+    for( RingList::const_iterator r = rings.begin(); r != rings.end(); ++r )
+        total += r->_count;
+
+    if ( total > _maxVertices )
+        return false;
+
+    int axis = projectionAxis( verts, rings[0] );
+    if ( axis < 0 )
+        return false;
+
+    // the outer ring is linked counter-clockwise and the holes clockwise;
+    // remember whether the outer ring was flipped so the output triangles
+    // can keep its original winding.
+    double outerArea = signedArea( verts, rings[0], axis );
+    if ( outerArea == 0.0 )
+        return false;
+
+    bool reversed = outerArea < 0.0;
+
+    // ear clipping assumes simple rings; crossing edges go to GLU instead.
+    if ( edgesCross(verts, rings, axis) )
+        return false;
+
+    _nodes.clear();
+    _nodes.reserve( total + 2*rings.size() );
+
+    int outer = linkRing( verts, rings[0], axis, reversed );
+    if ( _nodes[outer]._next == _nodes[outer]._prev )
+        return false;
+
+    if ( rings.size() > 1 )
+    {
+        _holes.clear();
+        for( unsigned i=1; i<rings.size(); ++i )
+        {
+            if ( rings[i]._count < 3 )
+                continue;
+
+            double area = signedArea( verts, rings[i], axis );
+            if ( area == 0.0 )
+                continue;
+
+            int hole = linkRing( verts, rings[i], axis, area > 0.0 );
+            _holes.push_back( leftmost(hole) );
+        }
+
+        // bridge the holes from left to right so that each bridge can only
+        // cross holes that have already been merged into the outer ring.
+        for( unsigned i=1; i<_holes.size(); ++i )
+        {
+            int h = _holes[i];
+            unsigned j = i;
+            for( ; j > 0 && (_nodes[_holes[j-1]]._x > _nodes[h]._x ||
+                 (_nodes[_holes[j-1]]._x == _nodes[h]._x && _nodes[_holes[j-1]]._y > _nodes[h]._y)); --j )
+            {
+                _holes[j] = _holes[j-1];
+            }
+            _holes[j] = h;
+        }
+
+        for( std::vector<int>::const_iterator h = _holes.begin(); h != _holes.end(); ++h )
+        {
+            int bridge = findBridge( *h, outer );
+            if ( bridge < 0 )
+                return false;
+
+            int bridgeReverse = split( bridge, *h );
+            filterPoints( bridgeReverse, _nodes[bridgeReverse]._next );
+            outer = filterPoints( bridge, _nodes[bridge]._next );
+        }
+    }
+
+    unsigned start = out.size();
+    out.reserve( start + 3*(total + 2*rings.size()) );
+
+    if ( !clip(outer, reversed, out) )
+    {
+        out.resize( start );
+        return false;
+    }
+
+    return true;
+}
+
+int
+PolygonTessellator::addNode( unsigned index, double x, double y, int last )
+{
+    Node node;
+    node._index = index;
+    node._x     = x;
+    node._y     = y;
+
+    int n = (int)_nodes.size();
+    if ( last < 0 )
+    {
+        node._prev = node._next = n;
+    }
+    else
+    {
+        node._prev = last;
+        node._next = _nodes[last]._next;
+        _nodes[node._next]._prev = n;
+        _nodes[last]._next = n;
+    }
+
+    _nodes.push_back( node );
+    return n;
+}
+
+double
+PolygonTessellator::turn( int a, int b, int c ) const
+{
+    return cross(_nodes[a]._x, _nodes[a]._y, _nodes[b]._x, _nodes[b]._y, _nodes[c]._x, _nodes[c]._y);
+}
+
+void
+PolygonTessellator::removeNode( int n )
+{
+    _nodes[_nodes[n]._next]._prev = _nodes[n]._prev;
+    _nodes[_nodes[n]._prev]._next = _nodes[n]._next;
+}
+
+int
+PolygonTessellator::linkRing( const osg::Vec3Array& verts, const Ring& ring, int axis, bool reverse )
+{
+    int last = -1;
+    double x, y;
+
+    if ( !reverse )
+    {
+        for( unsigned i=0; i<ring._count; ++i )
+        {
+            project( verts[ring._first + i], axis, x, y );
+            last = addNode( ring._first + i, x, y, last );
+        }
+    }
+    else
+    {
+        for( unsigned i=ring._count; i>0; --i )
+        {
+            project( verts[ring._first + i - 1], axis, x, y );
+            last = addNode( ring._first + i - 1, x, y, last );
+        }
+    }
+
+    return last;
+}
+
+// removes duplicate and collinear points between start and end; returns a
+// node that is still in the list.
+int
+PolygonTessellator::filterPoints( int start, int end )
+{
+    if ( end < 0 )
+        end = start;
+
+    int p = start;
+    bool again;
+    do
+    {
+        again = false;
+
+        const Node& n    = _nodes[p];
+        const Node& next = _nodes[n._next];
+
+        if ( (n._x == next._x && n._y == next._y) || turn(n._prev, p, n._next) == 0.0 )
+        {
+            removeNode( p );
+            p = end = n._prev;
+            if ( p == _nodes[p]._next )
+                break;
+            again = true;
+        }
+        else
+        {
+            p = n._next;
+        }
+    }
+    while( again || p != end );
+
+    return end;
+}
+
+int
+PolygonTessellator::leftmost( int start ) const
+{
+    int p = start, result = start;
+    do
+    {
+        if ( _nodes[p]._x < _nodes[result]._x ||
+            (_nodes[p]._x == _nodes[result]._x && _nodes[p]._y < _nodes[result]._y) )
+        {
+            result = p;
+        }
+        p = _nodes[p]._next;
+    }
+    while( p != start );
+
+    return result;
+}
+
+// finds a node on the outer ring that can be connected to the hole's leftmost
+// node without crossing any edge.
+int
+PolygonTessellator::findBridge( int hole, int outer ) const
+{
+    const double hx = _nodes[hole]._x;
+    const double hy = _nodes[hole]._y;
+    double qx = -DBL_MAX;
+    int m = -1;
+
+    // cast a ray from the hole point to the left and find the nearest
+    // (descending) edge it hits; take that edge's leftmost endpoint.
+    int p = outer;
+    do
+    {
+        const Node& a = _nodes[p];
+        const Node& b = _nodes[a._next];
+
+        if ( hy <= a._y && hy >= b._y && b._y != a._y )
+        {
+            double x = a._x + (hy - a._y) * (b._x - a._x) / (b._y - a._y);
+            if ( x <= hx && x > qx )
+            {
+                qx = x;
+                m = a._x < b._x ? p : a._next;
+                if ( x == hx )
+                    return m; // hole touches the outer ring
+            }
+        }
+        p = a._next;
+    }
+    while( p != outer );
+
+    if ( m < 0 )
+        return -1;
+
+    // a reflex vertex inside the triangle (hole, ray hit, m) would block
+    // the bridge; of those, use the one with the smallest angle to the ray.
+    const int    stop = m;
+    const double mx   = _nodes[m]._x;
+    const double my   = _nodes[m]._y;
+    double tanMin = DBL_MAX;
+
+    p = m;
+    do
+    {
+        const Node& n = _nodes[p];
+
+        if ( hx >= n._x && n._x >= mx && hx != n._x &&
+             inTriangle(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, n._x, n._y) )
+        {
+            double t = fabs(hy - n._y) / (hx - n._x);
+            if ( locallyInside(p, hole) && (t < tanMin || (t == tanMin && n._x > _nodes[m]._x)) )
+            {
+                m = p;
+                tanMin = t;
+            }
+        }
+        p = n._next;
+    }
+    while( p != stop );
+
+    return m;
+}
+
+// true if any two edges of the rings properly cross each other. Edges are
+// sorted by their minimum x and swept left to right, so only edges whose
+// x ranges overlap are compared.
+bool
+PolygonTessellator::edgesCross( const osg::Vec3Array& verts, const RingList& rings, int axis )
+{
+    _edges.clear();
+    for( RingList::const_iterator r = rings.begin(); r != rings.end(); ++r )
+    {
+        if ( r->_count < 3 )
+            continue;
+
+        double x0, y0, x1, y1;
+        project( verts[r->_first + r->_count - 1], axis, x0, y0 );
+        for( unsigned i=0; i<r->_count; ++i )
+        {
+            project( verts[r->_first + i], axis, x1, y1 );
+
+            Edge e;
+            e._x0 = x0, e._y0 = y0, e._x1 = x1, e._y1 = y1;
+            e._minX = std::min(x0, x1);
+            e._maxX = std::max(x0, x1);
+            _edges.push_back( e );
+
+            x0 = x1, y0 = y1;
+        }
+    }
+
+    std::sort( _edges.begin(), _edges.end() );
+
+    for( unsigned i=0; i<_edges.size(); ++i )
+    {
+        const Edge& a = _edges[i];
+        for( unsigned j=i+1; j<_edges.size() && _edges[j]._minX <= a._maxX; ++j )
+        {
+            const Edge& b = _edges[j];
+
+            // strictly opposite sides both ways; edges that share an endpoint
+            // (like neighbors in a ring) or are collinear never qualify.
+            double d1 = cross(a._x0, a._y0, a._x1, a._y1, b._x0, b._y0);
+            double d2 = cross(a._x0, a._y0, a._x1, a._y1, b._x1, b._y1);
+            if ( (d1 > 0.0 && d2 < 0.0) || (d1 < 0.0 && d2 > 0.0) )
+            {
+                double d3 = cross(b._x0, b._y0, b._x1, b._y1, a._x0, a._y0);
+                double d4 = cross(b._x0, b._y0, b._x1, b._y1, a._x1, a._y1);
+                if ( (d3 > 0.0 && d4 < 0.0) || (d3 < 0.0 && d4 > 0.0) )
+                    return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// links a to b with a pair of coincident edges, splicing b's ring into a's;
+// returns the copy of b.
+int
+PolygonTessellator::split( int a, int b )
+{
+    Node a2 = _nodes[a];
+    Node b2 = _nodes[b];
+    int an  = _nodes[a]._next;
+    int bp  = _nodes[b]._prev;
+
+    int ia2 = (int)_nodes.size();
+    int ib2 = ia2 + 1;
+    _nodes.push_back( a2 );
+    _nodes.push_back( b2 );
+
+    _nodes[a]._next   = b;
+    _nodes[b]._prev   = a;
+    _nodes[ia2]._next = an;
+    _nodes[an]._prev  = ia2;
+    _nodes[ib2]._next = ia2;
+    _nodes[ia2]._prev = ib2;
+    _nodes[bp]._next  = ib2;
+    _nodes[ib2]._prev = bp;
+
+    return ib2;
+}
+
+bool
+PolygonTessellator::isEar( int ear ) const
+{
+    const Node& a = _nodes[_nodes[ear]._prev];
+    const Node& b = _nodes[ear];
+    const Node& c = _nodes[b._next];
+
+    // reflex or degenerate corner
+    if ( cross(a._x, a._y, b._x, b._y, c._x, c._y) <= 0.0 )
+        return false;
+
+    double minX = std::min(a._x, std::min(b._x, c._x));
+    double minY = std::min(a._y, std::min(b._y, c._y));
+    double maxX = std::max(a._x, std::max(b._x, c._x));
+    double maxY = std::max(a._y, std::max(b._y, c._y));
+
+    // no reflex vertex may lie inside the ear. (Convex vertices cannot
+    // be inside an ear without a reflex vertex being inside too.)
+    for( int p = c._next; p != b._prev; p = _nodes[p]._next )
+    {
+        const Node& n = _nodes[p];
+        if ( n._x < minX || n._x > maxX || n._y < minY || n._y > maxY )
+            continue;
+
+        if ( n._x == a._x && n._y == a._y )
+            continue;
+
+        if ( inTriangle(a._x, a._y, b._x, b._y, c._x, c._y, n._x, n._y) &&
+             turn(n._prev, p, n._next) <= 0.0 )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// true if the diagonal a-b starts off into the interior of the polygon at a.
+bool
+PolygonTessellator::locallyInside( int a, int b ) const
+{
+    int prev = _nodes[a]._prev;
+    int next = _nodes[a]._next;
+
+    return turn(prev, a, next) > 0.0 ?
+        turn(a, b, next) <= 0.0 && turn(a, prev, b) <= 0.0 :
+        turn(a, b, prev) > 0.0  || turn(a, next, b) > 0.0;
+}
+
+bool
+PolygonTessellator::clip( int start, bool reverse, osg::DrawElementsUInt& out )
+{
+    int  ear      = start;
+    int  stop     = ear;
+    bool filtered = false;
+
+    while( _nodes[ear]._prev != _nodes[ear]._next )
+    {
+        int prev = _nodes[ear]._prev;
+        int next = _nodes[ear]._next;
+
+        if ( isEar(ear) )
+        {
+            out.push_back( _nodes[prev]._index );
+            if ( reverse )
+            {
+                out.push_back( _nodes[next]._index );
+                out.push_back( _nodes[ear]._index );
+            }
+            else
+            {
+                out.push_back( _nodes[ear]._index );
+                out.push_back( _nodes[next]._index );
+            }
+
+            removeNode( ear );
+
+            // skip the next vertex; it tends to produce sliver triangles.
+            ear      = _nodes[next]._next;
+            stop     = ear;
+            filtered = false;
+            continue;
+        }
+
+        ear = next;
+
+        // went all the way around without finding an ear. Drop any
+        // degenerate points and try once more; if that fails too, the
+        // polygon is not simple and the caller must fall back.
+        if ( ear == stop )
+        {
+            if ( filtered )
+                return false;
+
+            ear      = filterPoints( ear, -1 );
+            stop     = ear;
+            filtered = true;
+        }
+    }
+
+    return true;
+}
@@ -18,8 +18,23 @@
 */
 #include <osgEarthUtil/DataScanner>
 #include <osgEarthDrivers/gdal/GDALOptions>
+#include <osgEarth/FileUtils>
+#include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
+#include <osgEarth/TaskService>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
+#include <OpenThreads/Thread>
+#include <gdal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
 
 #define LC "[DataScanner] "
 
@@ -31,7 +46,7 @@ namespace
 {
     void traverse(const std::string&              path,
                   const std::vector<std::string>& extensions,
-                  ImageLayerVector&               out_imageLayers)
+                  std::vector<std::string>&       out_files)
     {
         if ( osgDB::fileType(path) == osgDB::DIRECTORY )
         {
@@ -42,7 +57,7 @@ namespace
                     continue;
 
                 std::string filepath = osgDB::concatPaths( path, *f );
-                traverse( filepath, extensions, out_imageLayers );
+                traverse( filepath, extensions, out_files );
             }
         }
 
@@ -52,18 +67,354 @@ namespace
 
             if ( std::find(extensions.begin(), extensions.end(), ext) != extensions.end() )
             {
-                GDALOptions gdal;
-                gdal.url() = path;
-                //gdal.interpolation() = INTERP_NEAREST;
+                out_files.push_back( path );
+            }
+        }
+    }
 
-                ImageLayerOptions options( path, gdal );
-                options.cachePolicy() = CachePolicy::NO_CACHE;
+    ImageLayer* createFileLayer( const std::string& path )
+    {
+        GDALOptions gdal;
+        gdal.url() = path;
+        //gdal.interpolation() = INTERP_NEAREST;
+
+        ImageLayerOptions options( path, gdal );
+        options.cachePolicy() = CachePolicy::NO_CACHE;
+
+        return new ImageLayer(options);
+    }
+
+    //--------------------------------------------------------------------
+
+    const char* CATALOG_HEADER = "# osgEarth data catalog 1";
+
+    // header information for one raster file.
+    struct CatalogEntry
+    {
+        CatalogEntry() :
+            _mtime(0), _size(0), _ok(false), _width(0), _height(0), _bands(0),
+            _blockX(0), _blockY(0), _hasNoData(false), _noData(0.0), _paletted(false)
+        {
+            for( unsigned i = 0; i < 6; ++i )
+                _gt[i] = 0.0;
+        }
+
+        std::string _path;
+        long long   _mtime;
+        long long   _size;
+        bool        _ok;          // false if GDAL could not make sense of the file
+        int         _width;
+        int         _height;
+        int         _bands;
+        int         _blockX;
+        int         _blockY;
+        std::string _dataType;
+        std::string _colorInterp; // comma-separated, one per band
+        double      _gt[6];       // GDAL geotransform
+        bool        _hasNoData;
+        double      _noData;
+        bool        _paletted;
+        std::string _srs;         // WKT
+
+        // files that can be mosaicked share this key
+        std::string getMosaicKey() const
+        {
+            std::stringstream buf;
+            buf << std::setprecision(17)
+                << _bands << '|' << _dataType << '|' << _colorInterp << '|'
+                << _hasNoData << '|' << (_hasNoData ? _noData : 0.0) << '|' << _srs;
+            return buf.str();
+        }
+
+        // north-up, unrotated, non-paletted rasters can join a mosaic
+        bool canMosaic() const
+        {
+            return _ok && !_paletted && _gt[2] == 0.0 && _gt[4] == 0.0 && _gt[1] > 0.0 && _gt[5] < 0.0;
+        }
+    };
+
+    bool getFileStats( const std::string& path, long long& out_mtime, long long& out_size )
+    {
+        struct stat buf;
+        if ( ::stat(path.c_str(), &buf) != 0 )
+            return false;
+        out_mtime = (long long)buf.st_mtime;
+        out_size  = (long long)buf.st_size;
+        return true;
+    }
+
+    void readHeader( CatalogEntry& entry )
+    {
+        entry._ok = false;
+
+        // Opening and closing go through the driver registry and the shared
+        // block cache, so they take the global GDAL lock. The queries in
+        // between only touch this dataset and run in parallel.
+        GDALDatasetH ds;
+        {
+            GDAL_SCOPED_LOCK;
+            ds = GDALOpen( entry._path.c_str(), GA_ReadOnly );
+        }
+        if ( !ds )
+        {
+            OE_WARN << LC << "Failed to open " << entry._path << std::endl;
+            return;
+        }
+
+        entry._width  = GDALGetRasterXSize( ds );
+        entry._height = GDALGetRasterYSize( ds );
+        entry._bands  = GDALGetRasterCount( ds );
+
+        const char* wkt = GDALGetProjectionRef( ds );
+        entry._srs = wkt ? wkt : "";
+
+        if ( entry._bands > 0 && !entry._srs.empty() && GDALGetGeoTransform(ds, entry._gt) == CE_None )
+        {
+            GDALRasterBandH band1 = GDALGetRasterBand( ds, 1 );
+            entry._dataType = GDALGetDataTypeName( GDALGetRasterDataType(band1) );
+            GDALGetBlockSize( band1, &entry._blockX, &entry._blockY );
+
+            int hasNoData = 0;
+            entry._noData    = GDALGetRasterNoDataValue( band1, &hasNoData );
+            entry._hasNoData = hasNoData != 0;
+            entry._paletted  = GDALGetRasterColorTable( band1 ) != 0L;
+
+            std::stringstream buf;
+            for( int b = 1; b <= entry._bands; ++b )
+            {
+                if ( b > 1 ) buf << ',';
+                buf << GDALGetColorInterpretationName(
+                    GDALGetRasterColorInterpretation(GDALGetRasterBand(ds, b)) );
+            }
+            entry._colorInterp = buf.str();
+
+            entry._ok = true;
+        }
+
+        GDAL_SCOPED_LOCK;
+        GDALClose( ds );
+    }
+
+    // reads the headers of a range of catalog entries.
+    struct ReadHeaders
+    {
+        std::vector<CatalogEntry>* _entries;
+        const std::vector<unsigned>* _todo;
+        unsigned _begin, _end;
+
+        void execute()
+        {
+            for( unsigned i = _begin; i < _end; ++i )
+                readHeader( (*_entries)[(*_todo)[i]] );
+        }
+    };
+
+    void splitTabs( const std::string& line, std::vector<std::string>& out )
+    {
+        out.clear();
+        std::string::size_type start = 0;
+        for(;;)
+        {
+            std::string::size_type tab = line.find( '\t', start );
+            out.push_back( line.substr(start, tab == std::string::npos ? std::string::npos : tab-start) );
+            if ( tab == std::string::npos )
+                break;
+            start = tab+1;
+        }
+    }
 
-                ImageLayer* layer = new ImageLayer(options);
-                out_imageLayers.push_back( layer );
-                OE_INFO << LC << "Found " << path << std::endl;
+    // catalog file: a header line followed by one tab-separated line per file.
+    void readCatalog( const std::string& path, std::map<std::string, CatalogEntry>& out_entries )
+    {
+        std::ifstream in( path.c_str() );
+        if ( !in.is_open() )
+            return;
+
+        std::string line;
+        if ( !std::getline(in, line) || line != CATALOG_HEADER )
+        {
+            OE_INFO << LC << "Ignoring catalog " << path << " (unknown format)" << std::endl;
+            return;
+        }
+
+        std::vector<std::string> f;
+        while( std::getline(in, line) )
+        {
+            splitTabs( line, f );
+            if ( f.size() != 21 )
+                continue;
+
+            CatalogEntry e;
+            e._path        = f[0];
+            e._mtime       = as<long long>( f[1], 0 );
+            e._size        = as<long long>( f[2], 0 );
+            e._ok          = f[3] == "1";
+            e._width       = as<int>( f[4], 0 );
+            e._height      = as<int>( f[5], 0 );
+            e._bands       = as<int>( f[6], 0 );
+            e._blockX      = as<int>( f[7], 0 );
+            e._blockY      = as<int>( f[8], 0 );
+            e._dataType    = f[9];
+            e._colorInterp = f[10];
+            for( unsigned i = 0; i < 6; ++i )
+                e._gt[i]   = as<double>( f[11+i], 0.0 );
+            e._hasNoData   = f[17] == "1";
+            e._noData      = as<double>( f[18], 0.0 );
+            e._paletted    = f[19] == "1";
+            e._srs         = f[20];
+            out_entries[e._path] = e;
+        }
+    }
+
+    bool writeCatalog( const std::string& path, const std::vector<CatalogEntry>& entries )
+    {
+        std::ofstream out( path.c_str() );
+        if ( !out.is_open() )
+            return false;
+
+        out << CATALOG_HEADER << "\n" << std::setprecision(17);
+
+        for( std::vector<CatalogEntry>::const_iterator e = entries.begin(); e != entries.end(); ++e )
+        {
+            out << e->_path << '\t' << e->_mtime << '\t' << e->_size << '\t'
+                << (e->_ok ? 1 : 0) << '\t'
+                << e->_width << '\t' << e->_height << '\t' << e->_bands << '\t'
+                << e->_blockX << '\t' << e->_blockY << '\t'
+                << e->_dataType << '\t' << e->_colorInterp;
+            for( unsigned i = 0; i < 6; ++i )
+                out << '\t' << e->_gt[i];
+            out << '\t' << (e->_hasNoData ? 1 : 0) << '\t' << e->_noData << '\t'
+                << (e->_paletted ? 1 : 0) << '\t' << e->_srs << "\n";
+        }
+
+        return !out.fail();
+    }
+
+    std::string escapeXML( const std::string& input )
+    {
+        std::string output;
+        output.reserve( input.size() );
+        for( std::string::const_iterator c = input.begin(); c != input.end(); ++c )
+        {
+            switch( *c )
+            {
+            case '&':  output += "&amp;";  break;
+            case '<':  output += "&lt;";   break;
+            case '>':  output += "&gt;";   break;
+            case '"':  output += "&quot;"; break;
+            default:   output += *c;
             }
         }
+        return output;
+    }
+
+    // writes a GDAL virtual dataset that mosaics the given files at the
+    // finest resolution among them. Parts of the union extent that no file
+    // covers must stay transparent: with a nodata value they are filled with
+    // it, and files with an alpha band leave them at zero alpha. Anything
+    // else gets an extra alpha band that is opaque only over the files.
+    bool writeMosaicVRT( const std::string& path, const std::vector<const CatalogEntry*>& files )
+    {
+        const CatalogEntry& first = *files.front();
+
+        double resX = DBL_MAX, resY = DBL_MAX;
+        double xmin = DBL_MAX, ymin = DBL_MAX, xmax = -DBL_MAX, ymax = -DBL_MAX;
+
+        for( std::vector<const CatalogEntry*>::const_iterator i = files.begin(); i != files.end(); ++i )
+        {
+            const CatalogEntry& e = **i;
+            resX = osg::minimum( resX, e._gt[1] );
+            resY = osg::minimum( resY, -e._gt[5] );
+            xmin = osg::minimum( xmin, e._gt[0] );
+            xmax = osg::maximum( xmax, e._gt[0] + e._width*e._gt[1] );
+            ymax = osg::maximum( ymax, e._gt[3] );
+            ymin = osg::minimum( ymin, e._gt[3] + e._height*e._gt[5] );
+        }
+
+        int width  = (int)ceil( (xmax-xmin)/resX - 0.5 );
+        int height = (int)ceil( (ymax-ymin)/resY - 0.5 );
+        if ( width <= 0 || height <= 0 )
+            return false;
+
+        std::vector<std::string> colorInterp;
+        {
+            std::stringstream buf( first._colorInterp );
+            std::string item;
+            while( std::getline(buf, item, ',') )
+                colorInterp.push_back( item );
+        }
+
+        bool addAlpha =
+            !first._hasNoData &&
+            std::find(colorInterp.begin(), colorInterp.end(), "Alpha") == colorInterp.end();
+
+        std::ofstream out( path.c_str() );
+        if ( !out.is_open() )
+            return false;
+
+        out << std::setprecision(17)
+            << "<VRTDataset rasterXSize=\"" << width << "\" rasterYSize=\"" << height << "\">\n"
+            << "  <SRS>" << escapeXML(first._srs) << "</SRS>\n"
+            << "  <GeoTransform>" << xmin << ", " << resX << ", 0, " << ymax << ", 0, " << -resY << "</GeoTransform>\n";
+
+        for( int b = 1; b <= first._bands; ++b )
+        {
+            out << "  <VRTRasterBand dataType=\"" << first._dataType << "\" band=\"" << b << "\">\n";
+            if ( first._hasNoData )
+                out << "    <NoDataValue>" << first._noData << "</NoDataValue>\n";
+            if ( b <= (int)colorInterp.size() )
+                out << "    <ColorInterp>" << colorInterp[b-1] << "</ColorInterp>\n";
+
+            for( std::vector<const CatalogEntry*>::const_iterator i = files.begin(); i != files.end(); ++i )
+            {
+                const CatalogEntry& e = **i;
+
+                // the source properties let GDAL defer opening the file
+                // until a read touches it.
+                out << "    <SimpleSource>\n"
+                    << "      <SourceFilename relativeToVRT=\"0\">" << escapeXML(e._path) << "</SourceFilename>\n"
+                    << "      <SourceBand>" << b << "</SourceBand>\n"
+                    << "      <SourceProperties RasterXSize=\"" << e._width << "\" RasterYSize=\"" << e._height
+                    << "\" DataType=\"" << e._dataType << "\" BlockXSize=\"" << e._blockX
+                    << "\" BlockYSize=\"" << e._blockY << "\"/>\n"
+                    << "      <SrcRect xOff=\"0\" yOff=\"0\" xSize=\"" << e._width << "\" ySize=\"" << e._height << "\"/>\n"
+                    << "      <DstRect xOff=\"" << (e._gt[0]-xmin)/resX << "\" yOff=\"" << (ymax-e._gt[3])/resY
+                    << "\" xSize=\"" << e._width*e._gt[1]/resX << "\" ySize=\"" << e._height*(-e._gt[5])/resY << "\"/>\n"
+                    << "    </SimpleSource>\n";
+            }
+
+            out << "  </VRTRasterBand>\n";
+        }
+
+        if ( addAlpha )
+        {
+            // each file contributes a constant 255 (any source band scaled by
+            // zero); the uncovered pixels keep the VRT's initial zero.
+            out << "  <VRTRasterBand dataType=\"Byte\" band=\"" << first._bands+1 << "\">\n"
+                << "    <ColorInterp>Alpha</ColorInterp>\n";
+
+            for( std::vector<const CatalogEntry*>::const_iterator i = files.begin(); i != files.end(); ++i )
+            {
+                const CatalogEntry& e = **i;
+                out << "    <ComplexSource>\n"
+                    << "      <SourceFilename relativeToVRT=\"0\">" << escapeXML(e._path) << "</SourceFilename>\n"
+                    << "      <SourceBand>1</SourceBand>\n"
+                    << "      <SourceProperties RasterXSize=\"" << e._width << "\" RasterYSize=\"" << e._height
+                    << "\" DataType=\"" << e._dataType << "\" BlockXSize=\"" << e._blockX
+                    << "\" BlockYSize=\"" << e._blockY << "\"/>\n"
+                    << "      <SrcRect xOff=\"0\" yOff=\"0\" xSize=\"" << e._width << "\" ySize=\"" << e._height << "\"/>\n"
+                    << "      <DstRect xOff=\"" << (e._gt[0]-xmin)/resX << "\" yOff=\"" << (ymax-e._gt[3])/resY
+                    << "\" xSize=\"" << e._width*e._gt[1]/resX << "\" ySize=\"" << e._height*(-e._gt[5])/resY << "\"/>\n"
+                    << "      <ScaleOffset>255</ScaleOffset>\n"
+                    << "      <ScaleRatio>0</ScaleRatio>\n"
+                    << "    </ComplexSource>\n";
+            }
+
+            out << "  </VRTRasterBand>\n";
+        }
+
+        out << "</VRTDataset>\n";
+        return !out.fail();
     }
 }
 
@@ -73,5 +424,169 @@ DataScanner::findImageLayers(const std::string&              absRootPath,
                              const std::vector<std::string>& extensions,
                              ImageLayerVector&               out_imageLayers) const
 {
-    traverse( absRootPath, extensions, out_imageLayers );
+    std::vector<std::string> files;
+    traverse( absRootPath, extensions, files );
+
+    for( std::vector<std::string>::const_iterator f = files.begin(); f != files.end(); ++f )
+    {
+        out_imageLayers.push_back( createFileLayer(*f) );
+        OE_INFO << LC << "Found " << *f << std::endl;
+    }
+}
+
+
+void
+DataScanner::createMosaicLayers(const std::string&              absRootPath,
+                                const std::vector<std::string>& extensions,
+                                ImageLayerVector&               out_imageLayers,
+                                const std::string&              catalogPath) const
+{
+    // by default keep the catalog and mosaics out of the data folder, which
+    // may be read-only or shared; one catalog per scanned folder.
+    std::string catalog = catalogPath;
+    if ( catalog.empty() )
+    {
+        catalog = osgDB::concatPaths(
+            getTempPath(),
+            Stringify() << "osgearth_catalog_" << std::hex << hashString(absRootPath) << ".txt" );
+    }
+
+    std::vector<std::string> found, files;
+    traverse( absRootPath, extensions, found );
+
+    // skip the mosaics written by an earlier scan.
+    std::string mosaicPrefix = osgDB::getNameLessExtension(catalog) + ".";
+    for( std::vector<std::string>::const_iterator f = found.begin(); f != found.end(); ++f )
+    {
+        if ( f->compare(0, mosaicPrefix.size(), mosaicPrefix) != 0 )
+            files.push_back( *f );
+    }
+
+    if ( files.empty() )
+        return;
+
+    // reuse the headers of unchanged files from the previous scan.
+    std::map<std::string, CatalogEntry> previous;
+    readCatalog( catalog, previous );
+
+    std::vector<CatalogEntry> entries( files.size() );
+    std::vector<unsigned> todo;
+
+    for( unsigned i = 0; i < files.size(); ++i )
+    {
+        CatalogEntry& entry = entries[i];
+        entry._path = files[i];
+        getFileStats( entry._path, entry._mtime, entry._size );
+
+        std::map<std::string, CatalogEntry>::const_iterator p = previous.find( entry._path );
+        if ( p != previous.end() && p->second._mtime == entry._mtime && p->second._size == entry._size )
+            entry = p->second;
+        else
+            todo.push_back( i );
+    }
+
+    OE_INFO << LC << files.size() << " files under " << absRootPath << ", "
+        << todo.size() << " to read" << std::endl;
+
+    if ( !todo.empty() )
+    {
+        // make sure GDAL's drivers are registered before the workers start.
+        Registry::instance();
+
+        unsigned numTasks = osg::minimum(
+            (unsigned)osg::maximum(OpenThreads::GetNumberOfProcessors(), 1),
+            (unsigned)todo.size() );
+
+        std::vector<ReadHeaders> tasks( numTasks );
+        for( unsigned t = 0; t < numTasks; ++t )
+        {
+            tasks[t]._entries = &entries;
+            tasks[t]._todo    = &todo;
+            tasks[t]._begin   = (todo.size() * t) / numTasks;
+            tasks[t]._end     = (todo.size() * (t+1)) / numTasks;
+        }
+
+        if ( numTasks > 1 )
+        {
+            osg::ref_ptr<TaskService> service = new TaskService( "DataScanner", numTasks-1 );
+            Threading::MultiEvent semaphore( numTasks-1 );
+
+            for( unsigned t = 1; t < numTasks; ++t )
+            {
+                ParallelTask<ReadHeaders>* task = new ParallelTask<ReadHeaders>( &semaphore );
+                static_cast<ReadHeaders&>(*task) = tasks[t];
+                service->add( task );
+            }
+
+            tasks[0].execute();
+            semaphore.wait();
+        }
+        else
+        {
+            tasks[0].execute();
+        }
+
+        if ( !writeCatalog(catalog, entries) )
+        {
+            OE_WARN << LC << "Failed to write catalog " << catalog << std::endl;
+        }
+    }
+
+    // group the files that can share a mosaic:
+    typedef std::map< std::string, std::vector<const CatalogEntry*> > Groups;
+    Groups groups;
+    std::vector<const CatalogEntry*> loners;
+
+    for( std::vector<CatalogEntry>::const_iterator e = entries.begin(); e != entries.end(); ++e )
+    {
+        if ( e->canMosaic() )
+            groups[e->getMosaicKey()].push_back( &(*e) );
+        else if ( e->_ok )
+            loners.push_back( &(*e) );
+    }
+
+    std::string name = osgDB::getSimpleFileName( absRootPath );
+    unsigned index = 0;
+
+    for( Groups::const_iterator g = groups.begin(); g != groups.end(); ++g )
+    {
+        const std::vector<const CatalogEntry*>& group = g->second;
+
+        if ( group.size() > 1 )
+        {
+            std::stringstream buf;
+            buf << osgDB::getNameLessExtension(catalog) << "." << index << ".vrt";
+            std::string vrt = buf.str();
+
+            if ( writeMosaicVRT(vrt, group) )
+            {
+                std::stringstream layerName;
+                layerName << name << " mosaic";
+                if ( groups.size() > 1 )
+                    layerName << " " << index;
+
+                GDALOptions gdal;
+                gdal.url() = vrt;
+
+                ImageLayerOptions options( layerName.str(), gdal );
+                options.cachePolicy() = CachePolicy::NO_CACHE;
+
+                out_imageLayers.push_back( new ImageLayer(options) );
+                OE_INFO << LC << "Mosaic " << vrt << " combines " << group.size() << " files" << std::endl;
+
+                ++index;
+                continue;
+            }
+
+            OE_WARN << LC << "Failed to write " << vrt << "; using one layer per file" << std::endl;
+        }
+
+        loners.insert( loners.end(), group.begin(), group.end() );
+    }
+
+    for( std::vector<const CatalogEntry*>::const_iterator e = loners.begin(); e != loners.end(); ++e )
+    {
+        out_imageLayers.push_back( createFileLayer((*e)->_path) );
+        OE_INFO << LC << "Found " << (*e)->_path << std::endl;
+    }
 }
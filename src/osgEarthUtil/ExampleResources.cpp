@@ -724,7 +724,7 @@ MapNodeHelper::parse(MapNode*             mapNode,
         OE_INFO << LC << "Loading images from " << imageFolder << "..." << std::endl;
         ImageLayerVector imageLayers;
         DataScanner scanner;
-        scanner.findImageLayers( imageFolder, extensions, imageLayers );
+        scanner.createMosaicLayers( imageFolder, extensions, imageLayers );
 
         if ( imageLayers.size() > 0 )
         {
@@ -735,7 +735,7 @@ MapNodeHelper::parse(MapNode*             mapNode,
             }
             mapNode->getMap()->endUpdate();
         }
-        OE_INFO << LC << "...found " << imageLayers.size() << " image layers." << std::endl;
+        OE_INFO << LC << "...created " << imageLayers.size() << " image layers." << std::endl;
     }
 
     // Install a normal map layer.
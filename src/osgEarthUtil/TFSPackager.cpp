@@ -19,8 +19,17 @@
 #include <osgEarthUtil/TFSPackager>
 
 #include <osgEarth/Registry>
+#include <osgEarth/TaskService>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
+#include <osg/Timer>
+#include <OpenThreads/Condition>
+#include <OpenThreads/Thread>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <queue>
 
 #define LC "[TFSPackager] "
 
@@ -29,260 +38,383 @@ using namespace osgEarth::Features;
 using namespace osgEarth::Symbology;
 using namespace osgEarth::Util;
 
-/******************************************************************************************/
-class FeatureTileVisitor;
-class FeatureTile;
+// Deepest level a Z-order code can address
+#define MAX_CODE_LEVEL 31
 
-typedef std::list< osgEarth::Features::FeatureID > FeatureIDList;
+/******************************************************************************************/
 
-class FeatureTile : public osg::Referenced
-{
-public:
-    FeatureTile( const TileKey& key ):
-      _key( key ),
-          _isSplit( false )
-      {        
-      }
-
-      const GeoExtent& getExtent() const
-      {
-          return _key.getExtent();
-      }
-
-      const TileKey& getKey() const
-      {
-          return _key;
-      }
-
-      bool getIsSplit() const { return _isSplit;}
-
-      void split()
-      {
-          if (!_isSplit)
-          {
-              for (unsigned int i = 0; i < 4; ++i)
-              {  
-                  _children[i] = new FeatureTile(_key.createChildKey( i ) );
-              }
-              _isSplit = true;
-          }
-      }
-
-      void accept( FeatureTileVisitor* v);
-
-      void traverse( FeatureTileVisitor* v )
-      {
-          if (_isSplit)
-          {
-              for (unsigned int i = 0; i < 4; ++i)
-              {
-                  _children[i]->accept( v );
-              }
-          }
-      }
-
-      FeatureIDList& getFeatures()
-      {
-          return _features;
-      }
-
-
-private:    
-    FeatureIDList _features;
-    TileKey _key;   
-    osg::ref_ptr<FeatureTile> _children[4];
-    bool _isSplit;
-};
-
-class FeatureTileVisitor : public osg::Referenced
+namespace
 {
-public:
-    virtual void traverse(FeatureTile* tile)
+    // Spreads the low 32 bits of v apart so they occupy the even bits.
+    unsigned long long spread( unsigned long long v )
     {
-        tile->traverse( this );
+        v &= 0x00000000ffffffffULL;
+        v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+        v = (v | (v <<  8)) & 0x00ff00ff00ff00ffULL;
+        v = (v | (v <<  4)) & 0x0f0f0f0f0f0f0f0fULL;
+        v = (v | (v <<  2)) & 0x3333333333333333ULL;
+        v = (v | (v <<  1)) & 0x5555555555555555ULL;
+        return v;
     }
-};
 
-void FeatureTile::accept(FeatureTileVisitor* v)
-{    
-    v->traverse( this );
-}
+    // Inverse of spread().
+    unsigned compact( unsigned long long v )
+    {
+        v &= 0x5555555555555555ULL;
+        v = (v | (v >>  1)) & 0x3333333333333333ULL;
+        v = (v | (v >>  2)) & 0x0f0f0f0f0f0f0f0fULL;
+        v = (v | (v >>  4)) & 0x00ff00ff00ff00ffULL;
+        v = (v | (v >>  8)) & 0x0000ffff0000ffffULL;
+        v = (v | (v >> 16)) & 0x00000000ffffffffULL;
+        return (unsigned)v;
+    }
 
-/******************************************************************************************/
+    unsigned long long morton( unsigned x, unsigned y )
+    {
+        return spread(x) | (spread(y) << 1);
+    }
 
-class AddFeatureVisitor : public FeatureTileVisitor
-{
-public:
-    AddFeatureVisitor( Feature* feature, int maxFeatures, int firstLevel, int maxLevel, CropFilter::Method cropMethod):
-      _feature( feature ),
-          _maxFeatures( maxFeatures ),      
-          _maxLevel( maxLevel ),
-          _firstLevel( firstLevel ),
-          _added(false),
-          _numAdded( 0 ),
-          _levelAdded(-1),
-          _cropMethod( cropMethod )
-      {
-
-      }
-
-      virtual void traverse( FeatureTile* tile)
-      {        
-          if (_added && _cropMethod != CropFilter::METHOD_CROPPING) return;
-
-          bool traverse = true;
-
-          GeoExtent featureExtent(_feature->getSRS(), _feature->getGeometry()->getBounds());
-
-          bool valid = false;
-          // It's a single point, so we do a contains check instead of an intersection check b/c the bounds really aren't valid.
-          if (featureExtent.width() == 0 && featureExtent.height() == 0)
-          {                            
-              valid = tile->getExtent().contains( featureExtent.xMin(), featureExtent.yMin());
-          }
-          else
-          {
-              // Do a normal intersection check
-              valid = featureExtent.intersects( tile->getExtent());
-          }
-
-          if (valid)
-          {
-              //If the node contains the feature, and it doesn't contain the max number of features add it.  If it's already full then 
-              //split it.
-              if (tile->getKey().getLevelOfDetail() >= (unsigned int)_firstLevel && 
-                  (tile->getFeatures().size() < (unsigned int)_maxFeatures || tile->getKey().getLevelOfDetail() == _maxLevel || tile->getKey().getLevelOfDetail() == _levelAdded))
-              {
-                  if (_levelAdded < 0 || _levelAdded == tile->getKey().getLevelOfDetail())
-                  {
-                      osg::ref_ptr< Feature > clone = new Feature( *_feature, osg::CopyOp::DEEP_COPY_ALL );
-                      FeatureList features;
-                      features.push_back( clone );
-
-                      CropFilter cropFilter(_cropMethod);
-                      FilterContext context(0);
-                      context.extent() = tile->getExtent();
-                      cropFilter.push( features, context );
-
-
-                      if (!features.empty() && clone->getGeometry() && clone->getGeometry()->isValid())
-                      {
-                          //tile->getFeatures().push_back( clone );
-                          tile->getFeatures().push_back( clone->getFID() );
-                          _added = true;
-                          _levelAdded = tile->getKey().getLevelOfDetail();
-                          _numAdded++;                   
-                          traverse = false;
-                      }
-                  }
-
-                  if (traverse || _cropMethod == CropFilter::METHOD_CROPPING)
-                  {
-                      tile->traverse( this );
-                  }
-              }
-              else
-              {   
-                  tile->split();
-                  tile->traverse( this );
-              }
-
-          }          
-      }
-
-      int _levelAdded;
-
-      bool _added;
-      int _maxFeatures;
-      int _firstLevel;
-      int _maxLevel;
-      int _numAdded;
-
-      CropFilter::Method _cropMethod;
-
-
-
-      osg::ref_ptr< Feature > _feature;
-};
+    /**
+     * What the packager keeps of each feature: the Z-order code of its
+     * centroid at the deepest level, its position in the input, and its bounds.
+     */
+    struct FeatureRecord
+    {
+        unsigned long long _code;
+        unsigned long long _seq;
+        FeatureID          _fid;
+        double             _xmin, _ymin, _xmax, _ymax;
+
+        bool operator < (const FeatureRecord& rhs) const {
+            return _code < rhs._code || (_code == rhs._code && _seq < rhs._seq);
+        }
+    };
 
+    // orders records by input position, for the per-tile selection heap
+    struct SeqLess
+    {
+        bool operator()(const FeatureRecord& lhs, const FeatureRecord& rhs) const {
+            return lhs._seq < rhs._seq;
+        }
+    };
 
-/******************************************************************************************/
-class WriteFeaturesVisitor : public FeatureTileVisitor
-{
-public:
-    WriteFeaturesVisitor(FeatureSource* features, const std::string& dest, CropFilter::Method cropMethod, const SpatialReference* srs):
-      _dest( dest ),
-          _features( features ),
+    /**
+     * Assignment of a feature to an output tile. The tile is the Z-order code
+     * of its (x,y) position at its level.
+     */
+    struct Placement
+    {
+        unsigned           _level;
+        unsigned long long _tile;
+        unsigned long long _seq;
+        FeatureID          _fid;
+
+        bool operator < (const Placement& rhs) const {
+            if ( _level != rhs._level ) return _level < rhs._level;
+            if ( _tile  != rhs._tile  ) return _tile  < rhs._tile;
+            return _seq < rhs._seq;
+        }
+    };
+
+    /**
+     * Sorts a stream of plain records with bounded memory. Records accumulate
+     * in memory; when the buffer fills up it is sorted and spilled to a
+     * temporary file (a "run"). sort() merges the runs into a single sorted
+     * file, which can then be read back any number of times.
+     */
+    template<typename T>
+    class ExternalSorter
+    {
+    public:
+        ExternalSorter( const std::string& pathPrefix, unsigned maxInMemory )
+            : _prefix(pathPrefix), _maxInMemory(osg::maximum(maxInMemory, 1024u)),
+              _count(0), _inMemory(true), _pos(0), _ok(true) { }
+
+        ~ExternalSorter()
+        {
+            _input.close();
+            for( unsigned i=0; i<_runs.size(); ++i )
+                ::remove( _runs[i].c_str() );
+            if ( !_inMemory )
+                ::remove( sortedPath().c_str() );
+        }
+
+        void add( const T& rec )
+        {
+            _buffer.push_back( rec );
+            ++_count;
+            if ( _buffer.size() >= _maxInMemory )
+                spill();
+        }
+
+        unsigned long long size() const { return _count; }
+
+        /** Ends input and sorts. Returns false if a temporary file failed. */
+        bool sort()
+        {
+            if ( _runs.empty() )
+            {
+                std::sort( _buffer.begin(), _buffer.end() );
+            }
+            else
+            {
+                if ( !_buffer.empty() )
+                    spill();
+
+                _inMemory = false;
+                if ( _ok )
+                    merge();
+            }
+            return _ok && rewind();
+        }
+
+        /** Restarts reading the sorted records from the beginning. */
+        bool rewind()
+        {
+            _pos = 0;
+            if ( !_inMemory )
+            {
+                _input.close();
+                _input.clear();
+                _input.open( sortedPath().c_str(), std::ios::in | std::ios::binary );
+                _ok = _ok && _input.is_open();
+            }
+            return _ok;
+        }
+
+        /** Reads the next sorted record. */
+        bool next( T& out )
+        {
+            if ( _inMemory )
+            {
+                if ( _pos >= _buffer.size() )
+                    return false;
+                out = _buffer[_pos++];
+                return true;
+            }
+            else
+            {
+                return _input.read( (char*)&out, sizeof(T) ).gcount() == sizeof(T);
+            }
+        }
+
+    private:
+        std::string sortedPath() const { return _prefix + ".tmp"; }
+
+        void spill()
+        {
+            std::sort( _buffer.begin(), _buffer.end() );
+
+            std::string path = Stringify() << _prefix << "_" << _runs.size() << ".tmp";
+            std::ofstream out( path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+            if ( out.is_open() )
+            {
+                out.write( (const char*)&_buffer[0], _buffer.size()*sizeof(T) );
+                out.close();
+            }
+            if ( out.fail() )
+            {
+                OE_WARN << LC << "Failed to write temporary file " << path << std::endl;
+                _ok = false;
+            }
+            _runs.push_back( path );
+
+            // release the memory, not just the contents
+            std::vector<T>().swap( _buffer );
+        }
+
+        struct Head
+        {
+            T        _rec;
+            unsigned _run;
+            bool operator < (const Head& rhs) const { return rhs._rec < _rec; } // min-heap
+        };
+
+        // k-way merge of the runs into the sorted file.
+        void merge()
+        {
+            std::vector<std::ifstream*> runs;
+            std::priority_queue<Head> heads;
+
+            for( unsigned i=0; i<_runs.size(); ++i )
+            {
+                runs.push_back( new std::ifstream(_runs[i].c_str(), std::ios::in | std::ios::binary) );
+                Head h;
+                h._run = i;
+                if ( runs[i]->read((char*)&h._rec, sizeof(T)).gcount() == sizeof(T) )
+                    heads.push( h );
+            }
+
+            std::ofstream out( sortedPath().c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+            if ( out.is_open() )
+            {
+                while( !heads.empty() )
+                {
+                    Head h = heads.top();
+                    heads.pop();
+                    out.write( (const char*)&h._rec, sizeof(T) );
+                    if ( runs[h._run]->read((char*)&h._rec, sizeof(T)).gcount() == sizeof(T) )
+                        heads.push( h );
+                }
+                out.close();
+            }
+            _ok = !out.fail();
+            if ( !_ok )
+            {
+                OE_WARN << LC << "Failed to write temporary file " << sortedPath() << std::endl;
+            }
+
+            for( unsigned i=0; i<runs.size(); ++i )
+            {
+                delete runs[i];
+                ::remove( _runs[i].c_str() );
+            }
+            _runs.clear();
+        }
+
+        std::string              _prefix;
+        unsigned                 _maxInMemory;
+        unsigned long long       _count;
+        std::vector<T>           _buffer;
+        std::vector<std::string> _runs;
+        bool                     _inMemory;
+        unsigned                 _pos;
+        std::ifstream            _input;
+        bool                     _ok;
+    };
+
+    /**
+     * Counts the tile write tasks in flight, and blocks the producer while
+     * there are too many.
+     */
+    class WriteThrottle
+    {
+    public:
+        WriteThrottle( unsigned maxInFlight, ProgressCallback* progress )
+            : _maxInFlight(osg::maximum(maxInFlight, 1u)), _inFlight(0), _submitted(0), _written(0), _progress(progress), _canceled(false) { }
+
+        bool acquire()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            while( _inFlight >= _maxInFlight && !_canceled )
+                _cond.wait( &_mutex );
+            if ( _canceled )
+                return false;
+            ++_inFlight;
+            ++_submitted;
+            return true;
+        }
+
+        void release()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            --_inFlight;
+            ++_written;
+            if ( _progress.valid() && _progress->reportProgress(_written, _submitted) )
+                _canceled = true;
+            _cond.broadcast();
+        }
+
+        void waitForAll()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            while( _inFlight > 0 )
+                _cond.wait( &_mutex );
+        }
+
+        bool canceled() const { return _canceled; }
+        unsigned getNumWritten() const { return _written; }
+
+    private:
+        OpenThreads::Mutex             _mutex;
+        OpenThreads::Condition         _cond;
+        unsigned                       _maxInFlight;
+        unsigned                       _inFlight;
+        unsigned                       _submitted;
+        unsigned                       _written;
+        osg::ref_ptr<ProgressCallback> _progress;
+        volatile bool                  _canceled;
+    };
+
+    /**
+     * Writes the features of one tile out as GeoJSON. The features are read
+     * from the source beforehand, on the producer thread, since a feature
+     * source need not be safe to read from several threads at once.
+     */
+    class WriteTileTask : public TaskRequest
+    {
+    public:
+        WriteTileTask(const TileKey& key, FeatureList& features, const std::string& dest, CropFilter::Method cropMethod, const SpatialReference* srs, WriteThrottle* throttle):
+          _key( key ),
+          _dest( dest ),
           _cropMethod( cropMethod ),
-          _srs( srs )
-      {
-
-      }
-
-      virtual void traverse( FeatureTile* tile)
-      {
-          if (tile->getFeatures().size() > 0)
-          {                 
-              //Actually load up the features
-              FeatureList features;
-              for (FeatureIDList::const_iterator i = tile->getFeatures().begin(); i != tile->getFeatures().end(); i++)
-              {
-                  Feature* f = _features->getFeature( *i );                  
-
-                  if (f)
-                  {
-                      //Reproject the feature to the dest SRS if it's not already
-                      if (!f->getSRS()->isEquivalentTo( _srs ) )
-                      {
-                          f->transform( _srs );
-                      }
-                      features.push_back( f );
-                  }
-                  else
-                  {
-                      OE_NOTICE << "couldn't get feature " << *i << std::endl;
-                  }
-              }
-
-              //Need to do the cropping again since these are brand new features coming from the feature source.
-              CropFilter cropFilter(_cropMethod);
-              FilterContext context(0);
-              context.extent() = tile->getExtent();
-              cropFilter.push( features, context );
-
-              std::string contents = Feature::featuresToGeoJSON( features );
-              std::stringstream buf;
-              int x =  tile->getKey().getTileX();
-              unsigned int numRows, numCols;
-              tile->getKey().getProfile()->getNumTiles(tile->getKey().getLevelOfDetail(), numCols, numRows);
-              int y  = numRows - tile->getKey().getTileY() - 1;
-
-              buf << _dest << "/" << tile->getKey().getLevelOfDetail() << "/" << x << "/" << y << ".json";
-              std::string filename = buf.str();
-              //OE_NOTICE << "Writing " << features.size() << " features to " << filename << std::endl;
-
-              if ( !osgDB::fileExists( osgDB::getFilePath(filename) ) )
-                  osgDB::makeDirectoryForFile( filename );
-
-
-              std::fstream output( filename.c_str(), std::ios_base::out );
-              if ( output.is_open() )
-              {
-                  output << contents;
-                  output.flush();
-                  output.close();                
-              }            
-          }
-          tile->traverse( this );        
-      }
-
-      osg::ref_ptr< FeatureSource > _features;
-      std::string _dest;      
-      CropFilter::Method _cropMethod;
-      osg::ref_ptr< const SpatialReference > _srs;
-};
+          _srs( srs ),
+          _throttle( throttle )
+        {
+            _features.swap( features );
+        }
+
+        void operator()(ProgressCallback*)
+        {
+            FeatureList features;
+            features.swap( _features );
+
+            //Reproject the features to the dest SRS if they're not already
+            for (FeatureList::iterator i = features.begin(); i != features.end(); ++i)
+            {
+                if (!i->get()->getSRS()->isEquivalentTo( _srs ) )
+                {
+                    i->get()->transform( _srs );
+                }
+            }
+
+            //Need to do the cropping again since these are brand new features coming from the feature source.
+            //(Centroid placement was already settled when the tile tree was built.)
+            if ( _cropMethod == CropFilter::METHOD_CROPPING )
+            {
+                CropFilter cropFilter(_cropMethod);
+                FilterContext context(0);
+                context.extent() = _key.getExtent();
+                cropFilter.push( features, context );
+            }
+
+            if ( !features.empty() )
+            {
+                std::string contents = Feature::featuresToGeoJSON( features );
+                std::stringstream buf;
+                int x =  _key.getTileX();
+                unsigned int numRows, numCols;
+                _key.getProfile()->getNumTiles(_key.getLevelOfDetail(), numCols, numRows);
+                int y  = numRows - _key.getTileY() - 1;
+
+                buf << _dest << "/" << _key.getLevelOfDetail() << "/" << x << "/" << y << ".json";
+                std::string filename = buf.str();
+                //OE_NOTICE << "Writing " << features.size() << " features to " << filename << std::endl;
+
+                if ( !osgDB::fileExists( osgDB::getFilePath(filename) ) )
+                    osgDB::makeDirectoryForFile( filename );
 
 
+                std::fstream output( filename.c_str(), std::ios_base::out );
+                if ( output.is_open() )
+                {
+                    output << contents;
+                    output.flush();
+                    output.close();
+                }
+            }
+
+            _throttle->release();
+        }
+
+        TileKey _key;
+        FeatureList _features;
+        std::string _dest;
+        CropFilter::Method _cropMethod;
+        osg::ref_ptr< const SpatialReference > _srs;
+        WriteThrottle* _throttle;
+    };
+}
 
 /******************************************************************************************/
 
@@ -290,12 +422,14 @@ TFSPackager::TFSPackager():
 _firstLevel( 0 ),
     _maxLevel( 10 ),
     _maxFeatures( 300 ),
+    _maxRecordsInMemory( 1000000 ),
+    _numThreads( (unsigned)osg::maximum(OpenThreads::GetNumberOfProcessors(), 1) ),
     _method( CropFilter::METHOD_CENTROID )
 {
 }
 
 void
-    TFSPackager::package( FeatureSource* features, const std::string& destination, const std::string& layername, const std::string& description )
+    TFSPackager::package( FeatureSource* features, const std::string& destination, const std::string& layername, const std::string& description, ProgressCallback* progress )
 {   
     if (!_destSRSString.empty())
     {
@@ -318,20 +452,36 @@ void
 
     osg::ref_ptr< const osgEarth::Profile > profile = osgEarth::Profile::create(extent.getSRS(), extent.xMin(), extent.yMin(), extent.xMax(), extent.yMax(), 1, 1);
 
+    const GeoExtent& rootExtent = profile->getExtent();
+
+    osgDB::makeDirectory( destination );
+    std::string tempPath = _tempPath.empty() ? destination : _tempPath;
+    osgDB::makeDirectory( tempPath );
+
+    // Records are coded at the deepest level the tree can reach.
+    unsigned depth      = std::min( _maxLevel, (unsigned)MAX_CODE_LEVEL );
+    unsigned firstLevel = std::min( _firstLevel, depth );
+    unsigned cells      = 1u << depth;
+    bool     cropping   = _method == CropFilter::METHOD_CROPPING;
 
-    TileKey rootKey = TileKey(0, 0, 0, profile );    
+    osg::Timer_t startTime = osg::Timer::instance()->tick();
 
+    //Pass 1: read the features once, keeping only an ID and the bounds of each
+    ExternalSorter<FeatureRecord> records( osgDB::concatPaths(tempPath, ".tfs_features"), _maxRecordsInMemory );
 
-    osg::ref_ptr< FeatureTile > root = new FeatureTile( rootKey );
-    //Loop through all the features and try to insert them into the quadtree
     osg::ref_ptr< FeatureCursor > cursor = features->createFeatureCursor( _query );
     int added = 0;
     int failed = 0;
     int skipped = 0;
-    int highestLevel = 0;
 
     while (cursor.valid() && cursor->hasMore())
     {        
+        if ( progress && progress->isCanceled() )
+        {
+            OE_WARN << LC << "Packaging canceled" << std::endl;
+            return;
+        }
+
         osg::ref_ptr< Feature > feature = cursor->nextFeature();
 
         //Reproject the feature to the dest SRS if it's not already
@@ -342,44 +492,253 @@ void
 
         if (feature->getGeometry() && feature->getGeometry()->getBounds().valid() && feature->getGeometry()->isValid())
         {
+            Bounds bounds = feature->getGeometry()->getBounds();
+            osg::Vec3d centroid = bounds.center();
 
-            AddFeatureVisitor v(feature.get(), _maxFeatures, _firstLevel, _maxLevel, _method);
-            root->accept( &v );
-            if (!v._added)
+            // When cropping, a feature that overlaps the root extent is kept even if its
+            // centroid falls outside; with the centroid method it has nowhere to go.
+            bool inside = rootExtent.contains( centroid.x(), centroid.y() );
+            if ( !inside && cropping )
+                inside = rootExtent.intersects( GeoExtent(_srs.get(), bounds) );
+
+            if ( inside )
+            {
+                double u = (centroid.x() - rootExtent.xMin()) / rootExtent.width();
+                double v = (centroid.y() - rootExtent.yMin()) / rootExtent.height();
+                unsigned ix = (unsigned)osg::clampBetween( (double)cells * u, 0.0, (double)(cells-1) );
+                unsigned iy = (unsigned)osg::clampBetween( (double)cells * v, 0.0, (double)(cells-1) );
+
+                FeatureRecord rec;
+                rec._code = morton( ix, iy );
+                rec._seq  = records.size();
+                rec._fid  = feature->getFID();
+                rec._xmin = bounds.xMin(); rec._ymin = bounds.yMin();
+                rec._xmax = bounds.xMax(); rec._ymax = bounds.yMax();
+                records.add( rec );
+                added++;
+            }
+            else
             {
                 OE_NOTICE << "Failed to add feature " << feature->getFID() << std::endl;
                 failed++;
             }
-            else
-            {                
-                if (highestLevel < v._levelAdded)
-                {
-                    highestLevel = v._levelAdded;
-                }
-                added++;
-                OE_DEBUG << "Added " << added << std::endl;
-            }   
         }
         else
         {
             OE_NOTICE << "Skipping feature " << feature->getFID() << " with null or invalid geometry" << std::endl;
             skipped++;
         }
-    }   
+    }
+    cursor = 0L;
+
     OE_NOTICE << "Added=" << added << " Skipped=" << skipped << " Failed=" << failed << std::endl;
 
-#if 1
+    if ( !records.sort() )
+    {
+        OE_WARN << LC << "Failed to sort the feature records; packaging aborted" << std::endl;
+        return;
+    }
+
+    //Pass 2: build the tree one level at a time. At each level, every tile keeps the first
+    //maxFeatures (in input order) of the features not taken by its ancestors and passes the
+    //rest down to its children; the max level keeps everything that is left.
+    //"full" records, for each tile that passed features down, the last input position it kept.
+    typedef std::pair<unsigned, unsigned long long> TileID;
+    typedef std::map<TileID, unsigned long long> FullTileMap;
+    FullTileMap full;
+
+    ExternalSorter<Placement> placements( osgDB::concatPaths(tempPath, ".tfs_placements"), _maxRecordsInMemory );
+
+    unsigned highestLevel = firstLevel;
+    unsigned tilesSplit   = 0;
+
+    // Records arrive in Z-order, so the coarser tile a record falls in only
+    // changes now and then; remember the last lookup at each level.
+    std::vector<unsigned long long> cachedTile( depth+1, ~0ULL );
+    std::vector<unsigned long long> cachedLimit( depth+1, 0ULL );
+
+    for( unsigned level = firstLevel; level <= depth; ++level )
+    {
+        if ( level > firstLevel && !records.rewind() )
+            break;
+
+        unsigned shift = 2*(depth - level);
+        bool     last  = level == depth;
+        bool     anyFull = false;
+        unsigned tileDim = 1u << level;
+        double   tileW   = rootExtent.width()  / (double)tileDim;
+        double   tileH   = rootExtent.height() / (double)tileDim;
+
+        std::priority_queue<FeatureRecord, std::vector<FeatureRecord>, SeqLess> kept;
+        unsigned long long currentTile = 0;
+        unsigned long long groupSize   = 0;
+        bool     more = true;
+
+        while( more )
+        {
+            FeatureRecord rec;
+            more = records.next( rec );
+
+            if ( more )
+            {
+                // skip records already taken at a coarser level.
+                bool taken = false;
+                for( unsigned l = firstLevel; l < level && !taken; ++l )
+                {
+                    unsigned long long t = rec._code >> 2*(depth-l);
+                    if ( t != cachedTile[l] )
+                    {
+                        FullTileMap::const_iterator f = full.find( TileID(l, t) );
+                        cachedTile[l]  = t;
+                        cachedLimit[l] = f != full.end() ? f->second : ~0ULL;
+                    }
+                    taken = rec._seq <= cachedLimit[l];
+                }
+                if ( taken )
+                    continue;
+            }
+
+            unsigned long long tile = more ? rec._code >> shift : 0ULL;
+
+            // a tile is complete: place the features it keeps.
+            if ( groupSize > 0 && (!more || tile != currentTile) )
+            {
+                if ( groupSize > kept.size() )
+                {
+                    full[TileID(level, currentTile)] = kept.top()._seq;
+                    anyFull = true;
+                    tilesSplit++;
+                }
+
+                for( ; !kept.empty(); kept.pop() )
+                {
+                    const FeatureRecord& r = kept.top();
+                    Placement p;
+                    p._level = level;
+                    p._seq   = r._seq;
+                    p._fid   = r._fid;
+
+                    if ( cropping )
+                    {
+                        // add the feature to every tile at this level that it overlaps.
+                        unsigned x0 = (unsigned)osg::clampBetween( (r._xmin - rootExtent.xMin())/tileW, 0.0, (double)(tileDim-1) );
+                        unsigned x1 = (unsigned)osg::clampBetween( (r._xmax - rootExtent.xMin())/tileW, 0.0, (double)(tileDim-1) );
+                        unsigned y0 = (unsigned)osg::clampBetween( (r._ymin - rootExtent.yMin())/tileH, 0.0, (double)(tileDim-1) );
+                        unsigned y1 = (unsigned)osg::clampBetween( (r._ymax - rootExtent.yMin())/tileH, 0.0, (double)(tileDim-1) );
+                        for( unsigned y = y0; y <= y1; ++y )
+                        {
+                            for( unsigned x = x0; x <= x1; ++x )
+                            {
+                                p._tile = morton( x, y );
+                                placements.add( p );
+                            }
+                        }
+                    }
+                    else
+                    {
+                        p._tile = currentTile;
+                        placements.add( p );
+                    }
+                }
+
+                highestLevel = level;
+                groupSize = 0;
+            }
+
+            if ( more )
+            {
+                currentTile = tile;
+                ++groupSize;
+                kept.push( rec );
+                if ( !last && kept.size() > _maxFeatures )
+                    kept.pop();
+            }
+        }
+
+        if ( !anyFull )
+            break;
+    }
+
+    full.clear();
+
+    OE_NOTICE << LC << "Built tile tree in " << osg::Timer::instance()->delta_s(startTime, osg::Timer::instance()->tick())
+        << " s; " << tilesSplit << " tiles subdivided" << std::endl;
+
     // Print the width of tiles at each level
-    for (int i = 0; i <= highestLevel; ++i)
+    for (unsigned i = 0; i <= highestLevel; ++i)
     {
         TileKey tileKey(i, 0, 0, profile);
         GeoExtent tileExtent = tileKey.getExtent();
         OE_NOTICE << "Level " << i << " tile size: " << tileExtent.width() << std::endl;
     }
-#endif
 
-    WriteFeaturesVisitor write(features, destination, _method, _srs);
-    root->accept( &write );
+    if ( !placements.sort() )
+    {
+        OE_WARN << LC << "Failed to sort the tile placements; packaging aborted" << std::endl;
+        return;
+    }
+
+    //Pass 3: read each tile's features and write the tiles in parallel
+    {
+        osg::ref_ptr<TaskService> service = new TaskService( "TFS Packager", osg::maximum(_numThreads, 1u) );
+        WriteThrottle throttle( 4 * osg::maximum(_numThreads, 1u), progress );
+
+        std::vector<FeatureID> fids;
+        Placement current;
+        bool more = true;
+        while( more && !throttle.canceled() )
+        {
+            Placement p;
+            more = placements.next( p );
+
+            if ( !fids.empty() && (!more || p._level != current._level || p._tile != current._tile) )
+            {
+                unsigned numRows = 1u << current._level;
+                TileKey key( current._level, compact(current._tile), numRows - compact(current._tile >> 1) - 1, profile.get() );
+
+                if ( !throttle.acquire() )
+                    break;
+
+                //Load the tile's features here; the tasks only transform and write them
+                FeatureList tileFeatures;
+                for (std::vector<FeatureID>::const_iterator i = fids.begin(); i != fids.end(); ++i)
+                {
+                    Feature* f = features->getFeature( *i );
+                    if (f)
+                    {
+                        tileFeatures.push_back( f );
+                    }
+                    else
+                    {
+                        OE_NOTICE << "couldn't get feature " << *i << std::endl;
+                    }
+                }
+
+                service->add( new WriteTileTask(key, tileFeatures, destination, _method, _srs.get(), &throttle) );
+                fids.clear();
+            }
+
+            if ( more )
+            {
+                current = p;
+                fids.push_back( p._fid );
+            }
+        }
+
+        throttle.waitForAll();
+
+        double elapsed = osg::Timer::instance()->delta_s( startTime, osg::Timer::instance()->tick() );
+        OE_NOTICE << LC << "Wrote " << throttle.getNumWritten() << " tiles in " << elapsed << " s" << std::endl;
+
+        if ( throttle.canceled() )
+        {
+            OE_WARN << LC << "Packaging canceled" << std::endl;
+            return;
+        }
+    }
+
+    if ( progress )
+        progress->onCompleted();
 
     //Write out the meta doc
     TFSLayer layer;
@@ -392,4 +751,3 @@ void
     TFSReaderWriter::write( layer, osgDB::concatPaths( destination, "tfs.xml"));
 
 }
-
@@ -21,184 +21,622 @@
 #include <osgEarth/ImageUtils>
 #include <osgEarth/ImageToHeightFieldConverter>
 #include <osgEarth/TaskService>
+#include <osgEarthDrivers/mbtiles/MBTilesOptions>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
-#include <osgDB/WriteFile>
+#include <osgDB/Registry>
+#include <OpenThreads/Condition>
+#include <OpenThreads/Thread>
+#include <osg/Timer>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <sstream>
 
 #define LC "[TMSPackager] "
 
 using namespace osgEarth::Util;
+using namespace osgEarth::Drivers;
 using namespace osgEarth;
 
+#define JOURNAL_FILENAME ".tms_journal"
+
 
 namespace
 {
-    struct CreateImageTileTask
+    // parses a folder or file name that must be all digits.
+    bool parseIndex(const std::string& str, unsigned& out)
+    {
+        if ( str.empty() || str.find_first_not_of("0123456789") != std::string::npos )
+            return false;
+        out = as<unsigned>( str, 0u );
+        return true;
+    }
+
+    /**
+     * A set of tiles, one bit per tile. Each level allocates its bits in
+     * blocks of 16x16 tiles as tiles are added, so the tiles of a quadtree
+     * export (which come in clusters) cost about a bit apiece.
+     */
+    class TileSet
     {
-        void init(ImageLayer* layer, const TileKey& key, const std::string& path, const std::string& extension, osgDB::Options* imageWriteOptions, bool keepEmpties, bool verbose)
+    public:
+        TileSet() : _size(0) { }
+
+        // adds a tile; returns false if it was already in the set.
+        bool insert(unsigned lod, unsigned x, unsigned y)
         {
-          _layer = layer;
-          _key = key;
-          _path = path;
-          _extension = extension;
-          _imageWriteOptions = imageWriteOptions;
-          _keepEmptyImageTiles = keepEmpties;
-          _verbose = verbose;
+            if ( lod >= _levels.size() )
+                _levels.resize( lod+1 );
+
+            Block&   block = _levels[lod][ std::make_pair(x >> BLOCK_SHIFT, y >> BLOCK_SHIFT) ];
+            unsigned bit   = ((y & BLOCK_MASK) << BLOCK_SHIFT) | (x & BLOCK_MASK);
+            unsigned mask  = 1u << (bit & 31);
+            if ( block._bits[bit >> 5] & mask )
+                return false;
+
+            block._bits[bit >> 5] |= mask;
+            ++_size;
+            return true;
         }
 
-        void execute()
+        bool contains(unsigned lod, unsigned x, unsigned y) const
         {
-            //bool isSingleColor = false;
-            bool tileOK = false;
+            if ( lod >= _levels.size() )
+                return false;
 
-            GeoImage image = _layer->createImage( _key );
-            if ( image.valid() )
+            BlockMap::const_iterator i = _levels[lod].find( std::make_pair(x >> BLOCK_SHIFT, y >> BLOCK_SHIFT) );
+            if ( i == _levels[lod].end() )
+                return false;
+
+            unsigned bit = ((y & BLOCK_MASK) << BLOCK_SHIFT) | (x & BLOCK_MASK);
+            return (i->second._bits[bit >> 5] & (1u << (bit & 31))) != 0;
+        }
+
+        unsigned size() const { return _size; }
+
+    private:
+        enum { BLOCK_SHIFT = 4, BLOCK_MASK = (1 << BLOCK_SHIFT) - 1 };
+
+        struct Block
+        {
+            Block() { for( unsigned i = 0; i < 8; ++i ) _bits[i] = 0u; }
+            unsigned _bits[8];
+        };
+
+        typedef std::map<std::pair<unsigned, unsigned>, Block> BlockMap;
+        std::vector<BlockMap> _levels;
+        unsigned              _size;
+    };
+
+    // whether a source may have data in the key's extent at any level below the key.
+    bool hasDataBelow(const TileSource* source, const TileKey& key)
+    {
+        const DataExtentList& extents = source->getDataExtents();
+        if ( extents.empty() )
+            return true;
+
+        const GeoExtent& keyExtent = key.getExtent();
+        for( DataExtentList::const_iterator i = extents.begin(); i != extents.end(); ++i )
+        {
+            if ( (!i->maxLevel().isSet() || *i->maxLevel() > key.getLOD()) && keyExtent.intersects(*i) )
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * Writes encoded tiles as loose files in a TMS folder structure, and
+     * journals each tile it writes so that a later run can skip them.
+     */
+    class TileFileWriter : public osg::Referenced
+    {
+    public:
+        TileFileWriter(const std::string& rootDir, const std::string& extension, const Profile* profile, bool overwrite)
+            : _rootDir(rootDir), _extension(extension), _overwrite(overwrite)
+        {
+            std::string journalFile = osgDB::concatPaths(rootDir, JOURNAL_FILENAME);
+
+            if ( overwrite )
             {
-                // Check for single color
-                //if ( !_subdivideSingleColorImageTiles )
-                //{
-                //    isSingleColor = ImageUtils::isSingleColorImage(image.getImage());
-                //    if ( isSingleColor && _verbose )
-                //    {
-                //        OE_NOTICE << LC << "Not subdividing single color tile " << key.str() << std::endl;
-                //    }
-                //}
-
-                // check for empty:
-                if ( !_keepEmptyImageTiles && ImageUtils::isEmptyImage(image.getImage()) )
+                // start a fresh journal.
+                _journal.open( journalFile.c_str(), std::ios::out | std::ios::trunc );
+            }
+            else
+            {
+                // load the journal of a previous run.
+                std::ifstream in( journalFile.c_str() );
+                if ( in.is_open() )
                 {
-                    if (  _verbose )
+                    std::string line;
+                    while( std::getline(in, line) )
                     {
-                        OE_NOTICE << LC << "Skipping empty tile " << _key.str() << std::endl;
+                        unsigned lod, x, y;
+                        if ( ::sscanf(line.c_str(), "%u/%u/%u", &lod, &x, &y) == 3 )
+                            _written.insert( lod, x, y );
                     }
+                    in.close();
+                    _journal.open( journalFile.c_str(), std::ios::out | std::ios::app );
                 }
                 else
                 {
-                    // convert to RGB if necessary
-                    osg::ref_ptr<osg::Image> final = image.getImage();
-                    if ( _extension == "jpg" && final->getPixelFormat() != GL_RGB )
-                        final = ImageUtils::convertToRGB8( image.getImage() );
+                    // no journal (e.g. a repo written before journaling, or by another
+                    // tool): seed a new one with the tiles already on disk, so that
+                    // neither this run nor the next one fetches them again.
+                    _journal.open( journalFile.c_str(), std::ios::out | std::ios::trunc );
+                    seedFromDisk( profile );
+                }
+            }
+        }
+
+        std::string getPath(const TileKey& key) const
+        {
+            unsigned w, h;
+            key.getProfile()->getNumTiles( key.getLevelOfDetail(), w, h );
+
+            return Stringify()
+                << _rootDir
+                << "/" << key.getLevelOfDetail()
+                << "/" << key.getTileX()
+                << "/" << h - key.getTileY() - 1
+                << "." << _extension;
+        }
+
+        // whether the tile was already written (call from the producer thread).
+        bool contains(const TileKey& key) const
+        {
+            if ( _overwrite )
+                return false;
+            else
+                return _written.contains( key.getLOD(), key.getTileX(), key.getTileY() );
+        }
+
+        // writes and journals a tile (call from the writer thread).
+        bool write(const TileKey& key, const std::string& data)
+        {
+            std::string path = getPath(key);
+            osgDB::makeDirectoryForFile( path );
+
+            std::ofstream out( path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+            if ( !out.is_open() )
+                return false;
+
+            out.write( data.data(), data.size() );
+            out.close();
+            if ( out.fail() )
+                return false;
+
+            if ( _journal.is_open() )
+                _journal << key.str() << std::endl;
+
+            return true;
+        }
 
-                    // dump it to disk
-                    osgDB::makeDirectoryForFile( _path );
-                    tileOK = osgDB::writeImageFile( *final.get(), _path, _imageWriteOptions);
+    private:
+        // journals every <lod>/<x>/<y>.<ext> tile file under the root folder.
+        void seedFromDisk(const Profile* profile)
+        {
+            osgDB::DirectoryContents lods = osgDB::getDirectoryContents( _rootDir );
+            for( osgDB::DirectoryContents::const_iterator i = lods.begin(); i != lods.end(); ++i )
+            {
+                unsigned lod;
+                if ( !parseIndex(*i, lod) )
+                    continue;
+
+                unsigned w, h;
+                profile->getNumTiles( lod, w, h );
 
-                    if ( _verbose )
+                std::string lodDir = osgDB::concatPaths( _rootDir, *i );
+                osgDB::DirectoryContents cols = osgDB::getDirectoryContents( lodDir );
+                for( osgDB::DirectoryContents::const_iterator j = cols.begin(); j != cols.end(); ++j )
+                {
+                    unsigned x;
+                    if ( !parseIndex(*j, x) || x >= w )
+                        continue;
+
+                    osgDB::DirectoryContents files = osgDB::getDirectoryContents( osgDB::concatPaths(lodDir, *j) );
+                    for( osgDB::DirectoryContents::const_iterator k = files.begin(); k != files.end(); ++k )
                     {
-                        if ( tileOK ) {
-                            OE_NOTICE << LC << "Wrote tile " << _key.str() << " (" << _key.getExtent().toString() << ")" << std::endl;
-                        }
-                        else {
-                            OE_NOTICE << LC << "Error write tile " << _key.str() << std::endl;
-                        }
+                        unsigned row;
+                        if ( osgDB::getFileExtension(*k) != _extension ||
+                             !parseIndex(osgDB::getNameLessExtension(*k), row) || row >= h )
+                            continue;
+
+                        // files are named by TMS row, which counts from the bottom.
+                        unsigned y = h - row - 1;
+                        if ( _written.insert(lod, x, y) && _journal.is_open() )
+                            _journal << lod << "/" << x << "/" << y << "\n";
                     }
-
-                    //if ( _abortOnError && !tileOK )
-                    //{
-                    //    return Result( Stringify() << "Aborting, write failed for tile " << key.str() );
-                    //}
                 }
             }
+
+            if ( _journal.is_open() )
+                _journal.flush();
+
+            if ( _written.size() > 0 )
+            {
+                OE_INFO << LC << "Journaled " << _written.size() << " existing tiles in " << _rootDir << std::endl;
+            }
         }
 
-    private:
-        osg::ref_ptr<ImageLayer> _layer;
-        TileKey _key;
-        std::string _path;
-        std::string _extension;
-        osg::ref_ptr<osgDB::Options> _imageWriteOptions;
-        bool _keepEmptyImageTiles;
-        bool _verbose;
+        std::string           _rootDir;
+        std::string           _extension;
+        bool                  _overwrite;
+        TileSet               _written;
+        std::ofstream         _journal;
     };
 
+    /**
+     * Opens (or creates) an MBTiles database to package tiles into.
+     */
+    TileSource* openMBTiles(const std::string& filename, const std::string& format, const Profile* profile, bool overwrite)
+    {
+        if ( overwrite && osgDB::fileExists(filename) )
+            ::remove( filename.c_str() );
+
+        MBTilesOptions options;
+        options.filename() = URI( filename );
+        options.format()   = format;
+        options.writable() = true;
+        options.profile()  = profile->toProfileOptions();
 
-    struct CreateElevationTileTask
+        osg::ref_ptr<TileSource> source = TileSourceFactory::create( options );
+        if ( !source.valid() || source->startup(0L).isError() || !source->isWritable() )
+            return 0L;
+
+        return source.release();
+    }
+}
+
+//------------------------------------------------------------------------
+
+/**
+ * The packaging pipeline. The producer (the thread traversing the tile
+ * hierarchy) submits fetch tasks; a fetched tile moves on to the encode
+ * pool and an encoded tile to the writer thread. The producer blocks while
+ * the maximum number of tiles is in flight.
+ *
+ * When packaging into a writable TileSource instead of a folder, the encode
+ * pool stores each tile in the TileSource directly.
+ */
+class TMSPackager::Pipeline
+{
+public:
+    // Fetches an image tile and hands it to the encode stage.
+    struct FetchImageTileTask : public TaskRequest
     {
-        void init(ElevationLayer* layer, const TileKey& key, const std::string& path, bool verbose)
+        FetchImageTileTask(Pipeline* pipeline, ImageLayer* layer, const TileKey& key, bool keepEmpties)
+            : _pipeline(pipeline), _layer(layer), _key(key), _keepEmptyImageTiles(keepEmpties) { }
+
+        void operator()(ProgressCallback*)
         {
-          _layer = layer;
-          _key = key;
-          _path = path;
-          _verbose = verbose;
+            GeoImage image = _layer->createImage( _key );
+            if ( !image.valid() )
+            {
+                _pipeline->skip( _key );
+            }
+            else if ( !_keepEmptyImageTiles && ImageUtils::isEmptyImage(image.getImage()) )
+            {
+                if ( _pipeline->verbose() )
+                {
+                    OE_NOTICE << LC << "Skipping empty tile " << _key.str() << std::endl;
+                }
+                _pipeline->skip( _key );
+            }
+            else
+            {
+                _pipeline->encode( _key, image.getImage() );
+            }
         }
 
-        void execute()
-        {
-            bool tileOK = false;
+        Pipeline*                _pipeline;
+        osg::ref_ptr<ImageLayer> _layer;
+        TileKey                  _key;
+        bool                     _keepEmptyImageTiles;
+    };
 
+    // Fetches a heightfield tile, converts it to an image and hands it to the encode stage.
+    struct FetchElevationTileTask : public TaskRequest
+    {
+        FetchElevationTileTask(Pipeline* pipeline, ElevationLayer* layer, const TileKey& key)
+            : _pipeline(pipeline), _layer(layer), _key(key) { }
+
+        void operator()(ProgressCallback*)
+        {
             GeoHeightField hf = _layer->createHeightField( _key );
             if ( hf.valid() )
             {
                 // convert the HF to an image
                 ImageToHeightFieldConverter conv;
                 osg::ref_ptr<osg::Image> image = conv.convert( hf.getHeightField() );
-
-                // dump it to disk
-                osgDB::makeDirectoryForFile( _path );
-                tileOK = osgDB::writeImageFile( *image.get(), _path );
-
-                if ( _verbose )
+                if ( image.valid() )
                 {
-                    if ( tileOK ) {
-                        OE_NOTICE << LC << "Wrote tile " << _key.str() << " (" << _key.getExtent().toString() << ")" << std::endl;
-                    }
-                    else {
-                        OE_NOTICE << LC << "Error write tile " << _key.str() << std::endl;
-                    }
+                    _pipeline->encode( _key, image.get() );
+                    return;
                 }
-
-                //if ( _abortOnError && !tileOK )
-                //{
-                //    return Result( Stringify() << "Aborting, write failed for tile " << key.str() );
-                //}
             }
+            _pipeline->skip( _key );
         }
 
-    private:
+        Pipeline*                    _pipeline;
         osg::ref_ptr<ElevationLayer> _layer;
-        TileKey _key;
-        std::string _path;
-        bool _verbose;
+        TileKey                      _key;
     };
 
+    Pipeline(TileFileWriter*             writer,
+             TileSource*                 target,
+             osgDB::ReaderWriter*        rw,
+             osgDB::Options*             writeOptions,
+             const std::string&          extension,
+             unsigned                    fetchThreads,
+             unsigned                    encodeThreads,
+             unsigned                    maxInFlight,
+             bool                        abortOnError,
+             bool                        verbose,
+             osgEarth::ProgressCallback* progress) :
+    _writer      ( writer ),
+    _target      ( target ),
+    _rw          ( rw ),
+    _writeOptions( writeOptions ),
+    _extension   ( extension ),
+    _maxInFlight ( maxInFlight > 0 ? maxInFlight : 8 * osg::maximum(fetchThreads, 1u) ),
+    _abortOnError( abortOnError ),
+    _verbose     ( verbose ),
+    _progress    ( progress ),
+    _inFlight    ( 0 ),
+    _submitted   ( 0 ),
+    _written     ( 0 ),
+    _empty       ( 0 ),
+    _failed      ( 0 ),
+    _aborted     ( false ),
+    _stopWriter  ( false )
+    {
+        _fetchService  = new TaskService( "TMS Packager Fetch",  osg::maximum(fetchThreads, 1u) );
+        _encodeService = new TaskService( "TMS Packager Encode", osg::maximum(encodeThreads, 1u) );
+        _writerThread  = new WriterThread( this );
+        _writerThread->start();
+        _startTime     = osg::Timer::instance()->tick();
+    }
 
-    class PackageTileProgressCallback : public osgEarth::ProgressCallback
+    ~Pipeline()
     {
-    public:
-      PackageTileProgressCallback(osgEarth::ProgressCallback* proxyProgress)
-        : _progress(proxyProgress), _total(0), _completed(0)
-      {
-      }
+        finish();
+    }
+
+    // Queues a fetch task, blocking while the pipeline is full.
+    // Returns false if packaging was aborted.
+    bool submit(TaskRequest* fetchTask)
+    {
+        osg::ref_ptr<TaskRequest> task = fetchTask;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            while( _inFlight >= _maxInFlight && !_aborted )
+                _stateChanged.wait( &_mutex );
 
-      virtual ~PackageTileProgressCallback() { }
+            if ( _aborted )
+                return false;
 
-      void setTotalTasks(int total) { _total = total; }
+            ++_inFlight;
+            ++_submitted;
+        }
+        _fetchService->add( task.get() );
+        return true;
+    }
 
-      bool reportProgress(double current, double total, unsigned currentStage, unsigned totalStages, const std::string& msg)
-      {
-        return false;
-      }
+    // Fetch stage output: a tile image to encode.
+    void encode(const TileKey& key, osg::Image* image)
+    {
+        _encodeService->add( new EncodeTask(this, key, image) );
+    }
 
-      void onCompleted()
-      {
-        if (_completed >= _total)
-          return;
+    // Fetch stage output: nothing to write (no data, or an empty tile).
+    void skip(const TileKey& key)
+    {
+        done( RESULT_EMPTY, key );
+    }
 
-        _completed++;
-        if (_progress.valid())
-          _progress->reportProgress(_completed, _total);
+    // Encode stage output: tile data to write.
+    void write(const TileKey& key, std::string& data)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        _writeQueue.push_back( EncodedTile() );
+        _writeQueue.back()._key = key;
+        _writeQueue.back()._data.swap( data );
+        _writeReady.signal();
+    }
 
-        if (_completed >= _total)
-          _progress->onCompleted();
-      }
+    // Waits for all tiles in flight, stops the threads, and reports throughput.
+    void finish()
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            while( _inFlight > 0 )
+                _stateChanged.wait( &_mutex );
+            _stopWriter = true;
+            _writeReady.signal();
+        }
 
-    private:
-      osg::ref_ptr<osgEarth::ProgressCallback> _progress;
-      int _total;
-      int _completed;
+        if ( _writerThread )
+        {
+            _writerThread->join();
+            delete _writerThread;
+            _writerThread = 0L;
+
+            if ( _target.valid() )
+                _target->flush();
+
+            double elapsed = osg::Timer::instance()->delta_s( _startTime, osg::Timer::instance()->tick() );
+            OE_NOTICE << LC
+                << "Wrote " << _written << " tiles in " << elapsed << " s ("
+                << (elapsed > 0.0 ? (double)_written/elapsed : 0.0) << " tiles/s); "
+                << _empty << " empty, " << _failed << " failed" << std::endl;
+        }
+    }
+
+    bool aborted() const { return _aborted; }
+
+    bool verbose() const { return _verbose; }
+
+    // whether a tile was already packaged by an earlier run.
+    bool contains(const TileKey& key) const { return _writer.valid() && _writer->contains(key); }
+
+    TileSource* getTarget() const { return _target.get(); }
+
+    const osgDB::ReaderWriter* getReaderWriter() const { return _rw; }
+    const osgDB::Options* getWriteOptions() const { return _writeOptions.get(); }
+    const std::string& getExtension() const { return _extension; }
+
+    enum TileResult { RESULT_WRITTEN, RESULT_EMPTY, RESULT_FAILED };
+
+    // Retires a tile from the pipeline.
+    void done(TileResult result, const TileKey& key)
+    {
+        if ( _verbose )
+        {
+            if ( result == RESULT_WRITTEN ) {
+                OE_NOTICE << LC << "Wrote tile " << key.str() << " (" << key.getExtent().toString() << ")" << std::endl;
+            }
+            else if ( result == RESULT_FAILED ) {
+                OE_NOTICE << LC << "Error packaging tile " << key.str() << std::endl;
+            }
+        }
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+
+        if      ( result == RESULT_WRITTEN ) ++_written;
+        else if ( result == RESULT_EMPTY )   ++_empty;
+        else                                 ++_failed;
+
+        if ( result == RESULT_FAILED && _abortOnError )
+            _aborted = true;
+
+        if ( _progress.valid() )
+        {
+            unsigned completed = _written + _empty + _failed;
+            if ( _progress->reportProgress(completed, _submitted) )
+                _aborted = true;
+        }
+
+        --_inFlight;
+        _stateChanged.broadcast();
+    }
+
+private:
+    struct EncodedTile
+    {
+        TileKey     _key;
+        std::string _data;
     };
-}
 
+    struct EncodeTask : public TaskRequest
+    {
+        EncodeTask(Pipeline* pipeline, const TileKey& key, osg::Image* image)
+            : _pipeline(pipeline), _key(key), _image(image) { }
+
+        void operator()(ProgressCallback*)
+        {
+            osg::ref_ptr<osg::Image> image = _image.get();
+            _image = 0L;
+
+            // a TileSource encodes and stores the tile itself.
+            if ( _pipeline->getTarget() )
+            {
+                bool stored = _pipeline->getTarget()->storeImage( _key, image.get() );
+                _pipeline->done( stored ? RESULT_WRITTEN : RESULT_FAILED, _key );
+                return;
+            }
+
+            // convert to RGB if necessary
+            if ( _pipeline->getExtension() == "jpg" && image->getPixelFormat() != GL_RGB )
+                image = ImageUtils::convertToRGB8( image.get() );
+
+            bool ok = false;
+            if ( image.valid() )
+            {
+                std::stringstream buf;
+                osgDB::ReaderWriter::WriteResult wr =
+                    _pipeline->getReaderWriter()->writeImage( *image.get(), buf, _pipeline->getWriteOptions() );
+
+                if ( wr.success() )
+                {
+                    std::string data = buf.str();
+                    _pipeline->write( _key, data );
+                    ok = true;
+                }
+            }
+
+            if ( !ok )
+            {
+                _pipeline->done( RESULT_FAILED, _key );
+            }
+        }
+
+        Pipeline*                _pipeline;
+        TileKey                  _key;
+        osg::ref_ptr<osg::Image> _image;
+    };
+
+    struct WriterThread : public OpenThreads::Thread
+    {
+        WriterThread(Pipeline* pipeline) : _pipeline(pipeline) { }
+
+        void run()
+        {
+            Pipeline& p = *_pipeline;
+            for(;;)
+            {
+                EncodedTile tile;
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( p._mutex );
+                    while( p._writeQueue.empty() && !p._stopWriter )
+                        p._writeReady.wait( &p._mutex );
+
+                    if ( p._writeQueue.empty() )
+                        return;
+
+                    tile._key = p._writeQueue.front()._key;
+                    tile._data.swap( p._writeQueue.front()._data );
+                    p._writeQueue.pop_front();
+                }
+
+                bool ok = p._writer.valid() && p._writer->write( tile._key, tile._data );
+                p.done( ok ? RESULT_WRITTEN : RESULT_FAILED, tile._key );
+            }
+        }
+
+        Pipeline* _pipeline;
+    };
+
+    osg::ref_ptr<TileFileWriter>             _writer;
+    osg::ref_ptr<TileSource>                 _target;
+    osg::ref_ptr<osgDB::ReaderWriter>        _rw;
+    osg::ref_ptr<osgDB::Options>             _writeOptions;
+    std::string                              _extension;
+    unsigned                                 _maxInFlight;
+    bool                                     _abortOnError;
+    bool                                     _verbose;
+    osg::ref_ptr<osgEarth::ProgressCallback> _progress;
+
+    osg::ref_ptr<TaskService>                _fetchService;
+    osg::ref_ptr<TaskService>                _encodeService;
+    WriterThread*                            _writerThread;
+    osg::Timer_t                             _startTime;
+
+    OpenThreads::Mutex                       _mutex;
+    OpenThreads::Condition                   _stateChanged;
+    OpenThreads::Condition                   _writeReady;
+    std::deque<EncodedTile>                  _writeQueue;
+    unsigned                                 _inFlight;
+    unsigned                                 _submitted;
+    unsigned                                 _written;
+    unsigned                                 _empty;
+    unsigned                                 _failed;
+    volatile bool                            _aborted;
+    bool                                     _stopWriter;
+};
+
+//------------------------------------------------------------------------
 
 TMSPackager::TMSPackager(const Profile* outProfile, osgDB::Options* imageWriteOptions) :
 _outProfile         ( outProfile ),
@@ -210,7 +648,10 @@ _subdivideSingleColorImageTiles ( false ),
 _abortOnError       ( true ),
 _imageWriteOptions  (imageWriteOptions)
 {
-    //nop
+    unsigned cpus = (unsigned)osg::maximum( OpenThreads::GetNumberOfProcessors(), 1 );
+    _numFetchThreads  = 2 * cpus;
+    _numEncodeThreads = cpus;
+    _maxTilesInFlight = 0; // automatic
 }
 
 
@@ -241,48 +682,36 @@ TMSPackager::shouldPackageKey( const TileKey& key ) const
 
 
 int
-TMSPackager::packageImageTile(ImageLayer*                  layer,
-                              const TileKey&               key,
-                              const std::string&           rootDir,
-                              const std::string&           extension,
-                              TaskRequestVector&           tasks,
-                              Threading::MultiEvent*       semaphore,
-                              osgEarth::ProgressCallback*  progress,
-                              unsigned&                    out_maxLevel )
+TMSPackager::packageImageTile(ImageLayer*          layer,
+                              const TileKey&       key,
+                              Pipeline&            pipeline,
+                              unsigned&            out_maxLevel )
 {
     unsigned minLevel = layer->getImageLayerOptions().minLevel().isSet() ?
         *layer->getImageLayerOptions().minLevel() : 0;
     
     int taskCount = 0;
 
-    bool hasData = layer->getTileSource()->hasData( key );
+    if ( pipeline.aborted() )
+        return taskCount;
 
+    // prune against the packaging extents first: it is cheaper than asking the source.
     if ( shouldPackageKey(key) )
     {        
+        bool hasData = layer->getTileSource()->hasData( key );
         bool tileOK = false;
         bool isSingleColor = false;
         if ( key.getLevelOfDetail() >= minLevel && hasData )
         {
             OE_DEBUG << "Packaging key " << key.str() << std::endl;
-            unsigned w, h;
-            key.getProfile()->getNumTiles( key.getLevelOfDetail(), w, h );
-
-            std::string path = Stringify() 
-                << rootDir 
-                << "/" << key.getLevelOfDetail() 
-                << "/" << key.getTileX() 
-                << "/" << h - key.getTileY() - 1
-                << "." << extension;
 
-            tileOK = osgDB::fileExists(path) && !_overwrite;
+            tileOK = pipeline.contains(key);
             if ( !tileOK )
             {
-                ParallelTask<CreateImageTileTask>* task = new ParallelTask<CreateImageTileTask>( semaphore );
-                task->init(layer, key, path, extension, _imageWriteOptions, _keepEmptyImageTiles, _verbose);
-                task->setProgressCallback(progress);
-                tasks.push_back(task);            
-                taskCount++;
+                if ( !pipeline.submit(new Pipeline::FetchImageTileTask(&pipeline, layer, key, _keepEmptyImageTiles)) )
+                    return taskCount;
 
+                taskCount++;
                 tileOK = true;
             }
             else
@@ -300,15 +729,16 @@ TMSPackager::packageImageTile(ImageLayer*                  layer,
             }
         }
 
-        // see if subdivision should continue.
+        // see if subdivision should continue. Stop where the layer's data
+        // extents say there is nothing below this tile.
         unsigned lod = key.getLevelOfDetail();
         const ImageLayerOptions& options = layer->getImageLayerOptions();
 
         unsigned layerMaxLevel = (options.maxLevel().isSet()? *options.maxLevel() : 99);
         unsigned maxLevel = std::min(_maxLevel, layerMaxLevel);
         bool subdivide =
-            (options.minLevel().isSet() && lod < *options.minLevel()) ||
-            (tileOK && lod < maxLevel);
+            lod < maxLevel &&
+            hasDataBelow( layer->getTileSource(), key );
 
         // subdivide if necessary:
         if ( (subdivide == true) && (isSingleColor == false) )
@@ -317,7 +747,7 @@ TMSPackager::packageImageTile(ImageLayer*                  layer,
             {                
                 TileKey childKey = key.createChildKey(q);
 
-                taskCount += packageImageTile( layer, childKey, rootDir, extension, tasks, semaphore, progress, out_maxLevel );                
+                taskCount += packageImageTile( layer, childKey, pipeline, out_maxLevel );
             }
         }
     }
@@ -327,46 +757,33 @@ TMSPackager::packageImageTile(ImageLayer*                  layer,
 
 
 int
-TMSPackager::packageElevationTile(ElevationLayer*               layer,
-                                  const TileKey&                key,
-                                  const std::string&            rootDir,
-                                  const std::string&            extension,
-                                  osgEarth::TaskRequestVector&  tasks,
-                                  Threading::MultiEvent*        semaphore,
-                                  osgEarth::ProgressCallback*   progress,
-                                  unsigned&                     out_maxLevel)
+TMSPackager::packageElevationTile(ElevationLayer*      layer,
+                                  const TileKey&       key,
+                                  Pipeline&            pipeline,
+                                  unsigned&            out_maxLevel)
 {
     unsigned minLevel = layer->getElevationLayerOptions().minLevel().isSet() ?
         *layer->getElevationLayerOptions().minLevel() : 0;
 
     int taskCount = 0;
 
-    bool hasData = layer->getTileSource()->hasData( key );
+    if ( pipeline.aborted() )
+        return taskCount;
 
+    // prune against the packaging extents first: it is cheaper than asking the source.
     if ( shouldPackageKey(key) )
     {
+        bool hasData = layer->getTileSource()->hasData( key );
         bool tileOK = false;
         if ( key.getLevelOfDetail() >= minLevel && hasData )
         {
-            unsigned w, h;
-            key.getProfile()->getNumTiles( key.getLevelOfDetail(), w, h );
-
-            std::string path = Stringify() 
-                << rootDir 
-                << "/" << key.getLevelOfDetail() 
-                << "/" << key.getTileX() 
-                << "/" << h - key.getTileY() - 1
-                << "." << extension;
-
-            tileOK = osgDB::fileExists(path) && !_overwrite;
+            tileOK = pipeline.contains(key);
             if ( !tileOK )
             {
-                ParallelTask<CreateElevationTileTask>* task = new ParallelTask<CreateElevationTileTask>( semaphore );
-                task->init(layer, key, path, _verbose);
-                task->setProgressCallback(progress);
-                tasks.push_back(task);
-                taskCount++;
+                if ( !pipeline.submit(new Pipeline::FetchElevationTileTask(&pipeline, layer, key)) )
+                    return taskCount;
 
+                taskCount++;
                 tileOK = true;
             }
             else
@@ -384,15 +801,16 @@ TMSPackager::packageElevationTile(ElevationLayer*               layer,
             }
         }
 
-        // see if subdivision should continue.
+        // see if subdivision should continue. Stop where the layer's data
+        // extents say there is nothing below this tile.
         unsigned lod = key.getLevelOfDetail();
         const ElevationLayerOptions& options = layer->getElevationLayerOptions();
 
         unsigned layerMaxLevel = (options.maxLevel().isSet()? *options.maxLevel() : 99);
         unsigned maxLevel = std::min(_maxLevel, layerMaxLevel);
         bool subdivide =
-            (options.minLevel().isSet() && lod < *options.minLevel()) ||
-            (tileOK && lod < maxLevel);
+            lod < maxLevel &&
+            hasDataBelow( layer->getTileSource(), key );
 
         // subdivide if necessary:
         if ( subdivide )
@@ -400,7 +818,7 @@ TMSPackager::packageElevationTile(ElevationLayer*               layer,
             for( unsigned q=0; q<4; ++q )
             {
                 TileKey childKey = key.createChildKey(q);                
-                taskCount += packageElevationTile( layer, childKey, rootDir, extension, tasks, semaphore, progress, out_maxLevel );
+                taskCount += packageElevationTile( layer, childKey, pipeline, out_maxLevel );
             }
         }
     }
@@ -415,16 +833,20 @@ TMSPackager::package(ImageLayer*        layer,
                      osgEarth::ProgressCallback* progress,
                      const std::string& overrideExtension )
 {
-  osg::Timer* timer = osg::Timer::instance();
-  osg::Timer_t start_t = timer->tick();
-
     if ( !layer || !_outProfile.valid() )
         return Result( "Illegal null layer or profile" );
 
+    // a path ending in .mbtiles is an MBTiles database to package into.
+    bool toMBTiles = osgDB::getLowerCaseFileExtension( rootFolder ) == "mbtiles";
+
     // attempt to create the output folder:
-    osgDB::makeDirectory( rootFolder );
-    if ( !osgDB::fileExists( rootFolder ) )
-        return Result( "Unable to create output folder" );
+    std::string outputFolder = toMBTiles ? osgDB::getFilePath( rootFolder ) : rootFolder;
+    if ( !outputFolder.empty() )
+    {
+        osgDB::makeDirectory( outputFolder );
+        if ( !osgDB::fileExists( outputFolder ) )
+            return Result( "Unable to create output folder" );
+    }
 
     // collect the root tile keys in preparation for packaging:
     std::vector<TileKey> rootKeys;
@@ -479,43 +901,52 @@ TMSPackager::package(ImageLayer*        layer,
         OE_NOTICE << LC << "MIME-TYPE = " << mimeType << ", Extension = " << extension << std::endl;
     }
 
-
-    // semaphore and tasks collection for multithreading
-    osgEarth::Threading::MultiEvent semaphore;
-    osgEarth::TaskRequestVector tasks;
-    int taskCount = 0;
-    
-    PackageTileProgressCallback* tileProgress = 0L;
-    if (progress)
-      tileProgress = new PackageTileProgressCallback(progress);
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension( extension );
+    if ( !rw )
+        return Result( Stringify() << "No image writer available for extension \"" << extension << "\"" );
 
     // package the tile hierarchy
-    unsigned maxLevel = 0;
-    for( std::vector<TileKey>::const_iterator i = rootKeys.begin(); i != rootKeys.end(); ++i )
+    OE_DEBUG << LC << "Packaging image layer \"" << layer->getName() << "\"" << std::endl;
+
+    osg::ref_ptr<TileFileWriter> writer;
+    osg::ref_ptr<TileSource>     target;
+    if ( toMBTiles )
     {
-        taskCount += packageImageTile( layer, *i, rootFolder, extension, tasks, &semaphore, tileProgress, maxLevel );
+        target = openMBTiles( rootFolder, extension, _outProfile.get(), _overwrite );
+        if ( !target.valid() )
+            return Result( Stringify() << "Unable to open MBTiles database \"" << rootFolder << "\"" );
+    }
+    else
+    {
+        writer = new TileFileWriter( rootFolder, extension, _outProfile.get(), _overwrite );
     }
 
-    // Run all the tasks in parallel
-    OE_DEBUG << LC << "Packaging image layer \"" << layer->getName() << "\", total number of tiles: " << taskCount << std::endl;
-
-    semaphore.reset( taskCount );
-    if (tileProgress) tileProgress->setTotalTasks(taskCount);
-
-    unsigned num = 2 * OpenThreads::GetNumberOfProcessors();
-    osg::ref_ptr<osgEarth::TaskService> taskService = new osgEarth::TaskService("TMS Packager", num);
+    unsigned maxLevel = 0;
+    bool     aborted  = false;
+    {
+        Pipeline pipeline(
+            writer.get(), target.get(), rw, _imageWriteOptions.get(), extension,
+            _numFetchThreads, _numEncodeThreads, _maxTilesInFlight,
+            _abortOnError, _verbose, progress );
 
-    for( TaskRequestVector::iterator i = tasks.begin(); i != tasks.end(); ++i )
-          taskService->add( i->get() );
+        for( std::vector<TileKey>::const_iterator i = rootKeys.begin(); i != rootKeys.end(); ++i )
+        {
+            packageImageTile( layer, *i, pipeline, maxLevel );
+        }
 
-    // Wait for them to complete
-    semaphore.wait();
+        pipeline.finish();
+        aborted = pipeline.aborted();
+    }
 
-    osg::Timer_t end_t = timer->tick();
-    double elapsed = (end_t - start_t) * timer->getSecondsPerTick();
-    OE_DEBUG << LC << "Packaging image layer\"" << layer->getName() << "\" complete. Seconds elapsed: " << elapsed << std::endl;
+    if ( progress )
+        progress->onCompleted();
 
+    if ( aborted )
+        return Result( Stringify() << "Packaging image layer \"" << layer->getName() << "\" aborted" );
 
+    // an MBTiles database carries its own metadata.
+    if ( toMBTiles )
+        return Result();
 
     // create the tile map metadata:
     osg::ref_ptr<TMS::TileMap> tileMap = TMS::TileMap::create(
@@ -543,16 +974,20 @@ TMSPackager::package(ElevationLayer*    layer,
                      const std::string& rootFolder,
                      osgEarth::ProgressCallback* progress )
 {
-    osg::Timer* timer = osg::Timer::instance();
-    osg::Timer_t start_t = timer->tick();
-
     if ( !layer || !_outProfile.valid() )
         return Result( "Illegal null layer or profile" );
 
+    // a path ending in .mbtiles is an MBTiles database to package into.
+    bool toMBTiles = osgDB::getLowerCaseFileExtension( rootFolder ) == "mbtiles";
+
     // attempt to create the output folder:
-    osgDB::makeDirectory( rootFolder );
-    if ( !osgDB::fileExists( rootFolder ) )
-        return Result( "Unable to create output folder" );
+    std::string outputFolder = toMBTiles ? osgDB::getFilePath( rootFolder ) : rootFolder;
+    if ( !outputFolder.empty() )
+    {
+        osgDB::makeDirectory( outputFolder );
+        if ( !osgDB::fileExists( outputFolder ) )
+            return Result( "Unable to create output folder" );
+    }
 
     // collect the root tile keys in preparation for packaging:
     std::vector<TileKey> rootKeys;
@@ -576,38 +1011,52 @@ TMSPackager::package(ElevationLayer*    layer,
     if ( !testHF.valid() )
         return Result( "Unable to determine heightfield size" );
 
-    osgEarth::Threading::MultiEvent semaphore;
-    osgEarth::TaskRequestVector tasks;
-    int taskCount = 0;
-
-    PackageTileProgressCallback* tileProgress = 0L;
-    if (progress)
-      tileProgress = new PackageTileProgressCallback(progress);
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension( extension );
+    if ( !rw )
+        return Result( Stringify() << "No image writer available for extension \"" << extension << "\"" );
 
     // package the tile hierarchy
-    unsigned maxLevel = 0;
-    for( std::vector<TileKey>::const_iterator i = rootKeys.begin(); i != rootKeys.end(); ++i )
+    OE_DEBUG << LC << "Packaging elevation layer \"" << layer->getName() << "\"" << std::endl;
+
+    osg::ref_ptr<TileFileWriter> writer;
+    osg::ref_ptr<TileSource>     target;
+    if ( toMBTiles )
     {
-        taskCount += packageElevationTile( layer, *i, rootFolder, extension, tasks, &semaphore, tileProgress, maxLevel );
+        target = openMBTiles( rootFolder, extension, _outProfile.get(), _overwrite );
+        if ( !target.valid() )
+            return Result( Stringify() << "Unable to open MBTiles database \"" << rootFolder << "\"" );
+    }
+    else
+    {
+        writer = new TileFileWriter( rootFolder, extension, _outProfile.get(), _overwrite );
     }
 
-    // run all the tasks in parallel
-    OE_DEBUG << LC << "Packaging elevation layer \"" << layer->getName() << "\", total number of tiles: " << taskCount << std::endl;
-
-    if (taskCount > 0)
+    unsigned maxLevel = 0;
+    bool     aborted  = false;
+    int      taskCount = 0;
     {
-        semaphore.reset( taskCount );
-        if (tileProgress) tileProgress->setTotalTasks(taskCount);
+        Pipeline pipeline(
+            writer.get(), target.get(), rw, 0L, extension,
+            _numFetchThreads, _numEncodeThreads, _maxTilesInFlight,
+            _abortOnError, _verbose, progress );
 
-        unsigned num = 2 * OpenThreads::GetNumberOfProcessors();
-        osg::ref_ptr<osgEarth::TaskService> taskService = new osgEarth::TaskService("TMS Elevation Packager", num);
+        for( std::vector<TileKey>::const_iterator i = rootKeys.begin(); i != rootKeys.end(); ++i )
+        {
+            taskCount += packageElevationTile( layer, *i, pipeline, maxLevel );
+        }
 
-        for (TaskRequestVector::iterator i = tasks.begin(); i != tasks.end(); ++i)
-            taskService->add( i->get() );
+        pipeline.finish();
+        aborted = pipeline.aborted();
+    }
 
-        semaphore.wait();
+    if ( progress )
+        progress->onCompleted();
 
+    if ( aborted )
+        return Result( Stringify() << "Packaging elevation layer \"" << layer->getName() << "\" aborted" );
 
+    if ( taskCount > 0 && !toMBTiles )
+    {
         // create the tile map metadata:
         osg::ref_ptr<TMS::TileMap> tileMap = TMS::TileMap::create(
             "",
@@ -626,9 +1075,5 @@ TMSPackager::package(ElevationLayer*    layer,
         TMS::TileMapReaderWriter::write( tileMap.get(), tileMapFilename );
     }
 
-    osg::Timer_t end_t = timer->tick();
-    double elapsed = (end_t - start_t) * timer->getSecondsPerTick();
-    OE_DEBUG << LC << "Packaging elevation layer \"" << layer->getName() << "\" complete. Seconds elapsed: " << elapsed << std::endl;
-
     return Result();
 }